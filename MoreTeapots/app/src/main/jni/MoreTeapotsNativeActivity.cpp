@@ -19,6 +19,7 @@
 //--------------------------------------------------------------------------------
 #include <jni.h>
 #include <errno.h>
+#include <math.h>
 
 #include <vector>
 #include <EGL/egl.h>
@@ -29,6 +30,7 @@
 #include <android_native_app_glue.h>
 #include <android/native_window_jni.h>
 #include <cpu-features.h>
+#include <sys/system_properties.h>
 
 #include "MoreTeapotsRenderer.h"
 
@@ -44,6 +46,26 @@ const int32_t NUM_TEAPOTS_X = 8;
 const int32_t NUM_TEAPOTS_Y = 8;
 const int32_t NUM_TEAPOTS_Z = 8;
 
+// Swapped frames the GPU may be working on, see GLContext::SetMaxFramesInFlight
+const int32_t MAX_FRAMES_IN_FLIGHT = 2;
+
+// Time of a frame JNIHelper::LoadTexture() uploads may take, in seconds
+const double TEXTURE_UPLOAD_BUDGET = 0.002;
+
+// Benchmark mode, start with
+// adb shell am start -n com.sample.moreteapots/.MoreTeapotsNativeActivity
+//     --es benchmark benchmark.properties
+// or enable with adb shell setprop debug.moreteapots.benchmark 1
+// The scenario is read from the external files directory or the assets, and
+// the report is written to the external files directory.
+const char BENCHMARK_SCENARIO[] = "benchmark.properties";
+const char BENCHMARK_REPORT[] = "benchmark.json";
+// Teapot counts swept without a scenario, grids of N x N x N teapots
+const int32_t BENCHMARK_INSTANCES[] = {512, 4096, 13824, 32768, 64000, 103823};
+
+// Coarse occlusion culling, enable with
+// adb shell setprop debug.moreteapots.occlusion 1
+
 //-------------------------------------------------------------------------
 // Shared state for our app.
 //-------------------------------------------------------------------------
@@ -65,6 +87,12 @@ class Engine {
 
   android_app* app_;
 
+  int32_t teapots_x_;
+  int32_t teapots_y_;
+  int32_t teapots_z_;
+
+  ndk_helper::Benchmark benchmark_;
+
   ASensorManager* sensor_manager_;
   const ASensor* accelerometer_sensor_;
   ASensorEventQueue* sensor_event_queue_;
@@ -72,6 +100,9 @@ class Engine {
   void UpdateFPS(float fps);
   void ShowUI();
   void TransformPosition(ndk_helper::Vec2& vec);
+  void SetTeapots(const int32_t x, const int32_t y, const int32_t z);
+  void InitBenchmark();
+  void UpdateBenchmark(const double time);
 
  public:
   static void HandleCmd(struct android_app* app, int32_t cmd);
@@ -103,10 +134,17 @@ Engine::Engine()
     : initialized_resources_(false),
       has_focus_(false),
       app_(NULL),
+      teapots_x_(NUM_TEAPOTS_X),
+      teapots_y_(NUM_TEAPOTS_Y),
+      teapots_z_(NUM_TEAPOTS_Z),
       sensor_manager_(NULL),
       accelerometer_sensor_(NULL),
       sensor_event_queue_(NULL) {
   gl_context_ = ndk_helper::GLContext::GetInstance();
+
+  char value[PROP_VALUE_MAX] = {};
+  __system_property_get("debug.moreteapots.occlusion", value);
+  renderer_.SetOcclusionCulling(atoi(value) != 0);
 }
 
 //-------------------------------------------------------------------------
@@ -118,7 +156,7 @@ Engine::~Engine() {}
  * Load resources
  */
 void Engine::LoadResources() {
-  renderer_.Init(NUM_TEAPOTS_X, NUM_TEAPOTS_Y, NUM_TEAPOTS_Z);
+  renderer_.Init(teapots_x_, teapots_y_, teapots_z_);
   renderer_.Bind(&tap_camera_);
 }
 
@@ -135,6 +173,7 @@ int Engine::InitDisplay() {
     gl_context_->Init(app_->window);
     LoadResources();
     initialized_resources_ = true;
+    InitBenchmark();
   } else {
     // initialize OpenGL ES and EGL
     if (EGL_SUCCESS != gl_context_->Resume(app_->window)) {
@@ -145,6 +184,12 @@ int Engine::InitDisplay() {
 
   ShowUI();
 
+  // GPU timings, when the driver supports timer queries
+  gl_context_->GetGpuTimer()->Init();
+
+  // Keep the CPU at most a frame ahead of the GPU, for less input latency
+  gl_context_->SetMaxFramesInFlight(MAX_FRAMES_IN_FLIGHT);
+
   // Initialize GL state.
   glEnable(GL_CULL_FACE);
   glEnable(GL_DEPTH_TEST);
@@ -169,24 +214,49 @@ void Engine::DrawFrame() {
     UpdateFPS(fps);
   }
   double dTime = monitor_.GetCurrentTime();
+  if (benchmark_.IsRunning()) UpdateBenchmark(dTime);
   renderer_.Update(dTime);
+  ndk_helper::JNIHelper::GetInstance()->UploadTextures(TEXTURE_UPLOAD_BUDGET);
 
   // Just fill the screen with a color.
+  ndk_helper::GpuTimer* gpu_timer = gl_context_->GetGpuTimer();
+  gpu_timer->BeginScope("clear");
   glClearColor(0.5f, 0.5f, 0.5f, 1.f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  gpu_timer->BeginScope("teapots");
   renderer_.Render();
+  gpu_timer->EndScope();
+
+  // Culling stats, logged with the frame rate
+  int32_t total = renderer_.GetNumTeapots();
+  int32_t visible = renderer_.GetNumVisibleTeapots();
+  monitor_.SetCounter("visible", visible);
+  monitor_.SetCounter("culled", total - visible);
+  monitor_.SetCounter("total", total);
+  monitor_.SetCounter("in_flight", gl_context_->GetFramesInFlight());
 
   // Swap
   if (EGL_SUCCESS != gl_context_->Swap()) {
     UnloadResources();
     LoadResources();
   }
+
+  // GPU time of a frame a few frames back
+  if (gpu_timer->HasResults()) monitor_.AddGpuTime(gpu_timer->GetFrameTimeNs());
 }
 
 /**
  * Tear down the EGL context currently associated with the display.
  */
-void Engine::TermDisplay() { gl_context_->Suspend(); }
+void Engine::TermDisplay() {
+  // Frame statistics of the session so far
+  if (app_->activity->internalDataPath) {
+    std::string path =
+        std::string(app_->activity->internalDataPath) + "/frame_stats.json";
+    monitor_.Export(path.c_str());
+  }
+  gl_context_->Suspend();
+}
 
 void Engine::TrimMemory() {
   LOGI("Trimming memory");
@@ -197,6 +267,10 @@ void Engine::TrimMemory() {
  */
 int32_t Engine::HandleInput(android_app* app, AInputEvent* event) {
   Engine* eng = (Engine*)app->userData;
+  if (eng->benchmark_.IsRunning()) {
+    // The benchmark drives the camera
+    return AInputEvent_getType(event) == AINPUT_EVENT_TYPE_MOTION;
+  }
   if (AInputEvent_getType(event) == AINPUT_EVENT_TYPE_MOTION) {
     ndk_helper::GESTURE_STATE doubleTapState =
         eng->doubletap_detector_.Detect(event);
@@ -260,6 +334,7 @@ void Engine::HandleCmd(struct android_app* app, int32_t cmd) {
     case APP_CMD_INIT_WINDOW:
       // The window is being shown, get it ready.
       if (app->window != NULL) {
+        eng->monitor_.Resume();
         eng->InitDisplay();
         eng->DrawFrame();
       }
@@ -272,6 +347,8 @@ void Engine::HandleCmd(struct android_app* app, int32_t cmd) {
     case APP_CMD_STOP:
       break;
     case APP_CMD_GAINED_FOCUS:
+      // Don't count the time in the background as a frame
+      eng->monitor_.Resume();
       eng->ResumeSensors();
       // Start animation
       eng->has_focus_ = true;
@@ -352,6 +429,63 @@ void Engine::TransformPosition(ndk_helper::Vec2& vec) {
         ndk_helper::Vec2(1.f, 1.f);
 }
 
+/**
+ * Change the number of teapots, the renderer is rebuilt for the new grid
+ */
+void Engine::SetTeapots(const int32_t x, const int32_t y, const int32_t z) {
+  teapots_x_ = x;
+  teapots_y_ = y;
+  teapots_z_ = z;
+  UnloadResources();
+  LoadResources();
+}
+
+/**
+ * Start the benchmark when the intent or the system property asks for it
+ */
+void Engine::InitBenchmark() {
+  ndk_helper::JNIHelper* helper = ndk_helper::JNIHelper::GetInstance();
+  std::string scenario = helper->GetIntentStringExtra("benchmark");
+  char value[PROP_VALUE_MAX] = {};
+  __system_property_get("debug.moreteapots.benchmark", value);
+  if (scenario.empty() && atoi(value) == 0) return;
+
+  benchmark_.SetInstanceCounts(
+      BENCHMARK_INSTANCES,
+      sizeof(BENCHMARK_INSTANCES) / sizeof(BENCHMARK_INSTANCES[0]));
+  if (scenario.empty()) scenario = BENCHMARK_SCENARIO;
+  ndk_helper::AssetView view;
+  if (view.Open(scenario.c_str()) && view.Size() > 0)
+    benchmark_.LoadScenario((const char*)view.Data(), view.Size());
+  benchmark_.SetDevice((const char*)glGetString(GL_RENDERER));
+  benchmark_.Start();
+}
+
+/**
+ * Benchmark mode runs the scenario's teapot counts, input is ignored and the
+ * camera follows the scenario's path. The report is written at the end.
+ */
+void Engine::UpdateBenchmark(const double time) {
+  ndk_helper::BenchmarkCounters counters = {renderer_.GetNumTeapots(),
+                                            renderer_.GetNumDrawCalls(),
+                                            renderer_.GetNumStateChanges()};
+  if (!benchmark_.Update(time, &monitor_, &tap_camera_, counters)) return;
+
+  if (benchmark_.IsRunning()) {
+    // Closest grid to the teapot count of the step
+    int32_t n = static_cast<int32_t>(cbrt(benchmark_.GetInstances()) + 0.5);
+    n = std::max(n, 1);
+    SetTeapots(n, n, n);
+    return;
+  }
+
+  std::string path =
+      ndk_helper::JNIHelper::GetInstance()->GetExternalFilesDir();
+  path.append("/").append(BENCHMARK_REPORT);
+  benchmark_.Export(path.c_str());
+  SetTeapots(NUM_TEAPOTS_X, NUM_TEAPOTS_Y, NUM_TEAPOTS_Z);
+}
+
 void Engine::ShowUI() {
   JNIEnv* jni;
   app_->activity->vm->AttachCurrentThread(&jni, NULL);
@@ -26,6 +26,7 @@
 //--------------------------------------------------------------------------------
 #include <jni.h>
 #include <errno.h>
+#include <algorithm>
 #include <random>
 #include <vector>
 
@@ -45,16 +46,34 @@
 
 #define BUFFER_OFFSET(i) ((char*)NULL + (i))
 
+// Levels of detail of the teapot mesh, 0 is the full mesh
+const int32_t TEAPOT_LODS = 4;
+
 struct TEAPOT_VERTEX {
   float pos[3];
   float normal[3];
 };
 
+// Vertex with the normal in normalized 16 bit integers
+struct TEAPOT_PACKED_VERTEX {
+  float pos[3];
+  int16_t normal[4];  // w is padding
+};
+
 enum SHADER_ATTRIBUTES {
   ATTRIB_VERTEX,
   ATTRIB_NORMAL,
   ATTRIB_COLOR,
-  ATTRIB_UV
+  ATTRIB_UV,
+  ATTRIB_MATRIX_PROJECTION,                            // mat4, 4 locations
+  ATTRIB_MATRIX_VIEW = ATTRIB_MATRIX_PROJECTION + 4,  // mat3, 3 locations
+};
+
+// Per instance data of the instanced attribute path
+struct TEAPOT_INSTANCE {
+  float matrix_projection[16];
+  float matrix_view[12];  // Upper 3 columns of the model view matrix
+  float color[4];
 };
 
 struct SHADER_PARAMS {
@@ -66,6 +85,7 @@ struct SHADER_PARAMS {
 
   GLuint matrix_projection_;
   GLuint matrix_view_;
+  GLuint instance_base_;
 };
 
 struct TEAPOT_MATERIALS {
@@ -78,7 +98,11 @@ class MoreTeapotsRenderer {
   int32_t num_vertices_;
   GLuint ibo_;
   GLuint vbo_;
-  GLuint ubo_;
+  ndk_helper::StreamingBuffer ubo_;
+  ndk_helper::StreamingBuffer instance_vbo_;
+  int32_t lod_first_index_[TEAPOT_LODS];
+  int32_t lod_num_indices_[TEAPOT_LODS];
+  float lod_errors_[TEAPOT_LODS];  // Simplification error in model space
 
   SHADER_PARAMS shader_param_;
   bool LoadShaders(SHADER_PARAMS* params, const char* strVsh,
@@ -94,6 +118,32 @@ class MoreTeapotsRenderer {
   std::vector<ndk_helper::Vec2> vec_rotations_;
   std::vector<ndk_helper::Vec2> vec_current_rotations_;
 
+  // Model * rotation of each teapot, double buffered so that the next frame's
+  // are computed by the job system while the current ones are in use
+  ndk_helper::JobSystem job_system_;
+  std::vector<ndk_helper::Mat4> vec_mat_worlds_[2];
+  int32_t world_index_;
+  std::vector<float> vec_matrices_;  // Matrices of the ES2 pass
+
+  // Culling. Only the teapots in vec_visible_ are drawn, instance data is
+  // written in the order of the list.
+  ndk_helper::Vec3 bound_center_;  // Bounding sphere in model space
+  float bound_radius_;
+  float occluder_radius_;  // Sphere inside the teapot's body
+  std::vector<ndk_helper::Vec3> vec_centers_;  // Bounding sphere in world space
+  std::vector<uint8_t> vec_visibility_;  // 0 when culled, LOD + 1 otherwise
+  std::vector<int32_t> vec_visible_;     // Grouped by LOD before drawing
+  std::vector<int32_t> vec_sorted_;
+  int32_t num_visible_;
+  int32_t lod_instances_[TEAPOT_LODS];  // Visible teapots of each LOD
+  float lod_scale_;                     // Pixels per unit at a depth of 1
+  bool occlusion_culling_;
+  std::vector<float> occlusion_depth_;
+
+  // GL calls of the last frame
+  int32_t num_draw_calls_;
+  int32_t num_state_changes_;
+
   ndk_helper::TapCamera* camera_;
 
   int32_t teapot_x_;
@@ -102,8 +152,23 @@ class MoreTeapotsRenderer {
   int32_t ubo_matrix_stride_;
   int32_t ubo_vector_stride_;
   bool geometry_instancing_support_;
+  bool instanced_attributes_;  // Instance data in vertex attributes, not a UBO
   bool arb_support_;
 
+  bool InitUniformBlock();
+  bool InitInstancedAttributes();
+  void DispatchWorldMatrices();
+  void UpdateViewMatrices(float* mvp, const int32_t mvp_stride, float* mv,
+                          const int32_t mv_stride, const int32_t mv_size,
+                          float* color, const int32_t color_stride);
+  void ComputeBounds();
+  float DistanceToTriangle(const ndk_helper::Vec3& p, const ndk_helper::Vec3& a,
+                           const ndk_helper::Vec3& b,
+                           const ndk_helper::Vec3& c);
+  void CullTeapots();
+  void CullOccludedTeapots();
+  void SortTeapotsByLod();
+  void DrawLod(const int32_t lod, const int32_t count);
   std::string ToString(const int32_t i);
 
  public:
@@ -115,6 +180,13 @@ class MoreTeapotsRenderer {
   bool Bind(ndk_helper::TapCamera* camera);
   void Unload();
   void UpdateViewport();
+
+  // Coarse occlusion culling on top of the frustum culling, off by default
+  void SetOcclusionCulling(const bool enable);
+  int32_t GetNumTeapots();
+  int32_t GetNumVisibleTeapots();
+  int32_t GetNumDrawCalls() { return num_draw_calls_; }
+  int32_t GetNumStateChanges() { return num_state_changes_; }
 };
 
 #endif
@@ -20,12 +20,28 @@
 //--------------------------------------------------------------------------------
 // includes
 //--------------------------------------------------------------------------------
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include "GLContext.h"
 #include "gl3stub.h"
 
 namespace ndk_helper {
 
+// Weight of the last frame is 1 / FRAME_TIME_SMOOTHING in the predicted time
+const int64_t FRAME_TIME_SMOOTHING = 8;
+// Longer times between swaps are pauses, not frames
+const int64_t FRAME_TIME_PAUSE_NS = 500000000;
+// Time a frame fence is waited on before the wait is retried, in nanoseconds
+const GLuint64 FRAME_FENCE_TIMEOUT = 100000000;
+
+static int64_t GetTimeNs() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
 //--------------------------------------------------------------------------------
 // eGLContext
 //--------------------------------------------------------------------------------
@@ -41,7 +57,17 @@ GLContext::GLContext()
       screen_height_(0),
       gles_initialized_(false),
       egl_context_initialized_(false),
-      es3_supported_(false) {}
+      es3_supported_(false),
+      swap_interval_(1),
+      presentation_interval_ns_(0),
+      presentation_time_(0),
+      presentation_time_func_(NULL),
+      last_swap_ns_(0),
+      predicted_frame_ns_(0),
+      max_frames_in_flight_(0),
+      frames_in_flight_(0),
+      frame_fences_(),
+      frame_fence_(0) {}
 
 void GLContext::InitGLES() {
   if (gles_initialized_) return;
@@ -84,6 +110,14 @@ bool GLContext::InitEGLSurface() {
   display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
   eglInitialize(display_, 0, 0);
 
+  // EGL_ANDROID_presentation_time, for paced swaps
+  const char* extensions = eglQueryString(display_, EGL_EXTENSIONS);
+  if (extensions && strstr(extensions, "EGL_ANDROID_presentation_time")) {
+    presentation_time_func_ = reinterpret_cast<EGLBoolean (*)(
+        EGLDisplay, EGLSurface, int64_t)>(
+        eglGetProcAddress("eglPresentationTimeANDROID"));
+  }
+
   /*
    * Here specify the attributes of the desired configuration.
    * Below, we select an EGLConfig with at least 8 bits per color
@@ -134,11 +168,22 @@ bool GLContext::InitEGLContext() {
     return false;
   }
 
+  eglSwapInterval(display_, swap_interval_);
+
   context_valid_ = true;
   return true;
 }
 
 EGLint GLContext::Swap() {
+  gpu_timer_.EndFrame();
+  int64_t now = GetTimeNs();
+  UpdateFrameTime(now);
+  if (presentation_interval_ns_ && presentation_time_func_) {
+    presentation_time_ += presentation_interval_ns_;
+    if (presentation_time_ < now) presentation_time_ = now;
+    presentation_time_func_(display_, surface_, presentation_time_);
+  }
+
   bool b = eglSwapBuffers(display_, surface_);
   if (!b) {
     EGLint err = eglGetError();
@@ -154,11 +199,94 @@ EGLint GLContext::Swap() {
     }
     return err;
   }
+  TrackFramesInFlight();
   return EGL_SUCCESS;
 }
 
+/*
+ * Smooth the time between swaps into the predicted frame time
+ */
+void GLContext::UpdateFrameTime(const int64_t now) {
+  int64_t frame_ns = now - last_swap_ns_;
+  if (last_swap_ns_ && frame_ns < FRAME_TIME_PAUSE_NS) {
+    if (predicted_frame_ns_)
+      predicted_frame_ns_ +=
+          (frame_ns - predicted_frame_ns_) / FRAME_TIME_SMOOTHING;
+    else
+      predicted_frame_ns_ = frame_ns;
+  }
+  last_swap_ns_ = now;
+}
+
+/*
+ * Fence the swapped frame, count the frames the GPU hasn't finished and wait
+ * for the oldest ones while there are more than max_frames_in_flight_
+ */
+void GLContext::TrackFramesInFlight() {
+  if (!es3_supported_) return;
+
+  frame_fence_ = (frame_fence_ + 1) % FRAME_FENCES;
+  GLsync& fence = frame_fences_[frame_fence_];
+  if (fence) glDeleteSync(fence);
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  // From the oldest frame to the one just swapped
+  frames_in_flight_ = 0;
+  for (int32_t i = 1; i <= FRAME_FENCES; ++i) {
+    GLsync& f = frame_fences_[(frame_fence_ + i) % FRAME_FENCES];
+    if (!f) continue;
+    GLenum result = glClientWaitSync(f, 0, 0);
+    int32_t frames = FRAME_FENCES - i + 1;  // Swapped since this one
+    if (result == GL_TIMEOUT_EXPIRED && max_frames_in_flight_ > 0 &&
+        frames > max_frames_in_flight_) {
+      do {
+        result = glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                  FRAME_FENCE_TIMEOUT);
+      } while (result == GL_TIMEOUT_EXPIRED);
+    }
+    if (result == GL_TIMEOUT_EXPIRED) {
+      frames_in_flight_ = frames;
+      break;
+    }
+    glDeleteSync(f);
+    f = 0;
+  }
+}
+
+void GLContext::SetSwapInterval(const int32_t interval) {
+  swap_interval_ = interval;
+  if (context_valid_) eglSwapInterval(display_, swap_interval_);
+}
+
+bool GLContext::SetPresentationInterval(const int64_t interval_ns) {
+  if (!presentation_interval_ns_) presentation_time_ = 0;
+  presentation_interval_ns_ = interval_ns;
+  return presentation_time_func_ != NULL;
+}
+
+void GLContext::SetMaxFramesInFlight(const int32_t frames) {
+  max_frames_in_flight_ = frames;
+}
+
+int64_t GLContext::GetNextPresentationTimeNs() const {
+  if (presentation_interval_ns_ && presentation_time_func_)
+    return std::max(presentation_time_ + presentation_interval_ns_,
+                    GetTimeNs());
+
+  // The frames in flight are shown first, one frame time apart
+  if (!last_swap_ns_) return GetTimeNs();
+  return last_swap_ns_ + predicted_frame_ns_ * (frames_in_flight_ + 1);
+}
+
 void GLContext::Terminate() {
   if (display_ != EGL_NO_DISPLAY) {
+    // Queries and fences belong to the context
+    gpu_timer_.Terminate();
+    for (int32_t i = 0; i < FRAME_FENCES; ++i) {
+      if (frame_fences_[i]) glDeleteSync(frame_fences_[i]);
+      frame_fences_[i] = 0;
+    }
+    frames_in_flight_ = 0;
     eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
     if (context_ != EGL_NO_CONTEXT) {
       eglDestroyContext(display_, context_);
@@ -196,8 +324,10 @@ EGLint GLContext::Resume(ANativeWindow* window) {
     LOGI("Screen resized");
   }
 
-  if (eglMakeCurrent(display_, surface_, surface_, context_) == EGL_TRUE)
+  if (eglMakeCurrent(display_, surface_, surface_, context_) == EGL_TRUE) {
+    eglSwapInterval(display_, swap_interval_);
     return EGL_SUCCESS;
+  }
 
   EGLint err = eglGetError();
   LOGW("Unable to eglMakeCurrent %d", err);
@@ -25,12 +25,16 @@
 #include <android/log.h>
 
 #include "JNIHelper.h"
+#include "gl3stub.h"
+#include "gpuTimer.h"
 
 namespace ndk_helper {
 
 //--------------------------------------------------------------------------------
 // Constants
 //--------------------------------------------------------------------------------
+// Swapped frames tracked by GetFramesInFlight()
+const int32_t FRAME_FENCES = 4;
 
 //--------------------------------------------------------------------------------
 // Class
@@ -46,6 +50,13 @@ namespace ndk_helper {
  *in the device.
  * getGLVersion() returns 3.0~ when the device supports OpenGLES3.0
  *
+ * GetGpuTimer() gives an optional GPU timer for the context. Once initialized,
+ *Swap() ends its frames.
+ *
+ * Swap() can pace frames: SetSwapInterval(), SetPresentationInterval() to
+ *schedule frames with EGL_ANDROID_presentation_time and SetMaxFramesInFlight()
+ *to keep the CPU from queueing frames far ahead of the GPU.
+ *
  * Thread safety: OpenGL context is expecting used within dedicated single
  *thread,
  * thus GLContext class is not designed as a thread-safe
@@ -72,10 +83,28 @@ class GLContext {
   float gl_version_;
   bool context_valid_;
 
+  // GPU timings, ends a frame on each Swap()
+  GpuTimer gpu_timer_;
+
+  // Frame pacing
+  int32_t swap_interval_;
+  int64_t presentation_interval_ns_;
+  int64_t presentation_time_;  // Target of the last frame
+  EGLBoolean (*presentation_time_func_)(EGLDisplay display, EGLSurface surface,
+                                        int64_t time);
+  int64_t last_swap_ns_;
+  int64_t predicted_frame_ns_;
+  int32_t max_frames_in_flight_;
+  int32_t frames_in_flight_;
+  GLsync frame_fences_[FRAME_FENCES];
+  int32_t frame_fence_;
+
   void InitGLES();
   void Terminate();
   bool InitEGLSurface();
   bool InitEGLContext();
+  void UpdateFrameTime(const int64_t now);
+  void TrackFramesInFlight();
 
   GLContext(GLContext const&);
   void operator=(GLContext const&);
@@ -104,6 +133,53 @@ class GLContext {
   int32_t GetBufferDepthSize() { return depth_size_; }
   float GetGLVersion() { return gl_version_; }
   bool CheckExtension(const char* extension);
+
+  /*
+   * Set the number of display refreshes a frame is shown for at least
+   *(eglSwapInterval). 0 swaps without waiting for the display.
+   */
+  void SetSwapInterval(const int32_t interval);
+
+  /*
+   * Schedule frames interval_ns apart with eglPresentationTimeANDROID, e.g.
+   *1/30 s for a steady 30 fps on a 60Hz display. A frame running late is shown
+   *as soon as possible and the schedule restarts from it.
+   *
+   * arguments:
+   * in: interval_ns, time between frames in nanoseconds, 0 turns it off
+   * return: true if EGL_ANDROID_presentation_time is supported, known once the
+   *context is initialized
+   */
+  bool SetPresentationInterval(const int64_t interval_ns);
+
+  /*
+   * Limit the frames the CPU can queue ahead of the GPU. Swap() waits until no
+   *more than that many swapped frames are unfinished, trading throughput for
+   *input latency. 0 leaves it to the driver. Needs OpenGL ES 3.
+   */
+  void SetMaxFramesInFlight(const int32_t frames);
+
+  /*
+   * return: frames swapped but not finished by the GPU after the last Swap(),
+   *counting that frame. 0 when unknown (OpenGL ES 2).
+   */
+  int32_t GetFramesInFlight() const { return frames_in_flight_; }
+
+  /*
+   * return: smoothed time between Swap() calls, in nanoseconds
+   */
+  int64_t GetPredictedFrameTimeNs() const { return predicted_frame_ns_; }
+
+  /*
+   * return: CLOCK_MONOTONIC time the frame being rendered is expected to be
+   *shown at, in nanoseconds
+   */
+  int64_t GetNextPresentationTimeNs() const;
+
+  /*
+   * return: GPU timer of the context, to be initialized with GpuTimer::Init()
+   */
+  GpuTimer* GetGpuTimer() { return &gpu_timer_; }
 };
 
 }  // namespace ndkHelper
@@ -15,10 +15,14 @@
  */
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
-#include <fstream>
-#include <iostream>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "JNIHelper.h"
+#include "textureLoader.h"
 
 namespace ndk_helper {
 
@@ -39,12 +43,16 @@ JNIHelper* JNIHelper::GetInstance() {
 //---------------------------------------------------------------------------
 // Ctor
 //---------------------------------------------------------------------------
-JNIHelper::JNIHelper() { pthread_mutex_init(&mutex_, NULL); }
+JNIHelper::JNIHelper() : texture_loader_(NULL) {
+  pthread_mutex_init(&mutex_, NULL);
+}
 
 //---------------------------------------------------------------------------
 // Dtor
 //---------------------------------------------------------------------------
 JNIHelper::~JNIHelper() {
+  delete texture_loader_;
+
   pthread_mutex_lock(&mutex_);
 
   JNIEnv* env;
@@ -100,70 +108,11 @@ void JNIHelper::Init(ANativeActivity* activity, const char* helper_class_name) {
 //---------------------------------------------------------------------------
 bool JNIHelper::ReadFile(const char* fileName,
                          std::vector<uint8_t>* buffer_ref) {
-  if (activity_ == NULL) {
-    LOGI(
-        "JNIHelper has not been initialized.Call init() to initialize the "
-        "helper");
-    return false;
-  }
-
-  // First, try reading from externalFileDir;
-  JNIEnv* env;
-
-  pthread_mutex_lock(&mutex_);
-  activity_->vm->AttachCurrentThread(&env, NULL);
-
-  jstring str_path = GetExternalFilesDirJString(env);
-  const char* path = env->GetStringUTFChars(str_path, NULL);
-  std::string s(path);
-
-  if (fileName[0] != '/') {
-    s.append("/");
-  }
-  s.append(fileName);
-  std::ifstream f(s.c_str(), std::ios::binary);
-
-  env->ReleaseStringUTFChars(str_path, path);
-  env->DeleteLocalRef(str_path);
-  activity_->vm->DetachCurrentThread();
-
-  if (f) {
-    LOGI("reading:%s", s.c_str());
-    f.seekg(0, std::ifstream::end);
-    int32_t fileSize = f.tellg();
-    f.seekg(0, std::ifstream::beg);
-    buffer_ref->reserve(fileSize);
-    buffer_ref->assign(std::istreambuf_iterator<char>(f),
-                       std::istreambuf_iterator<char>());
-    f.close();
-    pthread_mutex_unlock(&mutex_);
-    return true;
-  } else {
-    // Fallback to assetManager
-    AAssetManager* assetManager = activity_->assetManager;
-    AAsset* assetFile =
-        AAssetManager_open(assetManager, fileName, AASSET_MODE_BUFFER);
-    if (!assetFile) {
-      pthread_mutex_unlock(&mutex_);
-      return false;
-    }
-    uint8_t* data = (uint8_t*)AAsset_getBuffer(assetFile);
-    int32_t size = AAsset_getLength(assetFile);
-    if (data == NULL) {
-      AAsset_close(assetFile);
-
-      LOGI("Failed to load:%s", fileName);
-      pthread_mutex_unlock(&mutex_);
-      return false;
-    }
+  AssetView view;
+  if (!view.Open(fileName)) return false;
 
-    buffer_ref->reserve(size);
-    buffer_ref->assign(data, data + size);
-
-    AAsset_close(assetFile);
-    pthread_mutex_unlock(&mutex_);
-    return true;
-  }
+  buffer_ref->assign(view.Data(), view.Data() + view.Size());
+  return true;
 }
 
 std::string JNIHelper::GetExternalFilesDir() {
@@ -201,39 +150,140 @@ uint32_t JNIHelper::LoadTexture(const char* file_name) {
     return 0;
   }
 
-  JNIEnv* env;
-  jmethodID mid;
-
-  pthread_mutex_lock(&mutex_);
-  activity_->vm->AttachCurrentThread(&env, NULL);
-
-  jstring name = env->NewStringUTF(file_name);
+  if (texture_loader_ == NULL) {
+    texture_loader_ = new TextureLoader();
+    texture_loader_->Init(1);
+  }
 
   GLuint tex;
   glGenTextures(1, &tex);
-  glBindTexture(GL_TEXTURE_2D, tex);
-
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                  GL_LINEAR_MIPMAP_NEAREST);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  mid = env->GetMethodID(jni_helper_java_class_, "loadTexture",
-                         "(Ljava/lang/String;)Z");
-  jboolean ret = env->CallBooleanMethod(jni_helper_java_ref_, mid, name);
-  if (!ret) {
-    glDeleteTextures(1, &tex);
-    tex = -1;
-    LOGI("Texture load failed %s", file_name);
+  texture_loader_->Request(file_name, tex);
+  return tex;
+}
+
+bool JNIHelper::UploadTextures(const double budget) {
+  if (texture_loader_ == NULL) return false;
+  return texture_loader_->Upload(budget);
+}
+
+//---------------------------------------------------------------------------
+// Worker threads
+//---------------------------------------------------------------------------
+static pthread_key_t worker_env_key;
+static pthread_once_t worker_env_once = PTHREAD_ONCE_INIT;
+static JavaVM* worker_vm = NULL;
+
+static void DetachWorkerThread(void* env) { worker_vm->DetachCurrentThread(); }
+
+static void CreateWorkerEnvKey() {
+  pthread_key_create(&worker_env_key, DetachWorkerThread);
+}
+
+JNIEnv* JNIHelper::AttachWorkerThread() {
+  JNIEnv* env = NULL;
+  if (activity_->vm->GetEnv((void**)&env, JNI_VERSION_1_6) == JNI_OK)
+    return env;
+
+  pthread_once(&worker_env_once, CreateWorkerEnvKey);
+  worker_vm = activity_->vm;
+  if (activity_->vm->AttachCurrentThread(&env, NULL) != JNI_OK) return NULL;
+  pthread_setspecific(worker_env_key, env);
+  return env;
+}
+
+// Clears a Java exception thrown by the last call, so the next JNI call
+// doesn't abort
+static bool ClearException(JNIEnv* env, const char* call,
+                           const char* file_name) {
+  if (!env->ExceptionCheck()) return false;
+  env->ExceptionDescribe();
+  env->ExceptionClear();
+  LOGI("%s threw decoding %s", call, file_name);
+  return true;
+}
+
+bool JNIHelper::DecodeImage(const char* file_name, bool scale_pot,
+                            std::vector<uint8_t>* pixels, int32_t* width,
+                            int32_t* height) {
+  if (activity_ == NULL) {
+    LOGI(
+        "JNIHelper has not been initialized. Call init() to initialize the "
+        "helper");
+    return false;
   }
 
-  // Generate mipmap
-  glGenerateMipmap(GL_TEXTURE_2D);
+  // Global refs are immutable after Init(), no need to lock the mutex here.
+  // Decoding runs on TextureLoader workers, which stay attached.
+  JNIEnv* env = AttachWorkerThread();
+  if (env == NULL) return false;
 
+  jstring name = env->NewStringUTF(file_name);
+  if (ClearException(env, "NewStringUTF", file_name) || name == NULL)
+    return false;
+  jmethodID mid =
+      env->GetMethodID(jni_helper_java_class_, "openBitmap",
+                       "(Ljava/lang/String;Z)Landroid/graphics/Bitmap;");
+  jobject bitmap = env->CallObjectMethod(jni_helper_java_ref_, mid, name,
+                                         (jboolean)scale_pot);
   env->DeleteLocalRef(name);
-  activity_->vm->DetachCurrentThread();
-  pthread_mutex_unlock(&mutex_);
+  if (ClearException(env, "openBitmap", file_name) || bitmap == NULL) {
+    LOGI("Image decode failed %s", file_name);
+    return false;
+  }
 
-  return tex;
+  bool decoded = false;
+  jintArray array = NULL;
+  int32_t w = 0, h = 0;
+  mid = env->GetMethodID(jni_helper_java_class_, "getBitmapWidth",
+                         "(Landroid/graphics/Bitmap;)I");
+  w = env->CallIntMethod(jni_helper_java_ref_, mid, bitmap);
+  if (!ClearException(env, "getBitmapWidth", file_name)) {
+    mid = env->GetMethodID(jni_helper_java_class_, "getBitmapHeight",
+                           "(Landroid/graphics/Bitmap;)I");
+    h = env->CallIntMethod(jni_helper_java_ref_, mid, bitmap);
+    if (!ClearException(env, "getBitmapHeight", file_name) && w > 0 &&
+        h > 0) {
+      array = env->NewIntArray(w * h);
+      if (ClearException(env, "NewIntArray", file_name)) array = NULL;
+    }
+  }
+  if (array != NULL) {
+    mid = env->GetMethodID(jni_helper_java_class_, "getBitmapPixels",
+                           "(Landroid/graphics/Bitmap;[I)V");
+    env->CallVoidMethod(jni_helper_java_ref_, mid, bitmap, array);
+    jint* argb = NULL;
+    if (!ClearException(env, "getBitmapPixels", file_name))
+      argb = env->GetIntArrayElements(array, NULL);
+    if (argb != NULL) {
+      // Bitmap.getPixels() returns packed ARGB, convert it to RGBA bytes
+      pixels->resize(w * h * 4);
+      uint8_t* p = &(*pixels)[0];
+      for (int32_t i = 0; i < w * h; ++i) {
+        uint32_t c = static_cast<uint32_t>(argb[i]);
+        *p++ = (c >> 16) & 0xff;
+        *p++ = (c >> 8) & 0xff;
+        *p++ = c & 0xff;
+        *p++ = c >> 24;
+      }
+      env->ReleaseIntArrayElements(array, argb, JNI_ABORT);
+      decoded = true;
+    }
+    env->DeleteLocalRef(array);
+  }
+
+  mid = env->GetMethodID(jni_helper_java_class_, "closeBitmap",
+                         "(Landroid/graphics/Bitmap;)V");
+  env->CallVoidMethod(jni_helper_java_ref_, mid, bitmap);
+  if (ClearException(env, "closeBitmap", file_name)) decoded = false;
+  env->DeleteLocalRef(bitmap);
+  if (!decoded) {
+    LOGI("Image decode failed %s", file_name);
+    return false;
+  }
+
+  *width = w;
+  *height = h;
+  return true;
 }
 
 std::string JNIHelper::ConvertString(const char* str, const char* encode) {
@@ -273,6 +323,49 @@ std::string JNIHelper::ConvertString(const char* str, const char* encode) {
   return s;
 }
 
+std::string JNIHelper::GetIntentStringExtra(const char* name) {
+  if (activity_ == NULL) {
+    LOGI(
+        "JNIHelper has not been initialized. Call init() to initialize the "
+        "helper");
+    return std::string("");
+  }
+
+  JNIEnv* env;
+
+  pthread_mutex_lock(&mutex_);
+  activity_->vm->AttachCurrentThread(&env, NULL);
+
+  // Invoking getIntent().getStringExtra() java API
+  std::string s;
+  jclass cls = env->GetObjectClass(activity_->clazz);
+  jmethodID mid =
+      env->GetMethodID(cls, "getIntent", "()Landroid/content/Intent;");
+  jobject intent = env->CallObjectMethod(activity_->clazz, mid);
+  if (intent) {
+    jclass cls_intent = env->GetObjectClass(intent);
+    mid = env->GetMethodID(cls_intent, "getStringExtra",
+                           "(Ljava/lang/String;)Ljava/lang/String;");
+    jstring str_name = env->NewStringUTF(name);
+    jstring value = (jstring)env->CallObjectMethod(intent, mid, str_name);
+    if (value) {
+      const char* cparam = env->GetStringUTFChars(value, NULL);
+      s = std::string(cparam);
+      env->ReleaseStringUTFChars(value, cparam);
+      env->DeleteLocalRef(value);
+    }
+    env->DeleteLocalRef(str_name);
+    env->DeleteLocalRef(cls_intent);
+    env->DeleteLocalRef(intent);
+  }
+  env->DeleteLocalRef(cls);
+
+  activity_->vm->DetachCurrentThread();
+  pthread_mutex_unlock(&mutex_);
+
+  return s;
+}
+
 //---------------------------------------------------------------------------
 // Audio helpers
 //---------------------------------------------------------------------------
@@ -322,6 +415,103 @@ int32_t JNIHelper::GetNativeAudioSampleRate() {
   return i;
 }
 
+//---------------------------------------------------------------------------
+// AssetView
+//---------------------------------------------------------------------------
+AssetView::AssetView()
+    : asset_(NULL), map_(NULL), map_size_(0), data_(NULL), size_(0) {}
+
+AssetView::~AssetView() { Close(); }
+
+bool AssetView::Open(const char* file_name) {
+  Close();
+
+  JNIHelper* helper = JNIHelper::GetInstance();
+  AAssetManager* asset_manager = helper->GetAssetManager();
+  if (asset_manager == NULL) {
+    LOGI(
+        "JNIHelper has not been initialized. Call init() to initialize the "
+        "helper");
+    return false;
+  }
+
+  // First, try mapping a file in externalFileDir
+  std::string s = helper->GetExternalFilesDir();
+  if (file_name[0] != '/') {
+    s.append("/");
+  }
+  s.append(file_name);
+
+  int fd = open(s.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    bool mapped = fstat(fd, &st) == 0 && MapFile(fd, 0, st.st_size);
+    close(fd);
+    if (mapped) {
+      LOGI("reading:%s", s.c_str());
+      return true;
+    }
+  }
+
+  // Fallback to assetManager
+  asset_ = AAssetManager_open(asset_manager, file_name, AASSET_MODE_BUFFER);
+  if (asset_ == NULL) return false;
+
+  // Uncompressed assets can be mapped directly from the APK
+  off_t start, length;
+  fd = AAsset_openFileDescriptor(asset_, &start, &length);
+  if (fd >= 0) {
+    bool mapped = MapFile(fd, start, length);
+    close(fd);
+    if (mapped) {
+      AAsset_close(asset_);
+      asset_ = NULL;
+      return true;
+    }
+  }
+
+  data_ = static_cast<const uint8_t*>(AAsset_getBuffer(asset_));
+  size_ = AAsset_getLength(asset_);
+  if (data_ == NULL) {
+    LOGI("Failed to load:%s", file_name);
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool AssetView::MapFile(int fd, off_t offset, size_t length) {
+  if (length == 0) {
+    // Nothing to map, an empty view
+    data_ = NULL;
+    size_ = 0;
+    return true;
+  }
+
+  // mmap() requires a page aligned offset
+  off_t page_size = sysconf(_SC_PAGESIZE);
+  off_t aligned_offset = offset & ~(page_size - 1);
+  map_size_ = length + (offset - aligned_offset);
+  map_ = mmap(NULL, map_size_, PROT_READ, MAP_PRIVATE, fd, aligned_offset);
+  if (map_ == MAP_FAILED) {
+    map_ = NULL;
+    return false;
+  }
+
+  data_ = static_cast<const uint8_t*>(map_) + (offset - aligned_offset);
+  size_ = length;
+  return true;
+}
+
+void AssetView::Close() {
+  if (map_) munmap(map_, map_size_);
+  if (asset_) AAsset_close(asset_);
+  asset_ = NULL;
+  map_ = NULL;
+  data_ = NULL;
+  size_ = 0;
+}
+
 //---------------------------------------------------------------------------
 // Misc implementations
 //---------------------------------------------------------------------------
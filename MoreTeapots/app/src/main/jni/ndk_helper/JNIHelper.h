@@ -38,6 +38,53 @@
 
 namespace ndk_helper {
 
+class TextureLoader;
+
+/******************************************************************
+ * Read-only view of a file
+ * The view memory-maps a file in the external storage or an APK asset, and
+ * releases the mapping when it goes out of scope.
+ * Uncompressed assets are mapped directly from the APK, compressed assets are
+ * inflated by the asset manager.
+ */
+class AssetView {
+ private:
+  AAsset* asset_;
+  void* map_;
+  size_t map_size_;
+  const uint8_t* data_;
+  size_t size_;
+
+  bool MapFile(int fd, off_t offset, size_t length);
+
+  AssetView(const AssetView& rhs);
+  AssetView& operator=(const AssetView& rhs);
+
+ public:
+  AssetView();
+  ~AssetView();
+
+  /*
+   * Open a file.
+   * Same as JNIHelper::ReadFile(), the file is looked up in the external
+   *storage first, then falls back to APK assets.
+   *
+   * arguments:
+   * in: file_name, file name to open
+   * return:
+   * true when the file is opened
+   */
+  bool Open(const char* file_name);
+
+  /*
+   * Release the mapping. Pointers returned by Data() get invalid.
+   */
+  void Close();
+
+  const uint8_t* Data() const { return data_; }
+  size_t Size() const { return size_; }
+};
+
 /******************************************************************
  * Helper functions for JNI calls
  * This class wraps JNI calls and provides handy interface calling commonly used
@@ -64,8 +111,13 @@ class JNIHelper {
   // each methods locks the mutex for a thread safety
   mutable pthread_mutex_t mutex_;
 
+  // Loads the textures of LoadTexture(), started by its first call
+  TextureLoader* texture_loader_;
+
   jstring GetExternalFilesDirJString(JNIEnv* env);
   jclass RetrieveClass(JNIEnv* jni, const char* class_name);
+  // Attaches a worker thread once, it is detached when the thread exits
+  JNIEnv* AttachWorkerThread();
 
   JNIHelper();
   ~JNIHelper();
@@ -100,6 +152,7 @@ class JNIHelper {
    * First, the method tries to read the file from an external storage.
    * If it fails to read, it falls back to use assset manager and try to read
    *the file from APK asset.
+   * Use AssetView instead to access the file contents without copying them.
    *
    * arguments:
    * in: file_name, file name to read
@@ -115,23 +168,57 @@ class JNIHelper {
 
   /*
    * Load and create OpenGL texture from given file name.
-   * The method invokes BitmapFactory in Java so it can read jpeg/png formatted
-   *files
+   * The file is decoded by a TextureLoader worker thread, PNG/JPG through
+   *BitmapFactory in Java. The texture name is returned right away and the
+   *image is uploaded by a later UploadTextures() call, until then the texture
+   *has no image.
    *
-   * The methods creates mip-map and set texture parameters like this,
+   * Images without a mip chain get mip-maps generated and texture parameters
+   *set like this,
    * glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
    *GL_LINEAR_MIPMAP_NEAREST );
    * glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
    * glGenerateMipmap( GL_TEXTURE_2D );
    *
+   * Needs to be called from the thread owning the GL context.
+   *
    * arguments:
-   * in: file_name, file name to read, PNG&JPG is supported
+   * in: file_name, file name to read, PNG, JPG, KTX and .astc are supported
    * return:
-   * OpenGL texture name when the call succeeded
-   * When it failed to load the texture, it returns -1
+   * OpenGL texture name, 0 when the helper is not initialized
+   * When the texture fails to load, it is left without an image
    */
   uint32_t LoadTexture(const char* file_name);
 
+  /*
+   * Upload the textures of LoadTexture() which finished decoding.
+   * Call it once a frame from the thread owning the GL context.
+   *
+   * arguments:
+   * in: budget, upload time budget in seconds
+   * return: true when there are still textures being loaded
+   */
+  bool UploadTextures(const double budget);
+
+  /*
+   * Decode an image file in APK assets into RGBA8 pixels.
+   * The method invokes BitmapFactory in Java so it can read jpeg/png formatted
+   *files.
+   * Unlike LoadTexture(), it does not touch GL state and does not lock the
+   *helper mutex, so it can be called from worker threads.
+   *
+   * arguments:
+   * in: file_name, file name to read, PNG&JPG is supported
+   * in: scale_pot, scales the image to power of two dimensions when true
+   * out: pixels, RGBA8 pixels, tightly packed
+   * out: width, height, dimensions of the decoded image
+   * return:
+   * true when the image was decoded
+   */
+  bool DecodeImage(const char* file_name, bool scale_pot,
+                   std::vector<uint8_t>* pixels, int32_t* width,
+                   int32_t* height);
+
   /*
    * Convert string from character code other than UTF-8
    *
@@ -150,6 +237,25 @@ class JNIHelper {
    */
   std::string GetExternalFilesDir();
 
+  /*
+   * Retrieve a string extra of the intent that started the activity, e.g.
+   *passed with "adb shell am start ... --es name value"
+   *
+   * arguments:
+   * in: name, name of the extra
+   * return: value of the extra, an empty string when it is not set
+   */
+  std::string GetIntentStringExtra(const char* name);
+
+  /*
+   * Retrieve internal file directory of the app
+   *
+   * return: pointer to the directory path, NULL when it is not available
+   */
+  const char* GetInternalFilesDir() {
+    return activity_ ? activity_->internalDataPath : NULL;
+  }
+
   /*
    * Audio helper
    * Retrieves native audio buffer size which is required to achieve low latency
@@ -178,6 +284,16 @@ class JNIHelper {
    *
    */
   const char* GetAppName() { return app_name_.c_str(); }
+
+  /*
+   * Retrieves asset manager of the activity
+   *
+   * return: pointer to AAssetManager, NULL when the helper is not initialized
+   *
+   */
+  AAssetManager* GetAssetManager() {
+    return activity_ ? activity_->assetManager : NULL;
+  }
 };
 
 }  // namespace ndkHelper
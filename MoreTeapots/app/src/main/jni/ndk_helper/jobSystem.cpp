@@ -0,0 +1,191 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+#include <algorithm>
+
+#include "jobSystem.h"
+
+namespace ndk_helper {
+
+//--------------------------------------------------------------------------------
+// Range packing
+//--------------------------------------------------------------------------------
+static inline uint64_t PackRange(const int32_t begin, const int32_t end) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(begin)) << 32) |
+         static_cast<uint32_t>(end);
+}
+
+static inline int32_t RangeBegin(const uint64_t range) {
+  return static_cast<int32_t>(range >> 32);
+}
+
+static inline int32_t RangeEnd(const uint64_t range) {
+  return static_cast<int32_t>(range & 0xffffffff);
+}
+
+//--------------------------------------------------------------------------------
+// JobSystem
+//--------------------------------------------------------------------------------
+JobSystem::JobSystem()
+    : num_slots_(1),
+      grain_(1),
+      pending_(false),
+      generation_(0),
+      num_active_(0),
+      quit_(false) {}
+
+JobSystem::~JobSystem() { Terminate(); }
+
+void JobSystem::Init(const int32_t num_workers) {
+  Terminate();
+
+  int32_t workers = num_workers;
+  if (workers < 0) {
+    workers = std::max(static_cast<int32_t>(sysconf(_SC_NPROCESSORS_ONLN)) - 1,
+                       0);
+  }
+
+  num_slots_ = workers + 1;
+  slots_.reset(new RangeSlot[num_slots_]);
+  for (int32_t i = 0; i < num_slots_; ++i) slots_[i].range = PackRange(0, 0);
+
+  quit_ = false;
+  for (int32_t i = 1; i < num_slots_; ++i)
+    workers_.push_back(
+        std::thread(&JobSystem::WorkerThread, this, i, generation_));
+}
+
+void JobSystem::Terminate() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  start_condition_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i) workers_[i].join();
+  workers_.clear();
+  num_slots_ = 1;
+}
+
+void JobSystem::Dispatch(const int32_t count, const int32_t grain,
+                         const RangeFunction& function) {
+  // One loop at a time
+  Wait();
+  if (count <= 0) return;
+
+  if (workers_.empty()) {
+    function(0, count);
+    return;
+  }
+
+  function_ = function;
+  grain_ = std::max(grain, 1);
+  for (int32_t i = 0; i < num_slots_; ++i) {
+    int32_t begin = static_cast<int64_t>(count) * i / num_slots_;
+    int32_t end = static_cast<int64_t>(count) * (i + 1) / num_slots_;
+    slots_[i].range = PackRange(begin, end);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_active_ = workers_.size();
+    generation_++;
+  }
+  pending_ = true;
+  start_condition_.notify_all();
+}
+
+void JobSystem::Wait() {
+  if (!pending_) return;
+
+  // The calling thread works on its own range and steals like the workers
+  Run(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_condition_.wait(lock, [this] { return num_active_ == 0; });
+  pending_ = false;
+  function_ = nullptr;
+}
+
+void JobSystem::WorkerThread(const int32_t slot, uint32_t generation) {
+  // generation is the one at Init(), so a loop dispatched before this thread
+  // gets to wait is not missed
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    start_condition_.wait(lock, [this, generation] {
+      return quit_ || generation_ != generation;
+    });
+    if (quit_) return;
+    generation = generation_;
+
+    lock.unlock();
+    Run(slot);
+    lock.lock();
+
+    // Results written by the loop are published by the mutex
+    if (--num_active_ == 0) done_condition_.notify_all();
+  }
+}
+
+void JobSystem::Run(const int32_t slot) {
+  int32_t begin;
+  int32_t end;
+  do {
+    while (Take(slot, &begin, &end)) function_(begin, end);
+  } while (Steal(slot));
+}
+
+bool JobSystem::Take(const int32_t slot, int32_t* begin, int32_t* end) {
+  std::atomic<uint64_t>& range = slots_[slot].range;
+  uint64_t current = range.load();
+  while (true) {
+    int32_t b = RangeBegin(current);
+    int32_t e = RangeEnd(current);
+    if (b >= e) return false;
+
+    int32_t n = std::min(grain_, e - b);
+    if (range.compare_exchange_weak(current, PackRange(b + n, e))) {
+      *begin = b;
+      *end = b + n;
+      return true;
+    }
+  }
+}
+
+bool JobSystem::Steal(const int32_t slot) {
+  for (int32_t i = 1; i < num_slots_; ++i) {
+    std::atomic<uint64_t>& victim = slots_[(slot + i) % num_slots_].range;
+    uint64_t current = victim.load();
+    while (true) {
+      int32_t b = RangeBegin(current);
+      int32_t e = RangeEnd(current);
+      if (b >= e) break;
+
+      // Take the back half, or everything when only a grain is left
+      int32_t n = e - b;
+      int32_t stolen = n > grain_ ? n / 2 : n;
+      if (victim.compare_exchange_weak(current, PackRange(b, e - stolen))) {
+        // The own slot is empty, only this thread refills it
+        slots_[slot].range = PackRange(e - stolen, e);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace ndkHelper
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JOBSYSTEM_H_
+#define JOBSYSTEM_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ndk_helper {
+
+/******************************************************************
+ * Job system
+ * A fixed pool of worker threads running parallel loops over index ranges.
+ *
+ * The range of a loop is split evenly between the workers and the calling
+ *thread. Each of them takes grain sized pieces from the front of its own range
+ *and, once that runs dry, steals the back half of another thread's range, so
+ *uneven pieces of work are balanced without a shared queue.
+ *
+ * Thread safety: Dispatch(), Wait(), ParallelFor() and Terminate() need to be
+ *called from the thread owning the job system. One loop runs at a time.
+ */
+class JobSystem {
+ public:
+  // Processes indices [begin, end) of a loop
+  typedef std::function<void(const int32_t begin, const int32_t end)>
+      RangeFunction;
+
+ private:
+  // A range packed as (begin, end) so that it is updated with a single CAS,
+  // padded to a cache line to keep the threads from sharing one
+  struct RangeSlot {
+    std::atomic<uint64_t> range;
+    uint8_t padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+
+  std::vector<std::thread> workers_;
+  std::unique_ptr<RangeSlot[]> slots_;  // Slot 0 belongs to the calling thread
+  int32_t num_slots_;
+
+  RangeFunction function_;
+  int32_t grain_;
+  bool pending_;
+
+  std::mutex mutex_;
+  std::condition_variable start_condition_;
+  std::condition_variable done_condition_;
+  uint32_t generation_;
+  int32_t num_active_;
+  bool quit_;
+
+  void WorkerThread(const int32_t slot, uint32_t generation);
+  void Run(const int32_t slot);
+  bool Take(const int32_t slot, int32_t* begin, int32_t* end);
+  bool Steal(const int32_t slot);
+
+  JobSystem(const JobSystem& rhs);
+  JobSystem& operator=(const JobSystem& rhs);
+
+ public:
+  JobSystem();
+  ~JobSystem();
+
+  /*
+   * Start worker threads
+   *
+   * arguments:
+   * in: num_workers, number of worker threads. A negative value uses one
+   *worker per online CPU core besides the calling thread.
+   */
+  void Init(const int32_t num_workers);
+
+  /*
+   * Finish the running loop and stop worker threads
+   */
+  void Terminate();
+
+  /*
+   * return: number of threads a loop is split between, including the caller
+   */
+  int32_t GetNumThreads() const { return num_slots_; }
+
+  /*
+   * Start a parallel loop and return without waiting for it.
+   * Waits for the previous loop if it is still running. Without workers, the
+   *loop runs on the calling thread before returning.
+   *
+   * arguments:
+   * in: count, number of indices
+   * in: grain, number of indices a thread takes at a time
+   * in: function, loop body, copied for the lifetime of the loop
+   */
+  void Dispatch(const int32_t count, const int32_t grain,
+                const RangeFunction& function);
+
+  /*
+   * Help with the running loop and wait until it completes
+   */
+  void Wait();
+
+  /*
+   * Run a parallel loop to completion
+   */
+  void ParallelFor(const int32_t count, const int32_t grain,
+                   const RangeFunction& function) {
+    Dispatch(count, grain, function);
+    Wait();
+  }
+};
+
+}  // namespace ndkHelper
+#endif /* JOBSYSTEM_H_ */
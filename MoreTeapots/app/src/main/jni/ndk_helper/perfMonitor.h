@@ -17,42 +17,154 @@
 #ifndef PERFMONITOR_H_
 #define PERFMONITOR_H_
 
-#include <jni.h>
 #include <errno.h>
 #include <time.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __ANDROID__
+#include <jni.h>
 #include "JNIHelper.h"
+#else
+// Host builds, such as MoreTeapots/bench/benchmark_runner.cpp
+#include <stdint.h>
+#include <stdio.h>
+#define LOGI(...) ((void)(printf(__VA_ARGS__), printf("\n")))
+#endif
 
 namespace ndk_helper {
 
-const int32_t NUM_SAMPLES = 100;
+// Frame time histogram, 0.25 ms buckets up to 200 ms plus an overflow bucket
+const int32_t NUM_HISTOGRAM_BUCKETS = 800;
+const int64_t HISTOGRAM_BUCKET_NS = 250000;
+
+/******************************************************************
+ * Frame statistics
+ * Frame times, CPU times and GPU times in nanoseconds, accumulated over a
+ *period. GPU times arrive some frames late, so they are counted on their own.
+ */
+struct FrameStats {
+  int64_t num_frames;
+  int64_t total_ns;
+  int64_t max_ns;
+  int64_t cpu_ns;
+  int64_t max_cpu_ns;
+  int64_t num_janks;
+  int64_t num_gpu_frames;
+  int64_t gpu_ns;
+  int64_t max_gpu_ns;
+  std::vector<uint32_t> histogram;
+
+  FrameStats();
+  void Reset();
+  void Add(const int64_t frame_ns, const int64_t frame_cpu_ns,
+           const bool jank);
+  void AddGpu(const int64_t frame_gpu_ns);
+
+  /*
+   * return: frame time below which the given fraction of frames fall, in
+   *nanoseconds. Resolution is a histogram bucket.
+   */
+  int64_t Percentile(const double fraction) const;
+};
 
 /******************************************************************
  * Helper class for a performance monitoring and get current tick time
+ *
+ * Update() is called once per frame. It measures the frame time with
+ *CLOCK_MONOTONIC and the CPU time of the calling thread with
+ *CLOCK_THREAD_CPUTIME_ID, and keeps a histogram of frame times. Frames taking
+ *more than half a refresh period longer than expected are counted as janks.
+ *GPU times of frames measured with GpuTimer can be added with AddGpuTime(), so
+ *CPU and GPU load are reported together.
+ *Statistics of the last second are logged, statistics since the start or
+ *ResetStats() can be exported to a file.
  */
 class PerfMonitor {
  private:
   float current_FPS_;
-  time_t tv_last_sec_;
+  int64_t window_start_ns_;
+  int64_t last_frame_ns_;
+  int64_t last_cpu_ns_;
+  int64_t jank_threshold_ns_;
+
+  FrameStats window_;
+  FrameStats total_;
 
-  double last_tick_;
-  int32_t tickindex_;
-  double ticksum_;
-  double ticklist_[NUM_SAMPLES];
+  std::vector<std::pair<std::string, int64_t> > counters_;
 
-  double UpdateTick(double current_tick);
+  void LogStats();
 
  public:
   PerfMonitor();
   virtual ~PerfMonitor();
 
+  /*
+   * Record a frame
+   *
+   * arguments:
+   * out: fFPS, frames per second over the last second
+   * return: true once a second, when the frame rate is updated
+   */
   bool Update(float &fFPS);
 
-  static double GetCurrentTime() {
-    struct timeval time;
-    gettimeofday(&time, NULL);
-    double ret = time.tv_sec + time.tv_usec * 1.0 / 1000000.0;
-    return ret;
+  /*
+   * Start timing frames afresh, e.g. when the app regains focus, so the time
+   * spent paused isn't recorded as a frame
+   */
+  void Resume();
+
+  /*
+   * Set a named counter, such as the number of objects drawn in the frame.
+   * Counters are logged along with the frame rate when Update() updates it.
+   */
+  void SetCounter(const char *name, const int64_t value);
+
+  /*
+   * Record the GPU time of a frame, e.g. GpuTimer::GetFrameTimeNs()
+   */
+  void AddGpuTime(const int64_t frame_gpu_ns);
+
+  /*
+   * Set the frame time frames are expected to keep, used for jank counting.
+   * Defaults to one period of a 60Hz display.
+   *
+   * arguments:
+   * in: period_ns, display refresh period in nanoseconds
+   * in: interval, number of refresh periods per frame
+   */
+  void SetRefreshPeriod(const int64_t period_ns, const int32_t interval);
+
+  /*
+   * return: statistics since the start or the last ResetStats()
+   */
+  const FrameStats &GetStats() const { return total_; }
+
+  void ResetStats();
+
+  /*
+   * Write the statistics since the start or the last ResetStats() as JSON
+   *
+   * arguments:
+   * in: file_name, path of the file to write
+   * return: true if the file was written
+   */
+  bool Export(const char *file_name);
+
+  static int64_t GetCurrentTimeNs() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
   }
+
+  static int64_t GetThreadCpuTimeNs() {
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+  }
+
+  static double GetCurrentTime() { return GetCurrentTimeNs() / 1000000000.0; }
 };
 
 }  // namespace ndkHelper
@@ -95,6 +95,73 @@ bool CompileShader(GLuint *shader, const GLenum type, const char *strFileName);
 bool CompileShader(GLuint *shader, const GLenum type, const char *str_file_name,
                    const std::map<std::string, std::string> &map_parameters);
 
+/******************************************************************
+ * LoadShaderSource() with filename
+ *
+ * arguments:
+ *  in: str_file_name, filename
+ *  out: source, shader source
+ * return: true if the file was read, false if it failed
+ *
+ */
+bool LoadShaderSource(const char *str_file_name, std::string *source);
+
+/******************************************************************
+ * LoadShaderSource() with std::map patches the shader source in the same
+ *manner as CompileShader() with std::map.
+ * Keys need to be %NAME% placeholders made of alphanumerics and '_'. The file
+ *is tokenized once and the expanded sources are cached per parameter set, so
+ *loading the same shader again (e.g. after a context loss) is a lookup.
+ *
+ * arguments:
+ *  in: str_file_name, filename
+ *  in: map_parameters, %KEY% -> %VALUE% replacement map
+ *  out: source, patched shader source
+ * return: true if the file was read, false if it failed
+ *
+ */
+bool LoadShaderSource(const char *str_file_name,
+                      const std::map<std::string, std::string> &map_parameters,
+                      std::string *source);
+
+/******************************************************************
+ * ClearSourceCache() releases the tokenized and expanded shader sources kept by
+ *LoadShaderSource() with std::map.
+ *
+ */
+void ClearSourceCache();
+
+/******************************************************************
+ * LoadProgramBinary() restores a linked program from the program binary cache
+ *under the app's files directory.
+ * Cache entries are keyed by a hash of the given sources and the GL driver
+ *(vendor, renderer and version strings), so they are invalidated when either
+ *of them changes.
+ * Requires GLES3 or GL_OES_get_program_binary.
+ *
+ * arguments:
+ *  in: program, program created with glCreateProgram()
+ *  in: sources, shader sources and anything else affecting the program
+ * return: true if the program was restored and is ready to use,
+ *         false if the program needs to be built from the sources. In that
+ *case, call SaveProgramBinary() after linking it.
+ *
+ */
+bool LoadProgramBinary(const GLuint prog,
+                       const std::vector<std::string> &sources);
+
+/******************************************************************
+ * SaveProgramBinary() stores a linked program to the program binary cache
+ *
+ * arguments:
+ *  in: program, linked program
+ *  in: sources, same sources given to LoadProgramBinary()
+ * return: true if the binary was stored
+ *
+ */
+bool SaveProgramBinary(const GLuint prog,
+                       const std::vector<std::string> &sources);
+
 /******************************************************************
  * LinkProgram()
  *
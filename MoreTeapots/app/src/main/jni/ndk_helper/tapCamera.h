@@ -19,7 +19,9 @@
 #include <string>
 #include <GLES2/gl2.h>
 
+#ifdef __ANDROID__
 #include "JNIHelper.h"
+#endif
 #include "vecmath.h"
 #include "interpolator.h"
 
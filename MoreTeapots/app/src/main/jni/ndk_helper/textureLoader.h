@@ -0,0 +1,136 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TEXTURELOADER_H_
+#define TEXTURELOADER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GLES2/gl2.h>
+
+#include "JNIHelper.h"
+
+namespace ndk_helper {
+
+struct TextureJob;
+
+/******************************************************************
+ * Asynchronous texture loader
+ * Texture files are memory mapped with AssetView, decoded on worker threads and
+ * uploaded on the GL thread within a per-frame time budget.
+ *
+ * Supported formats:
+ * - KTX containers holding ETC1/ETC2/EAC/ASTC data
+ * - .astc files (ARM ASTC encoder output)
+ * - PNG/JPG, decoded through BitmapFactory on a worker thread
+ * Compressed data is uploaded straight from the asset mapping without decode.
+ *
+ * Thread safety: Request(), Upload(), GetTexture() and Terminate() need to be
+ * called from the thread owning the GL context.
+ */
+class TextureLoader {
+ private:
+  std::vector<std::thread> workers_;
+  std::vector<GLuint> textures_;
+  std::vector<int32_t> states_;
+  int32_t num_pending_;
+  std::vector<GLint> compressed_formats_;
+  bool formats_queried_;
+
+  // Jobs waiting for a worker / jobs waiting for an upload
+  std::deque<TextureJob*> decode_queue_;
+  std::deque<TextureJob*> upload_queue_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool quit_;
+
+  void WorkerThread();
+  bool UploadJob(TextureJob* job);
+  bool IsFormatSupported(const GLenum format);
+
+  TextureLoader(const TextureLoader& rhs);
+  TextureLoader& operator=(const TextureLoader& rhs);
+
+ public:
+  TextureLoader();
+  ~TextureLoader();
+
+  /*
+   * Start worker threads
+   *
+   * arguments:
+   * in: num_workers, number of decoder threads
+   */
+  void Init(const int32_t num_workers);
+
+  /*
+   * Stop worker threads and drop pending jobs.
+   * Textures which are already uploaded are owned by the caller and kept alive.
+   */
+  void Terminate();
+
+  /*
+   * Queue a texture load
+   *
+   * arguments:
+   * in: file_name, asset name of a .ktx, .astc, PNG or JPG file
+   * return: handle of the texture to be passed to GetTexture()
+   */
+  int32_t Request(const char* file_name);
+
+  /*
+   * Queue a texture load into an existing texture name
+   * The name stays owned by the caller, it is not deleted when the load fails.
+   *
+   * arguments:
+   * in: file_name, asset name of a .ktx, .astc, PNG or JPG file
+   * in: texture, texture name to upload the image to
+   * return: handle of the texture to be passed to GetTexture()
+   */
+  int32_t Request(const char* file_name, const GLuint texture);
+
+  /*
+   * Upload decoded textures to GL.
+   * At least one texture is uploaded per call when there is one ready, then
+   *uploads continue until the time budget is exhausted.
+   *
+   * arguments:
+   * in: budget, upload time budget in seconds
+   * return: true when there are still textures being loaded
+   */
+  bool Upload(const double budget);
+
+  /*
+   * Retrieve the texture of a handle
+   *
+   * return: OpenGL texture name, 0 while the texture is being loaded or when
+   *the load failed
+   */
+  GLuint GetTexture(const int32_t handle);
+
+  /*
+   * return: true when the texture of a handle failed to load
+   */
+  bool IsFailed(const int32_t handle);
+};
+
+}  // namespace ndkHelper
+#endif /* TEXTURELOADER_H_ */
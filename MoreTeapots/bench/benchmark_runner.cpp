@@ -0,0 +1,518 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Linux runner of the render benchmark scenarios, see ndk_helper::Benchmark.
+// The scenario runner, PerfMonitor and the scripted TapCamera path are the
+// ones the app uses. The teapots are drawn with the app's instanced attribute
+// shaders into an offscreen EGL pbuffer, so the runner works without a display
+// on a software GL such as Mesa llvmpipe.
+//
+// Build on a Linux host with Mesa's EGL and GLES from this directory:
+//   gcc -c -O2 -I../app/src/main/jni/ndk_helper
+//       ../app/src/main/jni/ndk_helper/gl3stub.c
+//   g++ -std=c++11 -O2 -I../app/src/main/jni -I../app/src/main/jni/ndk_helper
+//       benchmark_runner.cpp ../app/src/main/jni/ndk_helper/benchmark.cpp
+//       ../app/src/main/jni/ndk_helper/perfMonitor.cpp
+//       ../app/src/main/jni/ndk_helper/tapCamera.cpp
+//       ../app/src/main/jni/ndk_helper/interpolator.cpp
+//       ../app/src/main/jni/ndk_helper/vecmath.cpp gl3stub.o
+//       -lEGL -lGLESv2 -o benchmark_runner
+//   ./benchmark_runner [scenario.properties] [report.json]
+// Without a scenario the app's default teapot counts are run. A software GL
+// draws far fewer teapots per second than a phone, a scenario such as
+//   instances=27,216,512
+//   warmup=1
+//   duration=5
+// keeps a run on llvmpipe to a minute. The report is the JSON the app writes
+// to its external files directory.
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "gl3stub.h"
+
+#include "teapot.inl"
+
+#define BUFFER_OFFSET(i) ((char*)NULL + (i))
+
+// Size of the pbuffer, a landscape phone screen
+const int32_t SURFACE_WIDTH = 1280;
+const int32_t SURFACE_HEIGHT = 720;
+
+// Same as MoreTeapotsNativeActivity.cpp
+const int32_t BENCHMARK_INSTANCES[] = {512, 4096, 13824, 32768, 64000, 103823};
+
+const char ASSET_DIR[] = "../app/src/main/assets/";
+const char DEFAULT_REPORT[] = "benchmark.json";
+
+// Same as MoreTeapotsRenderer.cpp
+const float CAM_NEAR = 5.f;
+const float CAM_FAR = 10000.f;
+
+enum SHADER_ATTRIBUTES {
+  ATTRIB_VERTEX,
+  ATTRIB_NORMAL,
+  ATTRIB_COLOR,
+  ATTRIB_MATRIX_PROJECTION,                           // mat4, 4 locations
+  ATTRIB_MATRIX_VIEW = ATTRIB_MATRIX_PROJECTION + 4,  // mat3, 3 locations
+};
+
+struct TEAPOT_INSTANCE {
+  float matrix_projection[16];
+  float matrix_view[12];  // Upper 3 columns of the model view matrix
+  float color[4];
+};
+
+//--------------------------------------------------------------------------------
+// Offscreen context
+//--------------------------------------------------------------------------------
+struct Context {
+  EGLDisplay display;
+  EGLSurface surface;
+  EGLContext context;
+};
+
+/*
+ * Mesa's surfaceless platform needs no X or Wayland server. Other EGLs get the
+ * default display.
+ */
+static EGLDisplay GetDisplay() {
+  const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+    if (get_platform_display)
+      return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                  EGL_DEFAULT_DISPLAY, NULL);
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static bool InitContext(Context* ctx) {
+  ctx->display = GetDisplay();
+  if (ctx->display == EGL_NO_DISPLAY ||
+      !eglInitialize(ctx->display, NULL, NULL)) {
+    fprintf(stderr, "Unable to initialize EGL\n");
+    return false;
+  }
+
+  const EGLint attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+                            EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+                            EGL_BLUE_SIZE,       8,
+                            EGL_GREEN_SIZE,      8,
+                            EGL_RED_SIZE,        8,
+                            EGL_DEPTH_SIZE,      24,
+                            EGL_NONE};
+  EGLConfig config;
+  EGLint num_configs = 0;
+  eglChooseConfig(ctx->display, attribs, &config, 1, &num_configs);
+  if (!num_configs) {
+    fprintf(stderr, "Unable to retrieve a pbuffer EGL config\n");
+    return false;
+  }
+
+  const EGLint surface_attribs[] = {EGL_WIDTH, SURFACE_WIDTH, EGL_HEIGHT,
+                                    SURFACE_HEIGHT, EGL_NONE};
+  ctx->surface = eglCreatePbufferSurface(ctx->display, config, surface_attribs);
+
+  // The instanced path needs OpenGL ES 3
+  const EGLint context_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
+  ctx->context =
+      eglCreateContext(ctx->display, config, EGL_NO_CONTEXT, context_attribs);
+  if (ctx->surface == EGL_NO_SURFACE || ctx->context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(ctx->display, ctx->surface, ctx->surface,
+                      ctx->context)) {
+    fprintf(stderr, "Unable to create an OpenGL ES 3 pbuffer context\n");
+    return false;
+  }
+
+  if (!gl3stubInit()) {
+    fprintf(stderr, "OpenGL ES 3 entry points missing\n");
+    return false;
+  }
+  return true;
+}
+
+static void TerminateContext(Context* ctx) {
+  eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(ctx->display, ctx->context);
+  eglDestroySurface(ctx->display, ctx->surface);
+  eglTerminate(ctx->display);
+}
+
+//--------------------------------------------------------------------------------
+// Teapots
+//--------------------------------------------------------------------------------
+static bool ReadFile(const std::string& path, std::string* out) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (!fp) return false;
+  char buffer[4096];
+  size_t size;
+  out->clear();
+  while ((size = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    out->append(buffer, size);
+  fclose(fp);
+  return true;
+}
+
+/*
+ * Replace the %PARAM_NAME% parameters the way
+ *ndk_helper::shader::LoadShaderSource() does
+ */
+static void PatchShader(const std::map<std::string, std::string>& params,
+                        std::string* source) {
+  for (std::map<std::string, std::string>::const_iterator it = params.begin();
+       it != params.end(); ++it) {
+    size_t pos;
+    while ((pos = source->find(it->first)) != std::string::npos)
+      source->replace(pos, it->first.size(), it->second);
+  }
+}
+
+static GLuint CompileShader(const GLenum type, const std::string& source) {
+  GLuint shader = glCreateShader(type);
+  const GLchar* text = source.c_str();
+  glShaderSource(shader, 1, &text, NULL);
+  glCompileShader(shader);
+
+  GLint status;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (!status) {
+    GLchar log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    fprintf(stderr, "Shader compile error:\n%s\n", log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+/*
+ * Teapot grid drawn like MoreTeapotsRenderer's instanced attribute path,
+ *without culling and levels of detail
+ */
+class TeapotScene {
+  GLuint program_;
+  GLint light0_;
+  GLint material_ambient_;
+  GLint material_specular_;
+  GLuint vbo_;
+  GLuint ibo_;
+  GLuint instance_vbo_;
+  int32_t num_indices_;
+
+  ndk_helper::Mat4 mat_projection_;
+  ndk_helper::Mat4 mat_view_;
+  std::vector<ndk_helper::Mat4> vec_mat_models_;
+  std::vector<ndk_helper::Vec3> vec_colors_;
+  std::vector<TEAPOT_INSTANCE> instances_;
+
+  // GL calls of the last frame
+  int32_t num_draw_calls_;
+  int32_t num_state_changes_;
+
+ public:
+  TeapotScene()
+      : program_(0),
+        vbo_(0),
+        ibo_(0),
+        instance_vbo_(0),
+        num_indices_(0),
+        num_draw_calls_(0),
+        num_state_changes_(0) {}
+
+  bool Init(const std::string& asset_dir);
+  void SetTeapots(const int32_t n);
+  void Update(ndk_helper::TapCamera* camera);
+  void Render();
+  void Unload();
+  int32_t GetNumTeapots() { return vec_mat_models_.size(); }
+  int32_t GetNumDrawCalls() { return num_draw_calls_; }
+  int32_t GetNumStateChanges() { return num_state_changes_; }
+};
+
+bool TeapotScene::Init(const std::string& asset_dir) {
+  std::string vsh, fsh;
+  if (!ReadFile(asset_dir + "Shaders/VS_ShaderPlainES3Instanced.vsh", &vsh) ||
+      !ReadFile(asset_dir + "Shaders/ShaderPlainES3.fsh", &fsh)) {
+    fprintf(stderr, "Unable to read the shaders in %s\n", asset_dir.c_str());
+    return false;
+  }
+  char location[16];
+  std::map<std::string, std::string> params;
+  snprintf(location, sizeof(location), "%d", ATTRIB_VERTEX);
+  params["%LOCATION_VERTEX%"] = location;
+  snprintf(location, sizeof(location), "%d", ATTRIB_NORMAL);
+  params["%LOCATION_NORMAL%"] = location;
+  snprintf(location, sizeof(location), "%d", ATTRIB_COLOR);
+  params["%LOCATION_COLOR%"] = location;
+  snprintf(location, sizeof(location), "%d", ATTRIB_MATRIX_PROJECTION);
+  params["%LOCATION_MATRIX_PROJECTION%"] = location;
+  snprintf(location, sizeof(location), "%d", ATTRIB_MATRIX_VIEW);
+  params["%LOCATION_MATRIX_VIEW%"] = location;
+  PatchShader(params, &vsh);
+
+  GLuint vert_shader = CompileShader(GL_VERTEX_SHADER, vsh);
+  GLuint frag_shader = CompileShader(GL_FRAGMENT_SHADER, fsh);
+  if (!vert_shader || !frag_shader) return false;
+  program_ = glCreateProgram();
+  glAttachShader(program_, vert_shader);
+  glAttachShader(program_, frag_shader);
+  glLinkProgram(program_);
+  glDeleteShader(vert_shader);
+  glDeleteShader(frag_shader);
+  GLint linked;
+  glGetProgramiv(program_, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    GLchar log[1024];
+    glGetProgramInfoLog(program_, sizeof(log), NULL, log);
+    fprintf(stderr, "Program link error:\n%s\n", log);
+    return false;
+  }
+  light0_ = glGetUniformLocation(program_, "vLight0");
+  material_ambient_ = glGetUniformLocation(program_, "vMaterialAmbient");
+  material_specular_ = glGetUniformLocation(program_, "vMaterialSpecular");
+
+  // Interleaved positions and normals, as the app's unpacked vertices
+  const int32_t num_vertices =
+      sizeof(teapotPositions) / sizeof(teapotPositions[0]) / 3;
+  std::vector<float> vertices(num_vertices * 6);
+  for (int32_t i = 0; i < num_vertices; ++i) {
+    memcpy(&vertices[i * 6], teapotPositions + i * 3, 3 * sizeof(float));
+    memcpy(&vertices[i * 6 + 3], teapotNormals + i * 3, 3 * sizeof(float));
+  }
+  num_indices_ = sizeof(teapotIndices) / sizeof(teapotIndices[0]);
+
+  glGenBuffers(1, &vbo_);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0],
+               GL_STATIC_DRAW);
+  glGenBuffers(1, &ibo_);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(teapotIndices), teapotIndices,
+               GL_STATIC_DRAW);
+  glGenBuffers(1, &instance_vbo_);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  float aspect =
+      static_cast<float>(SURFACE_HEIGHT) / static_cast<float>(SURFACE_WIDTH);
+  mat_projection_ =
+      ndk_helper::Mat4::Perspective(1.0f, aspect, CAM_NEAR, CAM_FAR);
+  return true;
+}
+
+/*
+ * n * n * n teapots, spaced like MoreTeapotsRenderer::Init()
+ */
+void TeapotScene::SetTeapots(const int32_t n) {
+  vec_mat_models_.clear();
+  vec_colors_.clear();
+  srand(1);
+
+  const float gap = 500.f / 7.f;
+  const float offset = -gap * (n - 1) / 2.f;
+  for (int32_t x = 0; x < n; ++x)
+    for (int32_t y = 0; y < n; ++y)
+      for (int32_t z = 0; z < n; ++z) {
+        ndk_helper::Mat4 rotation =
+            ndk_helper::Mat4::RotationX((rand() / float(RAND_MAX) - 0.5f) *
+                                        M_PI) *
+            ndk_helper::Mat4::RotationY((rand() / float(RAND_MAX) - 0.5f) *
+                                        M_PI);
+        vec_mat_models_.push_back(
+            ndk_helper::Mat4::Translation(x * gap + offset, y * gap + offset,
+                                          z * gap + offset) *
+            rotation);
+        vec_colors_.push_back(ndk_helper::Vec3(
+            rand() / float(RAND_MAX * 1.1), rand() / float(RAND_MAX * 1.1),
+            rand() / float(RAND_MAX * 1.1)));
+      }
+  instances_.resize(vec_mat_models_.size());
+}
+
+void TeapotScene::Update(ndk_helper::TapCamera* camera) {
+  mat_view_ = ndk_helper::Mat4::LookAt(ndk_helper::Vec3(0.f, 0.f, 2000.f),
+                                       ndk_helper::Vec3(0.f, 0.f, 0.f),
+                                       ndk_helper::Vec3(0.f, 1.f, 0.f));
+  camera->Update();
+  mat_view_ = camera->GetTransformMatrix() * mat_view_ *
+              camera->GetRotationMatrix();
+}
+
+void TeapotScene::Render() {
+  num_draw_calls_ = 0;
+  num_state_changes_ = 0;
+
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    ndk_helper::Mat4 mat_v = mat_view_ * vec_mat_models_[i];
+    ndk_helper::Mat4 mat_vp = mat_projection_ * mat_v;
+    memcpy(instances_[i].matrix_projection, mat_vp.Ptr(), 16 * sizeof(float));
+    memcpy(instances_[i].matrix_view, mat_v.Ptr(), 12 * sizeof(float));
+    memcpy(instances_[i].color, &vec_colors_[i], 3 * sizeof(float));
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  num_state_changes_++;
+  glVertexAttribPointer(ATTRIB_VERTEX, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                        BUFFER_OFFSET(0));
+  num_state_changes_++;
+  glEnableVertexAttribArray(ATTRIB_VERTEX);
+  num_state_changes_++;
+  glVertexAttribPointer(ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                        BUFFER_OFFSET(3 * sizeof(float)));
+  num_state_changes_++;
+  glEnableVertexAttribArray(ATTRIB_NORMAL);
+  num_state_changes_++;
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+  num_state_changes_++;
+  glUseProgram(program_);
+  num_state_changes_++;
+
+  glUniform4f(material_specular_, 1.f, 1.f, 1.f, 10.f);
+  num_state_changes_++;
+  glUniform3f(material_ambient_, 0.1f, 0.1f, 0.1f);
+  num_state_changes_++;
+  glUniform3f(light0_, 100.f, -200.f, -600.f);
+  num_state_changes_++;
+
+  // Instance data of the frame in an orphaned buffer
+  glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+  num_state_changes_++;
+  glBufferData(GL_ARRAY_BUFFER, instances_.size() * sizeof(TEAPOT_INSTANCE),
+               instances_.empty() ? NULL : &instances_[0], GL_STREAM_DRAW);
+  for (int32_t i = 0; i < 4; ++i) {
+    glVertexAttribPointer(
+        ATTRIB_MATRIX_PROJECTION + i, 4, GL_FLOAT, GL_FALSE,
+        sizeof(TEAPOT_INSTANCE),
+        BUFFER_OFFSET(offsetof(TEAPOT_INSTANCE, matrix_projection) +
+                      i * 4 * sizeof(float)));
+    glEnableVertexAttribArray(ATTRIB_MATRIX_PROJECTION + i);
+    glVertexAttribDivisor(ATTRIB_MATRIX_PROJECTION + i, 1);
+    num_state_changes_ += 3;
+  }
+  for (int32_t i = 0; i < 3; ++i) {
+    glVertexAttribPointer(
+        ATTRIB_MATRIX_VIEW + i, 3, GL_FLOAT, GL_FALSE, sizeof(TEAPOT_INSTANCE),
+        BUFFER_OFFSET(offsetof(TEAPOT_INSTANCE, matrix_view) +
+                      i * 4 * sizeof(float)));
+    glEnableVertexAttribArray(ATTRIB_MATRIX_VIEW + i);
+    glVertexAttribDivisor(ATTRIB_MATRIX_VIEW + i, 1);
+    num_state_changes_ += 3;
+  }
+  glVertexAttribPointer(ATTRIB_COLOR, 3, GL_FLOAT, GL_FALSE,
+                        sizeof(TEAPOT_INSTANCE),
+                        BUFFER_OFFSET(offsetof(TEAPOT_INSTANCE, color)));
+  glEnableVertexAttribArray(ATTRIB_COLOR);
+  glVertexAttribDivisor(ATTRIB_COLOR, 1);
+  num_state_changes_ += 3;
+
+  glDrawElementsInstanced(GL_TRIANGLES, num_indices_, GL_UNSIGNED_SHORT,
+                          BUFFER_OFFSET(0), instances_.size());
+  num_draw_calls_++;
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  num_state_changes_++;
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  num_state_changes_++;
+}
+
+void TeapotScene::Unload() {
+  glDeleteBuffers(1, &vbo_);
+  glDeleteBuffers(1, &ibo_);
+  glDeleteBuffers(1, &instance_vbo_);
+  glDeleteProgram(program_);
+}
+
+//--------------------------------------------------------------------------------
+// Main
+//--------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+  const char* report = argc > 2 ? argv[2] : DEFAULT_REPORT;
+
+  Context ctx;
+  if (!InitContext(&ctx)) return 1;
+  printf("Renderer: %s | %s\n", (const char*)glGetString(GL_RENDERER),
+         (const char*)glGetString(GL_VERSION));
+
+  TeapotScene scene;
+  if (!scene.Init(ASSET_DIR)) return 1;
+
+  ndk_helper::PerfMonitor monitor;
+  ndk_helper::TapCamera camera;
+  camera.SetFlip(1.f, -1.f, -1.f);
+  camera.SetPinchTransformFactor(10.f, 10.f, 8.f);
+
+  ndk_helper::Benchmark benchmark;
+  benchmark.SetInstanceCounts(
+      BENCHMARK_INSTANCES,
+      sizeof(BENCHMARK_INSTANCES) / sizeof(BENCHMARK_INSTANCES[0]));
+  if (argc > 1) {
+    std::string scenario;
+    if (!ReadFile(argv[1], &scenario)) {
+      fprintf(stderr, "Unable to read %s\n", argv[1]);
+      return 1;
+    }
+    benchmark.LoadScenario(scenario.c_str(), scenario.size());
+  }
+  benchmark.SetDevice((const char*)glGetString(GL_RENDERER));
+  benchmark.Start();
+
+  glViewport(0, 0, SURFACE_WIDTH, SURFACE_HEIGHT);
+  glEnable(GL_CULL_FACE);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LEQUAL);
+
+  // Frame loop of MoreTeapotsNativeActivity.cpp, glFinish() takes the place
+  // of the display so that frame times include the rendering
+  while (benchmark.IsRunning()) {
+    float fps;
+    monitor.Update(fps);
+    double time = monitor.GetCurrentTime();
+    ndk_helper::BenchmarkCounters counters = {scene.GetNumTeapots(),
+                                              scene.GetNumDrawCalls(),
+                                              scene.GetNumStateChanges()};
+    if (benchmark.Update(time, &monitor, &camera, counters) &&
+        benchmark.IsRunning()) {
+      // Closest grid to the teapot count of the step
+      int32_t n = static_cast<int32_t>(cbrt(benchmark.GetInstances()) + 0.5);
+      scene.SetTeapots(n > 1 ? n : 1);
+    }
+
+    scene.Update(&camera);
+    glClearColor(0.5f, 0.5f, 0.5f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    scene.Render();
+    eglSwapBuffers(ctx.display, ctx.surface);
+    glFinish();
+  }
+
+  bool written = benchmark.Export(report);
+  scene.Unload();
+  TerminateContext(&ctx);
+  return written ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Linux tool reporting the post transform vertex cache efficiency of the
+// teapot mesh and its levels of detail, before and after
+// ndk_helper::mesh::OptimizeVertexCache(), prepared the way
+// MoreTeapotsRenderer::Init() does.
+//
+// ACMR is the transformed vertices per triangle (0.5 is ideal for a regular
+// grid, 3 is no reuse), ATVR the transformed vertices per used vertex (1 is
+// ideal).
+//
+// Build and run on a Linux host from this directory:
+//   g++ -std=c++11 -O2 -I../app/src/main/jni -I../app/src/main/jni/ndk_helper
+//       mesh_stats.cpp ../app/src/main/jni/ndk_helper/meshOptimizer.cpp
+//       -o mesh_stats
+//   ./mesh_stats [cache size]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "meshOptimizer.h"
+#include "teapot.inl"
+
+// Same as MoreTeapotsRenderer
+const int32_t TEAPOT_LODS = 4;
+const int32_t DEFAULT_CACHE_SIZE = 16;
+
+static void Report(const char* name, const std::vector<uint16_t>& before,
+                   const std::vector<uint16_t>& after,
+                   const int32_t num_vertices, const int32_t cache_size) {
+  float acmr_before, atvr_before, acmr_after, atvr_after;
+  ndk_helper::mesh::AnalyzeVertexCache(&before[0], before.size(),
+                                       num_vertices, cache_size, &acmr_before,
+                                       &atvr_before);
+  ndk_helper::mesh::AnalyzeVertexCache(&after[0], after.size(), num_vertices,
+                                       cache_size, &acmr_after, &atvr_after);
+  printf("%-6s %6d triangles  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f\n", name,
+         static_cast<int32_t>(before.size() / 3), acmr_before, acmr_after,
+         atvr_before, atvr_after);
+}
+
+int main(int argc, char** argv) {
+  const int32_t cache_size = argc > 1 ? atoi(argv[1]) : DEFAULT_CACHE_SIZE;
+  const int32_t num_indices = sizeof(teapotIndices) / sizeof(teapotIndices[0]);
+  const int32_t num_vertices =
+      sizeof(teapotPositions) / sizeof(teapotPositions[0]) / 3;
+  printf("cache size %d, %d vertices\n", cache_size, num_vertices);
+
+  // The full mesh as teapot.inl has it, then reordered
+  std::vector<uint16_t> original(teapotIndices, teapotIndices + num_indices);
+  std::vector<uint16_t> indices = original;
+  ndk_helper::mesh::OptimizeVertexCache(&indices[0], num_indices, num_vertices,
+                                        cache_size);
+  Report("full", original, indices, num_vertices, cache_size);
+
+  // The LODs are simplified from the reordered mesh, which leaves them in a
+  // worse order than it, then reordered themselves. Vertex renumbering for
+  // fetch doesn't change the cache behavior, it is left out.
+  for (int32_t lod = 1; lod < TEAPOT_LODS; ++lod) {
+    std::vector<uint16_t> simplified;
+    ndk_helper::mesh::Simplify(teapotPositions, num_vertices, 3, &indices[0],
+                               num_indices, num_indices >> lod, &simplified);
+    std::vector<uint16_t> reordered = simplified;
+    ndk_helper::mesh::OptimizeVertexCache(&reordered[0], reordered.size(),
+                                          num_vertices, cache_size);
+    char name[16];
+    snprintf(name, sizeof(name), "LOD %d", lod);
+    Report(name, simplified, reordered, num_vertices, cache_size);
+  }
+  return 0;
+}
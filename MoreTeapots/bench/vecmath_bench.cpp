@@ -0,0 +1,155 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Linux micro-benchmark of ndk_helper::Mat4: nanoseconds per matrix multiply,
+// matrix * vector transform and Inverse(), over a working set of per teapot
+// matrices like the ones MoreTeapotsRenderer::Render computes.
+//
+// Build the SIMD (SSE on x86, NEON on ARM) and the scalar version on a Linux
+// host from this directory, and compare them:
+//   g++ -std=c++11 -O2 -I../app/src/main/jni/ndk_helper vecmath_bench.cpp
+//       ../app/src/main/jni/ndk_helper/vecmath.cpp -o vecmath_bench
+//   g++ -std=c++11 -O2 -DVECMATH_NO_SIMD -I../app/src/main/jni/ndk_helper
+//       vecmath_bench.cpp ../app/src/main/jni/ndk_helper/vecmath.cpp
+//       -o vecmath_bench_scalar
+//   ./vecmath_bench [rounds]; ./vecmath_bench_scalar [rounds]
+// The checksums of both builds should agree to a few digits.
+
+#include "vecmath.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+using ndk_helper::Mat4;
+using ndk_helper::Vec4;
+
+// Matrices in the working set, about the teapots MoreTeapots draws
+const int32_t NUM_MATRICES = 512;
+// Each test is timed this many times and the fastest is reported, the others
+// are more likely to be preempted or to run at a lower clock
+const int32_t NUM_REPEATS = 7;
+
+static double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float Random(const float min, const float max) {
+  return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+// A model view matrix, affine as Inverse() requires
+static Mat4 RandomModelView() {
+  return Mat4::Translation(Random(-10.f, 10.f), Random(-10.f, 10.f),
+                           Random(-50.f, -5.f)) *
+         Mat4::RotationY(Random(0.f, 6.28f)) *
+         Mat4::RotationX(Random(0.f, 6.28f));
+}
+
+static float Checksum(Mat4& m) {
+  float sum = 0.f;
+  const float* f = m.Ptr();
+  for (int32_t i = 0; i < 16; ++i) sum += f[i];
+  return sum;
+}
+
+int main(int argc, char** argv) {
+  const int32_t rounds = argc > 1 ? atoi(argv[1]) : 2000;
+  srand(1);
+
+  // Model views, and projections to make MVPs of them
+  const Mat4 projection = Mat4::Perspective(1.f, 1.5f, 1.f, 100.f);
+  std::vector<Mat4> mv(NUM_MATRICES), p(NUM_MATRICES), out(NUM_MATRICES);
+  std::vector<Vec4> v(NUM_MATRICES), v_out(NUM_MATRICES);
+  for (int32_t i = 0; i < NUM_MATRICES; ++i) {
+    mv[i] = RandomModelView();
+    p[i] = projection * RandomModelView();
+    v[i] = Vec4(Random(-1.f, 1.f), Random(-1.f, 1.f), Random(-1.f, 1.f), 1.f);
+  }
+
+#if defined(VECMATH_NO_SIMD)
+  const char* path = "scalar";
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+  const char* path = "NEON";
+#elif defined(__SSE__)
+  const char* path = "SSE";
+#else
+  const char* path = "scalar";
+#endif
+  const double ops = (double)rounds * NUM_MATRICES;
+  printf("%s, %d matrices x %d rounds\n", path, NUM_MATRICES, rounds);
+
+  // Matrix multiply
+  double elapsed = 1e9;
+  for (int32_t n = 0; n < NUM_REPEATS; ++n) {
+    double start = NowSeconds();
+    for (int32_t r = 0; r < rounds; ++r) {
+      for (int32_t i = 0; i < NUM_MATRICES; ++i) out[i] = p[i] * mv[i];
+    }
+    elapsed = fmin(elapsed, NowSeconds() - start);
+  }
+  float sum = 0.f;
+  for (int32_t i = 0; i < NUM_MATRICES; ++i) sum += Checksum(out[i]);
+  printf("multiply:  %6.2f ns  checksum %.4f\n", elapsed * 1e9 / ops, sum);
+
+  // Transform
+  elapsed = 1e9;
+  for (int32_t n = 0; n < NUM_REPEATS; ++n) {
+    double start = NowSeconds();
+    for (int32_t r = 0; r < rounds; ++r) {
+      for (int32_t i = 0; i < NUM_MATRICES; ++i) v_out[i] = out[i] * v[i];
+    }
+    elapsed = fmin(elapsed, NowSeconds() - start);
+  }
+  sum = 0.f;
+  for (int32_t i = 0; i < NUM_MATRICES; ++i) {
+    float x, y, z, w;
+    v_out[i].Value(x, y, z, w);
+    sum += x + y + z + w;
+  }
+  printf("transform: %6.2f ns  checksum %.4f\n", elapsed * 1e9 / ops, sum);
+
+  // Inverse, out is reset each round as Inverse() works in place
+  elapsed = 1e9;
+  for (int32_t n = 0; n < NUM_REPEATS; ++n) {
+    double start = NowSeconds();
+    for (int32_t r = 0; r < rounds; ++r) {
+      for (int32_t i = 0; i < NUM_MATRICES; ++i) {
+        out[i] = mv[i];
+        out[i].Inverse();
+      }
+    }
+    elapsed = fmin(elapsed, NowSeconds() - start);
+  }
+  sum = 0.f;
+  float max_error = 0.f;
+  for (int32_t i = 0; i < NUM_MATRICES; ++i) {
+    sum += Checksum(out[i]);
+    // mv * mv^-1 should be the identity
+    Mat4 id = mv[i] * out[i];
+    const float* f = id.Ptr();
+    for (int32_t j = 0; j < 16; ++j)
+      max_error = fmaxf(max_error, fabsf(f[j] - (j % 5 == 0 ? 1.f : 0.f)));
+  }
+  printf("inverse:   %6.2f ns  checksum %.4f  max |mv * mv^-1 - I| %.2g\n",
+         elapsed * 1e9 / ops, sum, max_error);
+  return 0;
+}
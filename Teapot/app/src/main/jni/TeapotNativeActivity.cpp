@@ -35,6 +35,21 @@
 #define HELPER_CLASS_NAME \
   "com/sample/helper/NDKHelper"  // Class name of helper function
 //-------------------------------------------------------------------------
+// Constants
+//-------------------------------------------------------------------------
+// Swapped frames the GPU may be working on, see GLContext::SetMaxFramesInFlight
+const int32_t MAX_FRAMES_IN_FLIGHT = 2;
+
+// Time of a frame JNIHelper::LoadTexture() uploads may take, in seconds
+const double TEXTURE_UPLOAD_BUDGET = 0.002;
+
+// Benchmark mode, start with
+// adb shell am start -n com.sample.teapot/.TeapotNativeActivity
+//     --es benchmark benchmark.properties
+// The scenario named by the extra is read from the external files directory
+// or the assets, and the report is written to the external files directory.
+const char BENCHMARK_REPORT[] = "benchmark.json";
+//-------------------------------------------------------------------------
 // Shared state for our app.
 //-------------------------------------------------------------------------
 struct android_app;
@@ -55,6 +70,8 @@ class Engine {
 
   android_app* app_;
 
+  ndk_helper::Benchmark benchmark_;
+
   ASensorManager* sensor_manager_;
   const ASensor* accelerometer_sensor_;
   ASensorEventQueue* sensor_event_queue_;
@@ -62,6 +79,8 @@ class Engine {
   void UpdateFPS(float fFPS);
   void ShowUI();
   void TransformPosition(ndk_helper::Vec2& vec);
+  void InitBenchmark();
+  void UpdateBenchmark(const double time);
 
  public:
   static void HandleCmd(struct android_app* app, int32_t cmd);
@@ -125,6 +144,7 @@ int Engine::InitDisplay() {
     gl_context_->Init(app_->window);
     LoadResources();
     initialized_resources_ = true;
+    InitBenchmark();
   } else {
     // initialize OpenGL ES and EGL
     if (EGL_SUCCESS != gl_context_->Resume(app_->window)) {
@@ -135,6 +155,12 @@ int Engine::InitDisplay() {
 
   ShowUI();
 
+  // GPU timings, when the driver supports timer queries
+  gl_context_->GetGpuTimer()->Init();
+
+  // Keep the CPU at most a frame ahead of the GPU, for less input latency
+  gl_context_->SetMaxFramesInFlight(MAX_FRAMES_IN_FLIGHT);
+
   // Initialize GL state.
   glEnable(GL_CULL_FACE);
   glEnable(GL_DEPTH_TEST);
@@ -159,24 +185,42 @@ void Engine::DrawFrame() {
   if (monitor_.Update(fps)) {
     UpdateFPS(fps);
   }
-  renderer_.Update(monitor_.GetCurrentTime());
+  double dTime = monitor_.GetCurrentTime();
+  if (benchmark_.IsRunning()) UpdateBenchmark(dTime);
+  renderer_.Update(dTime);
+  ndk_helper::JNIHelper::GetInstance()->UploadTextures(TEXTURE_UPLOAD_BUDGET);
 
   // Just fill the screen with a color.
+  ndk_helper::GpuTimer* gpu_timer = gl_context_->GetGpuTimer();
+  gpu_timer->BeginScope("clear");
   glClearColor(0.5f, 0.5f, 0.5f, 1.f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  gpu_timer->BeginScope("teapot");
   renderer_.Render();
+  gpu_timer->EndScope();
 
   // Swap
   if (EGL_SUCCESS != gl_context_->Swap()) {
     UnloadResources();
     LoadResources();
   }
+
+  // GPU time of a frame a few frames back
+  if (gpu_timer->HasResults()) monitor_.AddGpuTime(gpu_timer->GetFrameTimeNs());
 }
 
 /**
  * Tear down the EGL context currently associated with the display.
  */
-void Engine::TermDisplay() { gl_context_->Suspend(); }
+void Engine::TermDisplay() {
+  // Frame statistics of the session so far
+  if (app_->activity->internalDataPath) {
+    std::string path =
+        std::string(app_->activity->internalDataPath) + "/frame_stats.json";
+    monitor_.Export(path.c_str());
+  }
+  gl_context_->Suspend();
+}
 
 void Engine::TrimMemory() {
   LOGI("Trimming memory");
@@ -187,6 +231,10 @@ void Engine::TrimMemory() {
  */
 int32_t Engine::HandleInput(android_app* app, AInputEvent* event) {
   Engine* eng = (Engine*)app->userData;
+  if (eng->benchmark_.IsRunning()) {
+    // The benchmark drives the camera
+    return AInputEvent_getType(event) == AINPUT_EVENT_TYPE_MOTION;
+  }
   if (AInputEvent_getType(event) == AINPUT_EVENT_TYPE_MOTION) {
     ndk_helper::GESTURE_STATE doubleTapState =
         eng->doubletap_detector_.Detect(event);
@@ -250,6 +298,7 @@ void Engine::HandleCmd(struct android_app* app, int32_t cmd) {
     case APP_CMD_INIT_WINDOW:
       // The window is being shown, get it ready.
       if (app->window != NULL) {
+        eng->monitor_.Resume();
         eng->InitDisplay();
         eng->DrawFrame();
       }
@@ -262,6 +311,8 @@ void Engine::HandleCmd(struct android_app* app, int32_t cmd) {
     case APP_CMD_STOP:
       break;
     case APP_CMD_GAINED_FOCUS:
+      // Don't count the time in the background as a frame
+      eng->monitor_.Resume();
       eng->ResumeSensors();
       // Start animation
       eng->has_focus_ = true;
@@ -342,6 +393,41 @@ void Engine::TransformPosition(ndk_helper::Vec2& vec) {
         ndk_helper::Vec2(1.f, 1.f);
 }
 
+/**
+ * Start the benchmark when the intent asks for it
+ */
+void Engine::InitBenchmark() {
+  ndk_helper::JNIHelper* helper = ndk_helper::JNIHelper::GetInstance();
+  std::string scenario = helper->GetIntentStringExtra("benchmark");
+  if (scenario.empty()) return;
+
+  ndk_helper::AssetView view;
+  if (view.Open(scenario.c_str()) && view.Size() > 0)
+    benchmark_.LoadScenario((const char*)view.Data(), view.Size());
+  // There is a single teapot, one step whatever counts the scenario lists
+  const int32_t instances = 1;
+  benchmark_.SetInstanceCounts(&instances, 1);
+  benchmark_.SetDevice((const char*)glGetString(GL_RENDERER));
+  benchmark_.Start();
+}
+
+/**
+ * Benchmark mode renders the single teapot for one step with the scenario's
+ * warm up and duration, input is ignored and the camera follows the
+ * scenario's path. The report is written at the end.
+ */
+void Engine::UpdateBenchmark(const double time) {
+  ndk_helper::BenchmarkCounters counters = {1, renderer_.GetNumDrawCalls(),
+                                            renderer_.GetNumStateChanges()};
+  if (!benchmark_.Update(time, &monitor_, &tap_camera_, counters)) return;
+  if (benchmark_.IsRunning()) return;
+
+  std::string path =
+      ndk_helper::JNIHelper::GetInstance()->GetExternalFilesDir();
+  path.append("/").append(BENCHMARK_REPORT);
+  benchmark_.Export(path.c_str());
+}
+
 void Engine::ShowUI() {
   JNIEnv* jni;
   app_->activity->vm->AttachCurrentThread(&jni, NULL);
@@ -28,10 +28,21 @@
 //--------------------------------------------------------------------------------
 #include "teapot.inl"
 
+//--------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------
+// The teapot uses the coarsest level of detail whose simplification error
+// projects to at most this many pixels
+const float LOD_PIXEL_ERROR = 1.f;
+
+// Entries of the post transform vertex cache the mesh is ordered for
+const int32_t VERTEX_CACHE_SIZE = 16;
+
 //--------------------------------------------------------------------------------
 // Ctor
 //--------------------------------------------------------------------------------
-TeapotRenderer::TeapotRenderer() {}
+TeapotRenderer::TeapotRenderer()
+    : lod_scale_(1.f), num_draw_calls_(0), num_state_changes_(0) {}
 
 //--------------------------------------------------------------------------------
 // Dtor
@@ -46,36 +57,62 @@ void TeapotRenderer::Init() {
   LoadShaders(&shader_param_, "Shaders/VS_ShaderPlain.vsh",
               "Shaders/ShaderPlain.fsh");
 
-  // Create Index buffer
+  // Order the full mesh for the post transform vertex cache, then number the
+  // vertices in the order it uses them. teapot.inl is already in a cache
+  // friendly order (ACMR 0.781 at 16 entries) that the reordering can't
+  // improve and keeps, it is there for other meshes. The simplified levels of
+  // detail below do gain from it, see MoreTeapots/bench/mesh_stats.cpp.
   num_indices_ = sizeof(teapotIndices) / sizeof(teapotIndices[0]);
+  num_vertices_ = sizeof(teapotPositions) / sizeof(teapotPositions[0]) / 3;
+  std::vector<uint16_t> indices(teapotIndices, teapotIndices + num_indices_);
+  ndk_helper::mesh::OptimizeVertexCache(&indices[0], num_indices_,
+                                        num_vertices_, VERTEX_CACHE_SIZE);
+  std::vector<uint16_t> remap;
+  ndk_helper::mesh::OptimizeVertexFetch(&indices[0], num_indices_,
+                                        num_vertices_, &remap);
+  std::vector<TEAPOT_VERTEX> vertices(num_vertices_);
+  for (int32_t i = 0; i < num_vertices_; ++i) {
+    memcpy(vertices[remap[i]].pos, teapotPositions + i * 3, 3 * sizeof(float));
+    memcpy(vertices[remap[i]].normal, teapotNormals + i * 3,
+           3 * sizeof(float));
+  }
+
+  // Create Index buffer, holding the levels of detail one after another.
+  // Each level halves the triangles of the full mesh and indexes its vertices.
+  lod_first_index_[0] = 0;
+  lod_num_indices_[0] = num_indices_;
+  lod_errors_[0] = 0.f;
+  for (int32_t lod = 1; lod < TEAPOT_LODS; ++lod) {
+    std::vector<uint16_t> lod_indices;
+    lod_errors_[lod] = ndk_helper::mesh::Simplify(
+        vertices[0].pos, num_vertices_, sizeof(TEAPOT_VERTEX) / sizeof(float),
+        &indices[0], num_indices_, num_indices_ >> lod, &lod_indices);
+    if (lod_indices.empty()) {
+      // Nothing left at this target, keep drawing the previous level
+      lod_first_index_[lod] = lod_first_index_[lod - 1];
+      lod_num_indices_[lod] = lod_num_indices_[lod - 1];
+      lod_errors_[lod] = lod_errors_[lod - 1];
+      continue;
+    }
+    ndk_helper::mesh::OptimizeVertexCache(&lod_indices[0], lod_indices.size(),
+                                          num_vertices_, VERTEX_CACHE_SIZE);
+    lod_first_index_[lod] = indices.size();
+    lod_num_indices_[lod] = lod_indices.size();
+    indices.insert(indices.end(), lod_indices.begin(), lod_indices.end());
+  }
   glGenBuffers(1, &ibo_);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(teapotIndices), teapotIndices,
-               GL_STATIC_DRAW);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t),
+               &indices[0], GL_STATIC_DRAW);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
   // Create VBO
-  num_vertices_ = sizeof(teapotPositions) / sizeof(teapotPositions[0]) / 3;
-  int32_t stride = sizeof(TEAPOT_VERTEX);
-  int32_t index = 0;
-  TEAPOT_VERTEX* p = new TEAPOT_VERTEX[num_vertices_];
-  for (int32_t i = 0; i < num_vertices_; ++i) {
-    p[i].pos[0] = teapotPositions[index];
-    p[i].pos[1] = teapotPositions[index + 1];
-    p[i].pos[2] = teapotPositions[index + 2];
-
-    p[i].normal[0] = teapotNormals[index];
-    p[i].normal[1] = teapotNormals[index + 1];
-    p[i].normal[2] = teapotNormals[index + 2];
-    index += 3;
-  }
   glGenBuffers(1, &vbo_);
   glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-  glBufferData(GL_ARRAY_BUFFER, stride * num_vertices_, p, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, num_vertices_ * sizeof(TEAPOT_VERTEX),
+               &vertices[0], GL_STATIC_DRAW);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  delete[] p;
-
   UpdateViewport();
   mat_model_ = ndk_helper::Mat4::Translation(0, 0, -15.f);
 
@@ -101,6 +138,22 @@ void TeapotRenderer::UpdateViewport() {
     mat_projection_ =
         ndk_helper::Mat4::Perspective(1.0f, aspect, CAM_NEAR, CAM_FAR);
   }
+
+  // Pixels per unit at a depth of 1
+  lod_scale_ = mat_projection_.Ptr()[5] * viewport[3] * 0.5f;
+}
+
+/*
+ * Level of detail from the size of the error on screen, at the depth of the
+ * model origin
+ */
+int32_t TeapotRenderer::SelectLod() {
+  float depth = -mat_view_.Ptr()[14];
+  int32_t lod = 0;
+  while (lod + 1 < TEAPOT_LODS &&
+         lod_errors_[lod + 1] * lod_scale_ <= LOD_PIXEL_ERROR * depth)
+    ++lod;
+  return lod;
 }
 
 void TeapotRenderer::Unload() {
@@ -143,23 +196,32 @@ void TeapotRenderer::Render() {
   // Feed Projection and Model View matrices to the shaders
   ndk_helper::Mat4 mat_vp = mat_projection_ * mat_view_;
 
+  // GL calls are counted as they are issued
+  num_draw_calls_ = 0;
+  num_state_changes_ = 0;
+
   // Bind the VBO
   glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  num_state_changes_++;
 
   int32_t iStride = sizeof(TEAPOT_VERTEX);
   // Pass the vertex data
   glVertexAttribPointer(ATTRIB_VERTEX, 3, GL_FLOAT, GL_FALSE, iStride,
                         BUFFER_OFFSET(0));
   glEnableVertexAttribArray(ATTRIB_VERTEX);
+  num_state_changes_ += 2;
 
   glVertexAttribPointer(ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, iStride,
                         BUFFER_OFFSET(3 * sizeof(GLfloat)));
   glEnableVertexAttribArray(ATTRIB_NORMAL);
+  num_state_changes_ += 2;
 
   // Bind the IB
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+  num_state_changes_++;
 
   glUseProgram(shader_param_.program_);
+  num_state_changes_++;
 
   TEAPOT_MATERIALS material = {
       {1.0f, 0.5f, 0.5f}, {1.0f, 1.0f, 1.0f, 10.f}, {0.1f, 0.1f, 0.1f}, };
@@ -167,26 +229,33 @@ void TeapotRenderer::Render() {
   // Update uniforms
   glUniform4f(shader_param_.material_diffuse_, material.diffuse_color[0],
               material.diffuse_color[1], material.diffuse_color[2], 1.f);
+  num_state_changes_++;
 
   glUniform4f(shader_param_.material_specular_, material.specular_color[0],
               material.specular_color[1], material.specular_color[2],
               material.specular_color[3]);
+  num_state_changes_++;
   //
   // using glUniform3fv here was troublesome
   //
   glUniform3f(shader_param_.material_ambient_, material.ambient_color[0],
               material.ambient_color[1], material.ambient_color[2]);
+  num_state_changes_++;
 
   glUniformMatrix4fv(shader_param_.matrix_projection_, 1, GL_FALSE,
                      mat_vp.Ptr());
   glUniformMatrix4fv(shader_param_.matrix_view_, 1, GL_FALSE, mat_view_.Ptr());
   glUniform3f(shader_param_.light0_, 100.f, -200.f, -600.f);
+  num_state_changes_ += 3;
 
-  glDrawElements(GL_TRIANGLES, num_indices_, GL_UNSIGNED_SHORT,
-                 BUFFER_OFFSET(0));
+  int32_t lod = SelectLod();
+  glDrawElements(GL_TRIANGLES, lod_num_indices_[lod], GL_UNSIGNED_SHORT,
+                 BUFFER_OFFSET(lod_first_index_[lod] * sizeof(uint16_t)));
+  num_draw_calls_++;
 
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  num_state_changes_ += 2;
 }
 
 bool TeapotRenderer::LoadShaders(SHADER_PARAMS* params, const char* strVsh,
@@ -198,51 +267,60 @@ bool TeapotRenderer::LoadShaders(SHADER_PARAMS* params, const char* strVsh,
   program = glCreateProgram();
   LOGI("Created Shader %d", program);
 
-  // Create and compile vertex shader
-  if (!ndk_helper::shader::CompileShader(&vert_shader, GL_VERTEX_SHADER,
-                                         strVsh)) {
-    LOGI("Failed to compile vertex shader");
+  std::vector<std::string> sources(2);
+  if (!ndk_helper::shader::LoadShaderSource(strVsh, &sources[0]) ||
+      !ndk_helper::shader::LoadShaderSource(strFsh, &sources[1])) {
     glDeleteProgram(program);
     return false;
   }
 
-  // Create and compile fragment shader
-  if (!ndk_helper::shader::CompileShader(&frag_shader, GL_FRAGMENT_SHADER,
-                                         strFsh)) {
-    LOGI("Failed to compile fragment shader");
-    glDeleteProgram(program);
-    return false;
-  }
+  // Restore the program from the binary cache, build it from sources on a miss
+  if (!ndk_helper::shader::LoadProgramBinary(program, sources)) {
+    // Create and compile vertex shader
+    if (!ndk_helper::shader::CompileShader(&vert_shader, GL_VERTEX_SHADER,
+                                           sources[0].c_str(),
+                                           sources[0].size())) {
+      LOGI("Failed to compile vertex shader");
+      glDeleteProgram(program);
+      return false;
+    }
 
-  // Attach vertex shader to program
-  glAttachShader(program, vert_shader);
+    // Create and compile fragment shader
+    if (!ndk_helper::shader::CompileShader(&frag_shader, GL_FRAGMENT_SHADER,
+                                           sources[1].c_str(),
+                                           sources[1].size())) {
+      LOGI("Failed to compile fragment shader");
+      glDeleteShader(vert_shader);
+      glDeleteProgram(program);
+      return false;
+    }
 
-  // Attach fragment shader to program
-  glAttachShader(program, frag_shader);
+    // Attach vertex shader to program
+    glAttachShader(program, vert_shader);
 
-  // Bind attribute locations
-  // this needs to be done prior to linking
-  glBindAttribLocation(program, ATTRIB_VERTEX, "myVertex");
-  glBindAttribLocation(program, ATTRIB_NORMAL, "myNormal");
-  glBindAttribLocation(program, ATTRIB_UV, "myUV");
+    // Attach fragment shader to program
+    glAttachShader(program, frag_shader);
 
-  // Link program
-  if (!ndk_helper::shader::LinkProgram(program)) {
-    LOGI("Failed to link program: %d", program);
+    // Bind attribute locations
+    // this needs to be done prior to linking
+    glBindAttribLocation(program, ATTRIB_VERTEX, "myVertex");
+    glBindAttribLocation(program, ATTRIB_NORMAL, "myNormal");
+    glBindAttribLocation(program, ATTRIB_UV, "myUV");
 
-    if (vert_shader) {
-      glDeleteShader(vert_shader);
-      vert_shader = 0;
-    }
-    if (frag_shader) {
-      glDeleteShader(frag_shader);
-      frag_shader = 0;
-    }
-    if (program) {
+    // Link program
+    bool linked = ndk_helper::shader::LinkProgram(program);
+
+    // Release vertex and fragment shaders
+    glDeleteShader(vert_shader);
+    glDeleteShader(frag_shader);
+
+    if (!linked) {
+      LOGI("Failed to link program: %d", program);
       glDeleteProgram(program);
+      return false;
     }
 
-    return false;
+    ndk_helper::shader::SaveProgramBinary(program, sources);
   }
 
   // Get uniform locations
@@ -255,10 +333,6 @@ bool TeapotRenderer::LoadShaders(SHADER_PARAMS* params, const char* strVsh,
   params->material_specular_ =
       glGetUniformLocation(program, "vMaterialSpecular");
 
-  // Release vertex and fragment shaders
-  if (vert_shader) glDeleteShader(vert_shader);
-  if (frag_shader) glDeleteShader(frag_shader);
-
   params->program_ = program;
   return true;
 }
@@ -45,6 +45,9 @@
 
 #define BUFFER_OFFSET(i) ((char*)NULL + (i))
 
+// Levels of detail of the teapot mesh, 0 is the full mesh
+const int32_t TEAPOT_LODS = 4;
+
 struct TEAPOT_VERTEX {
   float pos[3];
   float normal[3];
@@ -78,6 +81,10 @@ class TeapotRenderer {
   int32_t num_vertices_;
   GLuint ibo_;
   GLuint vbo_;
+  int32_t lod_first_index_[TEAPOT_LODS];
+  int32_t lod_num_indices_[TEAPOT_LODS];
+  float lod_errors_[TEAPOT_LODS];  // Simplification error in model space
+  float lod_scale_;                // Pixels per unit at a depth of 1
 
   SHADER_PARAMS shader_param_;
   bool LoadShaders(SHADER_PARAMS* params, const char* strVsh,
@@ -89,6 +96,10 @@ class TeapotRenderer {
 
   ndk_helper::TapCamera* camera_;
 
+  // GL calls of the last frame
+  int32_t num_draw_calls_;
+  int32_t num_state_changes_;
+
  public:
   TeapotRenderer();
   virtual ~TeapotRenderer();
@@ -98,6 +109,9 @@ class TeapotRenderer {
   bool Bind(ndk_helper::TapCamera* camera);
   void Unload();
   void UpdateViewport();
+  int32_t SelectLod();
+  int32_t GetNumDrawCalls() { return num_draw_calls_; }
+  int32_t GetNumStateChanges() { return num_state_changes_; }
 };
 
 #endif
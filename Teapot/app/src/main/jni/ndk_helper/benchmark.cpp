@@ -0,0 +1,247 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "benchmark.h"
+
+namespace ndk_helper {
+
+const double DEFAULT_WARMUP = 2.0;    // Seconds before measuring a step
+const double DEFAULT_DURATION = 5.0;  // Seconds measured per step
+
+// Scripted camera path, a figure eight dragged on the tap camera's ball
+const float CAMERA_RADIUS = 0.5f;
+const double CAMERA_PERIOD = 4.0;  // Seconds per loop
+
+static inline double ToMs(const int64_t ns) { return ns / 1000000.0; }
+
+static std::string Trim(const std::string& str) {
+  const char* whitespace = " \t\r";
+  size_t begin = str.find_first_not_of(whitespace);
+  if (begin == std::string::npos) return std::string();
+  size_t end = str.find_last_not_of(whitespace);
+  return str.substr(begin, end - begin + 1);
+}
+
+//--------------------------------------------------------------------------------
+// Benchmark
+//--------------------------------------------------------------------------------
+Benchmark::Benchmark()
+    : warmup_(DEFAULT_WARMUP),
+      duration_(DEFAULT_DURATION),
+      running_(false),
+      measuring_(false),
+      step_start_(0.0) {
+  instance_counts_.push_back(1);
+}
+
+Benchmark::~Benchmark() {}
+
+void Benchmark::SetInstanceCounts(const int32_t* counts,
+                                  const int32_t num_counts) {
+  if (num_counts <= 0) return;
+  instance_counts_.assign(counts, counts + num_counts);
+}
+
+void Benchmark::LoadScenario(const char* text, const size_t size) {
+  std::string scenario(text, size);
+  size_t line_start = 0;
+  while (line_start < scenario.size()) {
+    size_t line_end = scenario.find('\n', line_start);
+    if (line_end == std::string::npos) line_end = scenario.size();
+    std::string line = scenario.substr(line_start, line_end - line_start);
+    line_start = line_end + 1;
+
+    line = line.substr(0, line.find('#'));
+    size_t separator = line.find('=');
+    if (separator == std::string::npos) continue;
+    std::string key = Trim(line.substr(0, separator));
+    std::string value = Trim(line.substr(separator + 1));
+
+    if (key == "instances") {
+      std::vector<int32_t> counts;
+      const char* p = value.c_str();
+      while (*p) {
+        char* end;
+        long count = strtol(p, &end, 10);
+        if (end == p) break;
+        if (count > 0) counts.push_back(static_cast<int32_t>(count));
+        p = end;
+        while (*p == ',' || *p == ' ' || *p == '\t') p++;
+      }
+      SetInstanceCounts(counts.data(), counts.size());
+    } else if (key == "warmup") {
+      warmup_ = std::max(atof(value.c_str()), 0.0);
+    } else if (key == "duration") {
+      duration_ = std::max(atof(value.c_str()), 0.1);
+    } else {
+      LOGI("Benchmark: unknown scenario key %s", key.c_str());
+    }
+  }
+}
+
+void Benchmark::Start() {
+  steps_.clear();
+  running_ = true;
+  measuring_ = false;
+  LOGI("Benchmark: start, %d steps, %.1f s warmup, %.1f s measured",
+       static_cast<int32_t>(instance_counts_.size()), warmup_, duration_);
+}
+
+bool Benchmark::Update(const double time, PerfMonitor* monitor,
+                       TapCamera* camera, const BenchmarkCounters& counters) {
+  if (!running_) return false;
+
+  if (steps_.empty()) {
+    BeginStep(time, camera);
+    return true;
+  }
+
+  double elapsed = time - step_start_;
+  MoveCamera(elapsed, camera);
+  if (elapsed < warmup_) return false;
+
+  Step& step = steps_.back();
+  if (!measuring_) {
+    // Frame statistics are taken from this frame on
+    monitor->ResetStats();
+    measuring_ = true;
+    return false;
+  }
+
+  step.counters = counters;
+  step.draw_calls += counters.draw_calls;
+  step.state_changes += counters.state_changes;
+  step.num_frames++;
+  if (elapsed < warmup_ + duration_) return false;
+
+  EndStep(monitor, camera);
+  if (steps_.size() < instance_counts_.size()) {
+    BeginStep(time, camera);
+  } else {
+    LOGI("Benchmark: done");
+    running_ = false;
+  }
+  return true;
+}
+
+int32_t Benchmark::GetInstances() const {
+  if (steps_.empty()) return instance_counts_[0];
+  return steps_.back().instances;
+}
+
+void Benchmark::BeginStep(const double time, TapCamera* camera) {
+  Step step = {};
+  step.instances = instance_counts_[steps_.size()];
+  step.counters.instances = step.instances;
+  steps_.push_back(step);
+  step_start_ = time;
+  measuring_ = false;
+
+  // Every step starts from the same camera
+  camera->Reset(false);
+  camera->BeginDrag(Vec2());
+}
+
+void Benchmark::EndStep(PerfMonitor* monitor, TapCamera* camera) {
+  Step& step = steps_.back();
+  step.stats = monitor->GetStats();
+
+  // Dragging back to the start leaves the ball rotation as it was
+  camera->Drag(Vec2());
+  camera->EndDrag();
+  camera->Reset(false);
+
+  const FrameStats& s = step.stats;
+  LOGI("Benchmark: %d instances, p50 %.2f p99 %.2f max %.2f ms, %lld janks, "
+       "%lld draw calls, %lld state changes per frame",
+       step.counters.instances, ToMs(s.Percentile(0.5)),
+       ToMs(s.Percentile(0.99)), ToMs(s.max_ns),
+       static_cast<long long>(s.num_janks),
+       static_cast<long long>(step.draw_calls /
+                              std::max(step.num_frames, (int64_t)1)),
+       static_cast<long long>(step.state_changes /
+                              std::max(step.num_frames, (int64_t)1)));
+}
+
+void Benchmark::MoveCamera(const double time, TapCamera* camera) {
+  double angle = time * 2.0 * M_PI / CAMERA_PERIOD;
+  camera->Drag(Vec2(CAMERA_RADIUS * static_cast<float>(sin(angle)),
+                    CAMERA_RADIUS * 0.5f * static_cast<float>(sin(angle * 2))));
+}
+
+bool Benchmark::Export(const char* file_name) {
+  FILE* file = fopen(file_name, "w");
+  if (!file) {
+    LOGI("Failed to open %s for the benchmark report", file_name);
+    return false;
+  }
+
+  // Device strings come from the driver, keep them valid JSON
+  std::string device;
+  for (size_t i = 0; i < device_.size(); ++i) {
+    if (device_[i] == '"' || device_[i] == '\\') device += '\\';
+    if (static_cast<unsigned char>(device_[i]) >= ' ') device += device_[i];
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"device\": \"%s\",\n", device.c_str());
+  fprintf(file, "  \"warmup_s\": %.2f,\n", warmup_);
+  fprintf(file, "  \"duration_s\": %.2f,\n", duration_);
+  fprintf(file, "  \"steps\": [");
+  for (size_t i = 0; i < steps_.size(); ++i) {
+    const Step& step = steps_[i];
+    const FrameStats& s = step.stats;
+    int64_t num_frames = std::max(s.num_frames, static_cast<int64_t>(1));
+    int64_t num_counted = std::max(step.num_frames, static_cast<int64_t>(1));
+    fprintf(file, "%s\n    {\n", i ? "," : "");
+    fprintf(file, "      \"instances\": %d,\n", step.counters.instances);
+    fprintf(file, "      \"frames\": %lld,\n",
+            static_cast<long long>(s.num_frames));
+    fprintf(file, "      \"fps\": %.2f,\n",
+            s.total_ns ? s.num_frames * 1000000000.0 / s.total_ns : 0.0);
+    fprintf(file, "      \"frame_ms\": {\"mean\": %.3f, \"p50\": %.3f, "
+                  "\"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+            ToMs(s.total_ns / num_frames), ToMs(s.Percentile(0.5)),
+            ToMs(s.Percentile(0.9)), ToMs(s.Percentile(0.99)),
+            ToMs(s.max_ns));
+    fprintf(file, "      \"cpu_ms\": {\"mean\": %.3f, \"max\": %.3f},\n",
+            ToMs(s.cpu_ns / num_frames), ToMs(s.max_cpu_ns));
+    if (s.num_gpu_frames) {
+      fprintf(file, "      \"gpu_ms\": {\"mean\": %.3f, \"max\": %.3f},\n",
+              ToMs(s.gpu_ns / s.num_gpu_frames), ToMs(s.max_gpu_ns));
+    }
+    fprintf(file, "      \"janks\": %lld,\n",
+            static_cast<long long>(s.num_janks));
+    fprintf(file, "      \"draw_calls\": %.1f,\n",
+            static_cast<double>(step.draw_calls) / num_counted);
+    fprintf(file, "      \"state_changes\": %.1f\n",
+            static_cast<double>(step.state_changes) / num_counted);
+    fprintf(file, "    }");
+  }
+  fprintf(file, "\n  ]\n}\n");
+
+  bool result = !ferror(file);
+  fclose(file);
+  LOGI("Benchmark report written to %s", file_name);
+  return result;
+}
+
+}  // namespace ndkHelper
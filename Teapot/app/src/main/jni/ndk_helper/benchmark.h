@@ -0,0 +1,142 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "perfMonitor.h"
+#include "tapCamera.h"
+
+namespace ndk_helper {
+
+/******************************************************************
+ * Render statistics of a frame, as reported by the renderer
+ */
+struct BenchmarkCounters {
+  int32_t instances;      // Objects in the scene
+  int32_t draw_calls;     // glDraw* calls
+  int32_t state_changes;  // Binds, vertex formats, programs and uniforms
+};
+
+/******************************************************************
+ * Render benchmark scenario runner
+ *
+ * Runs the scene at each instance count of the scenario: warm up for a number
+ *of seconds, then measure the frame times with PerfMonitor for a number of
+ *seconds. The camera is driven along the same scripted path in every step, so
+ *runs are comparable across builds and devices. Results are exported as JSON.
+ *
+ * The runner only talks to PerfMonitor and TapCamera, so it doesn't depend on
+ *the window or the EGL surface being rendered to.
+ *
+ * Scenarios are text files of key=value lines, # starts a comment:
+ *  instances=512,4096,32768  instance counts, one step each
+ *  warmup=2                  seconds before measuring a step
+ *  duration=5                seconds measured per step
+ */
+class Benchmark {
+ private:
+  struct Step {
+    int32_t instances;  // Requested by the scenario
+    FrameStats stats;
+    BenchmarkCounters counters;  // Last frame of the step
+    int64_t num_frames;          // Frames the counters were summed over
+    int64_t draw_calls;
+    int64_t state_changes;
+  };
+
+  std::vector<int32_t> instance_counts_;
+  double warmup_;
+  double duration_;
+  std::string device_;
+
+  std::vector<Step> steps_;
+  bool running_;
+  bool measuring_;
+  double step_start_;
+
+  void BeginStep(const double time, TapCamera* camera);
+  void EndStep(PerfMonitor* monitor, TapCamera* camera);
+  void MoveCamera(const double time, TapCamera* camera);
+
+ public:
+  Benchmark();
+  virtual ~Benchmark();
+
+  /*
+   * Set the instance counts used when the scenario doesn't list any
+   */
+  void SetInstanceCounts(const int32_t* counts, const int32_t num_counts);
+
+  /*
+   * Read a scenario, see the class description for the format. Unknown keys
+   *are ignored.
+   *
+   * arguments:
+   * in: text, scenario text, not necessarily null terminated
+   * in: size, length of the text
+   */
+  void LoadScenario(const char* text, const size_t size);
+
+  /*
+   * Set a description of the device, e.g. GL_RENDERER, written to the report
+   */
+  void SetDevice(const char* device) { device_ = device ? device : ""; }
+
+  /*
+   * Start the scenario. The first Update() call starts the first step.
+   */
+  void Start();
+
+  /*
+   * Advance the scenario, called once per frame while IsRunning()
+   *
+   * arguments:
+   * in: time, current time in seconds
+   * in: monitor, performance monitor updated every frame
+   * in: camera, camera moved along the scripted path
+   * in: counters, render statistics of the last frame
+   * return: true when a step starts or the scenario finishes. The scene is
+   *then rebuilt with GetInstances() instances, or, once IsRunning() returns
+   *false, restored.
+   */
+  bool Update(const double time, PerfMonitor* monitor, TapCamera* camera,
+              const BenchmarkCounters& counters);
+
+  bool IsRunning() const { return running_; }
+
+  /*
+   * return: instance count of the current step
+   */
+  int32_t GetInstances() const;
+
+  /*
+   * Write the results of the measured steps as JSON
+   *
+   * arguments:
+   * in: file_name, path of the file to write
+   * return: true if the file was written
+   */
+  bool Export(const char* file_name);
+};
+
+}  // namespace ndkHelper
+#endif /* BENCHMARK_H_ */
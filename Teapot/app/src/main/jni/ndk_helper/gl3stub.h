@@ -14,7 +14,9 @@
  */
 
 #include <GLES2/gl2.h>
+#ifdef __ANDROID__
 #include <android/api-level.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
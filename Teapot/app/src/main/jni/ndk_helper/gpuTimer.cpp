@@ -0,0 +1,158 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <string.h>
+
+#include "gpuTimer.h"
+#include "GLContext.h"
+
+namespace ndk_helper {
+
+// GL_EXT_disjoint_timer_query entry points
+struct TIMER_QUERY_API {
+  PFNGLGENQUERIESEXTPROC gen_queries;
+  PFNGLDELETEQUERIESEXTPROC delete_queries;
+  PFNGLBEGINQUERYEXTPROC begin_query;
+  PFNGLENDQUERYEXTPROC end_query;
+  PFNGLGETQUERYOBJECTUIVEXTPROC get_query_object_uiv;
+  PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_object_ui64v;
+};
+
+static TIMER_QUERY_API api;
+
+//--------------------------------------------------------------------------------
+// GpuTimer
+//--------------------------------------------------------------------------------
+GpuTimer::GpuTimer()
+    : available_(false),
+      frame_(0),
+      scope_open_(false),
+      frame_ns_(0),
+      has_results_(false),
+      num_dropped_(0) {}
+
+GpuTimer::~GpuTimer() {}
+
+bool GpuTimer::Init() {
+  if (available_) return true;
+  if (!GLContext::GetInstance()->CheckExtension(
+          "GL_EXT_disjoint_timer_query")) {
+    LOGI("GL_EXT_disjoint_timer_query is not supported, no GPU timings");
+    return false;
+  }
+
+  api.gen_queries =
+      (PFNGLGENQUERIESEXTPROC)eglGetProcAddress("glGenQueriesEXT");
+  api.delete_queries =
+      (PFNGLDELETEQUERIESEXTPROC)eglGetProcAddress("glDeleteQueriesEXT");
+  api.begin_query =
+      (PFNGLBEGINQUERYEXTPROC)eglGetProcAddress("glBeginQueryEXT");
+  api.end_query = (PFNGLENDQUERYEXTPROC)eglGetProcAddress("glEndQueryEXT");
+  api.get_query_object_uiv = (PFNGLGETQUERYOBJECTUIVEXTPROC)eglGetProcAddress(
+      "glGetQueryObjectuivEXT");
+  api.get_query_object_ui64v =
+      (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress(
+          "glGetQueryObjectui64vEXT");
+  available_ = api.gen_queries && api.delete_queries && api.begin_query &&
+               api.end_query && api.get_query_object_uiv &&
+               api.get_query_object_ui64v;
+
+  // Clear a disjoint event left from before
+  GLint disjoint;
+  if (available_) glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+  return available_;
+}
+
+void GpuTimer::Terminate() {
+  for (int32_t i = 0; i < GPU_TIMER_LATENCY; ++i) {
+    Frame& frame = frames_[i];
+    if (!frame.queries.empty())
+      api.delete_queries(frame.queries.size(), &frame.queries[0]);
+    frame.queries.clear();
+    frame.scopes.clear();
+  }
+  scope_open_ = false;
+  has_results_ = false;
+}
+
+int32_t GpuTimer::GetNameIndex(const char* name) {
+  for (size_t i = 0; i < names_.size(); ++i) {
+    if (names_[i] == name) return i;
+  }
+  names_.push_back(name);
+  scope_ns_.push_back(0);
+  return names_.size() - 1;
+}
+
+void GpuTimer::BeginScope(const char* name) {
+  if (!available_) return;
+  if (scope_open_) EndScope();
+
+  Frame& frame = frames_[frame_];
+  if (frame.scopes.size() == frame.queries.size()) {
+    GLuint query;
+    api.gen_queries(1, &query);
+    frame.queries.push_back(query);
+  }
+  api.begin_query(GL_TIME_ELAPSED_EXT, frame.queries[frame.scopes.size()]);
+  frame.scopes.push_back(GetNameIndex(name));
+  scope_open_ = true;
+}
+
+void GpuTimer::EndScope() {
+  if (!scope_open_) return;
+  api.end_query(GL_TIME_ELAPSED_EXT);
+  scope_open_ = false;
+}
+
+bool GpuTimer::EndFrame() {
+  has_results_ = false;
+  if (!available_) return false;
+  EndScope();
+
+  // The oldest frame in the ring is reused next
+  frame_ = (frame_ + 1) % GPU_TIMER_LATENCY;
+  Frame& frame = frames_[frame_];
+  if (frame.scopes.empty()) return false;
+
+  // Queries complete in order, so the last one tells for the frame
+  GLuint available = GL_FALSE;
+  api.get_query_object_uiv(frame.queries[frame.scopes.size() - 1],
+                           GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+  GLint disjoint = GL_FALSE;
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+  if (available && !disjoint) {
+    frame_ns_ = 0;
+    memset(&scope_ns_[0], 0, scope_ns_.size() * sizeof(scope_ns_[0]));
+    for (size_t i = 0; i < frame.scopes.size(); ++i) {
+      GLuint64 ns = 0;
+      api.get_query_object_ui64v(frame.queries[i], GL_QUERY_RESULT_EXT, &ns);
+      scope_ns_[frame.scopes[i]] += ns;
+      frame_ns_ += ns;
+    }
+    has_results_ = true;
+  } else {
+    num_dropped_++;
+  }
+  frame.scopes.clear();
+  return has_results_;
+}
+
+}  // namespace ndkHelper
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GPUTIMER_H_
+#define GPUTIMER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <GLES2/gl2.h>
+
+namespace ndk_helper {
+
+// Frames in flight before the queries of a frame are read back
+const int32_t GPU_TIMER_LATENCY = 4;
+
+/******************************************************************
+ * GPU timer
+ * Measures named scopes of GL commands on the GPU with GL_TIME_ELAPSED_EXT
+ *queries of GL_EXT_disjoint_timer_query.
+ *
+ * Queries of a frame are read GPU_TIMER_LATENCY frames later, so reading them
+ *doesn't stall the pipeline. Frames whose queries are not complete by then, or
+ *which saw a disjoint event such as a GPU frequency change, are dropped.
+ *
+ * Time elapsed queries can't nest, so scopes can't either: BeginScope() ends
+ *the open scope. GLContext::Swap() calls EndFrame().
+ *
+ * Thread safety: needs to be used from the thread owning the GL context
+ */
+class GpuTimer {
+ private:
+  struct Frame {
+    std::vector<GLuint> queries;  // Pool, grows to the scopes of a frame
+    std::vector<int32_t> scopes;  // Scope name index of each used query
+  };
+
+  bool available_;
+  Frame frames_[GPU_TIMER_LATENCY];
+  int32_t frame_;
+  bool scope_open_;
+
+  std::vector<std::string> names_;
+  std::vector<int64_t> scope_ns_;  // Of the last resolved frame
+  int64_t frame_ns_;
+  bool has_results_;
+  int32_t num_dropped_;
+
+  int32_t GetNameIndex(const char* name);
+
+  GpuTimer(const GpuTimer& rhs);
+  GpuTimer& operator=(const GpuTimer& rhs);
+
+ public:
+  GpuTimer();
+  virtual ~GpuTimer();
+
+  /*
+   * Load the entry points of GL_EXT_disjoint_timer_query. Needs a current
+   *context.
+   *
+   * return: true if the extension is supported
+   */
+  bool Init();
+
+  /*
+   * Release the queries. Call before the context is destroyed, the timer
+   *creates new queries when it is used again.
+   */
+  void Terminate();
+
+  bool IsAvailable() const { return available_; }
+
+  /*
+   * Start timing the GL commands issued until EndScope()
+   *
+   * arguments:
+   * in: name, name of the scope, results of scopes with the same name in a
+   *frame are added up
+   */
+  void BeginScope(const char* name);
+  void EndScope();
+
+  /*
+   * Close the frame and read back the queries of the frame issued
+   *GPU_TIMER_LATENCY - 1 frames ago
+   *
+   * return: true if that frame was resolved
+   */
+  bool EndFrame();
+
+  /*
+   * return: true if the last EndFrame() resolved a frame. The results below
+   *belong to the last resolved frame.
+   */
+  bool HasResults() const { return has_results_; }
+
+  /*
+   * return: GPU time of all scopes of the frame, in nanoseconds
+   */
+  int64_t GetFrameTimeNs() const { return frame_ns_; }
+
+  int32_t GetNumScopes() const { return names_.size(); }
+  const char* GetScopeName(const int32_t i) const { return names_[i].c_str(); }
+
+  /*
+   * return: GPU time of a scope in the frame, in nanoseconds
+   */
+  int64_t GetScopeTimeNs(const int32_t i) const { return scope_ns_[i]; }
+
+  /*
+   * return: number of frames whose results were dropped
+   */
+  int32_t GetNumDropped() const { return num_dropped_; }
+};
+
+}  // namespace ndkHelper
+#endif /* GPUTIMER_H_ */
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "streamingBuffer.h"
+#include "JNIHelper.h"
+
+namespace ndk_helper {
+
+// Time a fence is waited on before the wait is retried, in nanoseconds
+const GLuint64 FENCE_TIMEOUT = 100000000;
+
+//--------------------------------------------------------------------------------
+// StreamingBuffer
+//--------------------------------------------------------------------------------
+StreamingBuffer::StreamingBuffer()
+    : target_(GL_ARRAY_BUFFER),
+      buffer_(0),
+      region_size_(0),
+      num_regions_(0),
+      region_(0),
+      num_stalls_(0) {}
+
+StreamingBuffer::~StreamingBuffer() { Terminate(); }
+
+bool StreamingBuffer::Init(const GLenum target, const GLsizeiptr size,
+                           const int32_t num_frames) {
+  Terminate();
+
+  // Regions bound as uniform blocks need to start at the offset alignment
+  GLint alignment = 4;
+  if (target == GL_UNIFORM_BUFFER)
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  alignment = std::max(alignment, 4);
+
+  target_ = target;
+  region_size_ = (size + alignment - 1) / alignment * alignment;
+  num_regions_ = std::max(num_frames, 1);
+  region_ = 0;
+  num_stalls_ = 0;
+  fences_.assign(num_regions_, static_cast<GLsync>(0));
+
+  glGenBuffers(1, &buffer_);
+  glBindBuffer(target_, buffer_);
+  glBufferData(target_, region_size_ * num_regions_, NULL, GL_DYNAMIC_DRAW);
+  if (glGetError() != GL_NO_ERROR) {
+    LOGI("Failed to allocate a streaming buffer of %d bytes",
+         static_cast<int32_t>(region_size_ * num_regions_));
+    Terminate();
+    return false;
+  }
+  return true;
+}
+
+void StreamingBuffer::Terminate() {
+  for (size_t i = 0; i < fences_.size(); ++i) {
+    if (fences_[i]) glDeleteSync(fences_[i]);
+  }
+  fences_.clear();
+
+  if (buffer_) {
+    glDeleteBuffers(1, &buffer_);
+    buffer_ = 0;
+  }
+}
+
+void* StreamingBuffer::Map(const GLsizeiptr size) {
+  // Wait until the GPU is done with the draws of num_regions_ frames ago
+  GLsync& fence = fences_[region_];
+  if (fence) {
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+      num_stalls_++;
+      do {
+        result =
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+      } while (result == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(fence);
+    fence = 0;
+  }
+
+  glBindBuffer(target_, buffer_);
+  return glMapBufferRange(target_, GetOffset(), std::min(size, region_size_),
+                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                              GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+void StreamingBuffer::Unmap() {
+  glBindBuffer(target_, buffer_);
+  glUnmapBuffer(target_);
+}
+
+void StreamingBuffer::EndFrame() {
+  GLsync& fence = fences_[region_];
+  if (fence) glDeleteSync(fence);
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  region_ = (region_ + 1) % num_regions_;
+}
+
+}  // namespace ndkHelper
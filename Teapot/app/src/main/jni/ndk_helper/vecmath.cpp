@@ -19,8 +19,102 @@
 //--------------------------------------------------------------------------------
 #include "vecmath.h"
 
+#if !defined(VECMATH_NO_SIMD)
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VECMATH_NEON
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define VECMATH_SSE
+#endif
+#endif
+
 namespace ndk_helper {
 
+//--------------------------------------------------------------------------------
+// SIMD helpers
+// Loads are unaligned as heap allocated objects may only be 8 byte aligned on
+// 32 bit targets. They are as fast as aligned loads on aligned storage.
+//--------------------------------------------------------------------------------
+#if defined(VECMATH_NEON)
+typedef float32x4_t simd4f;
+
+static inline simd4f Load(const float* p) { return vld1q_f32(p); }
+static inline void Store(float* p, const simd4f v) { vst1q_f32(p, v); }
+static inline simd4f Splat(const float f) { return vdupq_n_f32(f); }
+static inline simd4f Sub(const simd4f a, const simd4f b) {
+  return vsubq_f32(a, b);
+}
+static inline simd4f Mul(const simd4f a, const simd4f b) {
+  return vmulq_f32(a, b);
+}
+
+// b * a.xxxx + c * a.yyyy + d * a.zzzz + e * a.wwww
+static inline simd4f Combine(const simd4f a, const simd4f b, const simd4f c,
+                             const simd4f d, const simd4f e) {
+  simd4f r = vmulq_lane_f32(b, vget_low_f32(a), 0);
+  r = vmlaq_lane_f32(r, c, vget_low_f32(a), 1);
+  r = vmlaq_lane_f32(r, d, vget_high_f32(a), 0);
+  return vmlaq_lane_f32(r, e, vget_high_f32(a), 1);
+}
+
+// (y, z, x, *)
+static inline simd4f ShuffleYZX(const simd4f v) {
+  return vcombine_f32(vext_f32(vget_low_f32(v), vget_high_f32(v), 1),
+                      vget_low_f32(v));
+}
+
+static inline void Transpose4(simd4f& r0, simd4f& r1, simd4f& r2,
+                              simd4f& r3) {
+  float32x4x2_t t01 = vtrnq_f32(r0, r1);
+  float32x4x2_t t23 = vtrnq_f32(r2, r3);
+  r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+  r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+  r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+  r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+#elif defined(VECMATH_SSE)
+typedef __m128 simd4f;
+
+static inline simd4f Load(const float* p) { return _mm_loadu_ps(p); }
+static inline void Store(float* p, const simd4f v) { _mm_storeu_ps(p, v); }
+static inline simd4f Splat(const float f) { return _mm_set1_ps(f); }
+static inline simd4f Sub(const simd4f a, const simd4f b) {
+  return _mm_sub_ps(a, b);
+}
+static inline simd4f Mul(const simd4f a, const simd4f b) {
+  return _mm_mul_ps(a, b);
+}
+
+// b * a.xxxx + c * a.yyyy + d * a.zzzz + e * a.wwww
+static inline simd4f Combine(const simd4f a, const simd4f b, const simd4f c,
+                             const simd4f d, const simd4f e) {
+  const simd4f x = _mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 0, 0));
+  const simd4f y = _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1));
+  const simd4f z = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2));
+  const simd4f w = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3));
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(b, x), _mm_mul_ps(c, y)),
+                    _mm_add_ps(_mm_mul_ps(d, z), _mm_mul_ps(e, w)));
+}
+
+// (y, z, x, *)
+static inline simd4f ShuffleYZX(const simd4f v) {
+  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+static inline void Transpose4(simd4f& r0, simd4f& r1, simd4f& r2,
+                              simd4f& r3) {
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+}
+#endif
+
+#if defined(VECMATH_NEON) || defined(VECMATH_SSE)
+// Cross product of the xyz components, w is undefined
+static inline simd4f Cross(const simd4f a, const simd4f b) {
+  return ShuffleYZX(Sub(Mul(a, ShuffleYZX(b)), Mul(ShuffleYZX(a), b)));
+}
+#endif
+
 //--------------------------------------------------------------------------------
 // vec3
 //--------------------------------------------------------------------------------
@@ -56,6 +150,16 @@ Mat4::Mat4(const float* mIn) {
 
 Mat4 Mat4::operator*(const Mat4& rhs) const {
   Mat4 ret;
+#if defined(VECMATH_NEON) || defined(VECMATH_SSE)
+  const simd4f c0 = Load(f_);
+  const simd4f c1 = Load(f_ + 4);
+  const simd4f c2 = Load(f_ + 8);
+  const simd4f c3 = Load(f_ + 12);
+  Store(ret.f_, Combine(Load(rhs.f_), c0, c1, c2, c3));
+  Store(ret.f_ + 4, Combine(Load(rhs.f_ + 4), c0, c1, c2, c3));
+  Store(ret.f_ + 8, Combine(Load(rhs.f_ + 8), c0, c1, c2, c3));
+  Store(ret.f_ + 12, Combine(Load(rhs.f_ + 12), c0, c1, c2, c3));
+#else
   ret.f_[0] = f_[0] * rhs.f_[0] + f_[4] * rhs.f_[1] + f_[8] * rhs.f_[2] +
               f_[12] * rhs.f_[3];
   ret.f_[1] = f_[1] * rhs.f_[0] + f_[5] * rhs.f_[1] + f_[9] * rhs.f_[2] +
@@ -91,21 +195,58 @@ Mat4 Mat4::operator*(const Mat4& rhs) const {
                f_[14] * rhs.f_[15];
   ret.f_[15] = f_[3] * rhs.f_[12] + f_[7] * rhs.f_[13] + f_[11] * rhs.f_[14] +
                f_[15] * rhs.f_[15];
+#endif
 
   return ret;
 }
 
 Vec4 Mat4::operator*(const Vec4& rhs) const {
   Vec4 ret;
+#if defined(VECMATH_NEON) || defined(VECMATH_SSE)
+  Store(&ret.x_, Combine(Load(&rhs.x_), Load(f_), Load(f_ + 4), Load(f_ + 8),
+                         Load(f_ + 12)));
+#else
   ret.x_ = rhs.x_ * f_[0] + rhs.y_ * f_[4] + rhs.z_ * f_[8] + rhs.w_ * f_[12];
   ret.y_ = rhs.x_ * f_[1] + rhs.y_ * f_[5] + rhs.z_ * f_[9] + rhs.w_ * f_[13];
   ret.z_ = rhs.x_ * f_[2] + rhs.y_ * f_[6] + rhs.z_ * f_[10] + rhs.w_ * f_[14];
   ret.w_ = rhs.x_ * f_[3] + rhs.y_ * f_[7] + rhs.z_ * f_[11] + rhs.w_ * f_[15];
+#endif
   return ret;
 }
 
 Mat4 Mat4::Inverse() {
   Mat4 ret;
+#if defined(VECMATH_NEON) || defined(VECMATH_SSE)
+  // Affine inverse: rows of inverse(A) are the cross products of A's columns
+  // divided by the determinant, the translation is -inverse(A) * C
+  const simd4f a0 = Load(f_);
+  const simd4f a1 = Load(f_ + 4);
+  const simd4f a2 = Load(f_ + 8);
+  simd4f r0 = Cross(a1, a2);
+  simd4f r1 = Cross(a2, a0);
+  simd4f r2 = Cross(a0, a1);
+
+  float det[4];
+  Store(det, Mul(a0, r0));
+  float det_1 = det[0] + det[1] + det[2];
+  if (det_1 != 0.0f) {
+    const simd4f scale = Splat(1.0f / det_1);
+    r0 = Mul(r0, scale);
+    r1 = Mul(r1, scale);
+    r2 = Mul(r2, scale);
+    simd4f r3 = Splat(0.0f);
+    Transpose4(r0, r1, r2, r3);
+
+    // The 4th rows of the transposed columns come from r3, thus are 0
+    const simd4f c = Load(f_ + 12);
+    const float w[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    r3 = Sub(Load(w), Combine(c, r0, r1, r2, Splat(0.0f)));
+    Store(ret.f_, r0);
+    Store(ret.f_ + 4, r1);
+    Store(ret.f_ + 8, r2);
+    Store(ret.f_ + 12, r3);
+  }
+#else
   float det_1;
   float pos = 0;
   float neg = 0;
@@ -170,6 +311,7 @@ Mat4 Mat4::Inverse() {
     ret.f_[11] = 0.0f;
     ret.f_[15] = 1.0f;
   }
+#endif
 
   *this = ret;
   return *this;
@@ -86,7 +86,6 @@ class Engine {
   void CheckAPISupport();
   void StartFPSThrottle();
   void StopFPSThrottle();
-  int64_t GetCurrentTime();
 
   void StartChoreographer();
   void StartJavaChoreographer();
@@ -97,10 +96,6 @@ class Engine {
   func_AChoreographer_getInstance AChoreographer_getInstance_;
   func_AChoreographer_postFrameCallback AChoreographer_postFrameCallback_;
 
-  // Stuff for EGL Android presentation time extension.
-  int64_t presentation_time_;
-  bool (*eglPresentationTimeANDROID_)(EGLDisplay dpy, EGLSurface sur,
-                                      khronos_stime_nanoseconds_t time);
   int32_t render_cycle_;
   bool should_render_;
   std::mutex mtx_;              // mutex for critical section
@@ -169,15 +164,9 @@ void Engine::CheckAPISupport() {
     }
   } else if (apilevel >= 18) {
     // eglPresentationTimeANDROID would be supported in API level 18~.
+    // GLContext::Swap() schedules the frames with it.
     LOGI("Run with EGLExtension.");
     api_mode_ = kAPIEGLExtension;
-
-    // Retrieve the EGL extension's function pointer.
-    eglPresentationTimeANDROID_ = reinterpret_cast<
-        bool (*)(EGLDisplay, EGLSurface, khronos_stime_nanoseconds_t)>(
-        eglGetProcAddress("eglPresentationTimeANDROID"));
-    assert(eglPresentationTimeANDROID_);
-    presentation_time_ = GetCurrentTime();
   } else if (apilevel >= 16) {
     // Choreographer Java API is supported API level 16~.
     LOGI("Run with Chreographer Java API.");
@@ -190,6 +179,10 @@ void Engine::CheckAPISupport() {
 }
 
 void Engine::StartFPSThrottle() {
+  // Frames are expected to take kFPSThrottleInterval refresh periods
+  monitor_.SetRefreshPeriod(
+      kFPSThrottlePresentationInterval / kFPSThrottleInterval,
+      kFPSThrottleInterval);
   api_mode_ = original_api_mode_;
   if (api_mode_ == kAPINativeChoreographer) {
     // Initiate choreographer callback.
@@ -197,15 +190,31 @@ void Engine::StartFPSThrottle() {
   } else if (api_mode_ == kAPIJavaChoreographer) {
     // Initiate Java choreographer callback.
     StartJavaChoreographer();
+  } else if (api_mode_ == kAPIEGLExtension) {
+    // Whether EGL_ANDROID_presentation_time is there is only known once the
+    // display is initialized, InitDisplay() starts the throttle again then.
+    if (!gl_context_->SetPresentationInterval(
+            kFPSThrottlePresentationInterval) &&
+        initialized_resources_) {
+      LOGI("eglPresentationTimeANDROID is not supported.");
+      LOGI("Run with Chreographer Java API.");
+      api_mode_ = kAPIJavaChoreographer;
+      original_api_mode_ = api_mode_;
+      StartJavaChoreographer();
+    }
   }
 }
 
 void Engine::StopFPSThrottle() {
+  monitor_.SetRefreshPeriod(
+      kFPSThrottlePresentationInterval / kFPSThrottleInterval, 1);
   if (api_mode_ == kAPINativeChoreographer) {
     should_render_ = true;
     //    ALooper_wake(app_->looper);
   } else if (api_mode_ == kAPIJavaChoreographer) {
     StopJavaChoreographer();
+  } else if (api_mode_ == kAPIEGLExtension) {
+    gl_context_->SetPresentationInterval(0);
   }
   api_mode_ = kAPINone;
 }
@@ -220,14 +229,8 @@ void Engine::DoSwap() {
     std::unique_lock<std::mutex> lock(mtx_);
     cv_.wait(lock);
     Swap();
-  } else if (api_mode_ == kAPIEGLExtension) {
-    // Use eglPresentationTimeANDROID extension.
-    presentation_time_ += kFPSThrottlePresentationInterval;
-    eglPresentationTimeANDROID_(gl_context_->GetDisplay(),
-                                gl_context_->GetSurface(), presentation_time_);
-    Swap();
   } else {
-    // Regular Swap.
+    // Regular Swap, paced by GLContext in kAPIEGLExtension mode.
     Swap();
   }
 }
@@ -305,13 +308,6 @@ Java_com_sample_choreographer_ChoreographerNativeActivity_choregrapherCallback(
 }
 
 // Helper functions.
-int64_t Engine::GetCurrentTime() {
-  timespec time;
-  clock_gettime(CLOCK_MONOTONIC, &time);
-  return static_cast<int64_t>(time.tv_sec) * 1e9 +
-         static_cast<int64_t>(time.tv_nsec);
-}
-
 void Engine::Swap() {
   if (EGL_SUCCESS != gl_context_->Swap()) {
     UnloadResources();
@@ -340,6 +336,7 @@ int Engine::InitDisplay() {
     gl_context_->Init(app_->window);
     LoadResources();
     initialized_resources_ = true;
+    if (api_mode_ == kAPIEGLExtension) StartFPSThrottle();
   } else {
     // initialize OpenGL ES and EGL
     if (EGL_SUCCESS != gl_context_->Resume(app_->window)) {
@@ -388,7 +385,15 @@ void Engine::DrawFrame() {
 /**
  * Tear down the EGL context currently associated with the display.
  */
-void Engine::TermDisplay() { gl_context_->Suspend(); }
+void Engine::TermDisplay() {
+  // Frame statistics of the session so far
+  if (app_->activity->internalDataPath) {
+    std::string path =
+        std::string(app_->activity->internalDataPath) + "/frame_stats.json";
+    monitor_.Export(path.c_str());
+  }
+  gl_context_->Suspend();
+}
 
 void Engine::TrimMemory() {
   LOGI("Trimming memory");
@@ -472,6 +477,7 @@ void Engine::HandleCmd(struct android_app* app, int32_t cmd) {
     case APP_CMD_INIT_WINDOW:
       // The window is being shown, get it ready.
       if (app->window != NULL) {
+        eng->monitor_.Resume();
         eng->InitDisplay();
         eng->DrawFrame();
       }
@@ -484,11 +490,11 @@ void Engine::HandleCmd(struct android_app* app, int32_t cmd) {
     case APP_CMD_STOP:
       break;
     case APP_CMD_GAINED_FOCUS:
+      // Don't count the time in the background as a frame
+      eng->monitor_.Resume();
       // Start animation
       eng->has_focus_ = true;
 
-      // Update counter when the app becomes active.
-      eng->presentation_time_ = eng->GetCurrentTime();
       if (eng->api_mode_ == kAPINativeChoreographer) {
         eng->StartChoreographer();
       }
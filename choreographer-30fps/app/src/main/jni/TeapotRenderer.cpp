@@ -199,51 +199,60 @@ bool TeapotRenderer::LoadShaders(SHADER_PARAMS* params, const char* strVsh,
   program = glCreateProgram();
   LOGI("Created Shader %d", program);
 
-  // Create and compile vertex shader
-  if (!ndk_helper::shader::CompileShader(&vert_shader, GL_VERTEX_SHADER,
-                                         strVsh)) {
-    LOGI("Failed to compile vertex shader");
+  std::vector<std::string> sources(2);
+  if (!ndk_helper::shader::LoadShaderSource(strVsh, &sources[0]) ||
+      !ndk_helper::shader::LoadShaderSource(strFsh, &sources[1])) {
     glDeleteProgram(program);
     return false;
   }
 
-  // Create and compile fragment shader
-  if (!ndk_helper::shader::CompileShader(&frag_shader, GL_FRAGMENT_SHADER,
-                                         strFsh)) {
-    LOGI("Failed to compile fragment shader");
-    glDeleteProgram(program);
-    return false;
-  }
+  // Restore the program from the binary cache, build it from sources on a miss
+  if (!ndk_helper::shader::LoadProgramBinary(program, sources)) {
+    // Create and compile vertex shader
+    if (!ndk_helper::shader::CompileShader(&vert_shader, GL_VERTEX_SHADER,
+                                           sources[0].c_str(),
+                                           sources[0].size())) {
+      LOGI("Failed to compile vertex shader");
+      glDeleteProgram(program);
+      return false;
+    }
 
-  // Attach vertex shader to program
-  glAttachShader(program, vert_shader);
+    // Create and compile fragment shader
+    if (!ndk_helper::shader::CompileShader(&frag_shader, GL_FRAGMENT_SHADER,
+                                           sources[1].c_str(),
+                                           sources[1].size())) {
+      LOGI("Failed to compile fragment shader");
+      glDeleteShader(vert_shader);
+      glDeleteProgram(program);
+      return false;
+    }
 
-  // Attach fragment shader to program
-  glAttachShader(program, frag_shader);
+    // Attach vertex shader to program
+    glAttachShader(program, vert_shader);
 
-  // Bind attribute locations
-  // this needs to be done prior to linking
-  glBindAttribLocation(program, ATTRIB_VERTEX, "myVertex");
-  glBindAttribLocation(program, ATTRIB_NORMAL, "myNormal");
-  glBindAttribLocation(program, ATTRIB_UV, "myUV");
+    // Attach fragment shader to program
+    glAttachShader(program, frag_shader);
 
-  // Link program
-  if (!ndk_helper::shader::LinkProgram(program)) {
-    LOGI("Failed to link program: %d", program);
+    // Bind attribute locations
+    // this needs to be done prior to linking
+    glBindAttribLocation(program, ATTRIB_VERTEX, "myVertex");
+    glBindAttribLocation(program, ATTRIB_NORMAL, "myNormal");
+    glBindAttribLocation(program, ATTRIB_UV, "myUV");
 
-    if (vert_shader) {
-      glDeleteShader(vert_shader);
-      vert_shader = 0;
-    }
-    if (frag_shader) {
-      glDeleteShader(frag_shader);
-      frag_shader = 0;
-    }
-    if (program) {
+    // Link program
+    bool linked = ndk_helper::shader::LinkProgram(program);
+
+    // Release vertex and fragment shaders
+    glDeleteShader(vert_shader);
+    glDeleteShader(frag_shader);
+
+    if (!linked) {
+      LOGI("Failed to link program: %d", program);
       glDeleteProgram(program);
+      return false;
     }
 
-    return false;
+    ndk_helper::shader::SaveProgramBinary(program, sources);
   }
 
   // Get uniform locations
@@ -256,10 +265,6 @@ bool TeapotRenderer::LoadShaders(SHADER_PARAMS* params, const char* strVsh,
   params->material_specular_ =
       glGetUniformLocation(program, "vMaterialSpecular");
 
-  // Release vertex and fragment shaders
-  if (vert_shader) glDeleteShader(vert_shader);
-  if (frag_shader) glDeleteShader(frag_shader);
-
   params->program_ = program;
   return true;
 }
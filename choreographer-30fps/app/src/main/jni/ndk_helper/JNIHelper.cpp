@@ -15,8 +15,10 @@
  */
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
-#include <fstream>
-#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <assert.h>
 
 #include "JNIHelper.h"
@@ -128,65 +130,11 @@ void JNIHelper::Init(ANativeActivity *activity, const char *helper_class_name,
  */
 bool JNIHelper::ReadFile(const char *fileName,
                          std::vector<uint8_t> *buffer_ref) {
-  if (activity_ == NULL) {
-    LOGI("JNIHelper has not been initialized.Call init() to initialize the "
-         "helper");
-    return false;
-  }
-
-  // Lock mutex
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  // First, try reading from externalFileDir;
-  JNIEnv *env = AttachCurrentThread();
-
-  jstring str_path = GetExternalFilesDirJString(env);
-  const char *path = env->GetStringUTFChars(str_path, NULL);
-  std::string s(path);
-
-  if (fileName[0] != '/') {
-    s.append("/");
-  }
-  s.append(fileName);
-  std::ifstream f(s.c_str(), std::ios::binary);
-
-  env->ReleaseStringUTFChars(str_path, path);
-  env->DeleteLocalRef(str_path);
-  activity_->vm->DetachCurrentThread();
-
-  if (f) {
-    LOGI("reading:%s", s.c_str());
-    f.seekg(0, std::ifstream::end);
-    int32_t fileSize = f.tellg();
-    f.seekg(0, std::ifstream::beg);
-    buffer_ref->reserve(fileSize);
-    buffer_ref->assign(std::istreambuf_iterator<char>(f),
-                       std::istreambuf_iterator<char>());
-    f.close();
-    return true;
-  } else {
-    //Fallback to assetManager
-    AAssetManager *assetManager = activity_->assetManager;
-    AAsset *assetFile =
-        AAssetManager_open(assetManager, fileName, AASSET_MODE_BUFFER);
-    if (!assetFile) {
-      return false;
-    }
-    uint8_t *data = (uint8_t *)AAsset_getBuffer(assetFile);
-    int32_t size = AAsset_getLength(assetFile);
-    if (data == NULL) {
-      AAsset_close(assetFile);
+  AssetView view;
+  if (!view.Open(fileName)) return false;
 
-      LOGI("Failed to load:%s", fileName);
-      return false;
-    }
-
-    buffer_ref->reserve(size);
-    buffer_ref->assign(data, data + size);
-
-    AAsset_close(assetFile);
-    return true;
-  }
+  buffer_ref->assign(view.Data(), view.Data() + view.Size());
+  return true;
 }
 
 std::string JNIHelper::GetExternalFilesDir() {
@@ -734,6 +682,102 @@ void JNIHelper::RunOnUiThread(std::function<void()> callback) {
   env->CallVoidMethod(jni_helper_java_ref_, mid, (int64_t) pCallback);
 }
 
+/*
+ * AssetView
+ */
+AssetView::AssetView()
+    : asset_(NULL), map_(NULL), map_size_(0), data_(NULL), size_(0) {}
+
+AssetView::~AssetView() { Close(); }
+
+bool AssetView::Open(const char *file_name) {
+  Close();
+
+  JNIHelper *helper = JNIHelper::GetInstance();
+  AAssetManager *asset_manager = helper->GetAssetManager();
+  if (asset_manager == NULL) {
+    LOGI("JNIHelper has not been initialized. Call init() to initialize the "
+         "helper");
+    return false;
+  }
+
+  // First, try mapping a file in externalFileDir
+  std::string s = helper->GetExternalFilesDir();
+  if (file_name[0] != '/') {
+    s.append("/");
+  }
+  s.append(file_name);
+
+  int fd = open(s.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    bool mapped = fstat(fd, &st) == 0 && MapFile(fd, 0, st.st_size);
+    close(fd);
+    if (mapped) {
+      LOGI("reading:%s", s.c_str());
+      return true;
+    }
+  }
+
+  //Fallback to assetManager
+  asset_ = AAssetManager_open(asset_manager, file_name, AASSET_MODE_BUFFER);
+  if (asset_ == NULL) return false;
+
+  // Uncompressed assets can be mapped directly from the APK
+  off_t start, length;
+  fd = AAsset_openFileDescriptor(asset_, &start, &length);
+  if (fd >= 0) {
+    bool mapped = MapFile(fd, start, length);
+    close(fd);
+    if (mapped) {
+      AAsset_close(asset_);
+      asset_ = NULL;
+      return true;
+    }
+  }
+
+  data_ = static_cast<const uint8_t *>(AAsset_getBuffer(asset_));
+  size_ = AAsset_getLength(asset_);
+  if (data_ == NULL) {
+    LOGI("Failed to load:%s", file_name);
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool AssetView::MapFile(int fd, off_t offset, size_t length) {
+  if (length == 0) {
+    // Nothing to map, an empty view
+    data_ = NULL;
+    size_ = 0;
+    return true;
+  }
+
+  // mmap() requires a page aligned offset
+  off_t page_size = sysconf(_SC_PAGESIZE);
+  off_t aligned_offset = offset & ~(page_size - 1);
+  map_size_ = length + (offset - aligned_offset);
+  map_ = mmap(NULL, map_size_, PROT_READ, MAP_PRIVATE, fd, aligned_offset);
+  if (map_ == MAP_FAILED) {
+    map_ = NULL;
+    return false;
+  }
+
+  data_ = static_cast<const uint8_t *>(map_) + (offset - aligned_offset);
+  size_ = length;
+  return true;
+}
+
+void AssetView::Close() {
+  if (map_) munmap(map_, map_size_);
+  if (asset_) AAsset_close(asset_);
+  asset_ = NULL;
+  map_ = NULL;
+  data_ = NULL;
+  size_ = 0;
+}
+
 // This JNI function is invoked from UIThread asynchronously
 extern "C" {
 JNIEXPORT void
@@ -24,6 +24,7 @@
 #include <mutex>
 #include <pthread.h>
 
+#include <android/asset_manager.h>
 #include <android/log.h>
 #include <android_native_app_glue.h>
 
@@ -44,6 +45,51 @@ namespace ndk_helper {
 
 class JUIView;
 
+/******************************************************************
+ * Read-only view of a file
+ * The view memory-maps a file in the external storage or an APK asset, and
+ * releases the mapping when it goes out of scope.
+ * Uncompressed assets are mapped directly from the APK, compressed assets are
+ * inflated by the asset manager.
+ */
+class AssetView {
+public:
+  AssetView();
+  ~AssetView();
+
+  /*
+   * Open a file.
+   * Same as JNIHelper::ReadFile(), the file is looked up in the external
+   * storage first, then falls back to APK assets.
+   *
+   * arguments:
+   * in: file_name, file name to open
+   * return:
+   * true when the file is opened
+   */
+  bool Open(const char *file_name);
+
+  /*
+   * Release the mapping. Pointers returned by Data() get invalid.
+   */
+  void Close();
+
+  const uint8_t *Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+private:
+  AAsset *asset_;
+  void *map_;
+  size_t map_size_;
+  const uint8_t *data_;
+  size_t size_;
+
+  bool MapFile(int fd, off_t offset, size_t length);
+
+  AssetView(const AssetView &rhs);
+  AssetView &operator=(const AssetView &rhs);
+};
+
 /******************************************************************
  * Helper functions for JNI calls
  * This class wraps JNI calls and provides handy interface calling commonly used
@@ -103,6 +149,7 @@ public:
    * First, the method tries to read the file from an external storage.
    * If it fails to read, it falls back to use assset manager and try to read
    * the file from APK asset.
+   * Use AssetView instead to access the file contents without copying them.
    *
    * arguments:
    * in: file_name, file name to read
@@ -192,6 +239,25 @@ public:
    */
   std::string GetExternalFilesDir();
 
+  /*
+   * Retrieve the asset manager of the activity
+   *
+   * return: pointer to the asset manager, NULL when the helper is not
+   * initialized
+   */
+  AAssetManager *GetAssetManager() {
+    return activity_ ? activity_->assetManager : NULL;
+  }
+
+  /*
+   * Retrieve internal file directory of the app
+   *
+   * return: pointer to the directory path, NULL when it is not available
+   */
+  const char *GetInternalFilesDir() {
+    return activity_ ? activity_->internalDataPath : NULL;
+  }
+
   /*
    * Retrieve string resource with a given name
    * arguments:
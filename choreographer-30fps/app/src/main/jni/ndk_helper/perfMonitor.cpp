@@ -14,40 +14,102 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
+#include <algorithm>
+
 #include "perfMonitor.h"
 
 namespace ndk_helper {
 
-PerfMonitor::PerfMonitor()
-    : current_FPS_(0), tv_last_sec_(0), last_tick_(0.f), tickindex_(0),
-      ticksum_(0) {
-  for (int32_t i = 0; i < NUM_SAMPLES; ++i)
-    ticklist_[i] = 0;
+const int64_t NS_PER_SEC = 1000000000;
+const int64_t DEFAULT_REFRESH_PERIOD_NS = NS_PER_SEC / 60;
+
+static inline double ToMs(const int64_t ns) { return ns / 1000000.0; }
+
+//--------------------------------------------------------------------------------
+// FrameStats
+//--------------------------------------------------------------------------------
+FrameStats::FrameStats() { Reset(); }
+
+void FrameStats::Reset() {
+  num_frames = 0;
+  total_ns = 0;
+  max_ns = 0;
+  cpu_ns = 0;
+  max_cpu_ns = 0;
+  num_janks = 0;
+  num_gpu_frames = 0;
+  gpu_ns = 0;
+  max_gpu_ns = 0;
+  histogram.assign(NUM_HISTOGRAM_BUCKETS + 1, 0);
 }
 
-PerfMonitor::~PerfMonitor() {}
+void FrameStats::Add(const int64_t frame_ns, const int64_t frame_cpu_ns,
+                     const bool jank) {
+  num_frames++;
+  total_ns += frame_ns;
+  max_ns = std::max(max_ns, frame_ns);
+  cpu_ns += frame_cpu_ns;
+  max_cpu_ns = std::max(max_cpu_ns, frame_cpu_ns);
+  if (jank) num_janks++;
 
-double PerfMonitor::UpdateTick(double currentTick) {
-  ticksum_ -= ticklist_[tickindex_];
-  ticksum_ += currentTick;
-  ticklist_[tickindex_] = currentTick;
-  tickindex_ = (tickindex_ + 1) % NUM_SAMPLES;
+  int64_t bucket = std::min(frame_ns / HISTOGRAM_BUCKET_NS,
+                            static_cast<int64_t>(NUM_HISTOGRAM_BUCKETS));
+  histogram[bucket]++;
+}
 
-  return ((double) ticksum_ / NUM_SAMPLES);
+void FrameStats::AddGpu(const int64_t frame_gpu_ns) {
+  num_gpu_frames++;
+  gpu_ns += frame_gpu_ns;
+  max_gpu_ns = std::max(max_gpu_ns, frame_gpu_ns);
 }
 
-bool PerfMonitor::Update(float &fFPS) {
-  struct timeval Time;
-  gettimeofday(&Time, NULL);
+int64_t FrameStats::Percentile(const double fraction) const {
+  if (!num_frames) return 0;
+
+  int64_t rank = static_cast<int64_t>(fraction * num_frames + 0.5);
+  rank = std::min(std::max(rank, static_cast<int64_t>(1)), num_frames);
+  int64_t count = 0;
+  for (int32_t i = 0; i < NUM_HISTOGRAM_BUCKETS; ++i) {
+    count += histogram[i];
+    if (count >= rank) return std::min((i + 1) * HISTOGRAM_BUCKET_NS, max_ns);
+  }
+  return max_ns;
+}
+
+//--------------------------------------------------------------------------------
+// PerfMonitor
+//--------------------------------------------------------------------------------
+PerfMonitor::PerfMonitor()
+    : current_FPS_(0.f),
+      window_start_ns_(0),
+      last_frame_ns_(0),
+      last_cpu_ns_(0),
+      jank_threshold_ns_(DEFAULT_REFRESH_PERIOD_NS * 3 / 2) {}
+
+PerfMonitor::~PerfMonitor() {}
 
-  double time = Time.tv_sec + Time.tv_usec * 1.0 / 1000000.0;
-  double tick = time - last_tick_;
-  double d = UpdateTick(tick);
-  last_tick_ = time;
+bool PerfMonitor::Update(float &fFPS) {
+  int64_t now = GetCurrentTimeNs();
+  int64_t cpu = GetThreadCpuTimeNs();
+  if (last_frame_ns_) {
+    int64_t frame_ns = now - last_frame_ns_;
+    int64_t frame_cpu_ns = cpu - last_cpu_ns_;
+    bool jank = frame_ns > jank_threshold_ns_;
+    window_.Add(frame_ns, frame_cpu_ns, jank);
+    total_.Add(frame_ns, frame_cpu_ns, jank);
+  }
+  last_frame_ns_ = now;
+  last_cpu_ns_ = cpu;
 
-  if (Time.tv_sec - tv_last_sec_ >= 1) {
-    current_FPS_ = 1.f / d;
-    tv_last_sec_ = Time.tv_sec;
+  if (now - window_start_ns_ >= NS_PER_SEC) {
+    if (window_.num_frames) {
+      current_FPS_ = window_.num_frames * static_cast<double>(NS_PER_SEC) /
+                     window_.total_ns;
+      LogStats();
+    }
+    window_.Reset();
+    window_start_ns_ = now;
     fFPS = current_FPS_;
     return true;
   } else {
@@ -56,4 +118,108 @@ bool PerfMonitor::Update(float &fFPS) {
   }
 }
 
+void PerfMonitor::Resume() {
+  last_frame_ns_ = 0;
+  window_.Reset();
+  window_start_ns_ = 0;
+}
+
+void PerfMonitor::SetCounter(const char *name, const int64_t value) {
+  for (size_t i = 0; i < counters_.size(); ++i) {
+    if (counters_[i].first == name) {
+      counters_[i].second = value;
+      return;
+    }
+  }
+  counters_.push_back(std::make_pair(std::string(name), value));
+}
+
+void PerfMonitor::AddGpuTime(const int64_t frame_gpu_ns) {
+  window_.AddGpu(frame_gpu_ns);
+  total_.AddGpu(frame_gpu_ns);
+}
+
+void PerfMonitor::SetRefreshPeriod(const int64_t period_ns,
+                                   const int32_t interval) {
+  jank_threshold_ns_ = period_ns * std::max(interval, 1) + period_ns / 2;
+}
+
+void PerfMonitor::ResetStats() { total_.Reset(); }
+
+void PerfMonitor::LogStats() {
+  char str[512];
+  int32_t length = snprintf(
+      str, sizeof(str),
+      "%.2f FPS, frame p50 %.2f p90 %.2f p99 %.2f max %.2f ms, %lld janks, "
+      "cpu %.2f max %.2f ms",
+      current_FPS_, ToMs(window_.Percentile(0.5)),
+      ToMs(window_.Percentile(0.9)), ToMs(window_.Percentile(0.99)),
+      ToMs(window_.max_ns), static_cast<long long>(window_.num_janks),
+      ToMs(window_.cpu_ns / window_.num_frames), ToMs(window_.max_cpu_ns));
+  if (window_.num_gpu_frames && length < (int32_t)sizeof(str)) {
+    length += snprintf(str + length, sizeof(str) - length,
+                       ", gpu %.2f max %.2f ms",
+                       ToMs(window_.gpu_ns / window_.num_gpu_frames),
+                       ToMs(window_.max_gpu_ns));
+  }
+  for (size_t i = 0; i < counters_.size() && length < (int32_t)sizeof(str);
+       ++i) {
+    length += snprintf(str + length, sizeof(str) - length, ", %s: %lld",
+                       counters_[i].first.c_str(),
+                       static_cast<long long>(counters_[i].second));
+  }
+  LOGI("%s", str);
+}
+
+bool PerfMonitor::Export(const char *file_name) {
+  FILE *file = fopen(file_name, "w");
+  if (!file) {
+    LOGI("Failed to open %s for frame statistics", file_name);
+    return false;
+  }
+
+  const FrameStats &s = total_;
+  int64_t num_frames = std::max(s.num_frames, static_cast<int64_t>(1));
+  fprintf(file, "{\n");
+  fprintf(file, "  \"frames\": %lld,\n", static_cast<long long>(s.num_frames));
+  fprintf(file, "  \"fps\": %.2f,\n",
+          s.total_ns ? s.num_frames * static_cast<double>(NS_PER_SEC) /
+                           s.total_ns
+                     : 0.0);
+  fprintf(file, "  \"frame_ms\": {\"mean\": %.3f, \"p50\": %.3f, "
+                "\"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+          ToMs(s.total_ns / num_frames), ToMs(s.Percentile(0.5)),
+          ToMs(s.Percentile(0.9)), ToMs(s.Percentile(0.99)), ToMs(s.max_ns));
+  fprintf(file, "  \"cpu_ms\": {\"mean\": %.3f, \"max\": %.3f},\n",
+          ToMs(s.cpu_ns / num_frames), ToMs(s.max_cpu_ns));
+  if (s.num_gpu_frames) {
+    // The larger of the CPU and GPU time per frame limits the frame rate
+    int64_t gpu_mean = s.gpu_ns / s.num_gpu_frames;
+    fprintf(file, "  \"gpu_ms\": {\"mean\": %.3f, \"max\": %.3f, "
+                  "\"frames\": %lld},\n",
+            ToMs(gpu_mean), ToMs(s.max_gpu_ns),
+            static_cast<long long>(s.num_gpu_frames));
+    fprintf(file, "  \"bound\": \"%s\",\n",
+            gpu_mean > s.cpu_ns / num_frames ? "gpu" : "cpu");
+  }
+  fprintf(file, "  \"janks\": %lld,\n", static_cast<long long>(s.num_janks));
+  fprintf(file, "  \"jank_threshold_ms\": %.3f,\n", ToMs(jank_threshold_ns_));
+
+  // Non empty buckets as [lower bound in ms, frames]
+  fprintf(file, "  \"histogram\": [");
+  bool first = true;
+  for (int32_t i = 0; i <= NUM_HISTOGRAM_BUCKETS; ++i) {
+    if (!s.histogram[i]) continue;
+    fprintf(file, "%s[%.2f, %u]", first ? "" : ", ",
+            ToMs(i * HISTOGRAM_BUCKET_NS), s.histogram[i]);
+    first = false;
+  }
+  fprintf(file, "]\n}\n");
+
+  bool result = !ferror(file);
+  fclose(file);
+  LOGI("Frame statistics written to %s", file_name);
+  return result;
+}
+
 } //namespace ndkHelper
@@ -30,6 +30,7 @@
  */
 #include "gl3stub.h"    //GLES3 stubs
 #include "GLContext.h"  //EGL & OpenGL manager
+#include "gpuTimer.h"   //GPU timer queries
 #include "shader.h"     //Shader compiler support
 #include "vecmath.h"  //Vector math support, C++ implementation n current version
 #include "tapCamera.h"        //Tap/Pinch camera control
@@ -37,4 +38,9 @@
 #include "gestureDetector.h"  //Tap/Doubletap/Pinch detector
 #include "perfMonitor.h"      //FPS counter
 #include "interpolator.h"     //Interpolator
+#include "textureLoader.h"    //Asynchronous texture loader
+#include "jobSystem.h"        //Parallel loops on a worker pool
+#include "meshOptimizer.h"    //Mesh simplification, cache ordering
+#include "streamingBuffer.h"  //Per frame buffer regions guarded by fences
+#include "benchmark.h"        //Render benchmark scenarios
 #endif
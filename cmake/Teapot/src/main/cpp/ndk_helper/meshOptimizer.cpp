@@ -0,0 +1,467 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "meshOptimizer.h"
+
+namespace ndk_helper {
+
+namespace mesh {
+
+namespace {
+
+//--------------------------------------------------------------------------------
+// Quadric of the squared distance to a set of planes, weighted by area
+//--------------------------------------------------------------------------------
+struct Quadric {
+  // Upper triangle of the symmetric 4x4 matrix
+  double a00, a01, a02, a03;
+  double a11, a12, a13;
+  double a22, a23;
+  double a33;
+  double weight;
+
+  void Clear() {
+    a00 = a01 = a02 = a03 = a11 = a12 = a13 = a22 = a23 = a33 = weight = 0.0;
+  }
+
+  void AddPlane(const double a, const double b, const double c,
+                const double d, const double w) {
+    a00 += w * a * a;
+    a01 += w * a * b;
+    a02 += w * a * c;
+    a03 += w * a * d;
+    a11 += w * b * b;
+    a12 += w * b * c;
+    a13 += w * b * d;
+    a22 += w * c * c;
+    a23 += w * c * d;
+    a33 += w * d * d;
+    weight += w;
+  }
+
+  void Add(const Quadric &q) {
+    a00 += q.a00;
+    a01 += q.a01;
+    a02 += q.a02;
+    a03 += q.a03;
+    a11 += q.a11;
+    a12 += q.a12;
+    a13 += q.a13;
+    a22 += q.a22;
+    a23 += q.a23;
+    a33 += q.a33;
+    weight += q.weight;
+  }
+
+  double Evaluate(const float *p) const {
+    double x = p[0];
+    double y = p[1];
+    double z = p[2];
+    double e = a00 * x * x + a11 * y * y + a22 * z * z + a33 +
+               2.0 * (a01 * x * y + a02 * x * z + a12 * y * z + a03 * x +
+                      a13 * y + a23 * z);
+    return std::max(e, 0.0);
+  }
+};
+
+struct Collapse {
+  uint32_t from;
+  uint32_t to;
+  double error;
+  bool operator<(const Collapse &rhs) const { return error < rhs.error; }
+};
+
+inline void Cross(const float *a, const float *b, const float *c, float *n) {
+  float e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  float e1[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+  n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+  n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+}
+
+/*
+ * Map each vertex to the lowest index of the vertices at its position
+ */
+void WeldPositions(const float *positions, const int32_t num_vertices,
+                   const int32_t stride, std::vector<uint32_t> *remap) {
+  std::vector<uint32_t> order(num_vertices);
+  for (int32_t i = 0; i < num_vertices; ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    const float *pa = positions + a * stride;
+    const float *pb = positions + b * stride;
+    if (pa[0] != pb[0]) return pa[0] < pb[0];
+    if (pa[1] != pb[1]) return pa[1] < pb[1];
+    if (pa[2] != pb[2]) return pa[2] < pb[2];
+    return a < b;
+  });
+
+  remap->resize(num_vertices);
+  uint32_t first = 0;
+  for (int32_t i = 0; i < num_vertices; ++i) {
+    const float *p = positions + order[i] * stride;
+    const float *q = positions + order[first] * stride;
+    if (p[0] != q[0] || p[1] != q[1] || p[2] != q[2]) first = i;
+    (*remap)[order[i]] = order[first];
+  }
+}
+
+}  // namespace
+
+//--------------------------------------------------------------------------------
+// Simplify
+//--------------------------------------------------------------------------------
+float Simplify(const float *positions, const int32_t num_vertices,
+               const int32_t stride, const uint16_t *indices,
+               const int32_t num_indices, const int32_t target_num_indices,
+               std::vector<uint16_t> *result) {
+  std::vector<uint32_t> remap;
+  WeldPositions(positions, num_vertices, stride, &remap);
+
+  // Triangles on the welded vertices, without degenerate ones
+  std::vector<uint32_t> triangles;
+  triangles.reserve(num_indices);
+  for (int32_t i = 0; i + 2 < num_indices; i += 3) {
+    uint32_t a = remap[indices[i]];
+    uint32_t b = remap[indices[i + 1]];
+    uint32_t c = remap[indices[i + 2]];
+    if (a == b || b == c || c == a) continue;
+    triangles.push_back(a);
+    triangles.push_back(b);
+    triangles.push_back(c);
+  }
+
+  // Quadrics of the planes around each vertex
+  std::vector<Quadric> quadrics(num_vertices);
+  for (int32_t i = 0; i < num_vertices; ++i) quadrics[i].Clear();
+  for (size_t i = 0; i < triangles.size(); i += 3) {
+    const float *p0 = positions + triangles[i] * stride;
+    float n[3];
+    Cross(p0, positions + triangles[i + 1] * stride,
+          positions + triangles[i + 2] * stride, n);
+    double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0.0) continue;
+
+    double a = n[0] / length;
+    double b = n[1] / length;
+    double c = n[2] / length;
+    double d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+    for (int32_t j = 0; j < 3; ++j)
+      quadrics[triangles[i + j]].AddPlane(a, b, c, d, length * 0.5);
+  }
+
+  // Vertices on edges used by a single triangle are locked
+  std::vector<uint8_t> locked(num_vertices, 0);
+  {
+    std::vector<uint64_t> edges;
+    edges.reserve(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i += 3) {
+      for (int32_t j = 0; j < 3; ++j) {
+        uint64_t a = triangles[i + j];
+        uint64_t b = triangles[i + (j + 1) % 3];
+        edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();) {
+      size_t j = i + 1;
+      while (j < edges.size() && edges[j] == edges[i]) ++j;
+      if (j - i == 1) {
+        locked[edges[i] >> 32] = 1;
+        locked[edges[i] & 0xffffffff] = 1;
+      }
+      i = j;
+    }
+  }
+
+  std::vector<uint32_t> adjacency_first(num_vertices + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<Collapse> collapses;
+  std::vector<uint8_t> touched(num_vertices);
+  std::vector<uint32_t> target(num_vertices);
+  double max_error = 0.0;
+
+  // Collapse in passes of independent edges, cheapest first
+  while (static_cast<int32_t>(triangles.size()) > target_num_indices) {
+    const uint32_t num_triangles = triangles.size() / 3;
+
+    // Triangles around each vertex
+    std::fill(adjacency_first.begin(), adjacency_first.end(), 0);
+    for (size_t i = 0; i < triangles.size(); ++i)
+      adjacency_first[triangles[i] + 1]++;
+    for (int32_t i = 0; i < num_vertices; ++i)
+      adjacency_first[i + 1] += adjacency_first[i];
+    adjacency.resize(triangles.size());
+    {
+      std::vector<uint32_t> offsets(adjacency_first.begin(),
+                                    adjacency_first.end() - 1);
+      for (uint32_t i = 0; i < triangles.size(); ++i)
+        adjacency[offsets[triangles[i]]++] = i / 3;
+    }
+
+    // Candidate collapses with the cheaper direction of each edge
+    collapses.clear();
+    for (size_t i = 0; i < triangles.size(); i += 3) {
+      for (int32_t j = 0; j < 3; ++j) {
+        uint32_t a = triangles[i + j];
+        uint32_t b = triangles[i + (j + 1) % 3];
+        if (a > b) continue;  // Seen from the neighbor triangle
+        if (locked[a] && locked[b]) continue;
+
+        Quadric q = quadrics[a];
+        q.Add(quadrics[b]);
+        double error_ab =
+            locked[a] ? HUGE_VAL : q.Evaluate(positions + b * stride);
+        double error_ba =
+            locked[b] ? HUGE_VAL : q.Evaluate(positions + a * stride);
+        Collapse c;
+        if (error_ab <= error_ba) {
+          c.from = a;
+          c.to = b;
+          c.error = error_ab;
+        } else {
+          c.from = b;
+          c.to = a;
+          c.error = error_ba;
+        }
+        c.error /= std::max(q.weight, 1e-12);
+        collapses.push_back(c);
+      }
+    }
+    std::sort(collapses.begin(), collapses.end());
+
+    // Each collapse removes two triangles on a closed surface
+    int32_t limit = (num_triangles - target_num_indices / 3 + 1) / 2;
+    int32_t num_collapsed = 0;
+    std::fill(touched.begin(), touched.end(), 0);
+    for (int32_t i = 0; i < num_vertices; ++i) target[i] = i;
+
+    for (size_t i = 0; i < collapses.size() && num_collapsed < limit; ++i) {
+      const Collapse &c = collapses[i];
+      if (touched[c.from] || touched[c.to]) continue;
+
+      // Reject collapses flipping a triangle around the removed vertex
+      bool flipped = false;
+      for (uint32_t k = adjacency_first[c.from];
+           k < adjacency_first[c.from + 1] && !flipped; ++k) {
+        const uint32_t *t = &triangles[adjacency[k] * 3];
+        if (t[0] == c.to || t[1] == c.to || t[2] == c.to) continue;
+
+        const float *p[3];
+        const float *q[3];
+        for (int32_t j = 0; j < 3; ++j) {
+          p[j] = positions + t[j] * stride;
+          q[j] = positions + (t[j] == c.from ? c.to : t[j]) * stride;
+        }
+        float n0[3];
+        float n1[3];
+        Cross(p[0], p[1], p[2], n0);
+        Cross(q[0], q[1], q[2], n1);
+        flipped = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.f;
+      }
+      if (flipped) continue;
+
+      // Keep the neighborhood fixed for the rest of the pass
+      for (uint32_t k = adjacency_first[c.from];
+           k < adjacency_first[c.from + 1]; ++k) {
+        const uint32_t *t = &triangles[adjacency[k] * 3];
+        touched[t[0]] = touched[t[1]] = touched[t[2]] = 1;
+      }
+
+      target[c.from] = c.to;
+      quadrics[c.to].Add(quadrics[c.from]);
+      max_error = std::max(max_error, c.error);
+      num_collapsed++;
+    }
+
+    if (!num_collapsed) break;
+
+    size_t size = 0;
+    for (size_t i = 0; i < triangles.size(); i += 3) {
+      uint32_t a = target[triangles[i]];
+      uint32_t b = target[triangles[i + 1]];
+      uint32_t c = target[triangles[i + 2]];
+      if (a == b || b == c || c == a) continue;
+      triangles[size++] = a;
+      triangles[size++] = b;
+      triangles[size++] = c;
+    }
+    triangles.resize(size);
+  }
+
+  result->assign(triangles.begin(), triangles.end());
+  return static_cast<float>(sqrt(max_error));
+}
+
+//--------------------------------------------------------------------------------
+// Vertex cache optimization
+//--------------------------------------------------------------------------------
+namespace {
+
+/*
+ * Next vertex to fan around when the candidates have no live triangles left:
+ *the most recent vertex on the dead end stack which still has some, then the
+ *next such vertex in index order
+ */
+int32_t SkipDeadEnd(const std::vector<int32_t> &live,
+                    std::vector<uint16_t> *dead_end, int32_t *cursor,
+                    const int32_t num_vertices) {
+  while (!dead_end->empty()) {
+    int32_t d = dead_end->back();
+    dead_end->pop_back();
+    if (live[d] > 0) return d;
+  }
+  while (*cursor < num_vertices) {
+    int32_t i = (*cursor)++;
+    if (live[i] > 0) return i;
+  }
+  return -1;
+}
+
+}  // namespace
+
+void OptimizeVertexCache(uint16_t *indices, const int32_t num_indices,
+                         const int32_t num_vertices, const int32_t cache_size) {
+  const int32_t num_triangles = num_indices / 3;
+  if (!num_triangles) return;
+
+  // Triangles around each vertex
+  std::vector<int32_t> adjacency_first(num_vertices + 1, 0);
+  for (int32_t i = 0; i < num_triangles * 3; ++i)
+    adjacency_first[indices[i] + 1]++;
+  for (int32_t i = 0; i < num_vertices; ++i)
+    adjacency_first[i + 1] += adjacency_first[i];
+  std::vector<int32_t> adjacency(num_triangles * 3);
+  {
+    std::vector<int32_t> offsets(adjacency_first.begin(),
+                                 adjacency_first.end() - 1);
+    for (int32_t i = 0; i < num_triangles * 3; ++i)
+      adjacency[offsets[indices[i]]++] = i / 3;
+  }
+
+  // Live triangles of each vertex and the time it entered the cache
+  std::vector<int32_t> live(num_vertices);
+  for (int32_t i = 0; i < num_vertices; ++i)
+    live[i] = adjacency_first[i + 1] - adjacency_first[i];
+  std::vector<int32_t> cache_time(num_vertices, 0);
+  std::vector<uint8_t> emitted(num_triangles, 0);
+  std::vector<uint16_t> dead_end;
+  std::vector<uint16_t> candidates;
+  std::vector<uint16_t> result;
+  result.reserve(num_triangles * 3);
+
+  int32_t time = cache_size + 1;
+  int32_t cursor = 0;
+  int32_t fan = 0;
+  while (fan >= 0) {
+    // Emit the remaining triangles around the fanning vertex
+    candidates.clear();
+    for (int32_t k = adjacency_first[fan]; k < adjacency_first[fan + 1]; ++k) {
+      int32_t t = adjacency[k];
+      if (emitted[t]) continue;
+      for (int32_t j = 0; j < 3; ++j) {
+        uint16_t v = indices[t * 3 + j];
+        result.push_back(v);
+        dead_end.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cache_time[v] > cache_size) cache_time[v] = time++;
+      }
+      emitted[t] = 1;
+    }
+
+    // Prefer the oldest candidate which stays in the cache while its
+    // remaining triangles are emitted
+    fan = -1;
+    int32_t best = -1;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      uint16_t v = candidates[i];
+      if (live[v] <= 0) continue;
+      int32_t priority = 0;
+      if (time - cache_time[v] + 2 * live[v] <= cache_size)
+        priority = time - cache_time[v];
+      if (priority > best) {
+        best = priority;
+        fan = v;
+      }
+    }
+    if (fan < 0) fan = SkipDeadEnd(live, &dead_end, &cursor, num_vertices);
+  }
+
+  // A list already in a cache friendly order, such as the full teapot, can
+  // come out no better or slightly worse, it is kept then
+  float acmr_before, acmr_after, atvr;
+  AnalyzeVertexCache(indices, result.size(), num_vertices, cache_size,
+                     &acmr_before, &atvr);
+  AnalyzeVertexCache(&result[0], result.size(), num_vertices, cache_size,
+                     &acmr_after, &atvr);
+  if (acmr_after < acmr_before)
+    std::copy(result.begin(), result.end(), indices);
+}
+
+//--------------------------------------------------------------------------------
+// Vertex fetch optimization
+//--------------------------------------------------------------------------------
+int32_t OptimizeVertexFetch(uint16_t *indices, const int32_t num_indices,
+                            const int32_t num_vertices,
+                            std::vector<uint16_t> *remap) {
+  const uint16_t unused = 0xffff;
+  remap->assign(num_vertices, unused);
+
+  int32_t next = 0;
+  for (int32_t i = 0; i < num_indices; ++i) {
+    uint16_t &index = (*remap)[indices[i]];
+    if (index == unused) index = next++;
+    indices[i] = index;
+  }
+  const int32_t num_used = next;
+
+  for (int32_t i = 0; i < num_vertices; ++i) {
+    if ((*remap)[i] == unused) (*remap)[i] = next++;
+  }
+  return num_used;
+}
+
+//--------------------------------------------------------------------------------
+// Vertex cache analysis
+//--------------------------------------------------------------------------------
+void AnalyzeVertexCache(const uint16_t *indices, const int32_t num_indices,
+                        const int32_t num_vertices, const int32_t cache_size,
+                        float *acmr, float *atvr) {
+  // Time each vertex entered the FIFO, a vertex is cached while fewer than
+  // cache_size others entered after it
+  std::vector<int32_t> cache_time(num_vertices, -cache_size - 1);
+  std::vector<uint8_t> used(num_vertices, 0);
+  int32_t misses = 0;
+  int32_t num_used = 0;
+  for (int32_t i = 0; i < num_indices; ++i) {
+    uint16_t v = indices[i];
+    if (misses - cache_time[v] > cache_size) cache_time[v] = misses++;
+    if (!used[v]) {
+      used[v] = 1;
+      num_used++;
+    }
+  }
+
+  *acmr = num_indices ? misses * 3.f / num_indices : 0.f;
+  *atvr = num_used ? static_cast<float>(misses) / num_used : 0.f;
+}
+
+}  // namespace mesh
+
+}  // namespace ndkHelper
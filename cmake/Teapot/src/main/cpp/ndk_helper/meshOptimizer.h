@@ -0,0 +1,122 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MESHOPTIMIZER_H_
+#define MESHOPTIMIZER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace ndk_helper {
+
+namespace mesh {
+
+/******************************************************************
+ * Triangle mesh processing helper
+ * namespace: ndkHelper::mesh
+ *
+ * Functions work on indexed triangle lists with 16 bit indices and take
+ *vertex positions as 3 floats, stride floats apart.
+ *
+ * A typical preparation of a mesh is OptimizeVertexCache() followed by
+ *OptimizeVertexFetch(), whose remap table is then used to reorder the vertex
+ *data.
+ */
+
+/******************************************************************
+ * Simplify()
+ * Reduce the number of triangles with edge collapses driven by quadric error
+ *metrics. Vertices are collapsed onto existing vertices, so the result
+ *indexes the same vertex buffer and levels of detail can share it.
+ *
+ * Vertices at the same position are handled as one vertex and the result
+ *references the lowest index of them. Vertices on open borders are kept.
+ *
+ * arguments:
+ *  in: positions, vertex positions
+ *  in: num_vertices, number of vertices
+ *  in: stride, distance between positions in floats
+ *  in: indices, triangle list
+ *  in: num_indices, number of indices
+ *  in: target_num_indices, number of indices to reduce to
+ *  out: result, simplified triangle list. It can be larger than the target
+ *when the mesh can't be reduced further.
+ * return: largest distance of a collapse from the original surface
+ *
+ */
+float Simplify(const float *positions, const int32_t num_vertices,
+               const int32_t stride, const uint16_t *indices,
+               const int32_t num_indices, const int32_t target_num_indices,
+               std::vector<uint16_t> *result);
+
+/******************************************************************
+ * OptimizeVertexCache()
+ * Reorder triangles for the post transform vertex cache (Tipsify, Sander et
+ *al. 2007). Triangles are emitted as fans around vertices picked to stay in a
+ *FIFO cache of cache_size entries. The order is kept when the reordered list
+ *doesn't have a lower ACMR, see AnalyzeVertexCache().
+ *
+ * arguments:
+ *  in/out: indices, triangle list
+ *  in: num_indices, number of indices
+ *  in: num_vertices, number of vertices
+ *  in: cache_size, number of vertices the cache is optimized for
+ *
+ */
+void OptimizeVertexCache(uint16_t *indices, const int32_t num_indices,
+                         const int32_t num_vertices, const int32_t cache_size);
+
+/******************************************************************
+ * OptimizeVertexFetch()
+ * Number vertices in the order the triangle list first uses them, so that
+ *vertex fetches walk the vertex buffer linearly. Indices are rewritten to the
+ *new numbering. Unused vertices are kept at the end.
+ *
+ * arguments:
+ *  in/out: indices, triangle list
+ *  in: num_indices, number of indices
+ *  in: num_vertices, number of vertices
+ *  out: remap, new index of each vertex
+ * return: number of vertices used by the triangle list
+ *
+ */
+int32_t OptimizeVertexFetch(uint16_t *indices, const int32_t num_indices,
+                            const int32_t num_vertices,
+                            std::vector<uint16_t> *remap);
+
+/******************************************************************
+ * AnalyzeVertexCache()
+ * Simulate a FIFO post transform vertex cache
+ *
+ * arguments:
+ *  in: indices, triangle list
+ *  in: num_indices, number of indices
+ *  in: num_vertices, number of vertices
+ *  in: cache_size, number of cache entries
+ *  out: acmr, average cache miss ratio, transformed vertices per triangle
+ *  out: atvr, average transform to vertex ratio, transformed vertices per
+ *used vertex
+ *
+ */
+void AnalyzeVertexCache(const uint16_t *indices, const int32_t num_indices,
+                        const int32_t num_vertices, const int32_t cache_size,
+                        float *acmr, float *atvr);
+
+}  // namespace mesh
+
+}  // namespace ndkHelper
+#endif /* MESHOPTIMIZER_H_ */
@@ -16,57 +16,173 @@
 
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mutex>
 
 #include "shader.h"
 #include "JNIHelper.h"
+#include "GLContext.h"
+#include "gl3stub.h"
 
 namespace ndk_helper {
 
 #define DEBUG (1)
+// Define to dump patched shader sources to the log
+// #define DEBUG_SHADER_SOURCE (1)
 
 bool shader::CompileShader(
     GLuint *shader, const GLenum type, const char *str_file_name,
     const std::map<std::string, std::string> &map_parameters) {
-  std::vector<uint8_t> data;
-  if (!JNIHelper::GetInstance()->ReadFile(str_file_name, &data)) {
-    LOGI("Can not open a file:%s", str_file_name);
+  std::string str;
+  if (!shader::LoadShaderSource(str_file_name, map_parameters, &str))
     return false;
+
+  return shader::CompileShader(shader, type, str.c_str(), str.size());
+}
+
+//--------------------------------------------------------------------------------
+// Shader templates
+//--------------------------------------------------------------------------------
+namespace {
+/*
+ * A shader source tokenized into literal text and %NAME% placeholders once, so
+ *that expanding it with a parameter set is a single pass over the segments.
+ */
+class ShaderTemplate {
+  struct Segment {
+    size_t offset;
+    size_t length;
+    std::string name;  // Placeholder including the '%'s, empty for literals
+  };
+  std::string source_;
+  std::vector<Segment> segments_;
+  // Expanded sources keyed by serialized parameter sets
+  std::map<std::string, std::string> expanded_;
+
+  void AddSegment(const size_t offset, const size_t length, bool placeholder) {
+    if (length == 0) return;
+    Segment segment;
+    segment.offset = offset;
+    segment.length = length;
+    if (placeholder) segment.name.assign(source_, offset, length);
+    segments_.push_back(segment);
   }
 
-  const char REPLACEMENT_TAG = '*';
-  // Fill-in parameters
-  std::string str(data.begin(), data.end());
-  std::string str_replacement_map(data.size(), ' ');
+  static bool IsNameChar(const char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+           (c >= '0' && c <= '9') || c == '_';
+  }
 
-  std::map<std::string, std::string>::const_iterator it =
-      map_parameters.begin();
-  std::map<std::string, std::string>::const_iterator itEnd =
-      map_parameters.end();
-  while (it != itEnd) {
-    size_t pos = 0;
-    while ((pos = str.find(it->first, pos)) != std::string::npos) {
-      // Check if the sub string is already touched
+ public:
+  void Tokenize(const uint8_t *data, const size_t size) {
+    source_.assign(data, data + size);
+    segments_.clear();
+    expanded_.clear();
 
-      size_t replaced_pos = str_replacement_map.find(REPLACEMENT_TAG, pos);
-      if (replaced_pos == std::string::npos || replaced_pos > pos) {
+    size_t literal = 0;
+    size_t pos = source_.find('%');
+    while (pos != std::string::npos) {
+      size_t end = source_.find('%', pos + 1);
+      if (end == std::string::npos) break;
 
-        str.replace(pos, it->first.length(), it->second);
-        str_replacement_map.replace(pos, it->first.length(), it->first.length(),
-                                    REPLACEMENT_TAG);
-        pos += it->second.length();
+      size_t i = pos + 1;
+      while (i < end && IsNameChar(source_[i])) i++;
+      if (i == end && end > pos + 1) {
+        AddSegment(literal, pos - literal, false);
+        AddSegment(pos, end + 1 - pos, true);
+        literal = end + 1;
+        pos = source_.find('%', literal);
       } else {
-        // The replacement target has been touched by other tag, skipping them
-        pos += it->second.length();
+        // Not a placeholder, the closing '%' may open the next one
+        pos = end;
+      }
+    }
+    AddSegment(literal, source_.size() - literal, false);
+  }
+
+  const std::string &Expand(
+      const std::map<std::string, std::string> &map_parameters) {
+    std::string key;
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = map_parameters.begin(); it != map_parameters.end(); ++it) {
+      key.append(it->first).push_back('\0');
+      key.append(it->second).push_back('\0');
+    }
+
+    std::map<std::string, std::string>::iterator cached = expanded_.find(key);
+    if (cached != expanded_.end()) return cached->second;
+
+    // Resolve placeholders and size the output before writing it
+    std::vector<const std::string *> values(segments_.size(), NULL);
+    size_t size = 0;
+    for (size_t i = 0; i < segments_.size(); ++i) {
+      const Segment &segment = segments_[i];
+      if (!segment.name.empty()) {
+        it = map_parameters.find(segment.name);
+        if (it != map_parameters.end()) values[i] = &it->second;
       }
+      size += values[i] ? values[i]->size() : segment.length;
+    }
+
+    std::string &str = expanded_[key];
+    str.reserve(size);
+    for (size_t i = 0; i < segments_.size(); ++i) {
+      if (values[i])
+        str.append(*values[i]);
+      else
+        str.append(source_, segments_[i].offset, segments_[i].length);
     }
-    it++;
+    return str;
   }
+};
 
-  LOGI("Patched Shdader:\n%s", str.c_str());
+std::mutex template_mutex;
+std::map<std::string, ShaderTemplate> templates;
+}  // namespace
 
-  std::vector<uint8_t> v(str.begin(), str.end());
-  str.clear();
-  return shader::CompileShader(shader, type, v);
+bool shader::LoadShaderSource(
+    const char *str_file_name,
+    const std::map<std::string, std::string> &map_parameters,
+    std::string *source) {
+  std::lock_guard<std::mutex> lock(template_mutex);
+  std::map<std::string, ShaderTemplate>::iterator it =
+      templates.find(str_file_name);
+  if (it == templates.end()) {
+    AssetView view;
+    if (!view.Open(str_file_name)) {
+      LOGI("Can not open a file:%s", str_file_name);
+      return false;
+    }
+    it = templates.insert(std::make_pair(std::string(str_file_name),
+                                         ShaderTemplate())).first;
+    it->second.Tokenize(view.Data(), view.Size());
+  }
+
+  *source = it->second.Expand(map_parameters);
+
+#if defined(DEBUG_SHADER_SOURCE)
+  LOGI("Patched Shader:\n%s", source->c_str());
+#endif
+  return true;
+}
+
+void shader::ClearSourceCache() {
+  std::lock_guard<std::mutex> lock(template_mutex);
+  templates.clear();
+}
+
+bool shader::LoadShaderSource(const char *str_file_name, std::string *source) {
+  AssetView view;
+  if (!view.Open(str_file_name)) {
+    LOGI("Can not open a file:%s", str_file_name);
+    return false;
+  }
+
+  source->assign(view.Data(), view.Data() + view.Size());
+  return true;
 }
 
 bool shader::CompileShader(GLuint *shader, const GLenum type,
@@ -111,14 +227,170 @@ bool shader::CompileShader(GLuint *shader, const GLenum type,
 
 bool shader::CompileShader(GLuint *shader, const GLenum type,
                            const char *strFileName) {
-  std::vector<uint8_t> data;
-  bool b = JNIHelper::GetInstance()->ReadFile(strFileName, &data);
-  if (!b) {
+  AssetView view;
+  if (!view.Open(strFileName)) {
     LOGI("Can not open a file:%s", strFileName);
     return false;
   }
 
-  return shader::CompileShader(shader, type, data);
+  return shader::CompileShader(shader, type,
+                               reinterpret_cast<const GLchar *>(view.Data()),
+                               view.Size());
+}
+
+//--------------------------------------------------------------------------------
+// Program binary cache
+//--------------------------------------------------------------------------------
+const uint32_t PROGRAM_BINARY_MAGIC = 0x4e495042;  // "BPIN"
+#define PROGRAM_BINARY_CACHE_DIR "/program_cache"
+
+struct PROGRAM_BINARY_HEADER {
+  uint32_t magic;
+  uint32_t format;
+  uint32_t length;
+  uint32_t reserved;
+  uint64_t key;
+};
+
+struct PROGRAM_BINARY_API {
+  PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+  PFNGLPROGRAMBINARYOESPROC program_binary;
+};
+
+static bool GetProgramBinaryAPI(PROGRAM_BINARY_API *api) {
+  if (GLContext::GetInstance()->GetGLVersion() >= 3.0f) {
+    api->get_program_binary = glGetProgramBinary;
+    api->program_binary = glProgramBinary;
+  } else if (GLContext::GetInstance()->CheckExtension(
+                 "GL_OES_get_program_binary")) {
+    api->get_program_binary = (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress(
+        "glGetProgramBinaryOES");
+    api->program_binary =
+        (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+  } else {
+    return false;
+  }
+
+  // Some drivers expose the API without supporting any binary format
+  GLint num_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+  return num_formats > 0 && api->get_program_binary && api->program_binary;
+}
+
+static uint64_t HashString(uint64_t hash, const char *str, size_t size) {
+  // FNV-1a
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<uint8_t>(str[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  // Terminate each string so that concatenations do not collide
+  hash ^= 0xff;
+  hash *= 0x100000001b3ULL;
+  return hash;
+}
+
+static bool GetProgramBinaryPath(const std::vector<std::string> &sources,
+                                 uint64_t *key, std::string *path) {
+  const char *dir = JNIHelper::GetInstance()->GetInternalFilesDir();
+  if (dir == NULL) return false;
+
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const GLenum driver_strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+  for (size_t i = 0; i < sizeof(driver_strings) / sizeof(driver_strings[0]);
+       ++i) {
+    const char *str = (const char *)glGetString(driver_strings[i]);
+    if (str) hash = HashString(hash, str, strlen(str));
+  }
+  for (size_t i = 0; i < sources.size(); ++i)
+    hash = HashString(hash, sources[i].c_str(), sources[i].size());
+
+  char file_name[32];
+  snprintf(file_name, sizeof(file_name), "/%016llx.bin",
+           static_cast<unsigned long long>(hash));
+  *key = hash;
+  *path = std::string(dir) + PROGRAM_BINARY_CACHE_DIR + file_name;
+  return true;
+}
+
+bool shader::LoadProgramBinary(const GLuint prog,
+                               const std::vector<std::string> &sources) {
+  PROGRAM_BINARY_API api;
+  uint64_t key;
+  std::string path;
+  if (!GetProgramBinaryAPI(&api) || !GetProgramBinaryPath(sources, &key, &path))
+    return false;
+
+  // Let the driver know the binary is retrieved after linking from sources
+  if (glProgramParameteri)
+    glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == NULL) return false;
+
+  PROGRAM_BINARY_HEADER header;
+  std::vector<uint8_t> binary;
+  bool b = fread(&header, sizeof(header), 1, fp) == 1 &&
+           header.magic == PROGRAM_BINARY_MAGIC && header.key == key &&
+           header.length > 0;
+  if (b) {
+    binary.resize(header.length);
+    b = fread(&binary[0], header.length, 1, fp) == 1;
+  }
+  fclose(fp);
+
+  if (b) {
+    api.program_binary(prog, header.format, &binary[0], header.length);
+    GLint status = 0;
+    glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    b = status != 0;
+  }
+
+  if (!b) {
+    // Driver rejected the binary (e.g. driver update), rebuild it from sources
+    LOGI("Discarding program binary:%s", path.c_str());
+    unlink(path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool shader::SaveProgramBinary(const GLuint prog,
+                               const std::vector<std::string> &sources) {
+  PROGRAM_BINARY_API api;
+  uint64_t key;
+  std::string path;
+  if (!GetProgramBinaryAPI(&api) || !GetProgramBinaryPath(sources, &key, &path))
+    return false;
+
+  GLint length = 0;
+  glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+  if (length <= 0) return false;
+
+  PROGRAM_BINARY_HEADER header = {PROGRAM_BINARY_MAGIC, 0, 0, 0, key};
+  std::vector<uint8_t> binary(length);
+  GLenum format = 0;
+  api.get_program_binary(prog, length, &length, &format, &binary[0]);
+  if (length <= 0) return false;
+  header.format = format;
+  header.length = length;
+
+  std::string dir = JNIHelper::GetInstance()->GetInternalFilesDir();
+  mkdir((dir + PROGRAM_BINARY_CACHE_DIR).c_str(), 0700);
+
+  // Write to a temporary file first so that a partial file is never read
+  std::string temp_path = path + ".tmp";
+  FILE *fp = fopen(temp_path.c_str(), "wb");
+  if (fp == NULL) return false;
+  bool b = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+           fwrite(&binary[0], length, 1, fp) == 1;
+  b = fclose(fp) == 0 && b;
+  if (!b || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  return true;
 }
 
 bool shader::LinkProgram(const GLuint prog) {
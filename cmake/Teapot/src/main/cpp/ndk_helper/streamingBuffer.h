@@ -0,0 +1,114 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STREAMINGBUFFER_H_
+#define STREAMINGBUFFER_H_
+
+#include <vector>
+
+#include "gl3stub.h"
+
+namespace ndk_helper {
+
+/******************************************************************
+ * Streaming buffer
+ * A GL buffer object split into one region per frame in flight, for data
+ *rewritten every frame.
+ *
+ * Each frame maps the next region with GL_MAP_UNSYNCHRONIZED_BIT, so the
+ *driver doesn't wait for draws still reading the buffer. Instead, a fence
+ *inserted after the draws of a region is waited on before the region is
+ *reused, which only blocks when the CPU runs more than num_frames frames ahead
+ *of the GPU.
+ *
+ * Usage per frame: Map(), write, Unmap(), draw with GetOffset(), EndFrame().
+ *
+ * Requires OpenGL ES 3.0
+ */
+class StreamingBuffer {
+ private:
+  GLenum target_;
+  GLuint buffer_;
+  GLsizeiptr region_size_;
+  int32_t num_regions_;
+  int32_t region_;
+  std::vector<GLsync> fences_;
+  int32_t num_stalls_;
+
+  StreamingBuffer(const StreamingBuffer& rhs);
+  StreamingBuffer& operator=(const StreamingBuffer& rhs);
+
+ public:
+  StreamingBuffer();
+  ~StreamingBuffer();
+
+  /*
+   * Create the buffer object
+   *
+   * arguments:
+   * in: target, buffer binding target, i.e. GL_ARRAY_BUFFER/GL_UNIFORM_BUFFER
+   * in: size, bytes written per frame
+   * in: num_frames, number of frames the CPU can run ahead of the GPU
+   * return: true if the buffer was created
+   */
+  bool Init(const GLenum target, const GLsizeiptr size,
+            const int32_t num_frames);
+
+  /*
+   * Delete the buffer object and pending fences
+   */
+  void Terminate();
+
+  /*
+   * Map the region of the current frame for writing. The buffer is left bound
+   *to the target.
+   *
+   * arguments:
+   * in: size, bytes to map from the start of the region, at most the size
+   *passed to Init()
+   * return: pointer to the region, NULL on failure
+   */
+  void* Map(const GLsizeiptr size);
+
+  /*
+   * Unmap the region mapped by Map()
+   */
+  void Unmap();
+
+  /*
+   * Insert the fence guarding the region of the current frame and move to the
+   *next region. Call after the draws reading the region have been issued.
+   */
+  void EndFrame();
+
+  /*
+   * return: buffer object name
+   */
+  GLuint GetBuffer() const { return buffer_; }
+
+  /*
+   * return: byte offset of the region of the current frame
+   */
+  GLintptr GetOffset() const { return region_ * region_size_; }
+
+  /*
+   * return: number of times Map() had to wait for the GPU
+   */
+  int32_t GetNumStalls() const { return num_stalls_; }
+};
+
+}  // namespace ndkHelper
+#endif /* STREAMINGBUFFER_H_ */
@@ -0,0 +1,408 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "textureLoader.h"
+#include "gl3stub.h"
+#include "GLContext.h"
+#include "perfMonitor.h"
+
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR 0x93B0
+#endif
+
+namespace ndk_helper {
+
+//--------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------
+enum TEXTURE_STATE {
+  TEXTURE_STATE_LOADING,
+  TEXTURE_STATE_READY,
+  TEXTURE_STATE_FAILED,
+};
+
+const uint8_t KTX_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31,
+                                    0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+const uint32_t KTX_ENDIANNESS = 0x04030201;
+const int32_t KTX_HEADER_SIZE = 64;
+
+const uint8_t ASTC_MAGIC[4] = {0x13, 0xAB, 0xA1, 0x5C};
+const int32_t ASTC_HEADER_SIZE = 16;
+const int32_t ASTC_BLOCK_SIZE = 16;
+
+// ASTC block footprints in the order of GL_COMPRESSED_RGBA_ASTC_*_KHR enums
+const uint8_t ASTC_FOOTPRINTS[][2] = {{4, 4},   {5, 4},   {5, 5},  {6, 5},
+                                      {6, 6},   {8, 5},   {8, 6},  {8, 8},
+                                      {10, 5},  {10, 6},  {10, 8}, {10, 10},
+                                      {12, 10}, {12, 12}};
+
+//--------------------------------------------------------------------------------
+// Texture job
+//--------------------------------------------------------------------------------
+struct TextureLevel {
+  const uint8_t* data;
+  int32_t size;
+  int32_t width;
+  int32_t height;
+};
+
+struct TextureJob {
+  int32_t handle;
+  std::string file_name;
+  GLuint texture;  // 0 to create one
+  bool succeeded;
+
+  // Image from a container, levels point into the asset mapping
+  AssetView asset;
+  GLenum internal_format;
+  bool compressed;
+  std::vector<TextureLevel> levels;
+
+  // Image decoded by BitmapFactory
+  std::vector<uint8_t> pixels;
+};
+
+static uint32_t ReadU32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static bool ParseKTX(TextureJob* job) {
+  const uint8_t* data = job->asset.Data();
+  size_t size = job->asset.Size();
+  if (ReadU32(data + 12) != KTX_ENDIANNESS) {
+    LOGI("Big endian KTX is not supported:%s", job->file_name.c_str());
+    return false;
+  }
+
+  uint32_t gl_type = ReadU32(data + 16);
+  uint32_t gl_format = ReadU32(data + 24);
+  uint32_t gl_internal_format = ReadU32(data + 28);
+  int32_t width = ReadU32(data + 36);
+  int32_t height = ReadU32(data + 40);
+  uint32_t depth = ReadU32(data + 44);
+  uint32_t array_elements = ReadU32(data + 48);
+  uint32_t faces = ReadU32(data + 52);
+  uint32_t num_levels = std::max(ReadU32(data + 56), 1u);
+  uint32_t key_value_bytes = ReadU32(data + 60);
+
+  if (depth > 1 || array_elements > 0 || faces != 1) {
+    LOGI("Only 2D KTX textures are supported:%s", job->file_name.c_str());
+    return false;
+  }
+
+  // A full chain ends at 1x1, floor(log2(max(width, height))) + 1 levels
+  if (width <= 0 || height <= 0) {
+    LOGI("Invalid KTX size %dx%d:%s", width, height, job->file_name.c_str());
+    return false;
+  }
+  uint32_t max_levels = 1;
+  while ((std::max(width, height) >> max_levels) > 0) ++max_levels;
+  if (num_levels > max_levels) {
+    LOGI("Too many KTX levels %u:%s", num_levels, job->file_name.c_str());
+    return false;
+  }
+
+  if (gl_type == 0) {
+    job->compressed = true;
+    job->internal_format = gl_internal_format;
+  } else if (gl_type == GL_UNSIGNED_BYTE && gl_format == GL_RGBA) {
+    job->compressed = false;
+    job->internal_format = GL_RGBA;
+  } else {
+    LOGI("Unsupported KTX format %x:%s", gl_internal_format,
+         job->file_name.c_str());
+    return false;
+  }
+
+  if (key_value_bytes > size - KTX_HEADER_SIZE) return false;
+  size_t offset = KTX_HEADER_SIZE + key_value_bytes;
+  for (uint32_t i = 0; i < num_levels; ++i) {
+    if (size - offset < 4) return false;
+    uint32_t image_size = ReadU32(data + offset);
+    offset += 4;
+    if (image_size > size - offset) return false;
+
+    int32_t level_width = std::max(width >> i, 1);
+    int32_t level_height = std::max(height >> i, 1);
+    // glTexImage2D reads the whole level whatever imageSize says
+    if (!job->compressed &&
+        image_size < static_cast<uint64_t>(level_width) * level_height * 4) {
+      LOGI("KTX level %u is too small:%s", i, job->file_name.c_str());
+      return false;
+    }
+    TextureLevel level = {data + offset, static_cast<int32_t>(image_size),
+                          level_width, level_height};
+    job->levels.push_back(level);
+    offset += image_size;
+    offset += std::min<size_t>(3 - ((image_size + 3) & 3), size - offset);
+  }
+  return true;
+}
+
+static bool ParseASTC(TextureJob* job) {
+  const uint8_t* data = job->asset.Data();
+  size_t size = job->asset.Size();
+  int32_t block_x = data[4];
+  int32_t block_y = data[5];
+  int32_t block_z = data[6];
+  int32_t width = data[7] | (data[8] << 8) | (data[9] << 16);
+  int32_t height = data[10] | (data[11] << 8) | (data[12] << 16);
+
+  job->internal_format = 0;
+  const int32_t num_footprints =
+      sizeof(ASTC_FOOTPRINTS) / sizeof(ASTC_FOOTPRINTS[0]);
+  for (int32_t i = 0; i < num_footprints; ++i) {
+    if (ASTC_FOOTPRINTS[i][0] == block_x && ASTC_FOOTPRINTS[i][1] == block_y)
+      job->internal_format = GL_COMPRESSED_RGBA_ASTC_4x4_KHR + i;
+  }
+  if (job->internal_format == 0 || block_z != 1) {
+    LOGI("Unsupported ASTC block %dx%dx%d:%s", block_x, block_y, block_z,
+         job->file_name.c_str());
+    return false;
+  }
+
+  int32_t image_size = ((width + block_x - 1) / block_x) *
+                       ((height + block_y - 1) / block_y) * ASTC_BLOCK_SIZE;
+  if (ASTC_HEADER_SIZE + image_size > static_cast<int32_t>(size)) return false;
+
+  job->compressed = true;
+  TextureLevel level = {data + ASTC_HEADER_SIZE, image_size, width, height};
+  job->levels.push_back(level);
+  return true;
+}
+
+static void DecodeJob(TextureJob* job) {
+  if (!job->asset.Open(job->file_name.c_str())) {
+    LOGI("Can not open a file:%s", job->file_name.c_str());
+    job->succeeded = false;
+    return;
+  }
+
+  const uint8_t* data = job->asset.Data();
+  size_t size = job->asset.Size();
+  if (size >= KTX_HEADER_SIZE &&
+      !memcmp(data, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER))) {
+    job->succeeded = ParseKTX(job);
+  } else if (size >= ASTC_HEADER_SIZE &&
+             !memcmp(data, ASTC_MAGIC, sizeof(ASTC_MAGIC))) {
+    job->succeeded = ParseASTC(job);
+  } else {
+    // Not a container, let BitmapFactory decode it
+    job->asset.Close();
+    int32_t width, height;
+    job->succeeded = JNIHelper::GetInstance()->DecodeImage(
+        job->file_name.c_str(), true, &job->pixels, &width, &height);
+    if (job->succeeded) {
+      job->compressed = false;
+      job->internal_format = GL_RGBA;
+      TextureLevel level = {&job->pixels[0],
+                            static_cast<int32_t>(job->pixels.size()), width,
+                            height};
+      job->levels.push_back(level);
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------
+// Ctor
+//--------------------------------------------------------------------------------
+TextureLoader::TextureLoader()
+    : num_pending_(0), formats_queried_(false), quit_(false) {}
+
+//--------------------------------------------------------------------------------
+// Dtor
+//--------------------------------------------------------------------------------
+TextureLoader::~TextureLoader() { Terminate(); }
+
+void TextureLoader::Init(const int32_t num_workers) {
+  quit_ = false;
+  for (int32_t i = 0; i < num_workers; ++i)
+    workers_.push_back(std::thread(&TextureLoader::WorkerThread, this));
+}
+
+void TextureLoader::Terminate() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  condition_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i) workers_[i].join();
+  workers_.clear();
+
+  // Jobs left behind are dropped
+  while (!decode_queue_.empty()) {
+    states_[decode_queue_.front()->handle] = TEXTURE_STATE_FAILED;
+    delete decode_queue_.front();
+    decode_queue_.pop_front();
+  }
+  while (!upload_queue_.empty()) {
+    states_[upload_queue_.front()->handle] = TEXTURE_STATE_FAILED;
+    delete upload_queue_.front();
+    upload_queue_.pop_front();
+  }
+  num_pending_ = 0;
+}
+
+void TextureLoader::WorkerThread() {
+  while (true) {
+    TextureJob* job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock,
+                      [this] { return quit_ || !decode_queue_.empty(); });
+      if (quit_) return;
+      job = decode_queue_.front();
+      decode_queue_.pop_front();
+    }
+
+    DecodeJob(job);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    upload_queue_.push_back(job);
+  }
+}
+
+int32_t TextureLoader::Request(const char* file_name) {
+  return Request(file_name, 0);
+}
+
+int32_t TextureLoader::Request(const char* file_name, const GLuint texture) {
+  int32_t handle = textures_.size();
+  textures_.push_back(0);
+  states_.push_back(TEXTURE_STATE_LOADING);
+  num_pending_++;
+
+  TextureJob* job = new TextureJob();
+  job->handle = handle;
+  job->file_name = file_name;
+  job->texture = texture;
+  job->succeeded = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    decode_queue_.push_back(job);
+  }
+  condition_.notify_one();
+  return handle;
+}
+
+bool TextureLoader::Upload(const double budget) {
+  double start = PerfMonitor::GetCurrentTime();
+  while (num_pending_ > 0) {
+    TextureJob* job = NULL;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!upload_queue_.empty()) {
+        job = upload_queue_.front();
+        upload_queue_.pop_front();
+      }
+    }
+    if (job == NULL) break;
+
+    states_[job->handle] =
+        UploadJob(job) ? TEXTURE_STATE_READY : TEXTURE_STATE_FAILED;
+    num_pending_--;
+    delete job;
+
+    if (PerfMonitor::GetCurrentTime() - start >= budget) break;
+  }
+  return num_pending_ > 0;
+}
+
+bool TextureLoader::UploadJob(TextureJob* job) {
+  if (!job->succeeded) return false;
+  if (job->compressed && !IsFormatSupported(job->internal_format)) {
+    LOGI("Compressed format %x is not supported:%s", job->internal_format,
+         job->file_name.c_str());
+    return false;
+  }
+
+  GLuint tex = job->texture;
+  if (tex == 0) glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+
+  for (size_t i = 0; i < job->levels.size(); ++i) {
+    const TextureLevel& level = job->levels[i];
+    if (job->compressed) {
+      glCompressedTexImage2D(GL_TEXTURE_2D, i, job->internal_format,
+                             level.width, level.height, 0, level.size,
+                             level.data);
+    } else {
+      glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, level.width, level.height, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, level.data);
+    }
+  }
+
+  // A mipmap filter needs the chain down to 1x1, ES3 can clamp it to the
+  // levels there are
+  const TextureLevel& last = job->levels.back();
+  bool mip_complete = last.width == 1 && last.height == 1;
+  if (job->levels.size() > 1 && !mip_complete &&
+      GLContext::GetInstance()->GetGLVersion() >= 3.0f) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    job->levels.size() - 1);
+    mip_complete = true;
+  }
+
+  if (job->levels.size() > 1 && mip_complete) {
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_NEAREST);
+  } else if (!job->compressed) {
+    // Generate mipmap
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_NEAREST);
+    glGenerateMipmap(GL_TEXTURE_2D);
+  } else {
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  }
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  if (glGetError() != GL_NO_ERROR) {
+    LOGI("Texture upload failed %s", job->file_name.c_str());
+    if (job->texture == 0) glDeleteTextures(1, &tex);
+    return false;
+  }
+
+  textures_[job->handle] = tex;
+  return true;
+}
+
+bool TextureLoader::IsFormatSupported(const GLenum format) {
+  if (!formats_queried_) {
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &num_formats);
+    compressed_formats_.resize(num_formats);
+    if (num_formats > 0)
+      glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, &compressed_formats_[0]);
+    formats_queried_ = true;
+  }
+  return std::find(compressed_formats_.begin(), compressed_formats_.end(),
+                   static_cast<GLint>(format)) != compressed_formats_.end();
+}
+
+GLuint TextureLoader::GetTexture(const int32_t handle) {
+  if (handle < 0 || handle >= static_cast<int32_t>(textures_.size())) return 0;
+  return textures_[handle];
+}
+
+bool TextureLoader::IsFailed(const int32_t handle) {
+  if (handle < 0 || handle >= static_cast<int32_t>(states_.size())) return true;
+  return states_[handle] == TEXTURE_STATE_FAILED;
+}
+
+}  // namespace ndkHelper
@@ -25,6 +25,13 @@
 #define SCALEROT_ATTRIB 2
 #define OFFSET_ATTRIB 3
 
+// The transform buffer holds one region per frame in flight. A frame waits on
+// the fence of the frame that last used its region, then maps it without
+// synchronizing with the GPU.
+#define NUM_FRAMES 3
+#define TRANSFORM_BUF_SIZE (MAX_INSTANCES * 4*sizeof(float))
+#define FENCE_TIMEOUT_NS 100000000
+
 static const char VERTEX_SHADER[] =
     "#version 300 es\n"
     "layout(location = " STRV(POS_ATTRIB) ") in vec2 pos;\n"
@@ -66,6 +73,8 @@ private:
     GLuint mProgram;
     GLuint mVB[VB_COUNT];
     GLuint mVBState;
+    GLsync mFences[NUM_FRAMES];
+    unsigned int mFrame;
 };
 
 Renderer* createES3Renderer() {
@@ -80,10 +89,13 @@ Renderer* createES3Renderer() {
 RendererES3::RendererES3()
 :   mEglContext(eglGetCurrentContext()),
     mProgram(0),
-    mVBState(0)
+    mVBState(0),
+    mFrame(0)
 {
     for (int i = 0; i < VB_COUNT; i++)
         mVB[i] = 0;
+    for (int i = 0; i < NUM_FRAMES; i++)
+        mFences[i] = NULL;
 }
 
 bool RendererES3::init() {
@@ -95,7 +107,7 @@ bool RendererES3::init() {
     glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_INSTANCE]);
     glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD), &QUAD[0], GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_SCALEROT]);
-    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * 4*sizeof(float), NULL, GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, NUM_FRAMES * TRANSFORM_BUF_SIZE, NULL, GL_DYNAMIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_OFFSET]);
     glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * 2*sizeof(float), NULL, GL_STATIC_DRAW);
 
@@ -131,6 +143,10 @@ RendererES3::~RendererES3() {
      */
     if (eglGetCurrentContext() != mEglContext)
         return;
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        if (mFences[i])
+            glDeleteSync(mFences[i]);
+    }
     glDeleteVertexArrays(1, &mVBState);
     glDeleteBuffers(VB_COUNT, mVB);
     glDeleteProgram(mProgram);
@@ -148,10 +164,20 @@ void RendererES3::unmapOffsetBuf() {
 }
 
 float* RendererES3::mapTransformBuf() {
+    // Only blocks when the CPU is NUM_FRAMES frames ahead of the GPU
+    if (mFences[mFrame]) {
+        while (glClientWaitSync(mFences[mFrame], GL_SYNC_FLUSH_COMMANDS_BIT,
+                FENCE_TIMEOUT_NS) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(mFences[mFrame]);
+        mFences[mFrame] = NULL;
+    }
+
     glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_SCALEROT]);
     return (float*)glMapBufferRange(GL_ARRAY_BUFFER,
-            0, MAX_INSTANCES * 4*sizeof(float),
-            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            mFrame * TRANSFORM_BUF_SIZE, TRANSFORM_BUF_SIZE,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT);
 }
 
 void RendererES3::unmapTransformBuf() {
@@ -161,5 +187,13 @@ void RendererES3::unmapTransformBuf() {
 void RendererES3::draw(unsigned int numInstances) {
     glUseProgram(mProgram);
     glBindVertexArray(mVBState);
+
+    // Read the transforms from the region written this frame
+    glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_SCALEROT]);
+    glVertexAttribPointer(SCALEROT_ATTRIB, 4, GL_FLOAT, GL_FALSE, 4*sizeof(float),
+            (const GLvoid*)(mFrame * TRANSFORM_BUF_SIZE));
     glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, numInstances);
+
+    mFences[mFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    mFrame = (mFrame + 1) % NUM_FRAMES;
 }
@@ -23,6 +23,7 @@
 
 #include <assert.h>
 #include <jni.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 
@@ -39,6 +40,8 @@
 #include <android/asset_manager.h>
 #include <android/asset_manager_jni.h>
 
+#include "resampler.h"
+
 // pre-recorded sound clips, both are 8 kHz mono 16-bit signed little endian
 static const char hello[] =
 #include "hello_clip.h"
@@ -65,7 +68,6 @@ static SLMuteSoloItf bqPlayerMuteSolo;
 static SLVolumeItf bqPlayerVolume;
 static SLmilliHertz bqPlayerSampleRate = 0;
 static jint   bqPlayerBufSize = 0;
-static short *resampleBuf = NULL;
 // a mutext to guard against re-entrance to record & playback
 // as well as make recording and playing back to be mutually exclusive
 // this is to avoid crash at situations like:
@@ -111,6 +113,25 @@ static short *nextBuffer;
 static unsigned nextSize;
 static int nextCount;
 
+// A clip at another rate than the player's is converted while it plays, a
+// block at a time, into one of RESAMPLE_BLOCKS buffers the player takes turns
+// with. The blocks are as long as the device's buffers when it gave their size.
+#define RESAMPLE_BLOCKS 2
+#define DEFAULT_BLOCK_FRAMES 1024
+static jboolean resampling = JNI_FALSE;
+static Resampler *resampler = NULL;
+static SLuint32 resamplerSrcRate = 0;
+static short *resampleBuf = NULL;
+static unsigned resampleBlockFrames = 0;
+static unsigned nextBlock;
+static int blocksQueued;
+// the clip being converted, the next frame to convert, and the frames of
+// silence that flush the last frames out of the resampler
+static const short *clipData;
+static unsigned clipFrames;
+static unsigned clipPos;
+static int tailFrames;
+
 
 // synthesize a mono sawtooth wave and place it into a buffer (called automatically on load)
 __attribute__((constructor)) static void onDlOpen(void)
@@ -121,75 +142,86 @@ __attribute__((constructor)) static void onDlOpen(void)
     }
 }
 
-void releaseResampleBuf(void) {
-    if( 0 == bqPlayerSampleRate) {
-        /*
-         * we are not using fast path, so we were not creating buffers, nothing to do
-         */
-        return;
-    }
-
-    free(resampleBuf);
-    resampleBuf = NULL;
+// the sample rate of the buffer queue player, in milliHertz
+static SLuint32 playerSampleRate(void) {
+    return bqPlayerSampleRate ? bqPlayerSampleRate : SL_SAMPLINGRATE_8;
 }
 
 /*
- * Only support up-sampling
+ * Get ready to play a clip recorded at srcRate (milliHertz) at the player's rate, reusing the
+ * resampler and its buffers when they fit. JNI_FALSE if it can't be converted.
  */
-short* createResampledBuf(uint32_t idx, uint32_t srcRate, unsigned *size) {
-    short  *src = NULL;
-    short  *workBuf;
-    int    upSampleRate;
-    int32_t srcSampleCount = 0;
-
-    if(0 == bqPlayerSampleRate) {
-        return NULL;
+static jboolean startResampledClip(const short *clip, unsigned frames, SLuint32 srcRate) {
+    if (NULL == resampler || resamplerSrcRate != srcRate) {
+        resamplerDelete(resampler);
+        resampler = resamplerCreate(srcRate / 1000, playerSampleRate() / 1000);
+        resamplerSrcRate = resampler ? srcRate : 0;
+        if (NULL == resampler) {
+            return JNI_FALSE;
+        }
     }
-    if(bqPlayerSampleRate % srcRate) {
-        /*
-         * simple up-sampling, must be divisible
-         */
-        return NULL;
+    if (NULL == resampleBuf) {
+        resampleBlockFrames = bqPlayerBufSize > 0 ? bqPlayerBufSize : DEFAULT_BLOCK_FRAMES;
+        resampleBuf = (short*) malloc(RESAMPLE_BLOCKS * resampleBlockFrames * sizeof(short));
+        if (NULL == resampleBuf) {
+            return JNI_FALSE;
+        }
     }
-    upSampleRate = bqPlayerSampleRate / srcRate;
+    resamplerReset(resampler);
+    clipData = clip;
+    clipFrames = frames;
+    clipPos = 0;
+    tailFrames = resamplerLatency(resampler);
+    nextBlock = 0;
+    blocksQueued = 0;
+    return JNI_TRUE;
+}
 
-    switch (idx) {
-        case 0:
-            return NULL;
-        case 1: // HELLO_CLIP
-            srcSampleCount = sizeof(hello) >> 1;
-            src = (short*)hello;
-            break;
-        case 2: // ANDROID_CLIP
-            srcSampleCount = sizeof(android) >> 1;
-            src = (short*) android;
-            break;
-        case 3: // SAWTOOTH_CLIP
-            srcSampleCount = SAWTOOTH_FRAMES;
-            src = sawtoothBuffer;
-            break;
-        case 4: // captured frames
-            srcSampleCount = recorderSize / sizeof(short);
-            src =  recorderBuffer;
+/*
+ * Convert the next block of the clip, repeating it nextCount times, and enqueue it.
+ * JNI_FALSE once the clip is done.
+ */
+static jboolean enqueueResampledBlock(void) {
+    short *block = resampleBuf + nextBlock * resampleBlockFrames;
+    int produced = 0;
+    while (produced < (int)resampleBlockFrames) {
+        const short *in = NULL;
+        int frames = tailFrames;
+        if (clipPos < clipFrames) {
+            in = clipData + clipPos;
+            frames = clipFrames - clipPos;
+        } else if (nextCount > 1) {
+            // the repeats follow without a gap
+            --nextCount;
+            clipPos = 0;
+            continue;
+        }
+        // with no input left this still drains what the resampler holds
+        int converted = resamplerProcess(resampler, in, &frames, block + produced,
+                                         resampleBlockFrames - produced);
+        if (NULL != in) {
+            clipPos += frames;
+        } else {
+            tailFrames -= frames;
+        }
+        if (0 == converted && 0 == frames) {
             break;
-        default:
-            assert(0);
-            return NULL;
-    }
-
-    resampleBuf = (short*) malloc((srcSampleCount * upSampleRate) << 1);
-    if(resampleBuf == NULL) {
-        return resampleBuf;
-    }
-    workBuf = resampleBuf;
-    for(int sample=0; sample < srcSampleCount; sample++) {
-        for(int dup = 0; dup  < upSampleRate; dup++) {
-            *workBuf++ = src[sample];
         }
+        produced += converted;
+    }
+    if (0 == produced) {
+        return JNI_FALSE;
     }
 
-    *size = (srcSampleCount * upSampleRate) << 1;     // sample format is 16 bit
-    return resampleBuf;
+    SLresult result;
+    result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, block,
+                                             produced * sizeof(short));
+    if (SL_RESULT_SUCCESS != result) {
+        return JNI_FALSE;
+    }
+    nextBlock = (nextBlock + 1) % RESAMPLE_BLOCKS;
+    ++blocksQueued;
+    return JNI_TRUE;
 }
 
 // this callback handler is called every time a buffer finishes playing
@@ -197,6 +229,15 @@ void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 {
     assert(bq == bqPlayerBufferQueue);
     assert(NULL == context);
+    if (resampling) {
+        // the oldest block finished playing, convert the next one into it
+        --blocksQueued;
+        if (!enqueueResampledBlock() && 0 == blocksQueued) {
+            resampling = JNI_FALSE;
+            pthread_mutex_unlock(&audioEngineLock);
+        }
+        return;
+    }
     // for streaming playback, replace this test by logic to find and fill the next buffer
     if (--nextCount > 0 && NULL != nextBuffer && 0 != nextSize) {
         SLresult result;
@@ -209,7 +250,6 @@ void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
         }
         (void)result;
     } else {
-        releaseResampleBuf();
         pthread_mutex_unlock(&audioEngineLock);
     }
 }
@@ -630,52 +670,50 @@ jboolean Java_com_example_nativeaudio_NativeAudio_selectClip(JNIEnv* env, jclass
         // If we could not acquire audio engine lock, reject this request and client should re-try
         return JNI_FALSE;
     }
+    const short *clip = NULL;
+    unsigned size = 0;
+    SLuint32 clipRate = SL_SAMPLINGRATE_8;
     switch (which) {
     case 0:     // CLIP_NONE
-        nextBuffer = (short *) NULL;
-        nextSize = 0;
         break;
     case 1:     // CLIP_HELLO
-        nextBuffer = createResampledBuf(1, SL_SAMPLINGRATE_8, &nextSize);
-        if(!nextBuffer) {
-            nextBuffer = (short*)hello;
-            nextSize  = sizeof(hello);
-        }
+        clip = (const short*)hello;
+        size = sizeof(hello);
         break;
     case 2:     // CLIP_ANDROID
-        nextBuffer = createResampledBuf(2, SL_SAMPLINGRATE_8, &nextSize);
-        if(!nextBuffer) {
-            nextBuffer = (short*)android;
-            nextSize  = sizeof(android);
-        }
+        clip = (const short*)android;
+        size = sizeof(android);
         break;
     case 3:     // CLIP_SAWTOOTH
-        nextBuffer = createResampledBuf(3, SL_SAMPLINGRATE_8, &nextSize);
-        if(!nextBuffer) {
-            nextBuffer = (short*)sawtoothBuffer;
-            nextSize  = sizeof(sawtoothBuffer);
-        }
+        clip = sawtoothBuffer;
+        size = sizeof(sawtoothBuffer);
         break;
     case 4:     // CLIP_PLAYBACK
-        nextBuffer = createResampledBuf(4, SL_SAMPLINGRATE_16, &nextSize);
-        // we recorded at 16 kHz, but are playing buffers at 8 Khz, so do a primitive down-sample
-        if(!nextBuffer) {
-            unsigned i;
-            for (i = 0; i < recorderSize; i += 2 * sizeof(short)) {
-                recorderBuffer[i >> 2] = recorderBuffer[i >> 1];
-            }
-            recorderSize >>= 1;
-            nextBuffer = recorderBuffer;
-            nextSize = recorderSize;
-        }
+        // we recorded at 16 kHz
+        clip = recorderBuffer;
+        size = recorderSize;
+        clipRate = SL_SAMPLINGRATE_16;
         break;
     default:
-        nextBuffer = NULL;
-        nextSize = 0;
         break;
     }
+    nextBuffer = (short*)clip;
+    nextSize = size;
     nextCount = count;
-    if (nextSize > 0) {
+    // clips at another rate than the player's are converted while they play, or
+    // else played as they are
+    resampling = size > 0 && clipRate != playerSampleRate() &&
+                 startResampledClip(clip, size / sizeof(short), clipRate);
+    if (resampling) {
+        // start with all the blocks queued
+        while (blocksQueued < RESAMPLE_BLOCKS && enqueueResampledBlock()) {
+        }
+        if (0 == blocksQueued) {
+            resampling = JNI_FALSE;
+            pthread_mutex_unlock(&audioEngineLock);
+            return JNI_FALSE;
+        }
+    } else if (nextSize > 0) {
         // here we only enqueue one buffer because it is a long clip,
         // but for streaming playback we would typically enqueue at least 2 buffers to start
         SLresult result;
@@ -891,6 +929,13 @@ void Java_com_example_nativeaudio_NativeAudio_shutdown(JNIEnv* env, jclass clazz
         bqPlayerMuteSolo = NULL;
         bqPlayerVolume = NULL;
     }
+    // the player's callbacks are done, release the clip conversion
+    resampling = JNI_FALSE;
+    resamplerDelete(resampler);
+    resampler = NULL;
+    resamplerSrcRate = 0;
+    free(resampleBuf);
+    resampleBuf = NULL;
 
     // destroy file descriptor audio player object, and invalidate all associated interfaces
     if (fdPlayerObject != NULL) {
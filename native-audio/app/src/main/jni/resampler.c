@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "resampler.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// the ratio of the rates is reduced to L / M: the input is up-sampled by L,
+// filtered, and every M-th sample kept; only the kept ones are computed
+#define MAX_PHASES 1024
+
+// taps of each phase of the filter when up-sampling, 32 zero crossings;
+// down-sampling widens the filter by M / L
+#define UP_TAPS 64
+#define MAX_TAPS 512
+
+// a Kaiser window for about 80 dB of stop-band attenuation, with the cut-off
+// below the lower Nyquist frequency so that the stop-band starts at it
+#define KAISER_BETA 7.857
+#define PASS_BAND 0.92
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// input frames converted at once
+#define BLOCK_FRAMES 256
+
+struct Resampler {
+    int up;                 // L
+    int down;               // M
+    int taps;               // per phase, a multiple of 4
+    float* coefs;           // phase p at coefs[p * taps], reversed for the dot product
+    float* history;         // taps + BLOCK_FRAMES input frames
+    int fill;               // frames in history
+    int pos;                // first frame of the next output frame
+    int phase;
+};
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// zeroth order modified Bessel function of the first kind
+static double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    int k;
+    for (k = 1; k < 50 && term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static void designFilter(Resampler* r) {
+    const int length = r->up * r->taps;
+    // centered on an up-sampled frame, so that the output isn't late by half
+    // of one; coefficient 0 has no mirror and is left out
+    const double center = length / 2;
+    // in cycles per sample of the up-sampled signal
+    const double cutoff = PASS_BAND * 0.5 / (r->up > r->down ? r->up : r->down);
+    const double i0Beta = besselI0(KAISER_BETA);
+    int p, j;
+
+    for (p = 0; p < r->up; p++) {
+        float* phase = r->coefs + p * r->taps;
+        double sum = 0;
+        // output frame = sum(x[base - j] * h[j * L + p]), with x from pos = base - taps + 1
+        for (j = 0; j < r->taps; j++) {
+            const double t = j * r->up + p - center;
+            const double ratio = t / center;
+            const double window = fabs(ratio) < 1.0 ?
+                    besselI0(KAISER_BETA * sqrt(1.0 - ratio * ratio)) / i0Beta : 0.0;
+            const double x = 2 * cutoff * t;
+            const double sinc = fabs(x) < 1e-9 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            const double h = 2 * cutoff * sinc * window;
+            phase[r->taps - 1 - j] = (float) h;
+            sum += h;
+        }
+        // unity gain at DC for every phase, so a constant input stays constant
+        for (j = 0; j < r->taps; j++) {
+            phase[j] = (float) (phase[j] / sum);
+        }
+    }
+}
+
+Resampler* resamplerCreate(uint32_t srcRate, uint32_t dstRate) {
+    if (srcRate == 0 || dstRate == 0) {
+        return NULL;
+    }
+    const uint32_t divisor = gcd(srcRate, dstRate);
+    const uint32_t up = dstRate / divisor;
+    const uint32_t down = srcRate / divisor;
+    if (up > MAX_PHASES || down > MAX_PHASES * 16) {
+        return NULL;
+    }
+
+    Resampler* r = (Resampler*) calloc(1, sizeof(Resampler));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->up = up;
+    r->down = down;
+    r->taps = UP_TAPS;
+    if (down > up) {
+        r->taps = (int) ((UP_TAPS * (uint64_t) down / up + 3) & ~3);
+        if (r->taps > MAX_TAPS) {
+            r->taps = MAX_TAPS;
+        }
+    }
+    r->coefs = (float*) malloc(sizeof(float) * r->up * r->taps);
+    r->history = (float*) malloc(sizeof(float) * (r->taps + BLOCK_FRAMES));
+    if (r->coefs == NULL || r->history == NULL) {
+        resamplerDelete(r);
+        return NULL;
+    }
+    designFilter(r);
+    resamplerReset(r);
+    return r;
+}
+
+void resamplerDelete(Resampler* r) {
+    if (r != NULL) {
+        free(r->coefs);
+        free(r->history);
+        free(r);
+    }
+}
+
+void resamplerReset(Resampler* r) {
+    // start with silence so that the first output frame is centered on the
+    // first input frame
+    r->fill = r->taps / 2 - 1;
+    memset(r->history, 0, sizeof(float) * r->fill);
+    r->pos = 0;
+    r->phase = 0;
+}
+
+int resamplerLatency(const Resampler* r) {
+    return r->taps / 2;
+}
+
+// n is a multiple of 4
+static inline float dotProduct(const float* a, const float* b, int n) {
+    int i;
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (i = 0; i < n; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#elif defined(__SSE__)
+    __m128 acc = _mm_setzero_ps();
+    for (i = 0; i < n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#else
+    float sum = 0.0f;
+    for (i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+#endif
+}
+
+static inline short toShort(float v) {
+    v *= 32768.0f;
+    if (v >= 32767.0f) {
+        return 32767;
+    }
+    if (v <= -32768.0f) {
+        return -32768;
+    }
+    return (short) lrintf(v);
+}
+
+int resamplerProcess(Resampler* r, const short* in, int* inFrames, short* out, int outFrames) {
+    int consumed = 0;
+    int produced = 0;
+
+    for (;;) {
+        while (produced < outFrames && r->pos + r->taps <= r->fill) {
+            out[produced++] = toShort(dotProduct(r->history + r->pos,
+                                                 r->coefs + r->phase * r->taps, r->taps));
+            r->phase += r->down;
+            r->pos += r->phase / r->up;
+            r->phase %= r->up;
+        }
+        if (produced == outFrames || consumed == *inFrames) {
+            break;
+        }
+
+        // drop the frames no output needs anymore, when down-sampling the
+        // next output may even start past what has been read
+        const int drop = r->pos < r->fill ? r->pos : r->fill;
+        memmove(r->history, r->history + drop, sizeof(float) * (r->fill - drop));
+        r->fill -= drop;
+        r->pos -= drop;
+
+        int frames = r->taps + BLOCK_FRAMES - r->fill;
+        if (frames > *inFrames - consumed) {
+            frames = *inFrames - consumed;
+        }
+        float* dst = r->history + r->fill;
+        int i;
+        if (in != NULL) {
+            for (i = 0; i < frames; i++) {
+                dst[i] = in[consumed + i] * (1.0f / 32768.0f);
+            }
+        } else {
+            memset(dst, 0, sizeof(float) * frames);
+        }
+        r->fill += frames;
+        consumed += frames;
+    }
+
+    *inFrames = consumed;
+    return produced;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+/*
+ * Streaming sample rate converter for mono 16-bit audio, by any rational
+ * ratio of the two rates: a polyphase windowed-sinc filter, which also
+ * removes what the output rate can't represent when down-sampling.
+ * The caller converts in blocks of any size, the filter history is kept.
+ */
+typedef struct Resampler Resampler;
+
+// rates in Hz; NULL if out of memory or the ratio reduces to too many phases
+Resampler* resamplerCreate(uint32_t srcRate, uint32_t dstRate);
+void resamplerDelete(Resampler* resampler);
+
+// forget the history, to convert another clip
+void resamplerReset(Resampler* resampler);
+
+// input frames to feed after the end of a clip to flush its last output frames
+int resamplerLatency(const Resampler* resampler);
+
+/*
+ * Convert up to *inFrames from in, or as much silence if in is NULL, into at
+ * most outFrames of out. Sets *inFrames to the frames consumed and returns the
+ * frames produced; stops when out is full or all of the input is consumed.
+ */
+int resamplerProcess(Resampler* resampler, const short* in, int* inFrames,
+                     short* out, int outFrames);
+
+#endif  // RESAMPLER_H
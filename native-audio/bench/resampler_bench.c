@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Linux benchmark of the native-audio resampler, for the rate pairs the
+ * player converts clips between: the THD+N of sines converted across the
+ * pass band, how many times realtime a minute of audio converts in device
+ * sized blocks, and whether the output has as many frames as the ratio
+ * says and stays aligned with the input.
+ *
+ * Build and run on a Linux host from this directory:
+ *   gcc -std=c99 -O2 -I../app/src/main/jni resampler_bench.c
+ *       ../app/src/main/jni/resampler.c -lm -o resampler_bench
+ *   ./resampler_bench [block frames]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "resampler.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// the filter is designed for about 80 dB of stop-band attenuation
+#define MAX_THDN_DB (-80.0)
+// the sines are this long, and this many output frames at each end, where
+// the filter is still filling, are not measured
+#define SINE_SECONDS 2
+#define EDGE_FRAMES 200
+// the realtime factor is measured over this much audio
+#define BENCH_SECONDS 60
+
+static const struct {
+    uint32_t src;
+    uint32_t dst;
+} ratePairs[] = {
+    { 8000, 44100 },
+    { 8000, 48000 },
+    { 16000, 44100 },
+    { 16000, 48000 },
+    { 16000, 8000 },
+};
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Converts all of in and flushes the resampler, in blocks of block frames,
+ * the way the player does; returns the output frames. Once the silence is
+ * fed the resampler may still hold output frames, calls without input
+ * drain them.
+ */
+static int convert(Resampler* r, const short* in, int inFrames, short* out, int outFrames,
+                   int block) {
+    int pos = 0;
+    int total = 0;
+    int tail = resamplerLatency(r);
+    while (total < outFrames) {
+        int frames;
+        int converted;
+        const int room = outFrames - total < block ? outFrames - total : block;
+        if (pos < inFrames) {
+            frames = inFrames - pos < block ? inFrames - pos : block;
+            converted = resamplerProcess(r, in + pos, &frames, out + total, room);
+            pos += frames;
+        } else {
+            frames = tail;
+            converted = resamplerProcess(r, NULL, &frames, out + total, room);
+            tail -= frames;
+            if (converted == 0 && frames == 0) {
+                break;
+            }
+        }
+        total += converted;
+    }
+    return total;
+}
+
+/*
+ * THD+N in dB of n frames at rate that should hold a sine of freq: the sine
+ * is fitted by least squares, whatever it doesn't explain is distortion and
+ * noise.
+ */
+static double thdn(const short* y, int n, double freq, double rate) {
+    double ss = 0, cc = 0, sc = 0, ys = 0, yc = 0;
+    double error = 0, power = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        const double s = sin(2 * M_PI * freq * i / rate);
+        const double c = cos(2 * M_PI * freq * i / rate);
+        ss += s * s;
+        cc += c * c;
+        sc += s * c;
+        ys += y[i] * s;
+        yc += y[i] * c;
+    }
+    const double det = ss * cc - sc * sc;
+    const double a = (ys * cc - yc * sc) / det;
+    const double b = (yc * ss - ys * sc) / det;
+    for (i = 0; i < n; i++) {
+        const double fit = a * sin(2 * M_PI * freq * i / rate) + b * cos(2 * M_PI * freq * i / rate);
+        error += (y[i] - fit) * (y[i] - fit);
+        power += fit * fit;
+    }
+    return 10 * log10(error / power);
+}
+
+// returns whether the pair meets MAX_THDN_DB, has the right length and stays aligned
+static int benchPair(uint32_t src, uint32_t dst, int block) {
+    const int inFrames = src * SINE_SECONDS;
+    const int outCapacity = (int) ((int64_t) inFrames * dst / src) + 2 * block;
+    const double topFreq = 0.4 * (src < dst ? src : dst);
+    short* in = (short*) malloc(sizeof(short) * inFrames);
+    short* out = (short*) malloc(sizeof(short) * outCapacity);
+    Resampler* r = resamplerCreate(src, dst);
+    double worst = -200, worstFreq = 0;
+    double freq;
+    int frames = 0;
+    int i;
+
+    if (in == NULL || out == NULL || r == NULL) {
+        fprintf(stderr, "%u -> %u: out of memory\n", src, dst);
+        exit(2);
+    }
+
+    // sines at -6 dBFS across the pass band of the lower rate
+    for (freq = 100; freq < topFreq; freq *= 1.25) {
+        for (i = 0; i < inFrames; i++) {
+            in[i] = (short) lrint(16000 * sin(2 * M_PI * freq * i / src));
+        }
+        resamplerReset(r);
+        frames = convert(r, in, inFrames, out, outCapacity, block);
+        const double q = thdn(out + EDGE_FRAMES, frames - 2 * EDGE_FRAMES, freq, dst);
+        if (q > worst) {
+            worst = q;
+            worstFreq = freq;
+        }
+    }
+    const double expectedFrames = (double) inFrames * dst / src;
+
+    // an impulse in the middle comes out at the same time
+    for (i = 0; i < inFrames; i++) {
+        in[i] = 0;
+    }
+    in[inFrames / 2] = 20000;
+    resamplerReset(r);
+    const int impulseFrames = convert(r, in, inFrames, out, outCapacity, block);
+    int peak = 0;
+    for (i = 0; i < impulseFrames; i++) {
+        if (abs(out[i]) > abs(out[peak])) {
+            peak = i;
+        }
+    }
+    const double expectedPeak = (double) (inFrames / 2) * dst / src;
+    free(in);
+    free(out);
+
+    // a minute of a chord, in device sized blocks
+    const int benchFrames = src * BENCH_SECONDS;
+    const int benchCapacity = (int) ((int64_t) benchFrames * dst / src) + 2 * block;
+    in = (short*) malloc(sizeof(short) * benchFrames);
+    out = (short*) malloc(sizeof(short) * benchCapacity);
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "%u -> %u: out of memory\n", src, dst);
+        exit(2);
+    }
+    for (i = 0; i < benchFrames; i++) {
+        in[i] = (short) lrint(8000 * sin(2 * M_PI * 440.0 * i / src) +
+                              8000 * sin(2 * M_PI * 554.37 * i / src));
+    }
+    resamplerReset(r);
+    const double start = nowSeconds();
+    convert(r, in, benchFrames, out, benchCapacity, block);
+    const double seconds = nowSeconds() - start;
+    free(in);
+    free(out);
+    resamplerDelete(r);
+
+    const int lengthOk = fabs(frames - expectedFrames) < 1.0;
+    const int alignedOk = fabs(peak - expectedPeak) < 0.5;
+    printf("%5u -> %5u Hz: THD+N %6.1f dB (worst, at %4.0f Hz), %d frames (expected %.0f), "
+           "impulse at %d (expected %.1f), %6.0fx realtime\n",
+           src, dst, worst, worstFreq, frames, expectedFrames, peak, expectedPeak,
+           BENCH_SECONDS / seconds);
+    return worst <= MAX_THDN_DB && lengthOk && alignedOk;
+}
+
+int main(int argc, char** argv) {
+    // the buffer queue player's buffers are about 10 ms
+    const int block = argc > 1 ? atoi(argv[1]) : 240;
+    int ok = 1;
+    unsigned i;
+
+    if (block <= 0) {
+        fprintf(stderr, "usage: %s [block frames]\n", argv[0]);
+        return 2;
+    }
+    for (i = 0; i < sizeof(ratePairs) / sizeof(ratePairs[0]); i++) {
+        ok &= benchPair(ratePairs[i].src, ratePairs[i].dst, block);
+    }
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -17,8 +17,10 @@
 package com.example.nativecodec;
 
 import android.app.Activity;
+import android.content.res.AssetFileDescriptor;
 import android.content.res.AssetManager;
 import android.graphics.SurfaceTexture;
+import android.media.MediaMetadataRetriever;
 import android.os.Bundle;
 import android.util.Log;
 import android.view.Surface;
@@ -28,9 +30,11 @@ import android.view.View;
 import android.widget.AdapterView;
 import android.widget.ArrayAdapter;
 import android.widget.Button;
+import android.widget.CheckBox;
 import android.widget.CompoundButton;
 import android.widget.CompoundButton.OnCheckedChangeListener;
 import android.widget.RadioButton;
+import android.widget.SeekBar;
 import android.widget.Spinner;
 
 import java.io.IOException;
@@ -99,6 +103,8 @@ public class NativeCodec extends Activity {
             public void onItemSelected(AdapterView<?> parent, View view, int pos, long id) {
                 mSourceString = parent.getItemAtPosition(pos).toString();
                 Log.v(TAG, "onItemSelected " + mSourceString);
+                mSeekBar.setMax((int) getDurationMs(mSourceString));
+                mSeekBar.setProgress(0);
             }
 
             @Override
@@ -109,6 +115,63 @@ public class NativeCodec extends Activity {
 
         });
 
+        // native MediaPlayer seek: keyframes while dragging, the exact
+        // frame when let go
+        mSeekBar = (SeekBar) findViewById(R.id.seek_native);
+        mSeekBar.setOnSeekBarChangeListener(new SeekBar.OnSeekBarChangeListener() {
+
+            @Override
+            public void onProgressChanged(SeekBar seekBar, int progress, boolean fromUser) {
+                if (fromUser && mCreated) {
+                    seekStreamingMediaPlayer(progress, false);
+                }
+            }
+
+            @Override
+            public void onStartTrackingTouch(SeekBar seekBar) {
+            }
+
+            @Override
+            public void onStopTrackingTouch(SeekBar seekBar) {
+                if (mCreated) {
+                    seekStreamingMediaPlayer(seekBar.getProgress(), true);
+                }
+            }
+
+        });
+
+        // GL post-processing, from the next player created, and its color matrix
+        ((CheckBox) findViewById(R.id.postprocess_native)).setOnCheckedChangeListener(
+                new CompoundButton.OnCheckedChangeListener() {
+
+            @Override
+            public void onCheckedChanged(CompoundButton buttonView, boolean isChecked) {
+                setPostProcessingStreamingMediaPlayer(isChecked);
+                if (mCreated) {
+                    recreatePlayer();
+                }
+            }
+
+        });
+        Spinner colorSpinner = (Spinner) findViewById(R.id.color_spinner);
+        ArrayAdapter<CharSequence> colorAdapter = ArrayAdapter.createFromResource(
+                this, R.array.color_array, android.R.layout.simple_spinner_item);
+        colorAdapter.setDropDownViewResource(android.R.layout.simple_spinner_dropdown_item);
+        colorSpinner.setAdapter(colorAdapter);
+        colorSpinner.setOnItemSelectedListener(new AdapterView.OnItemSelectedListener() {
+
+            @Override
+            public void onItemSelected(AdapterView<?> parent, View view, int pos, long id) {
+                // the positions of color_array are the native color modes
+                setColorModeStreamingMediaPlayer(pos);
+            }
+
+            @Override
+            public void onNothingSelected(AdapterView parent) {
+            }
+
+        });
+
         mRadio1 = (RadioButton) findViewById(R.id.radio1);
         mRadio2 = (RadioButton) findViewById(R.id.radio2);
 
@@ -196,6 +259,7 @@ public class NativeCodec extends Activity {
             public void onClick(View view) {
                 if (mNativeCodecPlayerVideoSink != null) {
                     rewindStreamingMediaPlayer();
+                    mSeekBar.setProgress(0);
                 }
             }
 
@@ -205,16 +269,39 @@ public class NativeCodec extends Activity {
     void switchSurface() {
         if (mCreated && mNativeCodecPlayerVideoSink != mSelectedVideoSink) {
             // shutdown and recreate on other surface
-          Log.i("@@@", "shutting down player");
-            shutdown();
-            mCreated = false;
-            mSelectedVideoSink.useAsSinkForNative();
-            mNativeCodecPlayerVideoSink = mSelectedVideoSink;
-            if (mSourceString != null) {
-                Log.i("@@@", "recreating player");
-                mCreated = createStreamingMediaPlayer(getResources().getAssets(),mSourceString);
-                mIsPlaying = false;
-            }
+            recreatePlayer();
+        }
+    }
+
+    void recreatePlayer() {
+        Log.i("@@@", "shutting down player");
+        shutdown();
+        mCreated = false;
+        mSelectedVideoSink.useAsSinkForNative();
+        mNativeCodecPlayerVideoSink = mSelectedVideoSink;
+        if (mSourceString != null) {
+            Log.i("@@@", "recreating player");
+            mCreated = createStreamingMediaPlayer(getResources().getAssets(),mSourceString);
+            mIsPlaying = false;
+        }
+    }
+
+    // duration of an asset clip, for the range of the seek bar
+    long getDurationMs(String filename) {
+        MediaMetadataRetriever retriever = new MediaMetadataRetriever();
+        try {
+            AssetFileDescriptor afd = getResources().getAssets().openFd(filename);
+            retriever.setDataSource(afd.getFileDescriptor(), afd.getStartOffset(),
+                    afd.getLength());
+            afd.close();
+            String duration = retriever.extractMetadata(
+                    MediaMetadataRetriever.METADATA_KEY_DURATION);
+            return duration != null ? Long.parseLong(duration) : 0;
+        } catch (IOException | RuntimeException e) {
+            Log.w(TAG, "no duration for " + filename, e);
+            return 0;
+        } finally {
+            retriever.release();
         }
     }
 
@@ -251,6 +338,8 @@ public class NativeCodec extends Activity {
 
     private RadioButton mRadio2;
 
+    private SeekBar mSeekBar;
+
     /** Native methods, implemented in jni folder */
     public static native void createEngine();
     public static native boolean createStreamingMediaPlayer(AssetManager assetMgr, String filename);
@@ -258,6 +347,9 @@ public class NativeCodec extends Activity {
     public static native void shutdown();
     public static native void setSurface(Surface surface);
     public static native void rewindStreamingMediaPlayer();
+    public static native void seekStreamingMediaPlayer(long positionMs, boolean accurate);
+    public static native void setPostProcessingStreamingMediaPlayer(boolean enabled);
+    public static native void setColorModeStreamingMediaPlayer(int mode);
 
     /** Load jni .so on initialization */
     static {
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audiosink.h"
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+// for __android_log_print(ANDROID_LOG_INFO, "YourApp", "formatted message");
+#include <android/log.h>
+#define TAG "NativeCodec-audio"
+#define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+
+static int64_t systemnanotime() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+audiosink::audiosink(mediaclock *clock) :
+        clock(clock), bytespersecond(0), nextwrite(0), nextplayed(0),
+        queued(0), engineobject(NULL), engine(NULL), mixobject(NULL),
+        playerobject(NULL), player(NULL), queue(NULL) {
+}
+
+audiosink::~audiosink() {
+    close();
+}
+
+bool audiosink::open(int32_t samplerate, int32_t channels) {
+    close();
+    if (channels != 1 && channels != 2) {
+        LOGE("%d channels are not supported", channels);
+        return false;
+    }
+
+    SLresult result = slCreateEngine(&engineobject, 0, NULL, 0, NULL, NULL);
+    if (result != SL_RESULT_SUCCESS) {
+        LOGE("slCreateEngine failed: %u", result);
+        engineobject = NULL;
+        return false;
+    }
+    result = (*engineobject)->Realize(engineobject, SL_BOOLEAN_FALSE);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*engineobject)->GetInterface(engineobject, SL_IID_ENGINE, &engine);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*engine)->CreateOutputMix(engine, &mixobject, 0, NULL, NULL);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*mixobject)->Realize(mixobject, SL_BOOLEAN_FALSE);
+    assert(SL_RESULT_SUCCESS == result);
+
+    SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {
+        SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, kBuffers
+    };
+    // the sample rate is in milliHertz
+    SLDataFormat_PCM format_pcm = {SL_DATAFORMAT_PCM, (SLuint32)channels,
+        (SLuint32)samplerate * 1000,
+        SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16,
+        (SLuint32)(channels == 1 ? SL_SPEAKER_FRONT_CENTER :
+                   SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT),
+        SL_BYTEORDER_LITTLEENDIAN};
+    SLDataSource audioSrc = {&loc_bufq, &format_pcm};
+    SLDataLocator_OutputMix loc_outmix = {SL_DATALOCATOR_OUTPUTMIX, mixobject};
+    SLDataSink audioSnk = {&loc_outmix, NULL};
+
+    const SLInterfaceID ids[1] = {SL_IID_BUFFERQUEUE};
+    const SLboolean req[1] = {SL_BOOLEAN_TRUE};
+    result = (*engine)->CreateAudioPlayer(engine, &playerobject, &audioSrc,
+                                          &audioSnk, 1, ids, req);
+    if (result != SL_RESULT_SUCCESS) {
+        LOGE("no audio player for %d Hz, %d channels: %u", samplerate,
+             channels, result);
+        playerobject = NULL;
+        close();
+        return false;
+    }
+    result = (*playerobject)->Realize(playerobject, SL_BOOLEAN_FALSE);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*playerobject)->GetInterface(playerobject, SL_IID_PLAY, &player);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*playerobject)->GetInterface(playerobject, SL_IID_BUFFERQUEUE,
+                                           &queue);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*queue)->RegisterCallback(queue, callback, this);
+    assert(SL_RESULT_SUCCESS == result);
+    (void)result;
+
+    bytespersecond = samplerate * channels * 2;
+    nextwrite = nextplayed = queued = 0;
+    LOGV("audio sink open, %d Hz, %d channels", samplerate, channels);
+    return true;
+}
+
+void audiosink::close() {
+    // destroying the player waits for its callbacks to return
+    if (playerobject) {
+        (*playerobject)->Destroy(playerobject);
+        playerobject = NULL;
+        player = NULL;
+        queue = NULL;
+    }
+    if (mixobject) {
+        (*mixobject)->Destroy(mixobject);
+        mixobject = NULL;
+    }
+    if (engineobject) {
+        (*engineobject)->Destroy(engineobject);
+        engineobject = NULL;
+        engine = NULL;
+    }
+}
+
+bool audiosink::write(const void *pcm, size_t size, int64_t ptsus) {
+    if (!queue || size == 0) {
+        // nothing to play, the data is dropped
+        return true;
+    }
+    std::lock_guard<std::mutex> l(lock);
+    if (queued == kBuffers) {
+        return false;
+    }
+    buffer &b = buffers[nextwrite];
+    b.data.assign((const uint8_t*)pcm, (const uint8_t*)pcm + size);
+    b.endus = ptsus + (int64_t)size * 1000000 / bytespersecond;
+    SLresult result = (*queue)->Enqueue(queue, &b.data[0], size);
+    if (result != SL_RESULT_SUCCESS) {
+        LOGE("enqueue failed: %u", result);
+        return false;
+    }
+    nextwrite = (nextwrite + 1) % kBuffers;
+    queued++;
+    return true;
+}
+
+void audiosink::play() {
+    if (player) {
+        (*player)->SetPlayState(player, SL_PLAYSTATE_PLAYING);
+    }
+}
+
+void audiosink::pause() {
+    if (player) {
+        (*player)->SetPlayState(player, SL_PLAYSTATE_PAUSED);
+    }
+}
+
+void audiosink::flush() {
+    if (!queue) {
+        return;
+    }
+    std::lock_guard<std::mutex> l(lock);
+    (*queue)->Clear(queue);
+    nextwrite = nextplayed = queued = 0;
+}
+
+void audiosink::callback(SLAndroidSimpleBufferQueueItf bq, void *context) {
+    ((audiosink*)context)->played();
+}
+
+// OpenSL ES callback thread, a buffer has been played out
+void audiosink::played() {
+    int64_t endus;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (queued == 0) {
+            // cleared by a flush meanwhile
+            return;
+        }
+        endus = buffers[nextplayed].endus;
+        nextplayed = (nextplayed + 1) % kBuffers;
+        queued--;
+    }
+    clock->sync(endus, systemnanotime());
+}
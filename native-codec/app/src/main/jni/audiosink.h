@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIOSINK_H
+#define AUDIOSINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mutex>
+#include <vector>
+
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+
+#include "mediaclock.h"
+
+// 16 bit PCM output through an OpenSL ES buffer queue player. Each played
+// buffer reports its end position to the media clock, so the clock follows
+// the audio hardware.
+class audiosink {
+    public:
+        audiosink(mediaclock *clock);
+        audiosink& operator=(const audiosink& ) = delete;
+        audiosink(audiosink&) = delete;
+        ~audiosink();
+
+        bool open(int32_t samplerate, int32_t channels);
+        void close();
+        bool isopen() const { return playerobject != NULL; }
+
+        // copy PCM starting at media time ptsus into a free buffer, returns
+        // false if all buffers are queued
+        bool write(const void *pcm, size_t size, int64_t ptsus);
+
+        void play();
+        void pause();
+        // drop the queued buffers
+        void flush();
+
+    private:
+        static const int kBuffers = 4;
+
+        struct buffer {
+            std::vector<uint8_t> data;
+            int64_t endus;      // media time at the end of the buffer
+        };
+
+        static void callback(SLAndroidSimpleBufferQueueItf bq, void *context);
+        void played();
+
+        mediaclock *clock;
+        int32_t bytespersecond;
+        // the buffer ring is shared with the OpenSL ES callback thread
+        std::mutex lock;
+        buffer buffers[kBuffers];
+        int nextwrite;
+        int nextplayed;
+        int queued;
+
+        SLObjectItf engineobject;
+        SLEngineItf engine;
+        SLObjectItf mixobject;
+        SLObjectItf playerobject;
+        SLPlayItf player;
+        SLAndroidSimpleBufferQueueItf queue;
+};
+
+#endif // AUDIOSINK_H
@@ -17,8 +17,8 @@
 #include "looper.h"
 
 #include <assert.h>
-#include <jni.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -28,24 +28,44 @@
 #include <errno.h>
 #include <limits.h>
 #include <semaphore.h>
+#include <time.h>
 
+#include <algorithm>
+
+#ifdef __ANDROID__
 // for __android_log_print(ANDROID_LOG_INFO, "YourApp", "formatted message");
 #include <android/log.h>
 #define TAG "NativeCodec-looper"
 #define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#else
+// Host builds, e.g. the looper benchmark
+#define LOGV(...)
+#endif
 
 
 struct loopermessage;
 typedef struct loopermessage loopermessage;
 
+// Index of a message allocated on its own once the pool is full
+static const uint32_t kNotPooled = UINT32_MAX;
+
 struct loopermessage {
     int what;
     void *obj;
-    loopermessage *next;
+    std::atomic<loopermessage*> next;
     bool quit;
+    int64_t when;                     // for post_at, 0 if not timed
+    bool flush;                       // see looper::postmsg
+    uint32_t index;                   // in the pool
+    std::atomic<uint32_t> nextfree;   // index + 1 of the next free message
 };
 
 
+static int64_t nowns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 void* looper::trampoline(void* p) {
     ((looper*)p)->loop();
@@ -53,13 +73,26 @@ void* looper::trampoline(void* p) {
 }
 
 looper::looper() {
+    freelist.store(0);
+    for (int i = 0; i < kMaxBlocks; i++) {
+        blocks[i].store(NULL);
+    }
+    numblocks.store(0);
+    pthread_mutex_init(&growlock, NULL);
+    flushes.store(0);
+    generation = 0;
+
+    // The queue starts with a stub message, as if one had been taken
+    head = alloc();
+    head->next.store(NULL);
+    tail.store(head);
+
     sem_init(&headdataavailable, 0, 0);
-    sem_init(&headwriteprotect, 0, 1);
     pthread_attr_t attr;
     pthread_attr_init(&attr);
 
-    pthread_create(&worker, &attr, trampoline, this);
     running = true;
+    pthread_create(&worker, &attr, trampoline, this);
 }
 
 
@@ -68,85 +101,219 @@ looper::~looper() {
         LOGV("Looper deleted while still running. Some messages will not be processed");
         quit();
     }
+
+    // Messages still queued are only freed here if they aren't pooled
+    loopermessage *msg = head;
+    while (msg) {
+        loopermessage *next = msg->next.load();
+        if (msg->index == kNotPooled) {
+            delete msg;
+        }
+        msg = next;
+    }
+    for (int i = 0; i < numblocks.load(); i++) {
+        delete[] blocks[i].load();
+    }
+    pthread_mutex_destroy(&growlock);
+}
+
+loopermessage *looper::alloc() {
+    while (true) {
+        uint64_t free = freelist.load(std::memory_order_acquire);
+        while (uint32_t slot = free & 0xffffffff) {
+            slot--;
+            loopermessage *msg =
+                    blocks[slot / kBlockSize].load(std::memory_order_acquire) +
+                    slot % kBlockSize;
+            // The tag fails the exchange if msg was taken and freed again
+            // since free was read, so nextfree can't be stale
+            uint64_t next = (((free >> 32) + 1) << 32) |
+                    msg->nextfree.load(std::memory_order_relaxed);
+            if (freelist.compare_exchange_weak(free, next,
+                    std::memory_order_acquire, std::memory_order_acquire)) {
+                return msg;
+            }
+        }
+
+        // Out of messages, add a block unless another thread just did
+        pthread_mutex_lock(&growlock);
+        if (freelist.load(std::memory_order_acquire) & 0xffffffff) {
+            pthread_mutex_unlock(&growlock);
+            continue;
+        }
+        int n = numblocks.load(std::memory_order_relaxed);
+        if (n == kMaxBlocks) {
+            pthread_mutex_unlock(&growlock);
+            LOGV("message pool exhausted");
+            loopermessage *msg = new loopermessage();
+            msg->index = kNotPooled;
+            return msg;
+        }
+        loopermessage *block = new loopermessage[kBlockSize];
+        for (int i = 0; i < kBlockSize; i++) {
+            block[i].index = n * kBlockSize + i;
+        }
+        blocks[n].store(block, std::memory_order_release);
+        numblocks.store(n + 1, std::memory_order_release);
+        pthread_mutex_unlock(&growlock);
+
+        for (int i = 1; i < kBlockSize; i++) {
+            release(&block[i]);
+        }
+        return &block[0];
+    }
+}
+
+void looper::release(loopermessage *msg) {
+    if (msg->index == kNotPooled) {
+        delete msg;
+        return;
+    }
+    uint64_t free = freelist.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        msg->nextfree.store(free & 0xffffffff, std::memory_order_relaxed);
+        next = (((free >> 32) + 1) << 32) | (msg->index + 1);
+    } while (!freelist.compare_exchange_weak(free, next,
+            std::memory_order_release, std::memory_order_relaxed));
 }
 
 void looper::post(int what, void *data, bool flush) {
-    loopermessage *msg = new loopermessage();
+    postmsg(what, data, flush, 0);
+}
+
+void looper::post_at(int what, void *data, int64_t when_ns) {
+    postmsg(what, data, false, when_ns);
+}
+
+void looper::post_delayed(int what, void *data, int64_t delay_ns) {
+    postmsg(what, data, false, nowns(CLOCK_MONOTONIC) + delay_ns);
+}
+
+void looper::postmsg(int what, void *data, bool flush, int64_t when) {
+    loopermessage *msg = alloc();
     msg->what = what;
     msg->obj = data;
-    msg->next = NULL;
     msg->quit = false;
-    addmsg(msg, flush);
+    msg->when = when;
+    // Messages can't be taken out of the queue by other threads, so the
+    // looper drops the ones it takes while a flush is queued behind them.
+    // The queue order decides what is older than a flush, it is counted
+    // before it is linked so the looper never reaches it uncounted.
+    msg->flush = flush;
+    if (flush) {
+        flushes.fetch_add(1, std::memory_order_relaxed);
+    }
+    addmsg(msg);
 }
 
-void looper::addmsg(loopermessage *msg, bool flush) {
-    sem_wait(&headwriteprotect);
-    loopermessage *h = head;
+void looper::addmsg(loopermessage *msg) {
+    msg->next.store(NULL, std::memory_order_relaxed);
+    loopermessage *prev = tail.exchange(msg, std::memory_order_acq_rel);
+    // Until prev is linked the looper can't get past it, see nextmsg
+    prev->next.store(msg, std::memory_order_release);
+    LOGV("post msg %d", msg->what);
+    sem_post(&headdataavailable);
+}
 
-    if (flush) {
-        while(h) {
-            loopermessage *next = h->next;
-            delete h;
-            h = next;
-        }
-        h = NULL;
+loopermessage *looper::nextmsg() {
+    // The semaphore counted a posted message, but a post that came before
+    // it may not have linked its message yet
+    loopermessage *next;
+    while (!(next = head->next.load(std::memory_order_acquire))) {
+        sched_yield();
     }
-    if (h) {
-        while (h->next) {
-            h = h->next;
+    release(head);
+    head = next;
+    return next;
+}
+
+// Orders the timer heap by due time, earliest first
+bool looper::duelater(const timedmessage &a, const timedmessage &b) {
+    return a.when > b.when;
+}
+
+/*
+ * Wait for a posted message, handling timed messages as they become due
+ */
+void looper::waitmsg() {
+    while (!timers.empty()) {
+        int64_t now = nowns(CLOCK_MONOTONIC);
+        int64_t wait = timers.front().when - now;
+        if (wait <= 0) {
+            std::pop_heap(timers.begin(), timers.end(), duelater);
+            timedmessage t = timers.back();
+            timers.pop_back();
+            dispatch(t.what, t.obj, t.generation);
+            continue;
+        }
+
+        // sem_timedwait takes a CLOCK_REALTIME deadline. Waking early after
+        // a clock change is harmless, the timer is checked again above.
+        int64_t deadline = nowns(CLOCK_REALTIME) + wait;
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000000000;
+        ts.tv_nsec = deadline % 1000000000;
+        if (sem_timedwait(&headdataavailable, &ts) == 0) {
+            return;
         }
-        h->next = msg;
-    } else {
-        head = msg;
     }
-    LOGV("post msg %d", msg->what);
-    sem_post(&headwriteprotect);
-    sem_post(&headdataavailable);
+    while (sem_wait(&headdataavailable) != 0) {
+        // interrupted, wait again
+    }
+}
+
+void looper::dispatch(int what, void *data, uint32_t gen) {
+    if (gen != flushes.load(std::memory_order_relaxed)) {
+        LOGV("flushed msg %d", what);
+        return;
+    }
+    LOGV("processing msg %d", what);
+    handle(what, data);
 }
 
 void looper::loop() {
     while(true) {
         // wait for available message
-        sem_wait(&headdataavailable);
-
-        // get next available message
-        sem_wait(&headwriteprotect);
-        loopermessage *msg = head;
-        if (msg == NULL) {
-            LOGV("no msg");
-            sem_post(&headwriteprotect);
-            continue;
-        }
-        head = msg->next;
-        sem_post(&headwriteprotect);
+        waitmsg();
 
+        // get next available message, it stays valid until the next one
+        loopermessage *msg = nextmsg();
         if (msg->quit) {
             LOGV("quitting");
-            delete msg;
             return;
         }
-        LOGV("processing msg %d", msg->what);
-        handle(msg->what, msg->obj);
-        delete msg;
+        if (msg->flush) {
+            generation++;
+        }
+        if (msg->when > nowns(CLOCK_MONOTONIC)) {
+            timedmessage t = { msg->when, msg->what, msg->obj, generation };
+            timers.push_back(t);
+            std::push_heap(timers.begin(), timers.end(), duelater);
+            continue;
+        }
+        dispatch(msg->what, msg->obj, generation);
     }
 }
 
 void looper::quit() {
     LOGV("quit");
-    loopermessage *msg = new loopermessage();
+    loopermessage *msg = alloc();
     msg->what = 0;
     msg->obj = NULL;
-    msg->next = NULL;
     msg->quit = true;
-    addmsg(msg, false);
+    msg->when = 0;
+    msg->flush = false;
+    addmsg(msg);
     void *retval;
     pthread_join(worker, &retval);
     sem_destroy(&headdataavailable);
-    sem_destroy(&headwriteprotect);
     running = false;
 }
 
 void looper::handle(int what, void* obj) {
+    // LOGV is empty in the host build
+    (void) what;
+    (void) obj;
     LOGV("dropping msg %d %p", what, obj);
 }
-
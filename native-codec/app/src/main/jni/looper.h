@@ -14,8 +14,15 @@
  * limitations under the License.
  */
 
+#ifndef LOOPER_H
+#define LOOPER_H
+
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
 
 struct loopermessage;
 
@@ -27,17 +34,63 @@ class looper {
         virtual ~looper();
 
         void post(int what, void *data, bool flush = false);
+        // when_ns is a CLOCK_MONOTONIC time in nanoseconds. A flushing post
+        // also drops timed messages that are still waiting.
+        void post_at(int what, void *data, int64_t when_ns);
+        void post_delayed(int what, void *data, int64_t delay_ns);
         void quit();
 
         virtual void handle(int what, void *data);
 
     private:
-        void addmsg(loopermessage *msg, bool flush);
+        // Messages are pooled in blocks that live as long as the looper
+        static const int kBlockSize = 64;
+        static const int kMaxBlocks = 256;
+
+        struct timedmessage {
+            int64_t when;
+            int what;
+            void *obj;
+            uint32_t generation;
+        };
+
+        loopermessage *alloc();
+        void release(loopermessage *msg);
+        void postmsg(int what, void *data, bool flush, int64_t when);
+        void addmsg(loopermessage *msg);
+        loopermessage *nextmsg();
         static void* trampoline(void* p);
+        static bool duelater(const timedmessage &a, const timedmessage &b);
+        void waitmsg();
+        void dispatch(int what, void *data, uint32_t generation);
         void loop();
+
+        // Intrusive MPSC queue: posting threads append at tail, the looper
+        // thread takes from head. head is the last taken message, kept as
+        // the queue's stub until the next one is taken.
+        std::atomic<loopermessage*> tail;
         loopermessage *head;
+
+        // Free messages, ABA tag << 32 | (message index + 1)
+        std::atomic<uint64_t> freelist;
+        std::atomic<loopermessage*> blocks[kMaxBlocks];
+        std::atomic<int> numblocks;
+        pthread_mutex_t growlock;
+
+        // Flushing posts, counted before their message is linked
+        std::atomic<uint32_t> flushes;
+        // Flush messages the looper thread has taken from the queue. A
+        // message is dropped if a flush was posted after it, when flushes
+        // is past the generation it was taken in.
+        uint32_t generation;
+
+        // Timed messages taken from the queue before they are due, a min
+        // heap on when only used by the looper thread
+        std::vector<timedmessage> timers;
+
         pthread_t worker;
-        sem_t headwriteprotect;
         sem_t headdataavailable;
         bool running;
 };
+
+#endif // LOOPER_H
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mediaclock.h"
+
+#include <stdlib.h>
+
+// audio positions further off than this move the clock at once, closer ones
+// are corrected by 1 / kSlewDivisor of the error per report
+static const int64_t kSnapNs = 100000000;
+static const int64_t kSlewDivisor = 8;
+// frames rendered this late count as late, later ones are dropped
+static const int64_t kLateNs = 4000000;
+static const int64_t kDropNs = 50000000;
+
+mediaclock::mediaclock() {
+    reset();
+}
+
+void mediaclock::reset() {
+    std::lock_guard<std::mutex> l(lock);
+    isstarted = false;
+    paused = false;
+    anchormedia = 0;
+    anchorsystem = 0;
+    pausedmedia = 0;
+}
+
+bool mediaclock::started() {
+    std::lock_guard<std::mutex> l(lock);
+    return isstarted;
+}
+
+void mediaclock::start(int64_t mediaus, int64_t systemns) {
+    std::lock_guard<std::mutex> l(lock);
+    isstarted = true;
+    anchormedia = mediaus * 1000;
+    anchorsystem = systemns;
+    pausedmedia = anchormedia;
+}
+
+void mediaclock::sync(int64_t mediaus, int64_t systemns) {
+    std::lock_guard<std::mutex> l(lock);
+    if (paused) {
+        return;
+    }
+    int64_t media = mediaus * 1000;
+    int64_t error = media - (anchormedia + systemns - anchorsystem);
+    if (!isstarted || llabs(error) > kSnapNs) {
+        isstarted = true;
+        anchormedia = media;
+        anchorsystem = systemns;
+    } else {
+        // an earlier anchor runs the clock ahead
+        anchorsystem -= error / kSlewDivisor;
+    }
+}
+
+void mediaclock::pause(int64_t systemns) {
+    std::lock_guard<std::mutex> l(lock);
+    if (paused) {
+        return;
+    }
+    paused = true;
+    pausedmedia = anchormedia + systemns - anchorsystem;
+}
+
+void mediaclock::resume(int64_t systemns) {
+    std::lock_guard<std::mutex> l(lock);
+    if (!paused) {
+        return;
+    }
+    paused = false;
+    anchormedia = pausedmedia;
+    anchorsystem = systemns;
+}
+
+int64_t mediaclock::systemtime(int64_t mediaus) {
+    std::lock_guard<std::mutex> l(lock);
+    return anchorsystem + mediaus * 1000 - anchormedia;
+}
+
+frameaction scheduleframe(int64_t whenns, int64_t nowns, int64_t earlyns) {
+    if (whenns - nowns > earlyns) {
+        return kFrameWait;
+    }
+    if (nowns - whenns > kDropNs) {
+        return kFrameDrop;
+    }
+    return nowns - whenns > kLateNs ? kFrameLate : kFrameRender;
+}
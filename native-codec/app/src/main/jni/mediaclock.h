@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MEDIACLOCK_H
+#define MEDIACLOCK_H
+
+#include <stdint.h>
+
+#include <mutex>
+
+// Master clock of the player, mapping media time to CLOCK_MONOTONIC time.
+//
+// The clock runs at system rate from an anchor. When there is an audio
+// track, the audio sink reports its playback position with sync(), and the
+// clock is slewed towards it, so video follows the audio as it drifts.
+// Without audio the clock free-runs from the first video frame.
+class mediaclock {
+    public:
+        mediaclock();
+
+        // back to not started, e.g. after a seek
+        void reset();
+        bool started();
+
+        // media time mediaus is shown at system time systemns
+        void start(int64_t mediaus, int64_t systemns);
+
+        // audio position report: mediaus was played at systemns
+        void sync(int64_t mediaus, int64_t systemns);
+
+        void pause(int64_t systemns);
+        void resume(int64_t systemns);
+
+        // system time mediaus is due at, only valid once started
+        int64_t systemtime(int64_t mediaus);
+
+    private:
+        std::mutex lock;
+        bool isstarted;
+        bool paused;
+        int64_t anchormedia;    // in ns
+        int64_t anchorsystem;   // in ns
+        int64_t pausedmedia;    // media time the clock was paused at, in ns
+};
+
+// what the renderer does with a video frame due at system time whenns
+enum frameaction {
+    kFrameWait,     // due more than earlyns from nowns
+    kFrameRender,
+    kFrameLate,     // rendered, but more than kLateNs after its time
+    kFrameDrop,     // more than kDropNs late, not rendered
+};
+
+frameaction scheduleframe(int64_t whenns, int64_t nowns, int64_t earlyns);
+
+#endif // MEDIACLOCK_H
@@ -25,9 +25,11 @@
  */
 
 #include <assert.h>
+#include <dlfcn.h>
 #include <jni.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -35,7 +37,11 @@
 #include <errno.h>
 #include <limits.h>
 
+#include <atomic>
+
 #include "looper.h"
+#include "player.h"
+#include "texturesink.h"
 #include "media/NdkMediaCodec.h"
 #include "media/NdkMediaExtractor.h"
 
@@ -43,6 +49,7 @@
 #include <android/log.h>
 #define TAG "NativeCodec"
 #define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
 
 // for native window JNI
@@ -50,36 +57,61 @@
 #include <android/asset_manager.h>
 #include <android/asset_manager_jni.h>
 
-typedef struct {
-    int fd;
-    ANativeWindow* window;
-    AMediaExtractor* ex;
-    AMediaCodec *codec;
-    int64_t renderstart;
-    bool sawInputEOS;
-    bool sawOutputEOS;
-    bool isPlaying;
-    bool renderonce;
-} workerdata;
-
-workerdata data = {-1, NULL, NULL, NULL, 0, false, false, false, false};
+// images shared by the codec and the post-processing stage
+static const int32_t kFramePool = 4;
 
-enum {
-    kMsgCodecBuffer,
-    kMsgPause,
-    kMsgResume,
-    kMsgPauseAck,
-    kMsgDecodeDone,
-    kMsgSeek,
-};
+workerdata data = {NULL, NULL, NULL, false, false, false, false, -1, 0, 0};
 
+// With post-processing, the GL stage draws the frames the renderer released
+// to the window.
+class gllooper: public looper {
+    public:
+        gllooper() : lastlog(0) {}
 
+    private:
+        virtual void handle(int what, void* obj);
+        void logframes(workerdata *d, bool force);
 
-class mylooper: public looper {
-    virtual void handle(int what, void* obj);
+        int64_t lastlog;
 };
 
-static mylooper *mlooper = NULL;
+static gllooper *mgl = NULL;
+// for the next player created
+static bool postprocess = false;
+
+// Color matrices of the post-processing stage, 4x4 column major on RGBA,
+// by the mode of setColorModeStreamingMediaPlayer()
+enum {
+    kColorAsDecoded,
+    // many drivers sample YUV textures with BT.601 even for HD video, which
+    // is BT.709; this is the BT.601 to RGB conversion undone and the BT.709
+    // one applied
+    kColorBt709,
+    // BT.709 luma
+    kColorGray,
+    kColorModes,
+};
+static const float colormatrices[kColorModes][16] = {
+    {
+        1, 0, 0, 0,
+        0, 1, 0, 0,
+        0, 0, 1, 0,
+        0, 0, 0, 1,
+    },
+    {
+        1.0864f, 0.0965f, -0.0141f, 0,
+        -0.0723f, 0.8451f, -0.0277f, 0,
+        -0.0141f, 0.0584f, 1.0418f, 0,
+        0, 0, 0, 1,
+    },
+    {
+        0.2126f, 0.2126f, 0.2126f, 0,
+        0.7152f, 0.7152f, 0.7152f, 0,
+        0.0722f, 0.0722f, 0.0722f, 0,
+        0, 0, 0, 1,
+    },
+};
+static std::atomic<int> colormode(kColorAsDecoded);
 
 int64_t systemnanotime() {
     timespec now;
@@ -87,126 +119,132 @@ int64_t systemnanotime() {
     return now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
-void doCodecWork(workerdata *d) {
-
-    ssize_t bufidx = -1;
-    if (!d->sawInputEOS) {
-        bufidx = AMediaCodec_dequeueInputBuffer(d->codec, 2000);
-        LOGV("input buffer %zd", bufidx);
-        if (bufidx >= 0) {
-            size_t bufsize;
-            auto buf = AMediaCodec_getInputBuffer(d->codec, bufidx, &bufsize);
-            auto sampleSize = AMediaExtractor_readSampleData(d->ex, buf, bufsize);
-            if (sampleSize < 0) {
-                sampleSize = 0;
-                d->sawInputEOS = true;
-                LOGV("EOS");
-            }
-            auto presentationTimeUs = AMediaExtractor_getSampleTime(d->ex);
-
-            AMediaCodec_queueInputBuffer(d->codec, bufidx, 0, sampleSize, presentationTimeUs,
-                    d->sawInputEOS ? AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM : 0);
-            AMediaExtractor_advance(d->ex);
-        }
+// AMediaCodec_setAsyncNotifyCallback is API level 28, newer than the
+// platform this sample builds against, so it is looked up at runtime
+typedef struct {
+    void (*onAsyncInputAvailable)(AMediaCodec *codec, void *userdata,
+                                  int32_t index);
+    void (*onAsyncOutputAvailable)(AMediaCodec *codec, void *userdata,
+                                   int32_t index, AMediaCodecBufferInfo *info);
+    void (*onAsyncFormatChanged)(AMediaCodec *codec, void *userdata,
+                                 AMediaFormat *format);
+    void (*onAsyncError)(AMediaCodec *codec, void *userdata,
+                         media_status_t error, int32_t actionCode,
+                         const char *detail);
+} asynccallbacks;
+
+typedef media_status_t (*setasyncnotifycallback)(AMediaCodec *codec,
+        asynccallbacks callbacks, void *userdata);
+
+// switch the codec to asynchronous mode if the device supports it, before
+// it is configured
+bool setAsyncCallbacks(AMediaCodec *codec, workerdata *d) {
+    void *lib = dlopen("libmediandk.so", RTLD_NOW);
+    if (!lib) {
+        return false;
     }
+    setasyncnotifycallback setcallback = (setasyncnotifycallback)dlsym(lib,
+            "AMediaCodec_setAsyncNotifyCallback");
+    asynccallbacks callbacks = {
+        onInputAvailable, onOutputAvailable, onFormatChanged, onError
+    };
+    bool async = setcallback && setcallback(codec, callbacks, d) == AMEDIA_OK;
+    LOGI("codec runs in %s mode", async ? "asynchronous" : "synchronous");
+    return async;
+}
 
-    if (!d->sawOutputEOS) {
-        AMediaCodecBufferInfo info;
-        auto status = AMediaCodec_dequeueOutputBuffer(d->codec, &info, 0);
-        if (status >= 0) {
-            if (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) {
-                LOGV("output EOS");
-                d->sawOutputEOS = true;
-            }
-            int64_t presentationNano = info.presentationTimeUs * 1000;
-            if (d->renderstart < 0) {
-                d->renderstart = systemnanotime() - presentationNano;
-            }
-            int64_t delay = (d->renderstart + presentationNano) - systemnanotime();
-            if (delay > 0) {
-                usleep(delay / 1000);
-            }
-            AMediaCodec_releaseOutputBuffer(d->codec, status, info.size != 0);
-            if (d->renderonce) {
-                d->renderonce = false;
-                return;
-            }
-        } else if (status == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED) {
-            LOGV("output buffers changed");
-        } else if (status == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
-            auto format = AMediaCodec_getOutputFormat(d->codec);
-            LOGV("format changed to: %s", AMediaFormat_toString(format));
-            AMediaFormat_delete(format);
-        } else if (status == AMEDIACODEC_INFO_TRY_AGAIN_LATER) {
-            LOGV("no output buffer right now");
-        } else {
-            LOGV("unexpected info code: %zd", status);
-        }
-    }
+// image reader thread, the codec rendered a frame
+void onFrameAvailable(void *context) {
+    mgl->post(kMsgGlPresent, context);
+}
 
-    if (!d->sawInputEOS || !d->sawOutputEOS) {
-        mlooper->post(kMsgCodecBuffer, d);
+// logged every second, like the decoder metrics, and when closing
+void gllooper::logframes(workerdata *d, bool force) {
+    int64_t now = systemnanotime();
+    if (!force && now - lastlog < 1000000000LL) {
+        return;
     }
+    lastlog = now;
+    LOGI("post-processing: presented %lld, %d of %d images in flight",
+         (long long)d->frames->presented(), d->frames->inflight(),
+         d->frames->poolsize());
 }
 
-void mylooper::handle(int what, void* obj) {
+void gllooper::handle(int what, void* obj) {
+    workerdata *d = (workerdata*)obj;
     switch (what) {
-        case kMsgCodecBuffer:
-            doCodecWork((workerdata*)obj);
+        case kMsgGlAttach:
+            if (!d->frames->attach(d->window)) {
+                LOGE("no GL post-processing, frames are dropped");
+            }
+            d->frames->setcolormatrix(colormatrices[colormode]);
             break;
 
-        case kMsgDecodeDone:
-        {
-            workerdata *d = (workerdata*)obj;
-            AMediaCodec_stop(d->codec);
-            AMediaCodec_delete(d->codec);
-            AMediaExtractor_delete(d->ex);
-            d->sawInputEOS = true;
-            d->sawOutputEOS = true;
-        }
-        break;
-
-        case kMsgSeek:
-        {
-            workerdata *d = (workerdata*)obj;
-            AMediaExtractor_seekTo(d->ex, 0, AMEDIAEXTRACTOR_SEEK_NEXT_SYNC);
-            AMediaCodec_flush(d->codec);
-            d->renderstart = -1;
-            d->sawInputEOS = false;
-            d->sawOutputEOS = false;
-            if (!d->isPlaying) {
-                d->renderonce = true;
-                post(kMsgCodecBuffer, d);
-            }
-            LOGV("seeked");
-        }
-        break;
-
-        case kMsgPause:
-        {
-            workerdata *d = (workerdata*)obj;
-            if (d->isPlaying) {
-                // flush all outstanding codecbuffer messages with a no-op message
-                d->isPlaying = false;
-                post(kMsgPauseAck, NULL, true);
-            }
-        }
-        break;
-
-        case kMsgResume:
-        {
-            workerdata *d = (workerdata*)obj;
-            if (!d->isPlaying) {
-                d->renderstart = -1;
-                d->isPlaying = true;
-                post(kMsgCodecBuffer, d);
-            }
-        }
-        break;
+        case kMsgGlColor:
+            d->frames->setcolormatrix(colormatrices[colormode]);
+            break;
+
+        case kMsgGlPresent:
+            d->frames->present();
+            logframes(d, false);
+            break;
+
+        case kMsgGlClose:
+            logframes(d, true);
+            d->frames->close();
+            break;
     }
 }
 
 
+// the window the codec renders to: the window itself, or with post-processing
+// the image reader of the GL stage
+ANativeWindow *codecWindow(workerdata *d, AMediaFormat *format) {
+    if (!postprocess) {
+        return d->window;
+    }
+    int32_t width = 0, height = 0;
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &width);
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &height);
+    d->frames = new texturesink();
+    if (!d->frames->open(width, height, kFramePool, onFrameAvailable, d)) {
+        LOGI("no post-processing on this device");
+        delete d->frames;
+        d->frames = NULL;
+        return d->window;
+    }
+    mgl = new gllooper();
+    mgl->post(kMsgGlAttach, d);
+    return d->frames->codecwindow();
+}
+
+// an extractor on an asset, each stage reads through its own
+AMediaExtractor *openExtractor(AAssetManager *mgr, const char *filename) {
+    AAsset *asset = AAssetManager_open(mgr, filename, 0);
+    if (!asset) {
+        LOGE("failed to open file: %s", filename);
+        return NULL;
+    }
+    off_t outStart, outLen;
+    int fd = AAsset_openFileDescriptor(asset, &outStart, &outLen);
+    AAsset_close(asset);
+    if (fd < 0) {
+        LOGE("failed to open file: %s %d (%s)", filename, fd, strerror(errno));
+        return NULL;
+    }
+
+    AMediaExtractor *ex = AMediaExtractor_new();
+    media_status_t err = AMediaExtractor_setDataSourceFd(ex, fd,
+                                                         static_cast<off64_t>(outStart),
+                                                         static_cast<off64_t>(outLen));
+    close(fd);
+    if (err != AMEDIA_OK) {
+        LOGV("setDataSource error: %d", err);
+        AMediaExtractor_delete(ex);
+        return NULL;
+    }
+    return ex;
+}
 
 
 extern "C" {
@@ -220,29 +258,17 @@ jboolean Java_com_example_nativecodec_NativeCodec_createStreamingMediaPlayer(JNI
     const char *utf8 = env->GetStringUTFChars(filename, NULL);
     LOGV("opening %s", utf8);
 
-    off_t outStart, outLen;
-    int fd = AAsset_openFileDescriptor(AAssetManager_open(AAssetManager_fromJava(env, assetMgr), utf8, 0),
-                                       &outStart, &outLen);
-
-    env->ReleaseStringUTFChars(filename, utf8);
-    if (fd < 0) {
-        LOGE("failed to open file: %s %d (%s)", utf8, fd, strerror(errno));
+    AAssetManager *mgr = AAssetManager_fromJava(env, assetMgr);
+    AMediaExtractor *ex = openExtractor(mgr, utf8);
+    if (!ex) {
+        env->ReleaseStringUTFChars(filename, utf8);
         return JNI_FALSE;
     }
 
-    data.fd = fd;
-
     workerdata *d = &data;
-
-    AMediaExtractor *ex = AMediaExtractor_new();
-    media_status_t err = AMediaExtractor_setDataSourceFd(ex, d->fd,
-                                                         static_cast<off64_t>(outStart),
-                                                         static_cast<off64_t>(outLen));
-    close(d->fd);
-    if (err != AMEDIA_OK) {
-        LOGV("setDataSource error: %d", err);
-        return JNI_FALSE;
-    }
+    audiodata *a = &d->audio;
+    a->codec = NULL;
+    a->ex = NULL;
 
     int numtracks = AMediaExtractor_getTrackCount(ex);
 
@@ -256,28 +282,50 @@ jboolean Java_com_example_nativecodec_NativeCodec_createStreamingMediaPlayer(JNI
         const char *mime;
         if (!AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime)) {
             LOGV("no mime type");
-            return JNI_FALSE;
-        } else if (!strncmp(mime, "video/", 6)) {
+            AMediaFormat_delete(format);
+            break;
+        } else if (!strncmp(mime, "video/", 6) && !codec) {
             // Omitting most error handling for clarity.
             // Production code should check for errors.
             AMediaExtractor_selectTrack(ex, i);
             codec = AMediaCodec_createDecoderByType(mime);
-            AMediaCodec_configure(codec, format, d->window, NULL, 0);
-            d->ex = ex;
-            d->codec = codec;
-            d->renderstart = -1;
-            d->sawInputEOS = false;
-            d->sawOutputEOS = false;
-            d->isPlaying = false;
-            d->renderonce = true;
-            AMediaCodec_start(codec);
+            d->async = setAsyncCallbacks(codec, d);
+            AMediaCodec_configure(codec, format, codecWindow(d, format), NULL, 0);
+            setupVideo(d, ex, codec);
+            // seeks look their keyframes up here
+            AMediaExtractor *indexex = openExtractor(mgr, utf8);
+            if (indexex) {
+                AMediaExtractor_selectTrack(indexex, i);
+                d->index.build(indexex);
+            }
+        } else if (!strncmp(mime, "audio/", 6) && !a->codec) {
+            // the audio track is read by its own stage, through a second
+            // extractor
+            a->ex = openExtractor(mgr, utf8);
+            if (a->ex) {
+                AMediaExtractor_selectTrack(a->ex, i);
+                AMediaCodec *audiocodec = AMediaCodec_createDecoderByType(mime);
+                AMediaCodec_configure(audiocodec, format, NULL, NULL, 0);
+                setupAudio(d, a->ex, audiocodec, format);
+            }
         }
         AMediaFormat_delete(format);
     }
+    env->ReleaseStringUTFChars(filename, utf8);
 
-    mlooper = new mylooper();
-    mlooper->post(kMsgCodecBuffer, d);
+    if (!codec) {
+        LOGE("no video track");
+        if (a->codec) {
+            AMediaCodec_delete(a->codec);
+            AMediaExtractor_delete(a->ex);
+            a->codec = NULL;
+            a->ex = NULL;
+        }
+        AMediaExtractor_delete(ex);
+        return JNI_FALSE;
+    }
 
+    startPlayer(d);
     return JNI_TRUE;
 }
 
@@ -286,13 +334,7 @@ void Java_com_example_nativecodec_NativeCodec_setPlayingStreamingMediaPlayer(JNI
         jclass clazz, jboolean isPlaying)
 {
     LOGV("@@@ playpause: %d", isPlaying);
-    if (mlooper) {
-        if (isPlaying) {
-            mlooper->post(kMsgResume, &data);
-        } else {
-            mlooper->post(kMsgPause, &data);
-        }
-    }
+    setPlaying(&data, isPlaying);
 }
 
 
@@ -300,12 +342,16 @@ void Java_com_example_nativecodec_NativeCodec_setPlayingStreamingMediaPlayer(JNI
 void Java_com_example_nativecodec_NativeCodec_shutdown(JNIEnv* env, jclass clazz)
 {
     LOGV("@@@ shutdown");
-    if (mlooper) {
-        mlooper->post(kMsgDecodeDone, &data, true /* flush */);
-        mlooper->quit();
-        delete mlooper;
-        mlooper = NULL;
+    stopPlayer(&data);
+    // the codec is gone, the image reader can go
+    if (mgl) {
+        mgl->post(kMsgGlClose, &data);
+        mgl->quit();
+        delete mgl;
+        mgl = NULL;
     }
+    delete data.frames;
+    data.frames = NULL;
     if (data.window) {
         ANativeWindow_release(data.window);
         data.window = NULL;
@@ -326,13 +372,46 @@ void Java_com_example_nativecodec_NativeCodec_setSurface(JNIEnv *env, jclass cla
 }
 
 
+// seek the streaming media player, to the target frame if accurate, or else
+// to the keyframe before it
+void Java_com_example_nativecodec_NativeCodec_seekStreamingMediaPlayer(JNIEnv *env, jclass clazz,
+        jlong positionMs, jboolean accurate)
+{
+    LOGV("@@@ seek to %lld ms%s", (long long)positionMs, accurate ? ", accurate" : "");
+    seekPlayer(&data, (int64_t)positionMs * 1000, accurate);
+}
+
+
+// render through the GL post-processing stage, from the next player created
+void Java_com_example_nativecodec_NativeCodec_setPostProcessingStreamingMediaPlayer(JNIEnv *env,
+        jclass clazz, jboolean enabled)
+{
+    LOGV("@@@ post-processing: %d", enabled);
+    postprocess = enabled;
+}
+
+
+// color matrix of the post-processing stage, one of kColorAsDecoded,
+// kColorBt709 and kColorGray
+void Java_com_example_nativecodec_NativeCodec_setColorModeStreamingMediaPlayer(JNIEnv *env,
+        jclass clazz, jint mode)
+{
+    LOGV("@@@ color mode: %d", mode);
+    if (mode < 0 || mode >= kColorModes) {
+        return;
+    }
+    colormode = mode;
+    if (mgl) {
+        mgl->post(kMsgGlColor, &data);
+    }
+}
+
+
 // rewind the streaming media player
 void Java_com_example_nativecodec_NativeCodec_rewindStreamingMediaPlayer(JNIEnv *env, jclass clazz)
 {
     LOGV("@@@ rewind");
-    if (mlooper) {
-        mlooper->post(kMsgSeek, &data);
-    }
+    Java_com_example_nativecodec_NativeCodec_seekStreamingMediaPlayer(env, clazz, 0, false);
 }
 
-}
+}
\ No newline at end of file
@@ -0,0 +1,780 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "player.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#ifdef __ANDROID__
+// for __android_log_print(ANDROID_LOG_INFO, "YourApp", "formatted message");
+#include <android/log.h>
+#define TAG "NativeCodec"
+#define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+#else
+// Host builds, e.g. the player test
+#define LOGV(...)
+#define LOGI(...)
+#define LOGE(...)
+#endif
+
+// dequeue timeout of the stages in synchronous mode, the stages have their
+// own threads so they can block
+static const int64_t kCodecTimeoutUs = 10000;
+// a pending frame the clock moved further out than this is rescheduled
+static const int64_t kEarlyNs = 2000000;
+// the audio stage polls its codec, and waits this long when neither the
+// codec nor the sink can take more
+static const int64_t kAudioRetryNs = 5000000;
+
+mylooper *mlooper = NULL;
+feederlooper *mfeeder = NULL;
+audiolooper *maudio = NULL;
+
+void onInputAvailable(AMediaCodec *codec, void *userdata, int32_t index) {
+    (void) codec;
+    workerdata *d = (workerdata*)userdata;
+    codecbuffer b = {};
+    b.index = index;
+    if (!d->inputs.push(b)) {
+        LOGE("input buffer %d lost", index);
+    }
+    mfeeder->post(kMsgFeed, d);
+}
+
+void onOutputAvailable(AMediaCodec *codec, void *userdata, int32_t index,
+                       AMediaCodecBufferInfo *info) {
+    (void) codec;
+    workerdata *d = (workerdata*)userdata;
+    codecbuffer b = { index, *info, systemnanotime() };
+    if (!d->outputs.push(b)) {
+        LOGE("output buffer %d lost", index);
+    }
+    mlooper->post(kMsgDrain, d);
+}
+
+void onFormatChanged(AMediaCodec *codec, void *userdata, AMediaFormat *format) {
+    // the logs are empty in the host build
+    (void) codec;
+    (void) userdata;
+    (void) format;
+    LOGV("format changed to: %s", AMediaFormat_toString(format));
+}
+
+void onError(AMediaCodec *codec, void *userdata, media_status_t error,
+             int32_t actionCode, const char *detail) {
+    (void) codec;
+    (void) userdata;
+    (void) error;
+    (void) actionCode;
+    (void) detail;
+    LOGE("codec error %d (%d): %s", error, actionCode, detail);
+}
+
+ssize_t nextInputBuffer(workerdata *d) {
+    if (!d->async) {
+        return AMediaCodec_dequeueInputBuffer(d->codec, kCodecTimeoutUs);
+    }
+    codecbuffer b;
+    return d->inputs.pop(&b) ? b.index : -1;
+}
+
+ssize_t nextOutputBuffer(workerdata *d, AMediaCodecBufferInfo *info,
+                         int64_t *time) {
+    if (!d->async) {
+        ssize_t status = AMediaCodec_dequeueOutputBuffer(d->codec, info,
+                                                         kCodecTimeoutUs);
+        *time = systemnanotime();
+        return status;
+    }
+    codecbuffer b;
+    if (!d->outputs.pop(&b)) {
+        return AMEDIACODEC_INFO_TRY_AGAIN_LATER;
+    }
+    *info = b.info;
+    *time = b.time;
+    return b.index;
+}
+
+void recordInput(workerdata *d, int64_t presentationTimeUs) {
+    codecstats *s = &d->stats;
+    std::lock_guard<std::mutex> lock(s->inputlock);
+    s->inputpts[s->nextinput] = presentationTimeUs;
+    s->inputtime[s->nextinput] = systemnanotime();
+    s->nextinput = (s->nextinput + 1) % kInputTimes;
+    s->queued++;
+}
+
+void recordOutput(workerdata *d, int64_t presentationTimeUs, int64_t time) {
+    codecstats *s = &d->stats;
+    s->decoded++;
+    int64_t occupancy = s->queued.load() - s->flushed - s->decoded + 1;
+    s->occupancysum += occupancy;
+    s->occupancymax = std::max(s->occupancymax, occupancy);
+
+    // outputs may be reordered, look the sample up by its time
+    std::lock_guard<std::mutex> lock(s->inputlock);
+    for (int i = 0; i < kInputTimes; i++) {
+        if (s->inputtime[i] && s->inputpts[i] == presentationTimeUs) {
+            int64_t latency = time - s->inputtime[i];
+            s->latencysum += latency;
+            s->latencymax = std::max(s->latencymax, latency);
+            s->latencycount++;
+            s->inputtime[i] = 0;
+            break;
+        }
+    }
+}
+
+void logStats(workerdata *d, bool force) {
+    codecstats *s = &d->stats;
+    int64_t now = systemnanotime();
+    if (!force && now - s->lastlog < 1000000000LL) {
+        return;
+    }
+    s->lastlog = now;
+    LOGI("decoded %lld, rendered %lld, late %lld, dropped %lld, "
+         "decode latency %.2f ms (max %.2f), decoder queue %.1f (max %lld)",
+         (long long)s->decoded, (long long)s->rendered, (long long)s->late,
+         (long long)s->dropped,
+         s->latencycount ? s->latencysum / 1e6 / s->latencycount : 0.0,
+         s->latencymax / 1e6,
+         s->decoded ? (double)s->occupancysum / s->decoded : 0.0,
+         (long long)s->occupancymax);
+}
+
+// returns false if no output buffer was pending
+bool releasePendingBuffer(workerdata *d, bool render) {
+    if (d->pendingbuf < 0) {
+        return false;
+    }
+    AMediaCodec_releaseOutputBuffer(d->codec, d->pendingbuf, render);
+    d->pendingbuf = -1;
+    return true;
+}
+
+// stop the feeder and the audio stage and keep them out, so the renderer
+// can reset the extractors and the codecs; they wait for the start message
+// posted after unparkStages()
+void parkStages(workerdata *d) {
+    mfeeder->post(kMsgFeedStop, d, true);
+    d->feederlock.lock();
+    if (maudio) {
+        maudio->post(kMsgAudioStop, d, true);
+        d->audiolock.lock();
+    }
+}
+
+void unparkStages(workerdata *d) {
+    if (maudio) {
+        d->audiolock.unlock();
+    }
+    d->feederlock.unlock();
+}
+
+void feedCodec(workerdata *d) {
+    if (!d->feeding) {
+        return;
+    }
+
+    ssize_t bufidx = nextInputBuffer(d);
+    LOGV("input buffer %zd", bufidx);
+    if (bufidx >= 0) {
+        size_t bufsize;
+        auto buf = AMediaCodec_getInputBuffer(d->codec, bufidx, &bufsize);
+        auto sampleSize = AMediaExtractor_readSampleData(d->ex, buf, bufsize);
+        if (sampleSize < 0) {
+            sampleSize = 0;
+            d->sawInputEOS = true;
+            LOGV("EOS");
+        }
+        auto presentationTimeUs = AMediaExtractor_getSampleTime(d->ex);
+
+        AMediaCodec_queueInputBuffer(d->codec, bufidx, 0, sampleSize, presentationTimeUs,
+                d->sawInputEOS ? AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM : 0);
+        AMediaExtractor_advance(d->ex);
+        recordInput(d, presentationTimeUs);
+        d->queuedpts = std::max(d->queuedpts, presentationTimeUs);
+    }
+
+    if (d->sawInputEOS) {
+        d->feeding = false;
+    } else if (!d->async || !d->inputs.empty()) {
+        // in asynchronous mode the next input callback continues
+        mfeeder->post(kMsgFeed, d);
+    }
+}
+
+// audio thread, returns false if no input buffer was free
+bool feedAudio(audiodata *a) {
+    if (a->sawInputEOS) {
+        return false;
+    }
+    ssize_t bufidx = AMediaCodec_dequeueInputBuffer(a->codec, 0);
+    if (bufidx < 0) {
+        return false;
+    }
+    size_t bufsize;
+    auto buf = AMediaCodec_getInputBuffer(a->codec, bufidx, &bufsize);
+    auto sampleSize = AMediaExtractor_readSampleData(a->ex, buf, bufsize);
+    if (sampleSize < 0) {
+        sampleSize = 0;
+        a->sawInputEOS = true;
+        LOGV("audio EOS");
+    }
+    auto presentationTimeUs = AMediaExtractor_getSampleTime(a->ex);
+    AMediaCodec_queueInputBuffer(a->codec, bufidx, 0, sampleSize, presentationTimeUs,
+            a->sawInputEOS ? AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM : 0);
+    AMediaExtractor_advance(a->ex);
+    return true;
+}
+
+// the sink plays the format the decoder outputs
+void openAudioSink(audiodata *a, AMediaFormat *format) {
+    int32_t samplerate = 0, channels = 0;
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, &samplerate);
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, &channels);
+    if (samplerate == a->samplerate && channels == a->channels &&
+            a->sink->isopen()) {
+        return;
+    }
+    a->samplerate = samplerate;
+    a->channels = channels;
+    if (!a->sink->open(samplerate, channels)) {
+        LOGE("no audio output, the video plays on its own");
+    }
+}
+
+// returns false if there was no output buffer
+bool drainAudio(audiodata *a) {
+    if (a->pendingbuf < 0) {
+        if (a->sawOutputEOS) {
+            return false;
+        }
+        AMediaCodecBufferInfo info;
+        auto status = AMediaCodec_dequeueOutputBuffer(a->codec, &info, 0);
+        if (status == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
+            auto format = AMediaCodec_getOutputFormat(a->codec);
+            LOGV("audio format changed to: %s", AMediaFormat_toString(format));
+            openAudioSink(a, format);
+            a->sink->play();
+            AMediaFormat_delete(format);
+            return true;
+        } else if (status < 0) {
+            return false;
+        }
+        if (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) {
+            LOGV("audio output EOS");
+            a->sawOutputEOS = true;
+        }
+        // trim what a seek went past, in whole frames
+        int64_t skipus = a->skipuntil - info.presentationTimeUs;
+        if (skipus > 0 && info.size > 0 && a->samplerate > 0) {
+            int32_t framesize = a->channels * 2;
+            int32_t skip = std::min((int64_t)info.size / framesize,
+                                    skipus * a->samplerate / 1000000) * framesize;
+            info.offset += skip;
+            info.size -= skip;
+            info.presentationTimeUs += (int64_t)skip / framesize * 1000000 / a->samplerate;
+        }
+        a->pendingbuf = status;
+        a->pendinginfo = info;
+    }
+
+    size_t bufsize;
+    auto buf = AMediaCodec_getOutputBuffer(a->codec, a->pendingbuf, &bufsize);
+    const AMediaCodecBufferInfo &info = a->pendinginfo;
+    if (!a->sink->write(buf + info.offset, info.size, info.presentationTimeUs)) {
+        // all sink buffers are queued, the buffer is written once one
+        // has played
+        return false;
+    }
+    AMediaCodec_releaseOutputBuffer(a->codec, a->pendingbuf, false);
+    a->pendingbuf = -1;
+    return true;
+}
+
+void stepAudio(workerdata *d) {
+    audiodata *a = &d->audio;
+    if (!a->playing) {
+        return;
+    }
+    bool fed = feedAudio(a);
+    bool drained = drainAudio(a);
+    if (a->sawOutputEOS && a->pendingbuf < 0) {
+        a->playing = false;
+    } else if (fed || drained) {
+        maudio->post(kMsgAudio, d);
+    } else {
+        maudio->post_delayed(kMsgAudio, d, kAudioRetryNs);
+    }
+}
+
+// renderer thread
+void startDrain(workerdata *d) {
+    if (d->async) {
+        mlooper->post(kMsgDrain, d);
+    } else if (!d->draining) {
+        d->draining = true;
+        mlooper->post(kMsgDrain, d);
+    }
+}
+
+void continueDrain(workerdata *d) {
+    if (d->sawOutputEOS) {
+        d->draining = false;
+        logStats(d, true);
+    } else if (!d->async || !d->outputs.empty()) {
+        // in asynchronous mode the next output callback continues
+        mlooper->post(kMsgDrain, d);
+    }
+}
+
+// the first frame shown after a seek completes it
+void recordFirstFrame(workerdata *d) {
+    if (!d->seekstart) {
+        return;
+    }
+    codecstats *s = &d->stats;
+    int64_t firstframe = systemnanotime() - d->seekstart;
+    s->seeks++;
+    s->firstframesum += firstframe;
+    s->firstframemax = std::max(s->firstframemax, firstframe);
+    LOGI("seek: first frame after %.2f ms, %lld frames skipped, "
+         "%.2f ms on average (max %.2f)", firstframe / 1e6,
+         (long long)(s->skipped - d->seekskipped),
+         s->firstframesum / 1e6 / s->seeks, s->firstframemax / 1e6);
+    d->seekstart = 0;
+}
+
+// returns false if the buffer is pending, or no more buffers are wanted
+bool renderOutput(workerdata *d, ssize_t index,
+                  const AMediaCodecBufferInfo &info, int64_t time) {
+    recordOutput(d, info.presentationTimeUs, time);
+    d->outputpts = std::max(d->outputpts, info.presentationTimeUs);
+    if (info.presentationTimeUs < d->skipuntil) {
+        // decoded on the way to the target of an accurate seek
+        d->stats.skipped++;
+        AMediaCodec_releaseOutputBuffer(d->codec, index, false);
+        return true;
+    }
+    int64_t now = systemnanotime();
+    int64_t when = now;
+    if (!d->renderonce) {
+        // without audio the clock starts at the first frame shown
+        if (!d->clock.started()) {
+            d->clock.start(info.presentationTimeUs, now);
+        }
+        when = d->clock.systemtime(info.presentationTimeUs);
+    }
+    frameaction action = scheduleframe(when, now, 0);
+    if (action == kFrameWait) {
+        // release the buffer at its presentation time, pause, seek
+        // and shutdown are handled meanwhile
+        d->pendingbuf = index;
+        d->pendingpts = info.presentationTimeUs;
+        d->pendingwhen = when;
+        mlooper->post_at(kMsgReleaseBuffer, d, when);
+        return false;
+    }
+    if (action == kFrameDrop) {
+        d->stats.dropped++;
+        AMediaCodec_releaseOutputBuffer(d->codec, index, false);
+    } else {
+        d->stats.rendered++;
+        if (action == kFrameLate) {
+            d->stats.late++;
+        }
+        AMediaCodec_releaseOutputBuffer(d->codec, index, true);
+        recordFirstFrame(d);
+    }
+    logStats(d, false);
+    if (d->renderonce) {
+        d->renderonce = false;
+        d->draining = false;
+        if (!d->isPlaying) {
+            mfeeder->post(kMsgFeedStop, d, true);
+        }
+        return false;
+    }
+    return true;
+}
+
+void drainCodec(workerdata *d) {
+    // output buffers are taken one at a time, the release of a pending
+    // buffer continues
+    if (d->pendingbuf >= 0) {
+        return;
+    }
+    if (d->sawOutputEOS || (!d->isPlaying && !d->renderonce)) {
+        d->draining = false;
+        return;
+    }
+
+    AMediaCodecBufferInfo info;
+    int64_t time;
+    auto status = nextOutputBuffer(d, &info, &time);
+    if (status >= 0) {
+        if (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) {
+            LOGV("output EOS");
+            d->sawOutputEOS = true;
+        }
+        if (info.size == 0) {
+            // nothing to show, e.g. the end of stream buffer
+            AMediaCodec_releaseOutputBuffer(d->codec, status, false);
+        } else if (!renderOutput(d, status, info, time)) {
+            return;
+        }
+    } else if (status == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED) {
+        LOGV("output buffers changed");
+    } else if (status == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
+        auto format = AMediaCodec_getOutputFormat(d->codec);
+        LOGV("format changed to: %s", AMediaFormat_toString(format));
+        AMediaFormat_delete(format);
+    } else if (status == AMEDIACODEC_INFO_TRY_AGAIN_LATER) {
+        LOGV("no output buffer right now");
+    } else {
+        LOGV("unexpected info code: %zd", status);
+    }
+    continueDrain(d);
+}
+
+void feederlooper::handle(int what, void* obj) {
+    workerdata *d = (workerdata*)obj;
+    std::lock_guard<std::mutex> lock(d->feederlock);
+    switch (what) {
+        case kMsgFeed:
+            feedCodec(d);
+            break;
+
+        case kMsgFeedStart:
+            if (!d->feeding && !d->sawInputEOS) {
+                d->feeding = true;
+                post(kMsgFeed, d);
+            }
+            break;
+
+        case kMsgFeedStop:
+            d->feeding = false;
+            break;
+    }
+}
+
+void audiolooper::handle(int what, void* obj) {
+    workerdata *d = (workerdata*)obj;
+    audiodata *a = &d->audio;
+    std::lock_guard<std::mutex> lock(d->audiolock);
+    switch (what) {
+        case kMsgAudio:
+            stepAudio(d);
+            break;
+
+        case kMsgAudioPlay:
+            if (!a->playing && !a->sawOutputEOS) {
+                a->playing = true;
+                a->sink->play();
+                post(kMsgAudio, d);
+            }
+            break;
+
+        case kMsgAudioPause:
+            a->playing = false;
+            a->sink->pause();
+            break;
+
+        case kMsgAudioStop:
+            a->playing = false;
+            break;
+    }
+}
+
+void mylooper::handle(int what, void* obj) {
+    switch (what) {
+        case kMsgDrain:
+            drainCodec((workerdata*)obj);
+            break;
+
+        case kMsgReleaseBuffer:
+        {
+            workerdata *d = (workerdata*)obj;
+            // a pause or seek may have released the buffer already, and
+            // another one may be pending, due later
+            int64_t now = systemnanotime();
+            if (d->pendingbuf < 0 || now < d->pendingwhen) {
+                break;
+            }
+            // the audio may have moved the clock since the frame was
+            // scheduled
+            int64_t when = d->clock.systemtime(d->pendingpts);
+            frameaction action = scheduleframe(when, now, kEarlyNs);
+            if (action == kFrameWait) {
+                d->pendingwhen = when;
+                post_at(kMsgReleaseBuffer, d, when);
+                break;
+            }
+            bool render = action != kFrameDrop;
+            if (!render) {
+                d->stats.dropped++;
+            } else {
+                d->stats.rendered++;
+                if (action == kFrameLate) {
+                    d->stats.late++;
+                }
+            }
+            releasePendingBuffer(d, render);
+            if (render) {
+                recordFirstFrame(d);
+            }
+            logStats(d, false);
+            continueDrain(d);
+        }
+        break;
+
+        case kMsgDecodeDone:
+        {
+            workerdata *d = (workerdata*)obj;
+            parkStages(d);
+            // stopping the codec returns the pending buffer
+            d->pendingbuf = -1;
+            AMediaCodec_stop(d->codec);
+            AMediaCodec_delete(d->codec);
+            AMediaExtractor_delete(d->ex);
+            d->sawInputEOS = true;
+            d->sawOutputEOS = true;
+            audiodata *a = &d->audio;
+            if (a->codec) {
+                a->sink->close();
+                a->pendingbuf = -1;
+                AMediaCodec_stop(a->codec);
+                AMediaCodec_delete(a->codec);
+                AMediaExtractor_delete(a->ex);
+                a->codec = NULL;
+                a->ex = NULL;
+                a->sawInputEOS = true;
+                a->sawOutputEOS = true;
+            }
+            unparkStages(d);
+            logStats(d, true);
+        }
+        break;
+
+        case kMsgSeek:
+        {
+            workerdata *d = (workerdata*)obj;
+            int64_t target = d->seektarget.load();
+            bool accurate = d->seekaccurate.load();
+            d->seekstart = d->seekrequested.load();
+            d->seekskipped = d->stats.skipped;
+            // all stages stop while the extractors and the codecs are reset,
+            // buffer indices are invalid after a flush
+            parkStages(d);
+            if (releasePendingBuffer(d, false)) {
+                // the drain chain was waiting on the buffer
+                d->draining = false;
+            }
+            int64_t syncus;
+            bool indexed = d->index.syncbefore(target, &syncus);
+            int64_t startus = target;
+            if (accurate && indexed && !d->sawInputEOS &&
+                    d->outputpts < target && syncus <= d->queuedpts) {
+                // the decoder is past the keyframe of the target already,
+                // decoding on is cheaper than a flush
+                LOGV("seek to %lld us decodes on from %lld us",
+                     (long long)target, (long long)d->queuedpts);
+            } else {
+                if (indexed) {
+                    AMediaExtractor_seekTo(d->ex, syncus,
+                                           AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC);
+                } else {
+                    AMediaExtractor_seekTo(d->ex, target,
+                                           AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+                }
+                // the keyframe decoding starts from
+                startus = std::max(AMediaExtractor_getSampleTime(d->ex),
+                                   (int64_t)0);
+                AMediaCodec_flush(d->codec);
+                d->inputs.clear();
+                d->outputs.clear();
+                if (d->async) {
+                    // asynchronous mode needs a start to resume after a flush
+                    AMediaCodec_start(d->codec);
+                }
+                d->stats.flushed = d->stats.queued.load() - d->stats.decoded;
+                memset(d->stats.inputtime, 0, sizeof(d->stats.inputtime));
+                d->sawInputEOS = false;
+                d->sawOutputEOS = false;
+                d->queuedpts = -1;
+                d->outputpts = -1;
+            }
+            // an accurate seek shows the target frame, a fast one the
+            // keyframe before it
+            if (!accurate) {
+                target = startus;
+            }
+            d->skipuntil = target;
+            audiodata *a = &d->audio;
+            if (a->codec) {
+                a->sink->flush();
+                AMediaExtractor_seekTo(a->ex, target,
+                                       AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+                AMediaCodec_flush(a->codec);
+                a->pendingbuf = -1;
+                a->skipuntil = target;
+                a->sawInputEOS = false;
+                a->sawOutputEOS = false;
+            }
+            // the clock starts again from the first frame or audio buffer
+            d->clock.reset();
+            unparkStages(d);
+
+            if (!d->isPlaying) {
+                d->renderonce = true;
+            } else if (maudio) {
+                maudio->post(kMsgAudioPlay, d);
+            }
+            mfeeder->post(kMsgFeedStart, d);
+            startDrain(d);
+            LOGV("seeked to %lld us", (long long)target);
+        }
+        break;
+
+        case kMsgPause:
+        {
+            workerdata *d = (workerdata*)obj;
+            if (d->isPlaying) {
+                // flush all outstanding drain messages with a no-op message
+                d->isPlaying = false;
+                d->draining = false;
+                // show the pending frame now, its timed release is flushed
+                releasePendingBuffer(d, true);
+                d->clock.pause(systemnanotime());
+                mfeeder->post(kMsgFeedStop, d, true);
+                if (maudio) {
+                    maudio->post(kMsgAudioPause, d, true);
+                }
+                post(kMsgPauseAck, NULL, true);
+            }
+        }
+        break;
+
+        case kMsgResume:
+        {
+            workerdata *d = (workerdata*)obj;
+            if (!d->isPlaying) {
+                d->clock.resume(systemnanotime());
+                d->isPlaying = true;
+                mfeeder->post(kMsgFeedStart, d);
+                if (maudio) {
+                    maudio->post(kMsgAudioPlay, d);
+                }
+                startDrain(d);
+            }
+        }
+        break;
+    }
+}
+
+void setupVideo(workerdata *d, AMediaExtractor *ex, AMediaCodec *codec) {
+    d->ex = ex;
+    d->codec = codec;
+    d->sawInputEOS = false;
+    d->sawOutputEOS = false;
+    d->isPlaying = false;
+    d->renderonce = true;
+    d->pendingbuf = -1;
+    d->feeding = false;
+    d->draining = false;
+    d->queuedpts = -1;
+    d->outputpts = -1;
+    d->skipuntil = -1;
+    d->seekstart = 0;
+}
+
+void setupAudio(workerdata *d, AMediaExtractor *ex, AMediaCodec *codec,
+                AMediaFormat *format) {
+    audiodata *a = &d->audio;
+    a->ex = ex;
+    a->codec = codec;
+    if (!a->sink) {
+        a->sink = new audiosink(&d->clock);
+    }
+    a->samplerate = 0;
+    a->channels = 0;
+    openAudioSink(a, format);
+    a->sawInputEOS = false;
+    a->sawOutputEOS = false;
+    a->playing = false;
+    a->pendingbuf = -1;
+    a->skipuntil = -1;
+}
+
+void startPlayer(workerdata *d) {
+    audiodata *a = &d->audio;
+    d->clock.reset();
+    // callbacks post to the stages as soon as the codecs start
+    if (!mlooper) {
+        mfeeder = new feederlooper();
+        mlooper = new mylooper();
+    }
+    if (a->codec && !maudio) {
+        maudio = new audiolooper();
+    }
+    AMediaCodec_start(d->codec);
+    if (a->codec) {
+        AMediaCodec_start(a->codec);
+    }
+    d->draining = true;
+    mlooper->post(kMsgDrain, d);
+    mfeeder->post(kMsgFeedStart, d);
+}
+
+void setPlaying(workerdata *d, bool playing) {
+    if (mlooper) {
+        mlooper->post(playing ? kMsgResume : kMsgPause, d);
+    }
+}
+
+void seekPlayer(workerdata *d, int64_t us, bool accurate) {
+    if (mlooper) {
+        d->seektarget = std::max(us, (int64_t)0);
+        d->seekaccurate = accurate;
+        d->seekrequested = systemnanotime();
+        mlooper->post(kMsgSeek, d);
+    }
+}
+
+void stopPlayer(workerdata *d) {
+    if (mlooper) {
+        mlooper->post(kMsgDecodeDone, d, true /* flush */);
+        mlooper->quit();
+        delete mlooper;
+        mlooper = NULL;
+        mfeeder->quit();
+        delete mfeeder;
+        mfeeder = NULL;
+        if (maudio) {
+            maudio->quit();
+            delete maudio;
+            maudio = NULL;
+        }
+    }
+    d->index.stop();
+    delete d->audio.sink;
+    d->audio.sink = NULL;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "audiosink.h"
+#include "looper.h"
+#include "mediaclock.h"
+#include "syncindex.h"
+#include "media/NdkMediaCodec.h"
+#include "media/NdkMediaExtractor.h"
+
+struct ANativeWindow;
+class texturesink;
+
+// The player runs in stages: the feeder fills input buffers from the
+// extractor, the renderer takes output buffers and releases them at their
+// presentation time on the media clock. The renderer also handles the player
+// controls. If the file has an audio track, the audio stage decodes it into
+// the audio sink, which drives the media clock.
+//
+// The stages only talk to the platform through the AMediaCodec and
+// AMediaExtractor calls, the audio sink, the loopers and systemnanotime(),
+// so the host test runs them against fakes of those.
+
+// input samples whose queue time is kept, for the decode latency
+static const int kInputTimes = 64;
+
+// a codec buffer from the asynchronous callbacks
+typedef struct {
+    ssize_t index;
+    AMediaCodecBufferInfo info;
+    int64_t time;   // of the callback
+} codecbuffer;
+
+// single producer, single consumer ring of codec buffers, filled by the
+// codec's callback thread
+class bufferring {
+    public:
+        bufferring() : head(0), tail(0) {}
+
+        bool push(const codecbuffer &b) {
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) == kSize) {
+                return false;
+            }
+            buffers[t % kSize] = b;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(codecbuffer *b) {
+            uint32_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            *b = buffers[h % kSize];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const {
+            return head.load(std::memory_order_acquire) ==
+                   tail.load(std::memory_order_acquire);
+        }
+
+        // only while the codec makes no callbacks, e.g. after a flush
+        void clear() {
+            head.store(tail.load(std::memory_order_acquire),
+                       std::memory_order_release);
+        }
+
+    private:
+        static const uint32_t kSize = 64;
+        codecbuffer buffers[kSize];
+        std::atomic<uint32_t> head;
+        std::atomic<uint32_t> tail;
+};
+
+// decoder metrics, logged every second and at the end of the stream
+typedef struct {
+    std::atomic<int64_t> queued;    // input buffers queued, by the feeder
+    int64_t decoded;                // output buffers taken
+    int64_t flushed;                // inputs dropped by seeks
+    int64_t rendered;
+    int64_t late;                   // rendered, but kFrameLate
+    int64_t dropped;                // kFrameDrop, too late to render
+    int64_t skipped;                // before the target of an accurate seek
+    int64_t seeks;
+    int64_t firstframesum;          // from a seek request to its first frame
+    int64_t firstframemax;
+    // from input queued to output available, or taken by the renderer in
+    // synchronous mode
+    int64_t latencysum;
+    int64_t latencymax;
+    int64_t latencycount;
+    int64_t occupancysum;           // frames in the decoder, at each output
+    int64_t occupancymax;
+    int64_t lastlog;
+    // queue times of the last input samples
+    std::mutex inputlock;
+    int64_t inputpts[kInputTimes];
+    int64_t inputtime[kInputTimes];
+    int nextinput;
+} codecstats;
+
+// the audio track, decoded by its own stage into the audio sink
+typedef struct {
+    AMediaExtractor *ex;
+    AMediaCodec *codec;
+    audiosink *sink;
+    int32_t samplerate;
+    int32_t channels;
+    bool sawInputEOS;
+    bool sawOutputEOS;
+    // audio thread only: decoding and writing to the sink
+    bool playing;
+    // output buffer the sink had no room for, -1 if none
+    ssize_t pendingbuf;
+    AMediaCodecBufferInfo pendinginfo;
+    // PCM before this media time is dropped, after a seek
+    int64_t skipuntil;
+} audiodata;
+
+typedef struct {
+    ANativeWindow* window;
+    AMediaExtractor* ex;
+    AMediaCodec *codec;
+    bool sawInputEOS;
+    bool sawOutputEOS;
+    bool isPlaying;
+    bool renderonce;
+    // output buffer waiting for its presentation time, -1 if none
+    ssize_t pendingbuf;
+    int64_t pendingpts;
+    int64_t pendingwhen;
+    // buffers come from callbacks, not from dequeuing
+    bool async;
+    // feeder thread only: input buffers are being filled
+    bool feeding;
+    // renderer thread only: a kMsgDrain chain is running (synchronous mode)
+    bool draining;
+    // feeder thread only: the latest sample time queued, -1 after a flush
+    int64_t queuedpts;
+    // renderer thread only: the latest output time, -1 after a flush
+    int64_t outputpts;
+    // renderer thread only: outputs before this are decoded, not shown
+    int64_t skipuntil;
+    // renderer thread only: request time of the seek waiting for its first
+    // frame, 0 if none, and the skipped count when it started
+    int64_t seekstart;
+    int64_t seekskipped;
+    // the latest seek request
+    std::atomic<int64_t> seektarget;
+    std::atomic<bool> seekaccurate;
+    std::atomic<int64_t> seekrequested;
+    bufferring inputs;
+    bufferring outputs;
+    // held by the feeder and the audio stage while they handle a message,
+    // and by the renderer while it resets the extractors and the codecs
+    std::mutex feederlock;
+    std::mutex audiolock;
+    codecstats stats;
+    // driven by the audio sink if there is an audio track
+    mediaclock clock;
+    audiodata audio;
+    syncindex index;
+    // with post-processing the codec renders here, not to the window
+    texturesink *frames;
+} workerdata;
+
+enum {
+    // renderer
+    kMsgDrain,
+    kMsgPause,
+    kMsgResume,
+    kMsgPauseAck,
+    kMsgDecodeDone,
+    kMsgSeek,
+    kMsgReleaseBuffer,
+    // feeder
+    kMsgFeed,
+    kMsgFeedStart,
+    kMsgFeedStop,
+    // audio
+    kMsgAudio,
+    kMsgAudioPlay,
+    kMsgAudioPause,
+    kMsgAudioStop,
+    // post-processing
+    kMsgGlAttach,
+    kMsgGlPresent,
+    kMsgGlColor,
+    kMsgGlClose,
+};
+
+class mylooper: public looper {
+    virtual void handle(int what, void* obj);
+};
+
+class feederlooper: public looper {
+    virtual void handle(int what, void* obj);
+};
+
+class audiolooper: public looper {
+    virtual void handle(int what, void* obj);
+};
+
+// created by startPlayer(), maudio only with an audio track
+extern mylooper *mlooper;
+extern feederlooper *mfeeder;
+extern audiolooper *maudio;
+
+// CLOCK_MONOTONIC time in ns, defined by the app; the host test defines a
+// virtual clock instead
+int64_t systemnanotime();
+
+// the callbacks of a codec in asynchronous mode, userdata is the workerdata
+void onInputAvailable(AMediaCodec *codec, void *userdata, int32_t index);
+void onOutputAvailable(AMediaCodec *codec, void *userdata, int32_t index,
+                       AMediaCodecBufferInfo *info);
+void onFormatChanged(AMediaCodec *codec, void *userdata, AMediaFormat *format);
+void onError(AMediaCodec *codec, void *userdata, media_status_t error,
+             int32_t actionCode, const char *detail);
+
+// the video track of ex, decoded by the configured codec; the player is
+// paused and shows the first frame once started
+void setupVideo(workerdata *d, AMediaExtractor *ex, AMediaCodec *codec);
+// the audio track of ex, decoded by the configured codec into the sink
+void setupAudio(workerdata *d, AMediaExtractor *ex, AMediaCodec *codec,
+                AMediaFormat *format);
+void startPlayer(workerdata *d);
+void setPlaying(workerdata *d, bool playing);
+// to the target frame if accurate, or else to the keyframe before it
+void seekPlayer(workerdata *d, int64_t us, bool accurate);
+// deletes the codecs and the extractors, and the stages
+void stopPlayer(workerdata *d);
+
+void logStats(workerdata *d, bool force);
+
+#endif // PLAYER_H
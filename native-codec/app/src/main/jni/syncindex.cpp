@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "syncindex.h"
+
+#include <algorithm>
+
+#ifdef __ANDROID__
+// for __android_log_print(ANDROID_LOG_INFO, "YourApp", "formatted message");
+#include <android/log.h>
+#define TAG "NativeCodec-index"
+#define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#else
+// Host builds, e.g. the player test
+#define LOGV(...)
+#endif
+
+syncindex::syncindex() :
+        ex(NULL), running(false), stopping(false), indexedus(-1),
+        complete(false) {
+}
+
+syncindex::~syncindex() {
+    stop();
+}
+
+void syncindex::build(AMediaExtractor *ex) {
+    stop();
+    {
+        std::lock_guard<std::mutex> l(lock);
+        times.clear();
+        indexedus = -1;
+        complete = false;
+    }
+    this->ex = ex;
+    stopping = false;
+    running = true;
+    pthread_create(&thread, NULL, run, this);
+}
+
+void syncindex::stop() {
+    if (running) {
+        stopping = true;
+        pthread_join(thread, NULL);
+        running = false;
+    }
+}
+
+bool syncindex::syncbefore(int64_t us, int64_t *syncus) {
+    std::lock_guard<std::mutex> l(lock);
+    if (!complete && us > indexedus) {
+        return false;
+    }
+    auto it = std::upper_bound(times.begin(), times.end(), us);
+    if (it == times.begin()) {
+        return false;
+    }
+    *syncus = *--it;
+    return true;
+}
+
+void* syncindex::run(void *me) {
+    ((syncindex*)me)->walk();
+    return NULL;
+}
+
+// only the sample headers are read, advancing skips the data
+void syncindex::walk() {
+    int64_t samples = 0;
+    while (!stopping) {
+        int64_t us = AMediaExtractor_getSampleTime(ex);
+        if (us < 0) {
+            break;
+        }
+        bool sync = AMediaExtractor_getSampleFlags(ex) &
+                    AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC;
+        {
+            std::lock_guard<std::mutex> l(lock);
+            if (sync && (times.empty() || us > times.back())) {
+                times.push_back(us);
+            }
+            indexedus = std::max(indexedus, us);
+        }
+        samples++;
+        AMediaExtractor_advance(ex);
+    }
+    std::lock_guard<std::mutex> l(lock);
+    complete = !stopping;
+    LOGV("%zu sync samples in %lld samples%s", times.size(),
+         (long long)samples, complete ? "" : ", stopped");
+    AMediaExtractor_delete(ex);
+    ex = NULL;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYNCINDEX_H
+#define SYNCINDEX_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "media/NdkMediaExtractor.h"
+
+// Times of the sync samples of a track, so a seek knows the keyframe it
+// decodes from. A background thread walks the track, opening the player
+// does not wait for it, and lookups fail until it got far enough.
+class syncindex {
+    public:
+        syncindex();
+        syncindex& operator=(const syncindex& ) = delete;
+        syncindex(syncindex&) = delete;
+        ~syncindex();
+
+        // walk the selected track of ex, which the index deletes when done
+        void build(AMediaExtractor *ex);
+        void stop();
+
+        // the last sync sample at or before us, false if not indexed yet
+        bool syncbefore(int64_t us, int64_t *syncus);
+
+    private:
+        static void* run(void *me);
+        void walk();
+
+        AMediaExtractor *ex;
+        pthread_t thread;
+        bool running;
+        std::atomic<bool> stopping;
+        std::mutex lock;
+        std::vector<int64_t> times;     // in decode order
+        int64_t indexedus;              // the samples up to here are indexed
+        bool complete;
+};
+
+#endif // SYNCINDEX_H
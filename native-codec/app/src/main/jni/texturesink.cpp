@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "texturesink.h"
+
+#include <dlfcn.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <EGL/eglext.h>
+#include <GLES2/gl2ext.h>
+
+#include "media/NdkMediaError.h"
+
+// for __android_log_print(ANDROID_LOG_INFO, "YourApp", "formatted message");
+#include <android/log.h>
+#define TAG "NativeCodec-texture"
+#define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+
+#ifndef EGL_NATIVE_BUFFER_ANDROID
+#define EGL_NATIVE_BUFFER_ANDROID 0x3140
+#endif
+
+// from media/NdkImage.h and android/hardware_buffer.h
+static const int32_t kImageFormatPrivate = 0x22;
+static const uint64_t kUsageGpuSampledImage = 1ULL << 8;
+// images drawn are kept this many frames, a fence tells when the GPU is
+// done with them
+static const size_t kImagesKept = 2;
+
+typedef struct {
+    void *context;
+    void (*onImageAvailable)(void *context, AImageReader *reader);
+} imagelistener;
+
+// the entry points used, looked up at runtime
+static struct {
+    media_status_t (*newWithUsage)(int32_t width, int32_t height,
+                                   int32_t format, uint64_t usage,
+                                   int32_t maxImages, AImageReader **reader);
+    void (*deleteReader)(AImageReader *reader);
+    media_status_t (*getWindow)(AImageReader *reader, ANativeWindow **window);
+    media_status_t (*setImageListener)(AImageReader *reader,
+                                       imagelistener *listener);
+    media_status_t (*acquireLatestImage)(AImageReader *reader,
+                                         AImage **image);
+    media_status_t (*getHardwareBuffer)(const AImage *image,
+                                        AHardwareBuffer **buffer);
+    void (*deleteImage)(AImage *image);
+    EGLClientBuffer (*getNativeClientBuffer)(const AHardwareBuffer *buffer);
+    PFNEGLCREATEIMAGEKHRPROC createImage;
+    PFNEGLDESTROYIMAGEKHRPROC destroyImage;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC imageTargetTexture;
+    PFNEGLCREATESYNCKHRPROC createSync;
+    PFNEGLCLIENTWAITSYNCKHRPROC clientWaitSync;
+    PFNEGLDESTROYSYNCKHRPROC destroySync;
+} api;
+
+static bool loadapi() {
+    void *lib = dlopen("libmediandk.so", RTLD_NOW);
+    if (!lib) {
+        return false;
+    }
+    *(void**)&api.newWithUsage = dlsym(lib, "AImageReader_newWithUsage");
+    *(void**)&api.deleteReader = dlsym(lib, "AImageReader_delete");
+    *(void**)&api.getWindow = dlsym(lib, "AImageReader_getWindow");
+    *(void**)&api.setImageListener = dlsym(lib, "AImageReader_setImageListener");
+    *(void**)&api.acquireLatestImage = dlsym(lib, "AImageReader_acquireLatestImage");
+    *(void**)&api.getHardwareBuffer = dlsym(lib, "AImage_getHardwareBuffer");
+    *(void**)&api.deleteImage = dlsym(lib, "AImage_delete");
+    *(void**)&api.getNativeClientBuffer =
+            (void*)eglGetProcAddress("eglGetNativeClientBufferANDROID");
+    api.createImage = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    api.destroyImage = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    api.imageTargetTexture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+            eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    api.createSync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+    api.clientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+    api.destroySync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+    // the fences are optional, and only made when they can be waited on and
+    // destroyed
+    if (!api.clientWaitSync || !api.destroySync) {
+        api.createSync = NULL;
+    }
+    return api.newWithUsage && api.deleteReader && api.getWindow &&
+           api.setImageListener && api.acquireLatestImage &&
+           api.getHardwareBuffer && api.deleteImage &&
+           api.getNativeClientBuffer && api.createImage && api.destroyImage &&
+           api.imageTargetTexture;
+}
+
+static const char vertexshader[] =
+    "attribute vec2 a_position;\n"
+    "attribute vec2 a_texcoord;\n"
+    "varying vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(a_position, 0.0, 1.0);\n"
+    "    v_texcoord = a_texcoord;\n"
+    "}\n";
+
+static const char fragmentshader[] =
+    "#extension GL_OES_EGL_image_external : require\n"
+    "precision mediump float;\n"
+    "uniform samplerExternalOES u_frame;\n"
+    "uniform mat4 u_colormatrix;\n"
+    "varying vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    gl_FragColor = u_colormatrix * texture2D(u_frame, v_texcoord);\n"
+    "}\n";
+
+// a strip over the viewport, the top row of the frame at the top
+static const GLfloat quad[] = {
+    -1.0f, -1.0f, 0.0f, 1.0f,
+     1.0f, -1.0f, 1.0f, 1.0f,
+    -1.0f,  1.0f, 0.0f, 0.0f,
+     1.0f,  1.0f, 1.0f, 0.0f,
+};
+
+static GLuint compile(GLenum type, const char *source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        LOGE("shader compile failed: %s", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+texturesink::texturesink() :
+        reader(NULL), width(0), height(0), pool(0), available(NULL),
+        context(NULL), display(EGL_NO_DISPLAY), surface(EGL_NO_SURFACE),
+        eglcontext(EGL_NO_CONTEXT), program(0), colormatrixloc(-1), held(0),
+        frames(0) {
+    static const float identity[16] = {
+        1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1,
+    };
+    memcpy(colormatrix, identity, sizeof(colormatrix));
+}
+
+texturesink::~texturesink() {
+    close();
+}
+
+bool texturesink::open(int32_t width, int32_t height, int32_t poolsize,
+                       void (*available)(void *context), void *context) {
+    if (!loadapi()) {
+        LOGV("image reader or EGL image import not available");
+        return false;
+    }
+    media_status_t status = api.newWithUsage(width, height,
+            kImageFormatPrivate, kUsageGpuSampledImage, poolsize, &reader);
+    if (status != AMEDIA_OK) {
+        LOGE("no image reader for %dx%d: %d", width, height, status);
+        reader = NULL;
+        return false;
+    }
+    this->width = width;
+    this->height = height;
+    pool = poolsize;
+    this->available = available;
+    this->context = context;
+    imagelistener listener = { this, onimage };
+    api.setImageListener(reader, &listener);
+    return true;
+}
+
+ANativeWindow *texturesink::codecwindow() {
+    ANativeWindow *window = NULL;
+    if (reader) {
+        api.getWindow(reader, &window);
+    }
+    return window;
+}
+
+void texturesink::onimage(void *context, AImageReader *reader) {
+    texturesink *me = (texturesink*)context;
+    me->available(me->context);
+}
+
+bool texturesink::attach(ANativeWindow *window) {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    eglInitialize(display, NULL, NULL);
+    const EGLint attribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numconfigs = 0;
+    eglChooseConfig(display, attribs, &config, 1, &numconfigs);
+    if (!numconfigs) {
+        LOGE("no EGL config");
+        return false;
+    }
+    const EGLint contextattribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    eglcontext = eglCreateContext(display, config, EGL_NO_CONTEXT,
+                                  contextattribs);
+    surface = eglCreateWindowSurface(display, config, window, NULL);
+    if (eglcontext == EGL_NO_CONTEXT || surface == EGL_NO_SURFACE ||
+            !eglMakeCurrent(display, surface, surface, eglcontext)) {
+        LOGE("EGL setup failed: %x", eglGetError());
+        return false;
+    }
+
+    GLuint vs = compile(GL_VERTEX_SHADER, vertexshader);
+    GLuint fs = compile(GL_FRAGMENT_SHADER, fragmentshader);
+    if (!vs || !fs) {
+        return false;
+    }
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glBindAttribLocation(program, 0, "a_position");
+    glBindAttribLocation(program, 1, "a_texcoord");
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        LOGE("program link failed");
+        return false;
+    }
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "u_frame"), 0);
+    colormatrixloc = glGetUniformLocation(program, "u_colormatrix");
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), quad);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), quad + 2);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    LOGV("presenting %dx%d frames, %d images", width, height, pool);
+    return true;
+}
+
+void texturesink::setcolormatrix(const float *m) {
+    memcpy(colormatrix, m, sizeof(colormatrix));
+}
+
+// the reader hands out the same buffers over and over, so each is bound to
+// a texture once
+GLuint texturesink::bind(AHardwareBuffer *buffer) {
+    for (size_t i = 0; i < bound.size(); i++) {
+        if (bound[i].buffer == buffer) {
+            return bound[i].texture;
+        }
+    }
+    EGLClientBuffer clientbuffer = api.getNativeClientBuffer(buffer);
+    const EGLint attribs[] = { EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE };
+    EGLImageKHR image = api.createImage(display, EGL_NO_CONTEXT,
+            EGL_NATIVE_BUFFER_ANDROID, clientbuffer, attribs);
+    if (image == EGL_NO_IMAGE_KHR) {
+        LOGE("EGL image import failed: %x", eglGetError());
+        return 0;
+    }
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    api.imageTargetTexture(GL_TEXTURE_EXTERNAL_OES, (GLeglImageOES)image);
+
+    // the reader may have reallocated its buffers, the oldest binding of a
+    // buffer no drawn image holds any more goes
+    if (bound.size() >= (size_t)pool + kImagesKept) {
+        for (size_t i = 0; i < bound.size(); i++) {
+            bool inuse = false;
+            for (size_t j = 0; j < images.size(); j++) {
+                inuse = inuse || images[j].buffer == bound[i].buffer;
+            }
+            if (!inuse) {
+                glDeleteTextures(1, &bound[i].texture);
+                api.destroyImage(display, bound[i].image);
+                bound.erase(bound.begin() + i);
+                break;
+            }
+        }
+    }
+    boundbuffer b = { buffer, image, texture };
+    bound.push_back(b);
+    LOGV("bound buffer %p, %zu bound", buffer, bound.size());
+    return texture;
+}
+
+void texturesink::unbindall() {
+    for (size_t i = 0; i < bound.size(); i++) {
+        glDeleteTextures(1, &bound[i].texture);
+        api.destroyImage(display, bound[i].image);
+    }
+    bound.clear();
+}
+
+bool texturesink::present() {
+    if (!reader) {
+        return false;
+    }
+    AImage *image = NULL;
+    // older frames that were not presented yet are dropped
+    if (api.acquireLatestImage(reader, &image) != AMEDIA_OK) {
+        return false;
+    }
+    AHardwareBuffer *buffer = NULL;
+    api.getHardwareBuffer(image, &buffer);
+    // without a window the images are still returned, or the codec stalls
+    GLuint texture = buffer && surface != EGL_NO_SURFACE ? bind(buffer) : 0;
+    if (!texture) {
+        api.deleteImage(image);
+        return false;
+    }
+
+    // scale to fit, keeping the aspect ratio
+    EGLint surfacewidth = 0, surfaceheight = 0;
+    eglQuerySurface(display, surface, EGL_WIDTH, &surfacewidth);
+    eglQuerySurface(display, surface, EGL_HEIGHT, &surfaceheight);
+    float scale = std::min((float)surfacewidth / width,
+                           (float)surfaceheight / height);
+    GLsizei w = (GLsizei)(width * scale), h = (GLsizei)(height * scale);
+    glViewport(0, 0, surfacewidth, surfaceheight);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glViewport((surfacewidth - w) / 2, (surfaceheight - h) / 2, w, h);
+
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
+    glUniformMatrix4fv(colormatrixloc, 1, GL_FALSE, colormatrix);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    drawnimage drawn = { image, buffer, NULL };
+    if (api.createSync) {
+        drawn.fence = api.createSync(display, EGL_SYNC_FENCE_KHR, NULL);
+    }
+    eglSwapBuffers(display, surface);
+    images.push_back(drawn);
+    while (images.size() > kImagesKept) {
+        drawnimage &oldest = images.front();
+        if (oldest.fence && api.clientWaitSync) {
+            api.clientWaitSync(display, oldest.fence,
+                               EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+        }
+        if (oldest.fence && api.destroySync) {
+            api.destroySync(display, oldest.fence);
+        }
+        api.deleteImage(oldest.image);
+        images.pop_front();
+    }
+    held = images.size();
+    frames++;
+    return true;
+}
+
+void texturesink::close() {
+    if (display != EGL_NO_DISPLAY) {
+        for (size_t i = 0; i < images.size(); i++) {
+            if (images[i].fence && api.destroySync) {
+                api.destroySync(display, images[i].fence);
+            }
+        }
+        unbindall();
+        if (program) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (eglcontext != EGL_NO_CONTEXT) {
+            eglDestroyContext(display, eglcontext);
+            eglcontext = EGL_NO_CONTEXT;
+        }
+        if (surface != EGL_NO_SURFACE) {
+            eglDestroySurface(display, surface);
+            surface = EGL_NO_SURFACE;
+        }
+        // the display is shared with the rest of the app, it stays
+        // initialized
+        display = EGL_NO_DISPLAY;
+    }
+    for (size_t i = 0; i < images.size(); i++) {
+        api.deleteImage(images[i].image);
+    }
+    images.clear();
+    held = 0;
+    // the codec must not render into the reader any more
+    if (reader) {
+        api.deleteReader(reader);
+        reader = NULL;
+    }
+}
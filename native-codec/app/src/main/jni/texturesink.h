@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TEXTURESINK_H
+#define TEXTURESINK_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <android/native_window.h>
+
+// AImageReader and AHardwareBuffer are API level 26, newer than the
+// platform this sample builds against, so they are looked up at runtime
+struct AImageReader;
+struct AImage;
+struct AHardwareBuffer;
+
+// Video sink for post-processing in GL. The codec renders into the buffers
+// of an image reader, which are bound to external textures through EGL
+// images without copies. Each frame is drawn to the window with a color
+// matrix, scaled to fit.
+//
+// open() and codecwindow() may be called from any thread, the rest from the
+// GL thread, which presents the frames.
+class texturesink {
+    public:
+        texturesink();
+        texturesink& operator=(const texturesink& ) = delete;
+        texturesink(texturesink&) = delete;
+        ~texturesink();
+
+        // poolsize images are shared by the codec and the sink, available is
+        // called on another thread when the codec rendered one; false if
+        // the device doesn't support it
+        bool open(int32_t width, int32_t height, int32_t poolsize,
+                  void (*available)(void *context), void *context);
+        // the window the codec renders to
+        ANativeWindow *codecwindow();
+
+        bool attach(ANativeWindow *window);
+        // draw the latest frame to the window, false if there was none
+        bool present();
+        void close();
+
+        // 4x4, column major, applied to the RGBA of the frames
+        void setcolormatrix(const float *m);
+
+        int32_t poolsize() const { return pool; }
+        // images held by the sink, the codec renders into the others
+        int32_t inflight() const { return held.load(); }
+        int64_t presented() const { return frames.load(); }
+
+    private:
+        // an image reader buffer bound to a texture, the reader reuses them
+        struct boundbuffer {
+            AHardwareBuffer *buffer;
+            void *image;        // EGLImageKHR
+            GLuint texture;
+        };
+
+        static void onimage(void *context, AImageReader *reader);
+        GLuint bind(AHardwareBuffer *buffer);
+        void unbindall();
+
+        AImageReader *reader;
+        int32_t width;
+        int32_t height;
+        int32_t pool;
+        void (*available)(void *context);
+        void *context;
+
+        EGLDisplay display;
+        EGLSurface surface;
+        EGLContext eglcontext;
+        GLuint program;
+        GLint colormatrixloc;
+        float colormatrix[16];
+        std::vector<boundbuffer> bound;
+        // drawn images, deleted once the GPU is done with them
+        struct drawnimage {
+            AImage *image;
+            AHardwareBuffer *buffer;
+            void *fence;        // EGLSyncKHR after the draw, or NULL
+        };
+        std::deque<drawnimage> images;
+
+        std::atomic<int32_t> held;
+        std::atomic<int64_t> frames;
+};
+
+#endif // TEXTURESINK_H
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Linux micro-benchmark of the native-codec looper: posts per second with
+// several posting threads, the latency from a post to its handle() call on
+// an idle looper, and how late timed messages are handled.
+//
+// Build and run on a Linux host from this directory:
+//   g++ -std=c++11 -O2 -pthread -I../app/src/main/jni looper_bench.cpp
+//       ../app/src/main/jni/looper.cpp -o looper_bench
+//   ./looper_bench [posting threads] [posts per thread]
+
+#include "looper.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+enum {
+    kMsgCount,
+    kMsgStamp,
+    kMsgFlush,
+    kMsgTimer,
+    kMsgSeq,
+};
+
+// Posting threads of checkflushrace()
+const int kSeqThreads = 2;
+
+static int64_t nowns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+class benchlooper: public looper {
+    public:
+        std::atomic<int64_t> handled;
+        std::atomic<int64_t> latency;   // of the last kMsgStamp
+        int64_t flushed;                // handled before kMsgFlush
+        std::vector<int64_t> lateness;  // of kMsgTimer, handled order
+        std::atomic<int> timers;
+        // kMsgSeq numbers of each posting thread, negative once flushed
+        std::vector<int> seqs[kSeqThreads];
+
+        benchlooper() : handled(0), latency(0), flushed(0), timers(0) {}
+
+        virtual void handle(int what, void *data) {
+            switch (what) {
+                case kMsgCount:
+                    handled.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                case kMsgStamp:
+                    latency.store(nowns() - *(int64_t*)data,
+                                  std::memory_order_release);
+                    break;
+                case kMsgFlush:
+                    flushed = handled.load();
+                    handled.store(-1, std::memory_order_release);
+                    break;
+                case kMsgTimer:
+                    lateness.push_back(nowns() - *(int64_t*)data);
+                    timers.fetch_add(1, std::memory_order_release);
+                    break;
+                case kMsgSeq: {
+                    intptr_t v = (intptr_t)data;
+                    int seq = v >> 8;
+                    seqs[v & 0xff].push_back(handled.load() < 0 ? -seq - 1 : seq);
+                    break;
+                }
+            }
+        }
+};
+
+struct poster {
+    benchlooper *l;
+    int count;
+};
+
+static void *postloop(void *p) {
+    poster *ps = (poster*)p;
+    for (int i = 0; i < ps->count; i++) {
+        ps->l->post(kMsgCount, NULL);
+    }
+    return NULL;
+}
+
+static void benchposts(int threads, int count) {
+    benchlooper l;
+    std::vector<pthread_t> workers(threads);
+    poster ps = { &l, count };
+
+    int64_t start = nowns();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, postloop, &ps);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    int64_t posted = nowns();
+    int64_t total = (int64_t)threads * count;
+    while (l.handled.load(std::memory_order_relaxed) < total) {
+        sched_yield();
+    }
+    int64_t done = nowns();
+    l.quit();
+
+    printf("%d threads x %d posts: %.2f M posts/s, %.2f M handled/s\n",
+           threads, count, total * 1e3 / (posted - start),
+           total * 1e3 / (done - start));
+}
+
+static void benchlatency(int samples) {
+    benchlooper l;
+    std::vector<int64_t> latencies;
+    for (int i = 0; i < samples; i++) {
+        // Let the looper block on its semaphore first
+        usleep(200);
+        l.latency.store(0);
+        int64_t stamp = nowns();
+        l.post(kMsgStamp, &stamp);
+        int64_t latency;
+        while (!(latency = l.latency.load(std::memory_order_acquire))) {
+            sched_yield();
+        }
+        latencies.push_back(latency);
+    }
+    l.quit();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("wake-up latency: p50 %.1f us, p90 %.1f us, p99 %.1f us\n",
+           latencies[samples / 2] / 1e3, latencies[samples * 9 / 10] / 1e3,
+           latencies[samples * 99 / 100] / 1e3);
+}
+
+// Timed messages posted out of order, a millisecond apart
+static void benchtimers(int count) {
+    benchlooper l;
+    std::vector<int64_t> when(count);
+    int64_t start = nowns() + 10000000;
+    for (int i = 0; i < count; i++) {
+        // every 7th slot, so posts are out of order
+        when[i] = start + (int64_t)(i * 7 % count) * 1000000;
+        l.post_at(kMsgTimer, &when[i], when[i]);
+    }
+    while (l.timers.load(std::memory_order_acquire) < count) {
+        usleep(1000);
+    }
+    l.quit();
+
+    std::vector<int64_t> late = l.lateness;
+    std::sort(late.begin(), late.end());
+    printf("timer lateness: p50 %.1f us, p99 %.1f us, min %.1f us\n",
+           late[count / 2] / 1e3, late[count * 99 / 100] / 1e3, late[0] / 1e3);
+}
+
+// A flushing post drops what was queued before it
+static bool checkflush() {
+    benchlooper l;
+    for (int i = 0; i < 100000; i++) {
+        l.post(kMsgCount, NULL);
+    }
+    l.post(kMsgFlush, NULL, true);
+    while (l.handled.load(std::memory_order_acquire) >= 0) {
+        sched_yield();
+    }
+    l.quit();
+    printf("flush: %lld of 100000 handled before it\n", (long long)l.flushed);
+    return l.flushed <= 100000;
+}
+
+struct seqposter {
+    benchlooper *l;
+    int thread;
+    int count;
+};
+
+static void *seqloop(void *p) {
+    seqposter *ps = (seqposter*)p;
+    for (int i = 0; i < ps->count; i++) {
+        ps->l->post(kMsgSeq, (void*)(((intptr_t)i << 8) | ps->thread));
+    }
+    return NULL;
+}
+
+// A flush posted while other threads post drops exactly what the queue
+// holds before it. Each thread's numbers are then handled up to some point
+// before the flush, dropped up to the flush and all handled after it.
+static bool checkflushrace(int rounds) {
+    const int count = 20000;
+    for (int r = 0; r < rounds; r++) {
+        benchlooper l;
+        pthread_t workers[kSeqThreads];
+        seqposter ps[kSeqThreads];
+        for (int i = 0; i < kSeqThreads; i++) {
+            ps[i] = { &l, i, count };
+            pthread_create(&workers[i], NULL, seqloop, &ps[i]);
+        }
+        usleep(r % 50 * 20);
+        l.post(kMsgFlush, NULL, true);
+        for (int i = 0; i < kSeqThreads; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        l.quit();
+
+        for (int i = 0; i < kSeqThreads; i++) {
+            const std::vector<int> &seqs = l.seqs[i];
+            size_t k = 0;
+            while (k < seqs.size() && seqs[k] == (int)k) {
+                k++;
+            }
+            // after the flush, a run up to the last post
+            int first = k < seqs.size() ? -seqs[k] - 1 : count;
+            for (size_t j = k; j < seqs.size(); j++) {
+                if (seqs[j] != -(first + (int)(j - k)) - 1) {
+                    printf("flush race: thread %d lost posts after the flush\n",
+                           i);
+                    return false;
+                }
+            }
+            if (first + (int)(seqs.size() - k) != count) {
+                printf("flush race: thread %d lost its last posts\n", i);
+                return false;
+            }
+        }
+    }
+    printf("flush race: %d rounds, nothing after a flush dropped\n", rounds);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int count = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    benchposts(1, count);
+    benchposts(threads, count);
+    benchlatency(1000);
+    benchtimers(500);
+    bool ok = checkflush();
+    return checkflushrace(200) && ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host stand-in for the OpenSL ES types the audio sink's header uses. The
+// sink of player_test.cpp plays on a virtual device instead.
+
+#ifndef FAKE_OPENSLES_H
+#define FAKE_OPENSLES_H
+
+typedef const struct SLObjectItf_ * const * SLObjectItf;
+typedef const struct SLEngineItf_ * const * SLEngineItf;
+typedef const struct SLPlayItf_ * const * SLPlayItf;
+
+#endif // FAKE_OPENSLES_H
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host stand-in for the NDK codec, the part of its API the player's sources
+// use. The codec of player_test.cpp decodes in virtual time, and logs the
+// output buffers released.
+
+#ifndef FAKE_NDK_MEDIA_CODEC_H
+#define FAKE_NDK_MEDIA_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "media/NdkMediaError.h"
+#include "media/NdkMediaFormat.h"
+
+struct AMediaCodec;
+typedef struct AMediaCodec AMediaCodec;
+
+typedef struct {
+    int32_t offset;
+    int32_t size;
+    int64_t presentationTimeUs;
+    uint32_t flags;
+} AMediaCodecBufferInfo;
+
+enum {
+    AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM = 4,
+    AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED = -3,
+    AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED = -2,
+    AMEDIACODEC_INFO_TRY_AGAIN_LATER = -1,
+};
+
+media_status_t AMediaCodec_delete(AMediaCodec *codec);
+media_status_t AMediaCodec_start(AMediaCodec *codec);
+media_status_t AMediaCodec_stop(AMediaCodec *codec);
+media_status_t AMediaCodec_flush(AMediaCodec *codec);
+ssize_t AMediaCodec_dequeueInputBuffer(AMediaCodec *codec, int64_t timeoutUs);
+uint8_t *AMediaCodec_getInputBuffer(AMediaCodec *codec, size_t idx,
+                                    size_t *out_size);
+media_status_t AMediaCodec_queueInputBuffer(AMediaCodec *codec, size_t idx,
+                                            off_t offset, size_t size,
+                                            uint64_t time, uint32_t flags);
+ssize_t AMediaCodec_dequeueOutputBuffer(AMediaCodec *codec,
+                                        AMediaCodecBufferInfo *info,
+                                        int64_t timeoutUs);
+uint8_t *AMediaCodec_getOutputBuffer(AMediaCodec *codec, size_t idx,
+                                     size_t *out_size);
+AMediaFormat *AMediaCodec_getOutputFormat(AMediaCodec *codec);
+media_status_t AMediaCodec_releaseOutputBuffer(AMediaCodec *codec, size_t idx,
+                                               bool render);
+
+#endif // FAKE_NDK_MEDIA_CODEC_H
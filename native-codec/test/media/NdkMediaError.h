@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host stand-in for the NDK media error codes
+
+#ifndef FAKE_NDK_MEDIA_ERROR_H
+#define FAKE_NDK_MEDIA_ERROR_H
+
+typedef int media_status_t;
+enum {
+    AMEDIA_OK = 0,
+    AMEDIA_ERROR_UNKNOWN = -10000,
+};
+
+#endif // FAKE_NDK_MEDIA_ERROR_H
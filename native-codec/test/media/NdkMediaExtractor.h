@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host stand-in for the NDK extractor, the part of its API the player's
+// sources use. The extractor of player_test.cpp reads the sample table of
+// a clip from a text file instead of parsing a container.
+
+#ifndef FAKE_NDK_MEDIA_EXTRACTOR_H
+#define FAKE_NDK_MEDIA_EXTRACTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "media/NdkMediaError.h"
+
+enum {
+    AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC = 1,
+    AMEDIAEXTRACTOR_SAMPLE_FLAG_ENCRYPTED = 2,
+};
+
+typedef enum {
+    AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC,
+    AMEDIAEXTRACTOR_SEEK_NEXT_SYNC,
+    AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC,
+} SeekMode;
+
+struct AMediaExtractor;
+typedef struct AMediaExtractor AMediaExtractor;
+
+AMediaExtractor* AMediaExtractor_new();
+media_status_t AMediaExtractor_delete(AMediaExtractor *ex);
+// location is the path of a sample table, lines of
+// "track timeus flags size", # starts a comment
+media_status_t AMediaExtractor_setDataSource(AMediaExtractor *ex,
+                                             const char *location);
+size_t AMediaExtractor_getTrackCount(AMediaExtractor *ex);
+media_status_t AMediaExtractor_selectTrack(AMediaExtractor *ex, size_t idx);
+media_status_t AMediaExtractor_seekTo(AMediaExtractor *ex, int64_t seekPosUs,
+                                      SeekMode mode);
+// the sample is as many zero bytes as its size in the table
+ssize_t AMediaExtractor_readSampleData(AMediaExtractor *ex, uint8_t *buffer,
+                                       size_t capacity);
+bool AMediaExtractor_advance(AMediaExtractor *ex);
+int AMediaExtractor_getSampleTrackIndex(AMediaExtractor *ex);
+int64_t AMediaExtractor_getSampleTime(AMediaExtractor *ex);
+uint32_t AMediaExtractor_getSampleFlags(AMediaExtractor *ex);
+
+#endif // FAKE_NDK_MEDIA_EXTRACTOR_H
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host stand-in for the NDK media format, the part of its API the player's
+// sources use. The formats of player_test.cpp only hold integers.
+
+#ifndef FAKE_NDK_MEDIA_FORMAT_H
+#define FAKE_NDK_MEDIA_FORMAT_H
+
+#include <stdint.h>
+
+#include "media/NdkMediaError.h"
+
+struct AMediaFormat;
+typedef struct AMediaFormat AMediaFormat;
+
+extern const char *AMEDIAFORMAT_KEY_CHANNEL_COUNT;
+extern const char *AMEDIAFORMAT_KEY_HEIGHT;
+extern const char *AMEDIAFORMAT_KEY_SAMPLE_RATE;
+extern const char *AMEDIAFORMAT_KEY_WIDTH;
+
+AMediaFormat *AMediaFormat_new();
+media_status_t AMediaFormat_delete(AMediaFormat *format);
+const char *AMediaFormat_toString(AMediaFormat *format);
+bool AMediaFormat_getInt32(AMediaFormat *format, const char *name,
+                           int32_t *out);
+void AMediaFormat_setInt32(AMediaFormat *format, const char *name,
+                           int32_t value);
+
+#endif // FAKE_NDK_MEDIA_FORMAT_H
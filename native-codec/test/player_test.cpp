@@ -0,0 +1,847 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Linux test of the native-codec player: the stages of player.cpp play the
+// sample table of clip.samples in virtual time, against fakes of what they
+// call on the device. The fake extractor reads the sample table, the fake
+// codecs decode in virtual time, the fake audio sink plays on a device that
+// runs fast, and the fake loopers and systemnanotime() run every stage from
+// one event queue. The test checks the frames the renderer releases.
+//
+// Build and run on a Linux host from this directory:
+//   g++ -std=c++11 -O2 -pthread -I. -I../app/src/main/jni player_test.cpp
+//       ../app/src/main/jni/player.cpp ../app/src/main/jni/mediaclock.cpp
+//       ../app/src/main/jni/syncindex.cpp -o player_test
+//   ./player_test [clip.samples]
+
+#include "media/NdkMediaCodec.h"
+#include "media/NdkMediaExtractor.h"
+#include "media/NdkMediaFormat.h"
+#include "audiosink.h"
+#include "looper.h"
+#include "player.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+static const int kVideoTrack = 0;
+static const int kAudioTrack = 1;
+
+// the virtual clock starts here, a seek request at 0 would look like none
+static const int64_t kStartNs = 1000000000;
+// and a play ends here at the latest
+static const int64_t kEndNs = kStartNs + 30000000000LL;
+// the fake codecs: input and output buffers, and the video decoder's time
+// per frame
+static const int kCodecBuffers = 4;
+static const int64_t kDecodeNs = 8000000;
+static const int32_t kVideoFrameBytes = 320 * 240 * 3 / 2;
+static const int32_t kSampleRate = 44100;
+static const int32_t kChannels = 2;
+static const int32_t kAudioFrameBytes = 1024 * kChannels * 2;
+// the fake audio device plays this much faster than its nominal rate, and
+// starts playing this long after it is told to
+static const double kAudioRate = 1.005;
+static const int64_t kAudioStartNs = 10000000;
+// drift is measured from this long after the start
+static const int64_t kSettleNs = 1000000000;
+// a stall of the decoder at this frame, long enough to make frames late
+static const int kStallFrame = 150;
+static const int64_t kStallNs = 250000000;
+
+// Virtual time: the loopers, the codecs and the audio device post events,
+// run in time order from one thread. An event's owner cancels it when it is
+// flushed or deleted.
+struct simevent {
+    void *owner;
+    std::function<void()> run;
+};
+
+static int64_t simnow;
+static uint64_t simseq;
+static std::map<std::pair<int64_t, uint64_t>, simevent> simevents;
+
+static void schedule(int64_t when, void *owner, std::function<void()> run) {
+    simevent e = { owner, run };
+    simevents[std::make_pair(std::max(when, simnow), simseq++)] = e;
+}
+
+static void cancel(void *owner) {
+    for (auto i = simevents.begin(); i != simevents.end();) {
+        if (i->second.owner == owner) {
+            i = simevents.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+// runs the first event, of owner if not NULL, due by until; returns false
+// if there was none
+static bool runnext(void *owner, int64_t until) {
+    for (auto i = simevents.begin(); i != simevents.end(); ++i) {
+        if (i->first.first > until) {
+            break;
+        }
+        if (!owner || i->second.owner == owner) {
+            simnow = std::max(simnow, i->first.first);
+            std::function<void()> run = i->second.run;
+            simevents.erase(i);
+            run();
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t systemnanotime() {
+    return simnow;
+}
+
+// The loopers run their messages as events, a flushing post cancels the
+// ones still waiting
+looper::looper() {
+}
+
+looper::~looper() {
+    cancel(this);
+}
+
+void looper::postmsg(int what, void *data, bool flush, int64_t when) {
+    if (flush) {
+        cancel(this);
+    }
+    schedule(when, this, [this, what, data]() { handle(what, data); });
+}
+
+void looper::post(int what, void *data, bool flush) {
+    postmsg(what, data, flush, simnow);
+}
+
+void looper::post_at(int what, void *data, int64_t when_ns) {
+    postmsg(what, data, false, when_ns);
+}
+
+void looper::post_delayed(int what, void *data, int64_t delay_ns) {
+    postmsg(what, data, false, simnow + delay_ns);
+}
+
+// like the looper thread, handles the messages that are due and drops the
+// timed ones
+void looper::quit() {
+    while (runnext(this, simnow)) {
+    }
+    cancel(this);
+}
+
+void looper::handle(int what, void *data) {
+    (void) what;
+    (void) data;
+}
+
+struct AMediaFormat {
+    std::map<std::string, int32_t> values;
+};
+
+const char *AMEDIAFORMAT_KEY_CHANNEL_COUNT = "channel-count";
+const char *AMEDIAFORMAT_KEY_HEIGHT = "height";
+const char *AMEDIAFORMAT_KEY_SAMPLE_RATE = "sample-rate";
+const char *AMEDIAFORMAT_KEY_WIDTH = "width";
+
+AMediaFormat *AMediaFormat_new() {
+    return new AMediaFormat;
+}
+
+media_status_t AMediaFormat_delete(AMediaFormat *format) {
+    delete format;
+    return AMEDIA_OK;
+}
+
+const char *AMediaFormat_toString(AMediaFormat *format) {
+    (void) format;
+    return "fake format";
+}
+
+bool AMediaFormat_getInt32(AMediaFormat *format, const char *name,
+                           int32_t *out) {
+    auto i = format->values.find(name);
+    if (i == format->values.end()) {
+        return false;
+    }
+    *out = i->second;
+    return true;
+}
+
+void AMediaFormat_setInt32(AMediaFormat *format, const char *name,
+                           int32_t value) {
+    format->values[name] = value;
+}
+
+struct sample {
+    int track;
+    int64_t us;
+    uint32_t flags;
+    size_t size;
+};
+
+struct AMediaExtractor {
+    std::vector<sample> samples;    // in file order
+    std::vector<bool> selected;
+    size_t pos;
+};
+
+AMediaExtractor* AMediaExtractor_new() {
+    AMediaExtractor *ex = new AMediaExtractor;
+    ex->pos = 0;
+    return ex;
+}
+
+media_status_t AMediaExtractor_delete(AMediaExtractor *ex) {
+    delete ex;
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaExtractor_setDataSource(AMediaExtractor *ex,
+                                             const char *location) {
+    FILE *f = fopen(location, "r");
+    if (!f) {
+        return AMEDIA_ERROR_UNKNOWN;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        sample s;
+        long long us;
+        unsigned size;
+        if (line[0] == '#' ||
+            sscanf(line, "%d %lld %u %u", &s.track, &us, &s.flags,
+                   &size) != 4) {
+            continue;
+        }
+        s.us = us;
+        s.size = size;
+        ex->samples.push_back(s);
+        if ((size_t)s.track >= ex->selected.size()) {
+            ex->selected.resize(s.track + 1, false);
+        }
+    }
+    fclose(f);
+    ex->pos = 0;
+    return ex->samples.empty() ? AMEDIA_ERROR_UNKNOWN : AMEDIA_OK;
+}
+
+size_t AMediaExtractor_getTrackCount(AMediaExtractor *ex) {
+    return ex->selected.size();
+}
+
+static void skipunselected(AMediaExtractor *ex) {
+    while (ex->pos < ex->samples.size() &&
+           !ex->selected[ex->samples[ex->pos].track]) {
+        ex->pos++;
+    }
+}
+
+media_status_t AMediaExtractor_selectTrack(AMediaExtractor *ex, size_t idx) {
+    if (idx >= ex->selected.size()) {
+        return AMEDIA_ERROR_UNKNOWN;
+    }
+    ex->selected[idx] = true;
+    ex->pos = 0;
+    skipunselected(ex);
+    return AMEDIA_OK;
+}
+
+// the other modes seek like AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC
+media_status_t AMediaExtractor_seekTo(AMediaExtractor *ex, int64_t seekPosUs,
+                                      SeekMode mode) {
+    (void) mode;
+    ex->pos = 0;
+    skipunselected(ex);
+    for (size_t i = 0; i < ex->samples.size(); i++) {
+        const sample &s = ex->samples[i];
+        if (s.us > seekPosUs) {
+            break;
+        }
+        if (ex->selected[s.track] &&
+            (s.flags & AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC)) {
+            ex->pos = i;
+        }
+    }
+    return AMEDIA_OK;
+}
+
+ssize_t AMediaExtractor_readSampleData(AMediaExtractor *ex, uint8_t *buffer,
+                                       size_t capacity) {
+    if (ex->pos >= ex->samples.size() || ex->samples[ex->pos].size > capacity) {
+        return -1;
+    }
+    memset(buffer, 0, ex->samples[ex->pos].size);
+    return ex->samples[ex->pos].size;
+}
+
+bool AMediaExtractor_advance(AMediaExtractor *ex) {
+    if (ex->pos < ex->samples.size()) {
+        ex->pos++;
+        skipunselected(ex);
+    }
+    return ex->pos < ex->samples.size();
+}
+
+int AMediaExtractor_getSampleTrackIndex(AMediaExtractor *ex) {
+    return ex->pos < ex->samples.size() ? ex->samples[ex->pos].track : -1;
+}
+
+int64_t AMediaExtractor_getSampleTime(AMediaExtractor *ex) {
+    return ex->pos < ex->samples.size() ? ex->samples[ex->pos].us : -1;
+}
+
+uint32_t AMediaExtractor_getSampleFlags(AMediaExtractor *ex) {
+    return ex->pos < ex->samples.size() ? ex->samples[ex->pos].flags : 0;
+}
+
+// A frame the video codec released, and what the renderer had decided
+struct release {
+    int64_t pts;
+    int64_t ns;
+    bool render;
+    bool late;
+    bool dropped;
+    bool measured;      // on time, after kSettleNs
+    int64_t driftus;    // ahead of the audio heard
+};
+
+// The fake codecs decode a frame per input buffer, into one of
+// kCodecBuffers output buffers. The video codec runs in asynchronous mode,
+// kDecodeNs per frame, and a frame waits for a free output buffer. The
+// audio codec runs in synchronous mode and decodes at once, its first
+// output is a format change.
+struct AMediaCodec {
+    struct input {
+        int index;
+        int64_t pts;
+        uint32_t flags;
+    };
+
+    bool video;
+    void *userdata;         // the workerdata, for the callbacks
+    int stallat;            // the frame the decoder stalls at, -1 if none
+    bool started;
+    bool busy;              // decoding a video frame
+    bool formatpending;
+    int frames;             // decoded
+    // in asynchronous mode an input buffer is free until it is announced
+    bool inputfree[kCodecBuffers];
+    bool outputfree[kCodecBuffers];
+    AMediaCodecBufferInfo outputinfo[kCodecBuffers];
+    std::deque<input> queued;
+    std::deque<int> decoded;    // synchronous mode
+    std::vector<release> releases;
+};
+
+static uint8_t inputbuffer[65536];
+static uint8_t outputbuffer[kAudioFrameBytes];
+// the audio heard, see audiosink::open()
+static struct {
+    bool reports;       // the sink reports played buffers to the clock
+    bool playing;
+    bool busy;
+    int64_t readyns;    // the device plays from here, once told to
+    // the buffer playing, or the last one played
+    int64_t startus;
+    int64_t startns;
+    int64_t endus;
+    std::function<void()> kick;     // play the next buffer if idle
+} device;
+
+// media time heard at ns
+static int64_t heardus(int64_t ns) {
+    int64_t us = device.startus + (int64_t)((ns - device.startns) * kAudioRate / 1000);
+    return std::max(device.startus, std::min(us, device.endus));
+}
+
+static AMediaCodec *newCodec(bool video, void *userdata, int stallat) {
+    AMediaCodec *c = new AMediaCodec();
+    c->video = video;
+    c->userdata = userdata;
+    c->stallat = stallat;
+    c->formatpending = !video;
+    for (int i = 0; i < kCodecBuffers; i++) {
+        c->inputfree[i] = true;
+        c->outputfree[i] = true;
+    }
+    return c;
+}
+
+static void decode(AMediaCodec *c) {
+    while (c->started && !c->busy && !c->queued.empty()) {
+        int out = 0;
+        while (out < kCodecBuffers && !c->outputfree[out]) {
+            out++;
+        }
+        if (out == kCodecBuffers) {
+            return;
+        }
+        AMediaCodec::input in = c->queued.front();
+        c->queued.pop_front();
+        c->outputfree[out] = false;
+        AMediaCodecBufferInfo info = {};
+        info.presentationTimeUs = in.pts;
+        info.flags = in.flags;
+        if (!(in.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM)) {
+            info.size = c->video ? kVideoFrameBytes : kAudioFrameBytes;
+        }
+        c->outputinfo[out] = info;
+        if (!c->video) {
+            c->inputfree[in.index] = true;
+            c->decoded.push_back(out);
+            continue;
+        }
+        // the input buffer is free once the decoder took it
+        schedule(simnow, c, [c, in]() {
+            onInputAvailable(c, c->userdata, in.index);
+        });
+        int64_t ns = kDecodeNs;
+        if (c->frames++ == c->stallat) {
+            ns += kStallNs;
+        }
+        c->busy = true;
+        schedule(simnow + ns, c, [c, out]() {
+            c->busy = false;
+            onOutputAvailable(c, c->userdata, out, &c->outputinfo[out]);
+            decode(c);
+        });
+    }
+}
+
+media_status_t AMediaCodec_delete(AMediaCodec *codec) {
+    cancel(codec);
+    delete codec;
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaCodec_start(AMediaCodec *codec) {
+    codec->started = true;
+    if (codec->video) {
+        for (int i = 0; i < kCodecBuffers; i++) {
+            if (codec->inputfree[i]) {
+                codec->inputfree[i] = false;
+                schedule(simnow, codec, [codec, i]() {
+                    onInputAvailable(codec, codec->userdata, i);
+                });
+            }
+        }
+    }
+    decode(codec);
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaCodec_stop(AMediaCodec *codec) {
+    cancel(codec);
+    codec->started = false;
+    return AMEDIA_OK;
+}
+
+// drops the frames queued and decoding, asynchronous mode needs a start
+media_status_t AMediaCodec_flush(AMediaCodec *codec) {
+    cancel(codec);
+    codec->started = !codec->video;
+    codec->busy = false;
+    codec->queued.clear();
+    codec->decoded.clear();
+    for (int i = 0; i < kCodecBuffers; i++) {
+        codec->inputfree[i] = true;
+        codec->outputfree[i] = true;
+    }
+    return AMEDIA_OK;
+}
+
+ssize_t AMediaCodec_dequeueInputBuffer(AMediaCodec *codec, int64_t timeoutUs) {
+    (void) timeoutUs;
+    for (int i = 0; i < kCodecBuffers; i++) {
+        if (codec->inputfree[i]) {
+            codec->inputfree[i] = false;
+            return i;
+        }
+    }
+    return AMEDIACODEC_INFO_TRY_AGAIN_LATER;
+}
+
+uint8_t *AMediaCodec_getInputBuffer(AMediaCodec *codec, size_t idx,
+                                    size_t *out_size) {
+    (void) codec;
+    (void) idx;
+    *out_size = sizeof(inputbuffer);
+    return inputbuffer;
+}
+
+media_status_t AMediaCodec_queueInputBuffer(AMediaCodec *codec, size_t idx,
+                                            off_t offset, size_t size,
+                                            uint64_t time, uint32_t flags) {
+    (void) offset;
+    (void) size;
+    AMediaCodec::input in = { (int)idx, (int64_t)time, flags };
+    codec->queued.push_back(in);
+    decode(codec);
+    return AMEDIA_OK;
+}
+
+ssize_t AMediaCodec_dequeueOutputBuffer(AMediaCodec *codec,
+                                        AMediaCodecBufferInfo *info,
+                                        int64_t timeoutUs) {
+    (void) timeoutUs;
+    if (codec->formatpending) {
+        codec->formatpending = false;
+        return AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED;
+    }
+    if (codec->decoded.empty()) {
+        return AMEDIACODEC_INFO_TRY_AGAIN_LATER;
+    }
+    int out = codec->decoded.front();
+    codec->decoded.pop_front();
+    *info = codec->outputinfo[out];
+    return out;
+}
+
+uint8_t *AMediaCodec_getOutputBuffer(AMediaCodec *codec, size_t idx,
+                                     size_t *out_size) {
+    (void) codec;
+    (void) idx;
+    *out_size = sizeof(outputbuffer);
+    return outputbuffer;
+}
+
+AMediaFormat *AMediaCodec_getOutputFormat(AMediaCodec *codec) {
+    AMediaFormat *format = AMediaFormat_new();
+    if (codec->video) {
+        AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, 320);
+        AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, 240);
+    } else {
+        AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, kSampleRate);
+        AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, kChannels);
+    }
+    return format;
+}
+
+// the renderer counts a frame before it releases it, so the counts tell
+// what it decided
+media_status_t AMediaCodec_releaseOutputBuffer(AMediaCodec *codec, size_t idx,
+                                               bool render) {
+    codec->outputfree[idx] = true;
+    if (codec->video && codec->outputinfo[idx].size > 0) {
+        codecstats *s = &((workerdata*)codec->userdata)->stats;
+        int64_t late = 0, dropped = 0;
+        for (size_t i = 0; i < codec->releases.size(); i++) {
+            late += codec->releases[i].late;
+            dropped += codec->releases[i].dropped;
+        }
+        release r = { codec->outputinfo[idx].presentationTimeUs, simnow, render,
+                      s->late > late, s->dropped > dropped, false, 0 };
+        if (render && !r.late && simnow >= kStartNs + kSettleNs) {
+            r.measured = true;
+            r.driftus = r.pts - heardus(simnow);
+        }
+        codec->releases.push_back(r);
+    }
+    decode(codec);
+    return AMEDIA_OK;
+}
+
+// The sink plays on a device, which plays the queued buffers one after the
+// other, kAudioRate times faster than their rate, from kAudioStartNs after
+// it is told to play. Like the OpenSL ES callback, the device reports each
+// buffer played.
+static const SLObjectItf_ *const kDevice = NULL;
+
+audiosink::audiosink(mediaclock *clock) : clock(clock), bytespersecond(0),
+        nextwrite(0), nextplayed(0), queued(0), engineobject(NULL),
+        engine(NULL), mixobject(NULL), playerobject(NULL), player(NULL),
+        queue(NULL) {
+}
+
+audiosink::~audiosink() {
+    close();
+}
+
+bool audiosink::open(int32_t samplerate, int32_t channels) {
+    close();
+    playerobject = &kDevice;
+    bytespersecond = samplerate * channels * 2;
+    nextwrite = nextplayed = queued = 0;
+    device.kick = [this]() {
+        if (!device.playing || device.busy || queued == 0) {
+            return;
+        }
+        const buffer &b = buffers[nextplayed];
+        int64_t lengthus = (int64_t)b.data.size() * 1000000 / bytespersecond;
+        device.busy = true;
+        device.startns = std::max(simnow, device.readyns);
+        device.startus = b.endus - lengthus;
+        device.endus = b.endus;
+        schedule(device.startns + (int64_t)(lengthus * 1000 / kAudioRate), this,
+                 [this]() {
+            device.busy = false;
+            callback(NULL, this);
+            device.kick();
+        });
+    };
+    return true;
+}
+
+void audiosink::close() {
+    cancel(this);
+    playerobject = NULL;
+    device.playing = false;
+    device.busy = false;
+}
+
+bool audiosink::write(const void *pcm, size_t size, int64_t ptsus) {
+    if (!playerobject || size == 0) {
+        return true;
+    }
+    std::lock_guard<std::mutex> l(lock);
+    if (queued == kBuffers) {
+        return false;
+    }
+    buffer &b = buffers[nextwrite];
+    b.data.assign((const uint8_t*)pcm, (const uint8_t*)pcm + size);
+    b.endus = ptsus + (int64_t)size * 1000000 / bytespersecond;
+    nextwrite = (nextwrite + 1) % kBuffers;
+    queued++;
+    device.kick();
+    return true;
+}
+
+void audiosink::play() {
+    if (playerobject && !device.playing) {
+        device.playing = true;
+        device.readyns = simnow + kAudioStartNs;
+        device.kick();
+    }
+}
+
+// the buffer playing is played again from its start
+void audiosink::pause() {
+    cancel(this);
+    device.playing = false;
+    device.busy = false;
+}
+
+void audiosink::flush() {
+    std::lock_guard<std::mutex> l(lock);
+    cancel(this);
+    device.busy = false;
+    nextwrite = nextplayed = queued = 0;
+}
+
+void audiosink::callback(SLAndroidSimpleBufferQueueItf bq, void *context) {
+    (void) bq;
+    ((audiosink*)context)->played();
+}
+
+void audiosink::played() {
+    int64_t endus;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (queued == 0) {
+            return;
+        }
+        endus = buffers[nextplayed].endus;
+        nextplayed = (nextplayed + 1) % kBuffers;
+        queued--;
+    }
+    if (device.reports) {
+        clock->sync(endus, systemnanotime());
+    }
+}
+
+static AMediaExtractor* openTrack(const char *clip, int track) {
+    AMediaExtractor *ex = AMediaExtractor_new();
+    if (AMediaExtractor_setDataSource(ex, clip) != AMEDIA_OK ||
+        AMediaExtractor_selectTrack(ex, track) != AMEDIA_OK) {
+        fprintf(stderr, "can't read track %d of %s\n", track, clip);
+        exit(2);
+    }
+    return ex;
+}
+
+// waits for the index thread to get to the end of the clip
+static bool waitindex(syncindex *index) {
+    int64_t us;
+    for (int i = 0; i < 1000; i++) {
+        if (index->syncbefore(9999999, &us)) {
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+struct playresult {
+    int rendered;
+    int late;
+    int dropped;
+    int skipped;
+    int64_t firstus;                    // of the first frame rendered
+    // of frames on time, after kSettleNs: the largest, and how far it moved
+    int64_t maxdriftus;
+    int64_t driftrangeus;
+    std::vector<int64_t> lateus;        // late or dropped frames
+    bool statsok;                       // the stats count the same frames
+};
+
+// Opens the clip as native-codec-jni.cpp does, seeks to seekus if not 0,
+// plays to the end and shuts the player down
+static playresult play(const char *clip, int64_t seekus, bool audiosync,
+                       int stallat) {
+    simnow = kStartNs;
+    device.reports = audiosync;
+    workerdata *d = new workerdata();
+    d->async = true;
+    AMediaCodec *codec = newCodec(true, d, stallat);
+    setupVideo(d, openTrack(clip, kVideoTrack), codec);
+    d->index.build(openTrack(clip, kVideoTrack));
+    if (!waitindex(&d->index)) {
+        fprintf(stderr, "the index of %s isn't done\n", clip);
+        exit(1);
+    }
+    AMediaFormat *format = AMediaFormat_new();
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, kSampleRate);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, kChannels);
+    setupAudio(d, openTrack(clip, kAudioTrack), newCodec(false, d, -1), format);
+    AMediaFormat_delete(format);
+
+    startPlayer(d);
+    if (seekus > 0) {
+        seekPlayer(d, seekus, true);
+    }
+    setPlaying(d, true);
+    while (runnext(NULL, kEndNs)) {
+    }
+
+    playresult r = playresult();
+    r.firstus = -1;
+    int64_t mindrift = INT64_MAX, maxdrift = INT64_MIN;
+    for (size_t i = 0; i < codec->releases.size(); i++) {
+        const release &f = codec->releases[i];
+        if (f.render) {
+            r.rendered++;
+            if (r.firstus < 0) {
+                r.firstus = f.pts;
+            }
+        } else if (!f.dropped) {
+            r.skipped++;
+        }
+        if (f.late || f.dropped) {
+            r.late += f.late;
+            r.dropped += f.dropped;
+            r.lateus.push_back(f.pts);
+        }
+        if (f.measured) {
+            r.maxdriftus = std::max(r.maxdriftus, (int64_t)llabs(f.driftus));
+            mindrift = std::min(mindrift, f.driftus);
+            maxdrift = std::max(maxdrift, f.driftus);
+        }
+    }
+    r.driftrangeus = maxdrift - mindrift;
+    const codecstats &s = d->stats;
+    r.statsok = s.rendered == r.rendered && s.late == r.late &&
+                s.dropped == r.dropped && s.skipped == r.skipped &&
+                s.decoded == (int64_t)codec->releases.size() &&
+                s.seeks == (seekus > 0 ? 1 : 0) && d->sawOutputEOS &&
+                d->audio.sawOutputEOS;
+    stopPlayer(d);
+    delete d;
+
+    printf("from %.1f s, %s%s: rendered %d, late %d, dropped %d, skipped %d,"
+           " max A/V drift %.2f ms, drift range %.2f ms\n", seekus / 1e6,
+           audiosync ? "audio sync" : "free-running",
+           stallat >= 0 ? ", decoder stall" : "", r.rendered, r.late,
+           r.dropped, r.skipped, r.maxdriftus / 1e3, r.driftrangeus / 1e3);
+    return r;
+}
+
+static bool check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+    }
+    return ok;
+}
+
+static bool checkindex(syncindex *index) {
+    int64_t us = -1;
+    bool ok = check(index->syncbefore(0, &us) && us == 0,
+                    "first keyframe at 0");
+    ok &= check(index->syncbefore(4500000, &us) && us == 4000000,
+                "keyframe before 4.5 s at 4 s");
+    ok &= check(index->syncbefore(9999999, &us) && us == 9000000,
+                "last keyframe at 9 s");
+    ok &= check(!index->syncbefore(-1, &us), "no keyframe before 0");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    const char *clip = argc > 1 ? argv[1] : "clip.samples";
+
+    syncindex index;
+    index.build(openTrack(clip, kVideoTrack));
+    waitindex(&index);
+    bool ok = checkindex(&index);
+    index.stop();
+
+    playresult r = play(clip, 0, true, -1);
+    ok &= check(r.statsok, "the player's stats match the frames released");
+    ok &= check(r.maxdriftus < 10000, "audio sync keeps A/V drift under 10 ms");
+    ok &= check(r.late == 0 && r.dropped == 0, "no late frames without stall");
+    ok &= check(r.rendered == 300, "all frames rendered");
+
+    r = play(clip, 0, false, -1);
+    ok &= check(r.driftrangeus > 40000, "free-running video drifts from audio");
+
+    r = play(clip, 0, true, kStallFrame);
+    ok &= check(r.statsok, "the player's stats match the frames released");
+    ok &= check(r.late > 0, "a decoder stall makes frames late");
+    ok &= check(r.dropped > 0, "a decoder stall drops frames");
+    int64_t stallus = kStallFrame * 1000000LL / 30;
+    bool install = true;
+    for (size_t i = 0; i < r.lateus.size(); i++) {
+        install &= r.lateus[i] >= stallus &&
+                   r.lateus[i] < stallus + kStallNs / 1000 + 100000;
+    }
+    ok &= check(install, "late frames only right after the stall");
+    ok &= check(r.maxdriftus < 10000, "A/V drift recovers after the stall");
+
+    r = play(clip, 4500000, true, -1);
+    ok &= check(r.statsok, "the player's stats match the frames released");
+    ok &= check(r.skipped == 15, "seek decodes from the keyframe at 4 s");
+    // the audio starts at once, so the frames the decoder is late with
+    // after the keyframe are dropped, but none before the target is shown
+    ok &= check(r.firstus >= 4500000 && r.firstus < 4700000,
+                "seek shows frames from the target on");
+    ok &= check(r.maxdriftus < 10000, "A/V drift stays low after a seek");
+
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
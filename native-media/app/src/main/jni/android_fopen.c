@@ -17,9 +17,13 @@
 // The original code is from https://github.com/netguy204/gambit-game-lib
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "android_fopen.h"
 #include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <android/asset_manager.h>
 
 static int android_read(void* cookie, char* buf, int size) {
@@ -45,11 +49,163 @@ void android_fopen_set_asset_manager(AAssetManager* manager) {
     android_asset_manager = manager;
 }
 
+static android_asset_stream* open_mapped(AAsset* asset);
+static int mapped_read(void* cookie, char* buf, int size);
+static fpos_t mapped_seek(void* cookie, fpos_t offset, int whence);
+static int mapped_close(void* cookie);
+
 FILE* android_fopen(const char* fname, const char* mode) {
     if(mode[0] == 'w') return NULL;
 
     AAsset* asset = AAssetManager_open(android_asset_manager, fname, 0);
     if(!asset) return NULL;
 
+    // uncompressed assets are read straight from their mapping, without the
+    // stdio buffer in between
+    android_asset_stream* stream = open_mapped(asset);
+    if(stream) {
+        AAsset_close(asset);
+        FILE* file = funopen(stream, mapped_read, android_write, mapped_seek, mapped_close);
+        if(file) setvbuf(file, NULL, _IONBF, 0);
+        else android_asset_stream_close(stream);
+        return file;
+    }
+
     return funopen(asset, android_read, android_write, android_seek, android_close);
-}
\ No newline at end of file
+}
+
+// how much of a compressed asset is streamed at once
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+struct android_asset_stream {
+    off_t length;
+    // mapped: the pages from the one holding the start of the asset
+    void* map;
+    size_t map_size;
+    const char* data;
+    // streamed: the asset and the buffer it is read into
+    AAsset* asset;
+    char* buffer;
+    // where the asset is read, or the FILE* position of a mapped asset
+    off_t position;
+};
+
+// a stream on the mapping of asset, NULL if it can't be mapped
+static android_asset_stream* open_mapped(AAsset* asset) {
+    // a descriptor is only available if the asset isn't compressed
+    off_t start, length;
+    int fd = AAsset_openFileDescriptor(asset, &start, &length);
+    if(fd < 0) return NULL;
+
+    // the mapping starts at a page boundary
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t map_start = start & ~(page - 1);
+    size_t map_size = length + (start - map_start);
+    void* map = length > 0 ?
+        mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, map_start) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED) return NULL;
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    android_asset_stream* stream = calloc(1, sizeof(android_asset_stream));
+    if(!stream) {
+        munmap(map, map_size);
+        return NULL;
+    }
+    stream->length = length;
+    stream->map = map;
+    stream->map_size = map_size;
+    stream->data = (const char*)map + (start - map_start);
+    return stream;
+}
+
+android_asset_stream* android_asset_stream_open(const char* fname) {
+    AAsset* asset = AAssetManager_open(android_asset_manager, fname, AASSET_MODE_STREAMING);
+    if(!asset) return NULL;
+
+    android_asset_stream* stream = open_mapped(asset);
+    if(stream) {
+        AAsset_close(asset);
+        return stream;
+    }
+
+    stream = calloc(1, sizeof(android_asset_stream));
+    if(stream) stream->buffer = malloc(STREAM_BUFFER_SIZE);
+    if(!stream || !stream->buffer) {
+        free(stream);
+        AAsset_close(asset);
+        return NULL;
+    }
+    stream->length = AAsset_getLength(asset);
+    stream->asset = asset;
+    return stream;
+}
+
+void android_asset_stream_close(android_asset_stream* stream) {
+    if(!stream) return;
+    if(stream->map) munmap(stream->map, stream->map_size);
+    if(stream->asset) AAsset_close(stream->asset);
+    free(stream->buffer);
+    free(stream);
+}
+
+// the FILE* of a mapped asset reads from the mapping at the stream position
+static int mapped_read(void* cookie, char* buf, int size) {
+    android_asset_stream* stream = (android_asset_stream*)cookie;
+    const void* data;
+    ssize_t span = android_asset_stream_span(stream, stream->position, size, &data);
+    if(span > 0) {
+        memcpy(buf, data, span);
+        stream->position += span;
+    }
+    return span;
+}
+
+static fpos_t mapped_seek(void* cookie, fpos_t offset, int whence) {
+    android_asset_stream* stream = (android_asset_stream*)cookie;
+    off_t position = offset;
+    if(whence == SEEK_CUR) position += stream->position;
+    else if(whence == SEEK_END) position += stream->length;
+    if(position < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    stream->position = position;
+    return position;
+}
+
+static int mapped_close(void* cookie) {
+    android_asset_stream_close((android_asset_stream*)cookie);
+    return 0;
+}
+
+off_t android_asset_stream_length(const android_asset_stream* stream) {
+    return stream->length;
+}
+
+int android_asset_stream_is_mapped(const android_asset_stream* stream) {
+    return stream->map != NULL;
+}
+
+ssize_t android_asset_stream_span(android_asset_stream* stream, off_t offset,
+                                  size_t size, const void** data) {
+    if(offset < 0) return -1;
+    if(offset >= stream->length) return 0;
+    if((off_t)size > stream->length - offset) size = stream->length - offset;
+
+    if(stream->map) {
+        *data = stream->data + offset;
+        return size;
+    }
+
+    if(offset != stream->position) {
+        if(AAsset_seek(stream->asset, offset, SEEK_SET) != offset) return -1;
+        stream->position = offset;
+    }
+    if(size > STREAM_BUFFER_SIZE) size = STREAM_BUFFER_SIZE;
+    int bytes_read = AAsset_read(stream->asset, stream->buffer, size);
+    if(bytes_read < 0) return -1;
+    stream->position += bytes_read;
+    *data = stream->buffer;
+    return bytes_read;
+}
@@ -18,6 +18,7 @@
 #define ANDROID_FOPEN_H
 
 #include <stdio.h>
+#include <sys/types.h>
 #include <android/asset_manager.h>
 
 #ifdef __cplusplus
@@ -32,6 +33,25 @@ FILE* android_fopen(const char* fname, const char* mode);
 
 #define fopen(name, mode) android_fopen(name, mode)
 
+/* a read-only view of an asset that hands out spans of it without copying:
+   the asset is memory-mapped when it is stored uncompressed in the APK, and
+   streamed through a buffer otherwise */
+
+typedef struct android_asset_stream android_asset_stream;
+
+android_asset_stream* android_asset_stream_open(const char* fname);
+void android_asset_stream_close(android_asset_stream* stream);
+
+off_t android_asset_stream_length(const android_asset_stream* stream);
+int android_asset_stream_is_mapped(const android_asset_stream* stream);
+
+/* points *data to up to size bytes of the asset from offset, and returns how
+   many, 0 at the end or -1 on error. The span is valid until the stream is
+   closed if it is mapped, or else until the next call. Streamed assets are
+   best read in order, other offsets seek. */
+ssize_t android_asset_stream_span(android_asset_stream* stream, off_t offset,
+                                  size_t size, const void** data);
+
 #ifdef __cplusplus
 }
 #endif
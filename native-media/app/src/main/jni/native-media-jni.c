@@ -26,6 +26,7 @@
 #include <assert.h>
 #include <jni.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -42,6 +43,7 @@
 #include <android/native_window_jni.h>
 #include <android/asset_manager_jni.h>
 #include "android_fopen.h"
+#include "tsdemux.h"
 
 // engine interfaces
 static XAObjectItf engineObject = NULL;
@@ -75,12 +77,22 @@ static ANativeWindow* theNativeWindow;
 // determines how much memory we're dedicating to memory caching
 #define BUFFER_SIZE (PACKETS_PER_BUFFER*MPEG2_TS_PACKET_SIZE)
 
+// number of buffers the reader thread keeps filled ahead of the player,
+// must be more than NB_BUFFERS
+#define NB_RING_BUFFERS 64
+
+// most buffers the reader thread fills with a single read
+#define MAX_BUFFERS_PER_READ 16
+
 // where we cache in memory the data to play
-// note this memory is re-used by the buffer queue callback
-static char dataCache[BUFFER_SIZE * NB_BUFFERS];
+// note this memory is re-used once the player has consumed a buffer
+static char dataCache[BUFFER_SIZE * NB_RING_BUFFERS];
+
+// size of the data in each buffer of dataCache, whole packets
+static size_t bufferSizes[NB_RING_BUFFERS];
 
-// handle of the file to play
-static FILE *file;
+// the file to play, mapped if the asset is stored uncompressed in the APK
+static android_asset_stream *file;
 
 // has the app reached the end of the file
 static jboolean reachedEof = JNI_FALSE;
@@ -88,9 +100,10 @@ static jboolean reachedEof = JNI_FALSE;
 // constant to identify a buffer context which is the end of the stream to decode
 static const int kEosBufferCntxt = 1980; // a magic value we can compare against
 
-// For mutual exclusion between callback thread and application thread(s).
-// The mutex protects reachedEof, discontinuity,
-// The condition is signalled when a discontinuity is acknowledged.
+// For mutual exclusion between callback thread, reader thread and application thread(s).
+// The mutex protects reachedEof, discontinuity and the state of the ring.
+// The condition is signalled when a discontinuity is acknowledged, and when
+// the reader thread has filled buffers.
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
@@ -98,7 +111,240 @@ static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 // whether a discontinuity is in progress
 static jboolean discontinuity = JNI_FALSE;
 
-static jboolean enqueueInitialBuffers(jboolean discontinuity);
+// The ring of buffers in dataCache. The counts only grow, buffer n is at
+// n % NB_RING_BUFFERS; the player consumes buffers in the order they are enqueued.
+static unsigned buffersConsumed;    // returned by the player
+static unsigned buffersEnqueued;    // given to the player
+static unsigned buffersFilled;      // read by the reader thread
+// whether the next buffer enqueued signals a discontinuity
+static jboolean pendingDiscontinuity = JNI_FALSE;
+// times the player ran out of data while the reader thread was behind
+static unsigned underruns;
+
+// reader thread state, readerCond is signalled when buffers are consumed,
+// on a discontinuity and to quit
+static pthread_t readerThread;
+static pthread_cond_t readerCond = PTHREAD_COND_INITIALIZER;
+static jboolean readerStarted = JNI_FALSE;
+static jboolean readerQuit = JNI_FALSE;
+static jboolean readerEof = JNI_FALSE;
+static off_t readOffset;
+// incremented when a discontinuity resets the ring; the data of a read in progress
+// is then stale, and so are callbacks for buffers enqueued before
+static unsigned ringGeneration;
+
+
+// the reader thread validates the data and drops the packets the player has no use for
+static TsDemux *demux;
+
+
+// Enqueue the filled buffers the player has room for, then EOS once the reader
+// thread reached the end of the file. Called with the mutex held, never does I/O.
+static void enqueueFilledBuffers(void)
+{
+    XAresult res;
+
+    while (buffersEnqueued - buffersConsumed < NB_BUFFERS &&
+            buffersEnqueued != buffersFilled) {
+        const unsigned i = buffersEnqueued % NB_RING_BUFFERS;
+        if (pendingDiscontinuity) {
+            // signal discontinuity
+            XAAndroidBufferItem items[1];
+            items[0].itemKey = XA_ANDROID_ITEMKEY_DISCONTINUITY;
+            items[0].itemSize = 0;
+            // DISCONTINUITY message has no parameters,
+            //   so the total size of the message is the size of the key
+            //   plus the size if itemSize, both XAuint32
+            res = (*playerBQItf)->Enqueue(playerBQItf, (void *) (uintptr_t) ringGeneration,
+                    dataCache + i*BUFFER_SIZE, bufferSizes[i], items /*pMsg*/,
+                    sizeof(XAuint32)*2 /*msgLength*/);
+            pendingDiscontinuity = JNI_FALSE;
+        } else {
+            res = (*playerBQItf)->Enqueue(playerBQItf, (void *) (uintptr_t) ringGeneration,
+                    dataCache + i*BUFFER_SIZE, bufferSizes[i], NULL, 0);
+        }
+        assert(XA_RESULT_SUCCESS == res);
+        buffersEnqueued++;
+    }
+
+    if (readerEof && !reachedEof && buffersEnqueued == buffersFilled &&
+            buffersEnqueued - buffersConsumed < NB_BUFFERS) {
+        // EOF or I/O error, signal EOS
+        XAAndroidBufferItem msgEos[1];
+        msgEos[0].itemKey = XA_ANDROID_ITEMKEY_EOS;
+        msgEos[0].itemSize = 0;
+        // EOS message has no parameters, so the total size of the message is the size of the key
+        //   plus the size if itemSize, both XAuint32
+        res = (*playerBQItf)->Enqueue(playerBQItf, (void *)&kEosBufferCntxt /*pBufferContext*/,
+                NULL /*pData*/, 0 /*dataLength*/,
+                msgEos /*pMsg*/,
+                sizeof(XAuint32)*2 /*msgLength*/);
+        assert(XA_RESULT_SUCCESS == res);
+        reachedEof = JNI_TRUE;
+    }
+}
+
+
+// Reader thread: keeps the free buffers of the ring filled with whole packets,
+// reading several buffers at once, and enqueues them when the player is short of data.
+static void *readerLoop(void *unused)
+{
+    int ok;
+    unsigned demuxGeneration = ringGeneration;
+
+    ok = pthread_mutex_lock(&mutex);
+    assert(0 == ok);
+
+    for (;;) {
+        while (!readerQuit &&
+                (readerEof || buffersFilled - buffersConsumed == NB_RING_BUFFERS)) {
+            ok = pthread_cond_wait(&readerCond, &mutex);
+            assert(0 == ok);
+        }
+        if (readerQuit) {
+            break;
+        }
+
+        // fill the free buffers that are contiguous in dataCache
+        const unsigned first = buffersFilled % NB_RING_BUFFERS;
+        unsigned count = NB_RING_BUFFERS - (buffersFilled - buffersConsumed);
+        if (count > NB_RING_BUFFERS - first) {
+            count = NB_RING_BUFFERS - first;
+        }
+        if (count > MAX_BUFFERS_PER_READ) {
+            count = MAX_BUFFERS_PER_READ;
+        }
+        const off_t offset = readOffset;
+        const unsigned generation = ringGeneration;
+
+        ok = pthread_mutex_unlock(&mutex);
+        assert(0 == ok);
+        if (generation != demuxGeneration) {
+            // the data no longer follows what the demuxer has seen
+            tsDemuxReset(demux);
+            demuxGeneration = generation;
+        }
+        // the demuxer keeps a partial packet, read so that the packets it
+        // passes fit the buffers being filled, which are neither enqueued
+        // nor touched by anyone else; it reads the asset in place
+        const void *data;
+        ssize_t bytesRead = android_asset_stream_span(file, offset,
+                count*BUFFER_SIZE - tsDemuxPendingSize(demux), &data);
+        size_t packetsRead = 0;
+        if (bytesRead > 0) {
+            packetsRead = tsDemuxProcess(demux, data, bytesRead,
+                    (uint8_t *) dataCache + first*BUFFER_SIZE) / MPEG2_TS_PACKET_SIZE;
+        }
+        ok = pthread_mutex_lock(&mutex);
+        assert(0 == ok);
+
+        if (generation != ringGeneration) {
+            // a discontinuity reset the ring meanwhile, read again from its offset
+            continue;
+        }
+        if (bytesRead <= 0) {
+            // EOF or I/O error
+            if (tsDemuxPendingSize(demux) > 0) {
+                LOGV("Dropping last packet because it is not whole");
+            }
+            readerEof = JNI_TRUE;
+        } else {
+            // the packets dropped by the demuxer may leave nothing to enqueue
+            readOffset += bytesRead;
+            while (packetsRead > 0) {
+                size_t packetsThisBuffer = packetsRead;
+                if (packetsThisBuffer > PACKETS_PER_BUFFER) {
+                    packetsThisBuffer = PACKETS_PER_BUFFER;
+                }
+                bufferSizes[buffersFilled % NB_RING_BUFFERS] =
+                        packetsThisBuffer * MPEG2_TS_PACKET_SIZE;
+                buffersFilled++;
+                packetsRead -= packetsThisBuffer;
+            }
+        }
+
+        // the player's queue may have drained while we were reading
+        if (NULL != playerBQItf) {
+            enqueueFilledBuffers();
+        }
+        ok = pthread_cond_broadcast(&cond);
+        assert(0 == ok);
+    }
+
+    ok = pthread_mutex_unlock(&mutex);
+    assert(0 == ok);
+    return NULL;
+}
+
+
+// start the reader thread at the beginning of the file
+static void startReader(void)
+{
+    buffersConsumed = buffersEnqueued = buffersFilled = 0;
+    pendingDiscontinuity = JNI_FALSE;
+    underruns = 0;
+    readOffset = 0;
+    readerEof = JNI_FALSE;
+    readerQuit = JNI_FALSE;
+    reachedEof = JNI_FALSE;
+    // only pass the tables and the streams of the programs, not null packets
+    demux = tsDemuxCreate();
+    assert(NULL != demux);
+    tsDemuxSetFilterMode(demux, TS_FILTER_PROGRAMS);
+    int ok = pthread_create(&readerThread, NULL, readerLoop, NULL);
+    assert(0 == ok);
+    readerStarted = JNI_TRUE;
+}
+
+
+// stop the reader thread, after which it no longer enqueues
+static void stopReader(void)
+{
+    int ok;
+
+    if (!readerStarted) {
+        return;
+    }
+    ok = pthread_mutex_lock(&mutex);
+    assert(0 == ok);
+    readerQuit = JNI_TRUE;
+    ok = pthread_cond_signal(&readerCond);
+    assert(0 == ok);
+    ok = pthread_mutex_unlock(&mutex);
+    assert(0 == ok);
+    ok = pthread_join(readerThread, NULL);
+    assert(0 == ok);
+    readerStarted = JNI_FALSE;
+    LOGV("Reader thread stopped, %u underruns", underruns);
+
+    TsDemuxStats stats;
+    tsDemuxGetStats(demux, &stats);
+    LOGV("Demuxed %llu packets, passed %llu, %u kbit/s, %llu sync losses (%llu bytes skipped), "
+            "%llu transport errors, %llu continuity errors, %llu PCR discontinuities, "
+            "%llu bad sections",
+            (unsigned long long) stats.packets, (unsigned long long) stats.passed,
+            stats.bitrate / 1000, (unsigned long long) stats.syncLosses,
+            (unsigned long long) stats.bytesSkipped, (unsigned long long) stats.transportErrors,
+            (unsigned long long) stats.continuityErrors,
+            (unsigned long long) stats.pcrDiscontinuities,
+            (unsigned long long) stats.sectionErrors);
+    int i;
+    for (i = 0; i < tsDemuxStreamCount(demux); i++) {
+        TsStreamStats stream;
+        tsDemuxGetStreamStats(demux, i, &stream);
+        LOGV("PID 0x%04x program %u type 0x%02x%s: %llu packets, %u kbit/s, "
+                "%llu continuity errors, %llu duplicates, %llu transport errors, %llu scrambled",
+                stream.pid, stream.program, stream.streamType, stream.isTable ? " (table)" : "",
+                (unsigned long long) stream.packets, stream.bitrate / 1000,
+                (unsigned long long) stream.continuityErrors,
+                (unsigned long long) stream.duplicates,
+                (unsigned long long) stream.transportErrors,
+                (unsigned long long) stream.scrambled);
+    }
+    tsDemuxDelete(demux);
+    demux = NULL;
+}
+
 
 // AndroidBufferQueueItf callback to supply MPEG-2 TS packets to the media player
 static XAresult AndroidBufferQueueCallback(
@@ -117,7 +363,7 @@ static XAresult AndroidBufferQueueCallback(
     // pCallbackContext was specified as NULL at RegisterCallback and is unused here
     assert(NULL == pCallbackContext);
 
-    // note there is never any contention on this mutex unless a discontinuity request is active
+    // the reader thread only holds this mutex briefly, never while reading
     ok = pthread_mutex_lock(&mutex);
     assert(0 == ok);
 
@@ -129,14 +375,20 @@ static XAresult AndroidBufferQueueCallback(
             // clear the buffer queue
             res = (*playerBQItf)->Clear(playerBQItf);
             assert(XA_RESULT_SUCCESS == res);
-            // rewind the data source so we are guaranteed to be at an appropriate point
-            rewind(file);
-            // Enqueue the initial buffers, with a discontinuity indicator on first buffer
-            (void) enqueueInitialBuffers(JNI_TRUE);
+            // have the reader thread start over from the beginning of the data source,
+            // so we are guaranteed to be at an appropriate point
+            buffersConsumed = buffersEnqueued = buffersFilled = 0;
+            readOffset = 0;
+            readerEof = JNI_FALSE;
+            ringGeneration++;
+            // the first buffer it fills carries the discontinuity indicator
+            pendingDiscontinuity = JNI_TRUE;
+            ok = pthread_cond_signal(&readerCond);
+            assert(0 == ok);
         }
         // acknowledge the discontinuity request
         discontinuity = JNI_FALSE;
-        ok = pthread_cond_signal(&cond);
+        ok = pthread_cond_broadcast(&cond);
         assert(0 == ok);
         goto exit;
     }
@@ -151,46 +403,27 @@ static XAresult AndroidBufferQueueCallback(
         }
     }
 
-    // pBufferData is a pointer to a buffer that we previously Enqueued
-    assert((dataSize > 0) && ((dataSize % MPEG2_TS_PACKET_SIZE) == 0));
-    assert(dataCache <= (char *) pBufferData && (char *) pBufferData <
-            &dataCache[BUFFER_SIZE * NB_BUFFERS]);
-    assert(0 == (((char *) pBufferData - dataCache) % BUFFER_SIZE));
-
-    // don't bother trying to read more data once we've hit EOF
-    if (reachedEof) {
+    // the buffer context is the generation of the ring the buffer was enqueued from
+    if ((uintptr_t) pBufferContext != ringGeneration) {
+        // consumed before a discontinuity cleared the queue, the ring has been reset since
         goto exit;
     }
 
-    size_t nbRead;
-    // note we do call fread from multiple threads, but never concurrently
-    size_t bytesRead;
-    bytesRead = fread(pBufferData, 1, BUFFER_SIZE, file);
-    if (bytesRead > 0) {
-        if ((bytesRead % MPEG2_TS_PACKET_SIZE) != 0) {
-            LOGV("Dropping last packet because it is not whole");
-        }
-        size_t packetsRead = bytesRead / MPEG2_TS_PACKET_SIZE;
-        size_t bufferSize = packetsRead * MPEG2_TS_PACKET_SIZE;
-        res = (*caller)->Enqueue(caller, NULL /*pBufferContext*/,
-                pBufferData /*pData*/,
-                bufferSize /*dataLength*/,
-                NULL /*pMsg*/,
-                0 /*msgLength*/);
-        assert(XA_RESULT_SUCCESS == res);
-    } else {
-        // EOF or I/O error, signal EOS
-        XAAndroidBufferItem msgEos[1];
-        msgEos[0].itemKey = XA_ANDROID_ITEMKEY_EOS;
-        msgEos[0].itemSize = 0;
-        // EOS message has no parameters, so the total size of the message is the size of the key
-        //   plus the size if itemSize, both XAuint32
-        res = (*caller)->Enqueue(caller, (void *)&kEosBufferCntxt /*pBufferContext*/,
-                NULL /*pData*/, 0 /*dataLength*/,
-                msgEos /*pMsg*/,
-                sizeof(XAuint32)*2 /*msgLength*/);
-        assert(XA_RESULT_SUCCESS == res);
-        reachedEof = JNI_TRUE;
+    // pBufferData is a pointer to a buffer that we previously Enqueued, the oldest one
+    assert((dataSize > 0) && ((dataSize % MPEG2_TS_PACKET_SIZE) == 0));
+    assert(dataCache + (buffersConsumed % NB_RING_BUFFERS) * BUFFER_SIZE ==
+            (char *) pBufferData);
+
+    // hand the buffer back to the reader thread
+    buffersConsumed++;
+    ok = pthread_cond_signal(&readerCond);
+    assert(0 == ok);
+
+    // give the player the buffers that are ready
+    enqueueFilledBuffers();
+    if (buffersEnqueued == buffersConsumed && !reachedEof) {
+        // the reader thread enqueues as soon as it has filled a buffer
+        underruns++;
     }
 
 exit:
@@ -271,62 +504,6 @@ void Java_com_example_nativemedia_NativeMedia_createEngine(JNIEnv* env, jclass c
 }
 
 
-// Enqueue the initial buffers, and optionally signal a discontinuity in the first buffer
-static jboolean enqueueInitialBuffers(jboolean discontinuity)
-{
-
-    /* Fill our cache.
-     * We want to read whole packets (integral multiples of MPEG2_TS_PACKET_SIZE).
-     * fread returns units of "elements" not bytes, so we ask for 1-byte elements
-     * and then check that the number of elements is a multiple of the packet size.
-     */
-    size_t bytesRead;
-    bytesRead = fread(dataCache, 1, BUFFER_SIZE * NB_BUFFERS, file);
-    if (bytesRead <= 0) {
-        // could be premature EOF or I/O error
-        return JNI_FALSE;
-    }
-    if ((bytesRead % MPEG2_TS_PACKET_SIZE) != 0) {
-        LOGV("Dropping last packet because it is not whole");
-    }
-    size_t packetsRead = bytesRead / MPEG2_TS_PACKET_SIZE;
-    LOGV("Initially queueing %zu packets", packetsRead);
-
-    /* Enqueue the content of our cache before starting to play,
-       we don't want to starve the player */
-    size_t i;
-    for (i = 0; i < NB_BUFFERS && packetsRead > 0; i++) {
-        // compute size of this buffer
-        size_t packetsThisBuffer = packetsRead;
-        if (packetsThisBuffer > PACKETS_PER_BUFFER) {
-            packetsThisBuffer = PACKETS_PER_BUFFER;
-        }
-        size_t bufferSize = packetsThisBuffer * MPEG2_TS_PACKET_SIZE;
-        XAresult res;
-        if (discontinuity) {
-            // signal discontinuity
-            XAAndroidBufferItem items[1];
-            items[0].itemKey = XA_ANDROID_ITEMKEY_DISCONTINUITY;
-            items[0].itemSize = 0;
-            // DISCONTINUITY message has no parameters,
-            //   so the total size of the message is the size of the key
-            //   plus the size if itemSize, both XAuint32
-            res = (*playerBQItf)->Enqueue(playerBQItf, NULL /*pBufferContext*/,
-                    dataCache + i*BUFFER_SIZE, bufferSize, items /*pMsg*/,
-                    sizeof(XAuint32)*2 /*msgLength*/);
-            discontinuity = JNI_FALSE;
-        } else {
-            res = (*playerBQItf)->Enqueue(playerBQItf, NULL /*pBufferContext*/,
-                    dataCache + i*BUFFER_SIZE, bufferSize, NULL, 0);
-        }
-        assert(XA_RESULT_SUCCESS == res);
-        packetsRead -= packetsThisBuffer;
-    }
-
-    return JNI_TRUE;
-}
-
-
 // create streaming media player
 jboolean Java_com_example_nativemedia_NativeMedia_createStreamingMediaPlayer(JNIEnv* env,
         jclass clazz, jobject assetMgr, jstring filename)
@@ -339,10 +516,12 @@ jboolean Java_com_example_nativemedia_NativeMedia_createStreamingMediaPlayer(JNI
     assert(NULL != utf8);
 
     // open the file to play
-    file = android_fopen(utf8, "rb");
+    file = android_asset_stream_open(utf8);
     if (file == NULL) {
+        (*env)->ReleaseStringUTFChars(env, filename, utf8);
         return JNI_FALSE;
     }
+    LOGV("Reading %s %s", utf8, android_asset_stream_is_mapped(file) ? "mapped" : "streamed");
 
     // configure data source
     XADataLocator_AndroidBufferQueue loc_abq = { XA_DATALOCATOR_ANDROIDBUFFERQUEUE, NB_BUFFERS };
@@ -415,10 +594,26 @@ jboolean Java_com_example_nativemedia_NativeMedia_createStreamingMediaPlayer(JNI
             StreamChangeCallback, NULL);
     assert(XA_RESULT_SUCCESS == res);
 
-    // enqueue the initial buffers
-    if (!enqueueInitialBuffers(JNI_FALSE)) {
+    // start reading ahead, the reader thread enqueues the initial buffers
+    startReader();
+
+    // wait for the player's queue to be full before starting to play,
+    // we don't want to starve the player
+    int ok;
+    ok = pthread_mutex_lock(&mutex);
+    assert(0 == ok);
+    while (buffersEnqueued < NB_BUFFERS && !readerEof) {
+        ok = pthread_cond_wait(&cond, &mutex);
+        assert(0 == ok);
+    }
+    const unsigned initialBuffers = buffersEnqueued;
+    ok = pthread_mutex_unlock(&mutex);
+    assert(0 == ok);
+    if (initialBuffers == 0) {
+        // could be premature EOF or I/O error
         return JNI_FALSE;
     }
+    LOGV("Initially queued %u buffers", initialBuffers);
 
     // prepare the player
     res = (*playerPlayItf)->SetPlayState(playerPlayItf, XA_PLAYSTATE_PAUSED);
@@ -458,6 +653,9 @@ void Java_com_example_nativemedia_NativeMedia_setPlayingStreamingMediaPlayer(JNI
 // shut down the native media system
 void Java_com_example_nativemedia_NativeMedia_shutdown(JNIEnv* env, jclass clazz)
 {
+    // stop reading ahead, before the player goes away
+    stopReader();
+
     // destroy streaming media player object, and invalidate all associated interfaces
     if (playerObj != NULL) {
         (*playerObj)->Destroy(playerObj);
@@ -483,7 +681,7 @@ void Java_com_example_nativemedia_NativeMedia_shutdown(JNIEnv* env, jclass clazz
 
     // close the file
     if (file != NULL) {
-        fclose(file);
+        android_asset_stream_close(file);
         file = NULL;
     }
 
@@ -0,0 +1,575 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// See ISO/IEC 13818-1 for the transport stream syntax
+
+#include "tsdemux.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TS_SYNC_BYTE 0x47
+#define TS_PAT_PID 0x0000
+#define TS_NULL_PID 0x1FFF
+#define TS_PID_COUNT 0x2000
+
+#define TABLE_ID_PAT 0x00
+#define TABLE_ID_PMT 0x02
+
+// the PAT and PMT sections are at most 1024 bytes
+#define MAX_SECTION_SIZE 1024
+
+// the PCR counts a 27 MHz clock, modulo 2^33 * 300
+#define PCR_HZ 27000000LL
+#define PCR_WRAP (300LL << 33)
+// the PCR must come at least every 100 ms, a much larger step is a discontinuity
+#define PCR_MAX_INTERVAL (PCR_HZ / 2)
+
+// pidRoles bits, kept for every PID so the filter works whether or not the
+// PID has statistics
+#define PID_TABLE 0x01          // the PAT or a PMT
+#define PID_LISTED 0x02         // in a PMT, or its PCR PID
+
+typedef struct {
+    TsStreamStats stats;
+    int lastCc;                 // -1 until a payload was seen
+    uint64_t bytesUntimed;      // since the last PCR
+    uint64_t bytesTimed;        // in PCR intervals that counted
+} TsStream;
+
+// a section being assembled on the PID of the PAT or a PMT
+typedef struct {
+    uint16_t pid;
+    uint8_t active;
+    size_t fill;
+    size_t size;
+    uint8_t data[MAX_SECTION_SIZE];
+} TsSection;
+
+struct TsDemux {
+    TsFilterMode filterMode;
+    uint8_t pidFilter[TS_PID_COUNT];
+    uint8_t pidRoles[TS_PID_COUNT];
+    // index + 1 in streams of each PID, 0 if not tracked
+    uint8_t streamIndex[TS_PID_COUNT];
+    TsStream streams[TS_MAX_STREAMS];
+    int streamCount;
+    // index + 1 in sections of each table PID, 0 until its first section
+    uint16_t sectionIndex[TS_PID_COUNT];
+    TsSection *sections;
+    int sectionCount;
+    int sectionCapacity;
+
+    uint8_t pending[TS_PACKET_SIZE];
+    size_t pendingSize;
+    int inSync;
+
+    int64_t lastPcr;            // -1 after a discontinuity
+    uint64_t pcrTicks;          // the sum of the PCR intervals that counted
+    uint64_t bytesUntimed;
+    uint64_t bytesTimed;
+
+    TsDemuxStats stats;
+};
+
+static uint32_t crcTable[256];
+
+// the MPEG-2 CRC-32: polynomial 0x04C11DB7, MSB first, no final inversion
+static void initCrcTable(void)
+{
+    uint32_t i;
+    for (i = 0; i < 256; i++) {
+        uint32_t crc = i << 24;
+        int bit;
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+        crcTable[i] = crc;
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        crc = (crc << 8) ^ crcTable[(crc >> 24) ^ data[i]];
+    }
+    return crc;
+}
+
+static TsStream *findStream(TsDemux *demux, uint16_t pid)
+{
+    const int index = demux->streamIndex[pid];
+    return index > 0 ? &demux->streams[index - 1] : NULL;
+}
+
+// the stream of pid, tracked from now on if there is room
+static TsStream *addStream(TsDemux *demux, uint16_t pid)
+{
+    TsStream *stream = findStream(demux, pid);
+    if (stream == NULL && pid != TS_NULL_PID && demux->streamCount < TS_MAX_STREAMS) {
+        stream = &demux->streams[demux->streamCount++];
+        memset(stream, 0, sizeof(*stream));
+        stream->stats.pid = pid;
+        stream->lastCc = -1;
+        demux->streamIndex[pid] = demux->streamCount;
+    }
+    return stream;
+}
+
+// the section assembler of the table on pid, NULL if out of memory
+static TsSection *getSection(TsDemux *demux, uint16_t pid)
+{
+    const int index = demux->sectionIndex[pid];
+    if (index > 0) {
+        return &demux->sections[index - 1];
+    }
+    if (demux->sectionCount == demux->sectionCapacity) {
+        const int capacity = demux->sectionCapacity > 0 ? demux->sectionCapacity * 2 : 4;
+        TsSection *sections = realloc(demux->sections, capacity * sizeof(TsSection));
+        if (sections == NULL) {
+            return NULL;
+        }
+        demux->sections = sections;
+        demux->sectionCapacity = capacity;
+    }
+    TsSection *section = &demux->sections[demux->sectionCount++];
+    memset(section, 0, sizeof(*section));
+    section->pid = pid;
+    demux->sectionIndex[pid] = demux->sectionCount;
+    return section;
+}
+
+TsDemux *tsDemuxCreate(void)
+{
+    static int crcTableReady = 0;
+    if (!crcTableReady) {
+        initCrcTable();
+        crcTableReady = 1;
+    }
+
+    TsDemux *demux = calloc(1, sizeof(TsDemux));
+    if (demux == NULL) {
+        return NULL;
+    }
+    demux->filterMode = TS_FILTER_ALL;
+    demux->lastPcr = -1;
+    demux->stats.pcrPid = -1;
+    demux->pidRoles[TS_PAT_PID] = PID_TABLE;
+    addStream(demux, TS_PAT_PID);
+    return demux;
+}
+
+void tsDemuxDelete(TsDemux *demux)
+{
+    if (demux != NULL) {
+        free(demux->sections);
+    }
+    free(demux);
+}
+
+void tsDemuxSetFilterMode(TsDemux *demux, TsFilterMode mode)
+{
+    demux->filterMode = mode;
+}
+
+void tsDemuxSetPidFilter(TsDemux *demux, uint16_t pid, TsPidFilter filter)
+{
+    if (pid < TS_PID_COUNT) {
+        demux->pidFilter[pid] = filter;
+    }
+}
+
+size_t tsDemuxPendingSize(const TsDemux *demux)
+{
+    return demux->pendingSize;
+}
+
+void tsDemuxReset(TsDemux *demux)
+{
+    int i;
+    demux->pendingSize = 0;
+    demux->inSync = 0;
+    demux->lastPcr = -1;
+    demux->bytesUntimed = 0;
+    for (i = 0; i < demux->streamCount; i++) {
+        TsStream *stream = &demux->streams[i];
+        stream->lastCc = -1;
+        stream->bytesUntimed = 0;
+    }
+    for (i = 0; i < demux->sectionCount; i++) {
+        demux->sections[i].active = 0;
+    }
+}
+
+static void parsePat(TsDemux *demux, const uint8_t *section, size_t size)
+{
+    size_t i;
+    // the program loop is between the 8 header bytes and the CRC
+    for (i = 8; i + 4 <= size - 4; i += 4) {
+        const uint16_t program = (section[i] << 8) | section[i + 1];
+        const uint16_t pid = ((section[i + 2] & 0x1F) << 8) | section[i + 3];
+        // program 0 gives the network information PID
+        if (program == 0) {
+            continue;
+        }
+        demux->pidRoles[pid] |= PID_TABLE;
+        TsStream *pmt = addStream(demux, pid);
+        if (pmt != NULL) {
+            pmt->stats.program = program;
+        }
+    }
+}
+
+static void parsePmt(TsDemux *demux, const uint8_t *section, size_t size)
+{
+    const uint16_t program = (section[3] << 8) | section[4];
+    const uint16_t pcrPid = ((section[8] & 0x1F) << 8) | section[9];
+    const size_t programInfoLength = ((section[10] & 0x0F) << 8) | section[11];
+    size_t i;
+
+    // the first program with a PCR times the statistics
+    if (demux->stats.pcrPid < 0 && pcrPid != TS_NULL_PID) {
+        demux->stats.pcrPid = pcrPid;
+    }
+    demux->pidRoles[pcrPid] |= PID_LISTED;
+    addStream(demux, pcrPid);
+
+    // the elementary stream loop is between the program info and the CRC
+    for (i = 12 + programInfoLength; i + 5 <= size - 4; ) {
+        const uint8_t streamType = section[i];
+        const uint16_t pid = ((section[i + 1] & 0x1F) << 8) | section[i + 2];
+        const size_t esInfoLength = ((section[i + 3] & 0x0F) << 8) | section[i + 4];
+        demux->pidRoles[pid] |= PID_LISTED;
+        TsStream *stream = addStream(demux, pid);
+        if (stream != NULL) {
+            stream->stats.streamType = streamType;
+            stream->stats.program = program;
+        }
+        i += 5 + esInfoLength;
+    }
+}
+
+// a whole section was assembled
+static void parseSection(TsDemux *demux, const TsSection *assembled)
+{
+    const uint8_t *section = assembled->data;
+    const size_t size = assembled->size;
+
+    // PAT and PMT sections have the long syntax, with a CRC
+    if (!(section[1] & 0x80) || crc32(section, size) != 0) {
+        demux->stats.sectionErrors++;
+        return;
+    }
+    // skip the tables that aren't applicable yet
+    if (!(section[5] & 0x01)) {
+        return;
+    }
+    if (assembled->pid == TS_PAT_PID && section[0] == TABLE_ID_PAT) {
+        parsePat(demux, section, size);
+    } else if (assembled->pid != TS_PAT_PID && section[0] == TABLE_ID_PMT) {
+        parsePmt(demux, section, size);
+    }
+}
+
+// adds data to the section being assembled, returns the bytes used
+static size_t appendSection(TsDemux *demux, TsSection *section, const uint8_t *data, size_t size)
+{
+    size_t used = 0;
+    while (used < size) {
+        if (section->fill == 0 && data[used] == 0xFF) {
+            // stuffing up to the end of the packet
+            section->active = 0;
+            return size;
+        }
+        size_t needed = section->fill < 3 ? 3 - section->fill :
+                section->size - section->fill;
+        if (needed > size - used) {
+            needed = size - used;
+        }
+        memcpy(section->data + section->fill, data + used, needed);
+        section->fill += needed;
+        used += needed;
+
+        if (section->fill == 3) {
+            // the header is complete, it gives the size, PAT and PMT sections
+            // have at least 12 bytes
+            section->size = 3 + (((section->data[1] & 0x0F) << 8) | section->data[2]);
+            if (section->size < 12 || section->size > MAX_SECTION_SIZE) {
+                demux->stats.sectionErrors++;
+                section->active = 0;
+                return size;
+            }
+        } else if (section->fill > 3 && section->fill == section->size) {
+            parseSection(demux, section);
+            // another section may follow in the same packet
+            section->fill = 0;
+            return used;
+        }
+    }
+    return used;
+}
+
+static void feedSection(TsDemux *demux, TsSection *section, const uint8_t *payload,
+        size_t size, int unitStart)
+{
+    if (unitStart) {
+        // the pointer field gives where the first new section starts
+        const size_t pointer = payload[0];
+        if (1 + pointer > size) {
+            demux->stats.sectionErrors++;
+            section->active = 0;
+            return;
+        }
+        if (section->active) {
+            appendSection(demux, section, payload + 1, pointer);
+        }
+        payload += 1 + pointer;
+        size -= 1 + pointer;
+        section->active = 1;
+        section->fill = 0;
+    } else if (!section->active) {
+        // lost the start of this section
+        return;
+    }
+    while (section->active && size > 0) {
+        const size_t used = appendSection(demux, section, payload, size);
+        payload += used;
+        size -= used;
+    }
+}
+
+static void updatePcr(TsDemux *demux, int64_t pcr, int discontinuity)
+{
+    int i;
+    int64_t interval = demux->lastPcr < 0 ? -1 : pcr - demux->lastPcr;
+    if (interval < 0 && demux->lastPcr >= 0 && demux->lastPcr - pcr > PCR_WRAP / 2) {
+        // the PCR wrapped around
+        interval += PCR_WRAP;
+    }
+    const int counts = !discontinuity && interval > 0 && interval <= PCR_MAX_INTERVAL;
+    if (demux->lastPcr >= 0 && !counts) {
+        demux->stats.pcrDiscontinuities++;
+    }
+    // the bytes since the last PCR were sent during the interval
+    if (counts) {
+        demux->pcrTicks += interval;
+        demux->bytesTimed += demux->bytesUntimed;
+    }
+    demux->bytesUntimed = 0;
+    for (i = 0; i < demux->streamCount; i++) {
+        TsStream *stream = &demux->streams[i];
+        if (counts) {
+            stream->bytesTimed += stream->bytesUntimed;
+        }
+        stream->bytesUntimed = 0;
+    }
+    demux->lastPcr = pcr;
+}
+
+// returns whether the packet passes the filter
+static int processPacket(TsDemux *demux, const uint8_t *packet)
+{
+    const int transportError = packet[1] & 0x80;
+    const int unitStart = packet[1] & 0x40;
+    const uint16_t pid = ((packet[1] & 0x1F) << 8) | packet[2];
+    const int scrambled = (packet[3] & 0xC0) != 0;
+    const int adaptationField = packet[3] & 0x20;
+    const int hasPayload = packet[3] & 0x10;
+    const int cc = packet[3] & 0x0F;
+    TsStream *stream;
+
+    demux->stats.packets++;
+    demux->bytesUntimed += TS_PACKET_SIZE;
+    stream = findStream(demux, pid);
+    if (stream == NULL) {
+        stream = addStream(demux, pid);
+    }
+    if (stream != NULL) {
+        stream->stats.packets++;
+        stream->bytesUntimed += TS_PACKET_SIZE;
+    }
+
+    if (transportError) {
+        // the header itself can't be trusted
+        demux->stats.transportErrors++;
+        if (stream != NULL) {
+            stream->stats.transportErrors++;
+        }
+    } else {
+        size_t payloadOffset = 4;
+        int discontinuity = 0;
+        int duplicate = 0;
+
+        if (adaptationField) {
+            const size_t length = packet[4];
+            payloadOffset = 5 + length;
+            if (payloadOffset > TS_PACKET_SIZE) {
+                // malformed, like a transport error
+                demux->stats.transportErrors++;
+                if (stream != NULL) {
+                    stream->stats.transportErrors++;
+                }
+                goto filter;
+            }
+            if (length > 0) {
+                const uint8_t flags = packet[5];
+                discontinuity = flags & 0x80;
+                if ((flags & 0x10) && length >= 7 && pid == demux->stats.pcrPid) {
+                    const int64_t base = ((int64_t) packet[6] << 25) | (packet[7] << 17) |
+                            (packet[8] << 9) | (packet[9] << 1) | (packet[10] >> 7);
+                    const int64_t extension = ((packet[10] & 0x01) << 8) | packet[11];
+                    updatePcr(demux, base * 300 + extension, discontinuity);
+                }
+            }
+        }
+
+        // the counter increments with each payload, a packet may be sent twice
+        if (stream != NULL && hasPayload && pid != TS_NULL_PID) {
+            if (stream->lastCc >= 0 && !discontinuity) {
+                if (cc == stream->lastCc) {
+                    stream->stats.duplicates++;
+                    duplicate = 1;
+                } else {
+                    const int missing = (cc - stream->lastCc - 1) & 0x0F;
+                    stream->stats.continuityErrors += missing;
+                    demux->stats.continuityErrors += missing;
+                }
+            }
+            stream->lastCc = cc;
+        }
+
+        if (scrambled) {
+            if (stream != NULL) {
+                stream->stats.scrambled++;
+            }
+        } else if (hasPayload && !duplicate && (demux->pidRoles[pid] & PID_TABLE) &&
+                payloadOffset < TS_PACKET_SIZE) {
+            // sections are assembled whether or not the PID has statistics
+            TsSection *section = getSection(demux, pid);
+            if (section != NULL) {
+                feedSection(demux, section, packet + payloadOffset,
+                        TS_PACKET_SIZE - payloadOffset, unitStart);
+            }
+        }
+    }
+
+filter:
+    switch (demux->pidFilter[pid]) {
+      case TS_PID_PASS:
+        return 1;
+      case TS_PID_DROP:
+        return 0;
+      default:
+        break;
+    }
+    if (demux->filterMode == TS_FILTER_ALL) {
+        return 1;
+    }
+    return demux->pidRoles[pid] != 0;
+}
+
+// the offset of the next sync byte followed by another a packet later
+static size_t findSync(const uint8_t *data, size_t size)
+{
+    size_t i;
+    for (i = 1; i < size; i++) {
+        if (data[i] == TS_SYNC_BYTE &&
+                (i + TS_PACKET_SIZE >= size || data[i + TS_PACKET_SIZE] == TS_SYNC_BYTE)) {
+            return i;
+        }
+    }
+    return size;
+}
+
+size_t tsDemuxProcess(TsDemux *demux, const uint8_t *data, size_t size, uint8_t *out)
+{
+    size_t written = 0;
+
+    // complete the packet kept from the last call
+    if (demux->pendingSize > 0) {
+        size_t needed = TS_PACKET_SIZE - demux->pendingSize;
+        if (needed > size) {
+            needed = size;
+        }
+        memcpy(demux->pending + demux->pendingSize, data, needed);
+        demux->pendingSize += needed;
+        data += needed;
+        size -= needed;
+        if (demux->pendingSize < TS_PACKET_SIZE) {
+            return 0;
+        }
+        demux->pendingSize = 0;
+        if (processPacket(demux, demux->pending)) {
+            memcpy(out, demux->pending, TS_PACKET_SIZE);
+            written += TS_PACKET_SIZE;
+        }
+    }
+
+    while (size > 0) {
+        if (data[0] != TS_SYNC_BYTE) {
+            const size_t skip = findSync(data, size);
+            if (demux->inSync) {
+                demux->stats.syncLosses++;
+                demux->inSync = 0;
+            }
+            demux->stats.bytesSkipped += skip;
+            data += skip;
+            size -= skip;
+            continue;
+        }
+        if (size < TS_PACKET_SIZE) {
+            memcpy(demux->pending, data, size);
+            demux->pendingSize = size;
+            break;
+        }
+        demux->inSync = 1;
+        if (processPacket(demux, data)) {
+            memcpy(out + written, data, TS_PACKET_SIZE);
+            written += TS_PACKET_SIZE;
+        }
+        data += TS_PACKET_SIZE;
+        size -= TS_PACKET_SIZE;
+    }
+
+    demux->stats.passed += written / TS_PACKET_SIZE;
+    return written;
+}
+
+static uint32_t bitrate(uint64_t bytes, uint64_t ticks)
+{
+    return ticks > 0 ? (uint32_t) ((double) bytes * 8 * PCR_HZ / ticks) : 0;
+}
+
+void tsDemuxGetStats(const TsDemux *demux, TsDemuxStats *stats)
+{
+    *stats = demux->stats;
+    stats->bitrate = bitrate(demux->bytesTimed, demux->pcrTicks);
+}
+
+int tsDemuxStreamCount(const TsDemux *demux)
+{
+    return demux->streamCount;
+}
+
+void tsDemuxGetStreamStats(const TsDemux *demux, int index, TsStreamStats *stats)
+{
+    const TsStream *stream = &demux->streams[index];
+    *stats = stream->stats;
+    stats->isTable = (demux->pidRoles[stream->stats.pid] & PID_TABLE) != 0;
+    stats->bitrate = bitrate(stream->bytesTimed, demux->pcrTicks);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TSDEMUX_H
+#define TSDEMUX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A demultiplexer for MPEG-2 transport streams that validates and filters
+   packets before they are handed to a decoder. It resynchronizes on the sync
+   byte, parses the PAT and PMTs, checks continuity counters and times the
+   streams with the PCR. It only depends on the C library. */
+
+#define TS_PACKET_SIZE 188
+
+// the most PIDs with statistics, later ones are not tracked, but are still
+// filtered by the tables
+#define TS_MAX_STREAMS 64
+
+typedef struct TsDemux TsDemux;
+
+typedef enum {
+    TS_FILTER_ALL,          // pass every packet
+    TS_FILTER_PROGRAMS      // pass the PAT, the PMTs and the streams they list
+} TsFilterMode;
+
+typedef enum {
+    TS_PID_DEFAULT,         // as the filter mode says
+    TS_PID_PASS,
+    TS_PID_DROP
+} TsPidFilter;
+
+typedef struct {
+    uint16_t pid;
+    uint16_t program;           // program number from the PAT, 0 if in no program
+    uint8_t streamType;         // stream_type from the PMT, 0 if not listed
+    uint8_t isTable;            // the PAT or a PMT
+    uint64_t packets;
+    uint64_t transportErrors;   // transport_error_indicator set
+    uint64_t continuityErrors;  // packets missing before this one
+    uint64_t duplicates;
+    uint64_t scrambled;
+    uint32_t bitrate;           // bits per second over the PCR-timed span, 0 if unknown
+} TsStreamStats;
+
+typedef struct {
+    uint64_t packets;           // whole packets parsed
+    uint64_t passed;            // passed the filter
+    uint64_t syncLosses;        // times the sync byte was lost
+    uint64_t bytesSkipped;      // bytes dropped to resynchronize
+    uint64_t transportErrors;
+    uint64_t continuityErrors;
+    uint64_t pcrDiscontinuities;
+    uint64_t sectionErrors;     // PAT or PMT sections malformed or with a bad CRC
+    int32_t pcrPid;             // PID timing the streams, -1 until a PMT gives it
+    uint32_t bitrate;           // bits per second of the whole multiplex, 0 if unknown
+} TsDemuxStats;
+
+TsDemux *tsDemuxCreate(void);
+void tsDemuxDelete(TsDemux *demux);
+
+void tsDemuxSetFilterMode(TsDemux *demux, TsFilterMode mode);
+void tsDemuxSetPidFilter(TsDemux *demux, uint16_t pid, TsPidFilter filter);
+
+/* Demultiplexes size bytes of the stream and copies the packets that pass the
+   filter to out, which must not overlap data. Returns the bytes written, whole
+   packets. The bytes of a packet incomplete at the end of data are kept for
+   the next call, so out must have room for size + tsDemuxPendingSize(). */
+size_t tsDemuxProcess(TsDemux *demux, const uint8_t *data, size_t size, uint8_t *out);
+
+// bytes of an incomplete packet kept from the last call
+size_t tsDemuxPendingSize(const TsDemux *demux);
+
+/* Restarts after a discontinuity in the input, such as a seek: drops the
+   incomplete packet and the continuity and PCR state. The tables, filters
+   and statistics are kept. */
+void tsDemuxReset(TsDemux *demux);
+
+void tsDemuxGetStats(const TsDemux *demux, TsDemuxStats *stats);
+int tsDemuxStreamCount(const TsDemux *demux);
+// the statistics of the index-th PID seen, index < tsDemuxStreamCount()
+void tsDemuxGetStreamStats(const TsDemux *demux, int index, TsStreamStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Linux test of the transport stream demultiplexer. It runs sample.ts, and
+   copies of it with errors put in, through tsDemuxProcess() in chunks that
+   split packets, and checks the statistics and what the filter passes.
+
+   sample.ts is one second of a constant bitrate multiplex: program 1 with
+   H.264 video on PID 0x100, which carries the PCR, and AAC audio on PID
+   0x101. Each 40 ms frame has 12 packets: a PCR packet and 7 more video
+   packets, 2 audio packets, and the PAT and PMT every 5th frame or 2 null
+   packets in the others. The test wrote it with --make-sample.
+
+   Build and run on a Linux host from this directory:
+     gcc -std=c99 -O2 -I../app/src/main/jni tsdemux_test.c
+         ../app/src/main/jni/tsdemux.c -o tsdemux_test
+     ./tsdemux_test [sample.ts]
+     ./tsdemux_test --make-sample sample.ts */
+
+#include "tsdemux.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAT_PID 0x0000
+#define PMT_PID 0x1000
+#define VIDEO_PID 0x100
+#define AUDIO_PID 0x101
+#define NULL_PID 0x1FFF
+
+#define FRAMES 25
+#define FRAME_PACKETS 12
+#define TABLE_INTERVAL 5
+#define VIDEO_PACKETS 8
+#define AUDIO_PACKETS 2
+#define SAMPLE_PACKETS (FRAMES * FRAME_PACKETS)
+// the multiplex and stream bitrates, 25 frames per second
+#define BITRATE(packets) ((packets) * TS_PACKET_SIZE * 8 * 25)
+
+// the packets of the test streams are fed in chunks of this many bytes
+#define CHUNK_SIZE 1000
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} Buffer;
+
+static int failures = 0;
+
+static void check(int ok, const char *test, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s: %s\n", test, what);
+        failures++;
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    size_t i;
+    int bit;
+    for (i = 0; i < size; i++) {
+        crc ^= (uint32_t) data[i] << 24;
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// a long syntax section of table id with body after its 8 byte header
+static size_t makeSection(uint8_t *section, uint8_t tableId, uint16_t extension,
+        const uint8_t *body, size_t size)
+{
+    const size_t length = 5 + size + 4;
+    section[0] = tableId;
+    section[1] = 0xB0 | (length >> 8);
+    section[2] = length & 0xFF;
+    section[3] = extension >> 8;
+    section[4] = extension & 0xFF;
+    section[5] = 0xC1;          // current
+    section[6] = 0;
+    section[7] = 0;
+    memcpy(section + 8, body, size);
+    const uint32_t crc = crc32(section, 8 + size);
+    section[8 + size] = crc >> 24;
+    section[9 + size] = crc >> 16;
+    section[10 + size] = crc >> 8;
+    section[11 + size] = crc;
+    return 12 + size;
+}
+
+static uint8_t counters[0x2000];
+
+/* A packet of pid. A section starts its payload, after a pointer field, the
+   rest is stuffing; pcr >= 0 adds an adaptation field with the PCR. */
+static void makePacket(uint8_t *packet, uint16_t pid, const uint8_t *section,
+        size_t sectionSize, int64_t pcr)
+{
+    size_t offset = 4;
+    memset(packet, 0xFF, TS_PACKET_SIZE);
+    packet[0] = 0x47;
+    packet[1] = (section != NULL ? 0x40 : 0) | (pid >> 8);
+    packet[2] = pid & 0xFF;
+    packet[3] = (pcr >= 0 ? 0x30 : 0x10) | counters[pid];
+    counters[pid] = (counters[pid] + 1) & 0x0F;
+    if (pcr >= 0) {
+        const int64_t base = pcr / 300;
+        const int extension = pcr % 300;
+        packet[4] = 7;
+        packet[5] = 0x10;
+        packet[6] = base >> 25;
+        packet[7] = base >> 17;
+        packet[8] = base >> 9;
+        packet[9] = base >> 1;
+        packet[10] = ((base & 1) << 7) | 0x7E | (extension >> 8);
+        packet[11] = extension & 0xFF;
+        offset = 12;
+    }
+    if (section != NULL) {
+        packet[offset] = 0;
+        memcpy(packet + offset + 1, section, sectionSize);
+    } else if (pid != NULL_PID) {
+        memset(packet + offset, 0, TS_PACKET_SIZE - offset);
+    }
+}
+
+static int makeSample(const char *path)
+{
+    static const uint8_t patBody[] = {
+        0x00, 0x01, 0xE0 | (PMT_PID >> 8), PMT_PID & 0xFF,
+    };
+    static const uint8_t pmtBody[] = {
+        0xE0 | (VIDEO_PID >> 8), VIDEO_PID & 0xFF, 0xF0, 0x00,
+        0x1B, 0xE0 | (VIDEO_PID >> 8), VIDEO_PID & 0xFF, 0xF0, 0x00,
+        0x0F, 0xE0 | (AUDIO_PID >> 8), AUDIO_PID & 0xFF, 0xF0, 0x00,
+    };
+    uint8_t pat[64], pmt[64], packet[TS_PACKET_SIZE];
+    const size_t patSize = makeSection(pat, 0x00, 1, patBody, sizeof(patBody));
+    const size_t pmtSize = makeSection(pmt, 0x02, 1, pmtBody, sizeof(pmtBody));
+    FILE *f = fopen(path, "wb");
+    int frame, i;
+
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    for (frame = 0; frame < FRAMES; frame++) {
+        if (frame % TABLE_INTERVAL == 0) {
+            makePacket(packet, PAT_PID, pat, patSize, -1);
+            fwrite(packet, 1, TS_PACKET_SIZE, f);
+            makePacket(packet, PMT_PID, pmt, pmtSize, -1);
+            fwrite(packet, 1, TS_PACKET_SIZE, f);
+        } else {
+            for (i = 0; i < 2; i++) {
+                makePacket(packet, NULL_PID, NULL, 0, -1);
+                fwrite(packet, 1, TS_PACKET_SIZE, f);
+            }
+        }
+        makePacket(packet, VIDEO_PID, NULL, 0, frame * 27000000LL / 25);
+        fwrite(packet, 1, TS_PACKET_SIZE, f);
+        for (i = 1; i < VIDEO_PACKETS; i++) {
+            makePacket(packet, VIDEO_PID, NULL, 0, -1);
+            fwrite(packet, 1, TS_PACKET_SIZE, f);
+        }
+        for (i = 0; i < AUDIO_PACKETS; i++) {
+            makePacket(packet, AUDIO_PID, NULL, 0, -1);
+            fwrite(packet, 1, TS_PACKET_SIZE, f);
+        }
+    }
+    return fclose(f) != 0;
+}
+
+static Buffer readFile(const char *path)
+{
+    Buffer buffer = { NULL, 0 };
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(2);
+    }
+    fseek(f, 0, SEEK_END);
+    buffer.size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buffer.data = malloc(buffer.size);
+    if (buffer.data == NULL || fread(buffer.data, 1, buffer.size, f) != buffer.size) {
+        fprintf(stderr, "can't read %s\n", path);
+        exit(2);
+    }
+    fclose(f);
+    return buffer;
+}
+
+static Buffer copyBuffer(Buffer buffer)
+{
+    Buffer copy = { malloc(buffer.size + 16 * TS_PACKET_SIZE), buffer.size };
+    memcpy(copy.data, buffer.data, buffer.size);
+    return copy;
+}
+
+// inserts size bytes of data at offset, data must not be in buffer
+static void insertBytes(Buffer *buffer, size_t offset, const uint8_t *data, size_t size)
+{
+    memmove(buffer->data + offset + size, buffer->data + offset, buffer->size - offset);
+    memcpy(buffer->data + offset, data, size);
+    buffer->size += size;
+}
+
+static void removePacket(Buffer *buffer, int index)
+{
+    const size_t offset = index * TS_PACKET_SIZE;
+    memmove(buffer->data + offset, buffer->data + offset + TS_PACKET_SIZE,
+            buffer->size - offset - TS_PACKET_SIZE);
+    buffer->size -= TS_PACKET_SIZE;
+}
+
+static uint16_t packetPid(const Buffer *buffer, int index)
+{
+    const uint8_t *packet = buffer->data + index * TS_PACKET_SIZE;
+    return ((packet[1] & 0x1F) << 8) | packet[2];
+}
+
+// the index of the count-th packet of pid, from 0
+static int findPacket(const Buffer *buffer, uint16_t pid, int count)
+{
+    int i;
+    for (i = 0; (size_t) i < buffer->size / TS_PACKET_SIZE; i++) {
+        if (packetPid(buffer, i) == pid && count-- == 0) {
+            return i;
+        }
+    }
+    fprintf(stderr, "no packet %d on PID %#x\n", count, pid);
+    exit(2);
+}
+
+typedef struct {
+    TsDemuxStats stats;
+    int streams;
+    TsStreamStats video;
+    TsStreamStats audio;
+    TsStreamStats pmt;
+    uint64_t passedVideo;       // in the output
+    uint64_t passedNull;
+} Result;
+
+static Result demux(const Buffer *buffer, TsFilterMode mode)
+{
+    TsDemux *demux = tsDemuxCreate();
+    uint8_t *out = malloc(CHUNK_SIZE + TS_PACKET_SIZE);
+    Result result;
+    size_t offset, i;
+    int j;
+
+    memset(&result, 0, sizeof(result));
+    tsDemuxSetFilterMode(demux, mode);
+    for (offset = 0; offset < buffer->size; offset += CHUNK_SIZE) {
+        const size_t size = buffer->size - offset < CHUNK_SIZE ?
+                buffer->size - offset : CHUNK_SIZE;
+        const size_t written = tsDemuxProcess(demux, buffer->data + offset, size, out);
+        for (i = 0; i < written; i += TS_PACKET_SIZE) {
+            const uint16_t pid = ((out[i + 1] & 0x1F) << 8) | out[i + 2];
+            result.passedVideo += pid == VIDEO_PID;
+            result.passedNull += pid == NULL_PID;
+        }
+    }
+    tsDemuxGetStats(demux, &result.stats);
+    result.streams = tsDemuxStreamCount(demux);
+    for (j = 0; j < result.streams; j++) {
+        TsStreamStats stats;
+        tsDemuxGetStreamStats(demux, j, &stats);
+        if (stats.pid == VIDEO_PID) {
+            result.video = stats;
+        } else if (stats.pid == AUDIO_PID) {
+            result.audio = stats;
+        } else if (stats.pid == PMT_PID) {
+            result.pmt = stats;
+        }
+    }
+    free(out);
+    tsDemuxDelete(demux);
+    return result;
+}
+
+static int near(uint32_t value, uint32_t expected)
+{
+    return value > expected * 0.995 && value < expected * 1.005;
+}
+
+static void testClean(const Buffer *sample)
+{
+    const char *test = "clean";
+    const Result r = demux(sample, TS_FILTER_PROGRAMS);
+    const int nulls = 2 * (FRAMES - FRAMES / TABLE_INTERVAL);
+
+    check(r.stats.packets == SAMPLE_PACKETS, test, "all packets parsed");
+    check(r.stats.passed == SAMPLE_PACKETS - nulls, test, "only the null packets dropped");
+    check(r.passedNull == 0 && r.passedVideo == FRAMES * VIDEO_PACKETS, test,
+            "the output has the video and no null packets");
+    check(r.stats.syncLosses == 0 && r.stats.bytesSkipped == 0, test, "in sync");
+    check(r.stats.continuityErrors == 0 && r.video.duplicates == 0, test, "no CC errors");
+    check(r.stats.sectionErrors == 0, test, "no section errors");
+    check(r.stats.pcrPid == VIDEO_PID, test, "the PCR is on the video PID");
+    check(r.stats.pcrDiscontinuities == 0, test, "no PCR discontinuities");
+    check(near(r.stats.bitrate, BITRATE(FRAME_PACKETS)), test, "multiplex bitrate");
+    check(near(r.video.bitrate, BITRATE(VIDEO_PACKETS)), test, "video bitrate");
+    check(near(r.audio.bitrate, BITRATE(AUDIO_PACKETS)), test, "audio bitrate");
+    check(r.video.program == 1 && r.video.streamType == 0x1B, test, "video listed");
+    check(r.audio.program == 1 && r.audio.streamType == 0x0F, test, "audio listed");
+    check(r.pmt.isTable && !r.video.isTable, test, "the PMT is a table");
+    printf("%s: %llu packets, %llu passed, %u bit/s, video %u bit/s\n", test,
+            (unsigned long long) r.stats.packets, (unsigned long long) r.stats.passed,
+            r.stats.bitrate, r.video.bitrate);
+}
+
+static void testGarbage(const Buffer *sample)
+{
+    const char *test = "garbage";
+    Buffer buffer = copyBuffer(*sample);
+    uint8_t garbage[3 * 37];
+    size_t i;
+
+    // garbage before a packet, and inside one
+    for (i = 0; i < sizeof(garbage); i++) {
+        garbage[i] = i & 1 ? 0x34 : 0x12;
+    }
+    insertBytes(&buffer, 100 * TS_PACKET_SIZE, garbage, 74);
+    insertBytes(&buffer, 200 * TS_PACKET_SIZE + 74 + 5, garbage, 37);
+    const Result r = demux(&buffer, TS_FILTER_PROGRAMS);
+    /* the video packet the second garbage cuts is parsed with 37 bytes of it
+       in its payload, then the 37 bytes left of the packet are skipped */
+    check(r.stats.syncLosses == 2, test, "two sync losses");
+    check(r.stats.bytesSkipped == 74 + 37, test, "garbage skipped");
+    check(r.stats.packets == SAMPLE_PACKETS, test, "every packet parsed");
+    check(r.stats.continuityErrors == 0, test, "no CC errors");
+    check(r.stats.sectionErrors == 0, test, "tables still parsed");
+    printf("%s: %llu sync losses, %llu bytes skipped, %llu CC errors\n", test,
+            (unsigned long long) r.stats.syncLosses, (unsigned long long) r.stats.bytesSkipped,
+            (unsigned long long) r.stats.continuityErrors);
+    free(buffer.data);
+}
+
+static void testContinuity(const Buffer *sample)
+{
+    const char *test = "continuity";
+    Buffer buffer = copyBuffer(*sample);
+    uint8_t packet[TS_PACKET_SIZE];
+    int index;
+
+    // a video packet lost, another one twice
+    removePacket(&buffer, findPacket(&buffer, VIDEO_PID, 50));
+    index = findPacket(&buffer, VIDEO_PID, 100);
+    memcpy(packet, buffer.data + index * TS_PACKET_SIZE, TS_PACKET_SIZE);
+    insertBytes(&buffer, index * TS_PACKET_SIZE, packet, TS_PACKET_SIZE);
+    // three audio packets lost
+    for (index = 0; index < 3; index++) {
+        removePacket(&buffer, findPacket(&buffer, AUDIO_PID, 20));
+    }
+    // a PMT sent twice, its section must not be assembled twice
+    index = findPacket(&buffer, PMT_PID, 2);
+    memcpy(packet, buffer.data + index * TS_PACKET_SIZE, TS_PACKET_SIZE);
+    insertBytes(&buffer, index * TS_PACKET_SIZE, packet, TS_PACKET_SIZE);
+    const Result r = demux(&buffer, TS_FILTER_PROGRAMS);
+    check(r.video.continuityErrors == 1, test, "one video packet missing");
+    check(r.video.duplicates == 1, test, "one video duplicate");
+    check(r.audio.continuityErrors == 3, test, "three audio packets missing");
+    check(r.pmt.duplicates == 1 && r.pmt.continuityErrors == 0, test, "one PMT duplicate");
+    check(r.stats.continuityErrors == 4, test, "four packets missing in all");
+    check(r.stats.sectionErrors == 0, test, "no section errors");
+    printf("%s: %llu CC errors, video duplicates %llu\n", test,
+            (unsigned long long) r.stats.continuityErrors,
+            (unsigned long long) r.video.duplicates);
+    free(buffer.data);
+}
+
+static void testCrc(const Buffer *sample)
+{
+    const char *test = "CRC";
+    Buffer buffer = copyBuffer(*sample);
+    int i;
+
+    // the first PAT is bad, the later ones give the program
+    buffer.data[findPacket(&buffer, PAT_PID, 0) * TS_PACKET_SIZE + 5 + 9] ^= 0x01;
+    Result r = demux(&buffer, TS_FILTER_PROGRAMS);
+    check(r.stats.sectionErrors == 1, test, "one PAT section error");
+    check(r.passedVideo == FRAMES * VIDEO_PACKETS - TABLE_INTERVAL * VIDEO_PACKETS, test,
+            "the video passes from the second PMT on");
+    printf("%s: bad PAT: %llu section errors, %llu video packets passed\n", test,
+            (unsigned long long) r.stats.sectionErrors, (unsigned long long) r.passedVideo);
+
+    // no PMT is good, nothing but the tables is listed
+    memcpy(buffer.data, sample->data, sample->size);
+    for (i = 0; i < FRAMES / TABLE_INTERVAL; i++) {
+        buffer.data[findPacket(&buffer, PMT_PID, i) * TS_PACKET_SIZE + 5 + 12] ^= 0x80;
+    }
+    r = demux(&buffer, TS_FILTER_PROGRAMS);
+    check(r.stats.sectionErrors == FRAMES / TABLE_INTERVAL, test, "every PMT has an error");
+    check(r.passedVideo == 0, test, "no video passes without a PMT");
+    check(r.stats.pcrPid == -1 && r.stats.bitrate == 0, test, "no PCR without a PMT");
+    check(r.stats.passed == 2 * FRAMES / TABLE_INTERVAL, test, "the tables pass");
+    printf("%s: bad PMTs: %llu section errors, %llu passed\n", test,
+            (unsigned long long) r.stats.sectionErrors, (unsigned long long) r.stats.passed);
+    free(buffer.data);
+}
+
+static void testPcr(const Buffer *sample)
+{
+    const char *test = "PCR";
+    Buffer buffer = copyBuffer(*sample);
+    uint8_t *packet = buffer.data + findPacket(&buffer, VIDEO_PID, 12 * VIDEO_PACKETS) *
+            TS_PACKET_SIZE;
+
+    // the PCR of frame 12 jumps a second ahead: both its intervals are
+    // discontinuities, the others still time the bitrate
+    packet[7] ^= 0x01;
+    const Result r = demux(&buffer, TS_FILTER_PROGRAMS);
+    check(r.stats.pcrDiscontinuities == 2, test, "a jump is two discontinuities");
+    check(near(r.stats.bitrate, BITRATE(FRAME_PACKETS)), test, "bitrate without the jump");
+    check(near(r.video.bitrate, BITRATE(VIDEO_PACKETS)), test, "video bitrate without the jump");
+    printf("%s: %llu discontinuities, %u bit/s\n", test,
+            (unsigned long long) r.stats.pcrDiscontinuities, r.stats.bitrate);
+    free(buffer.data);
+}
+
+static void testManyPids(const Buffer *sample)
+{
+    const char *test = "many PIDs";
+    Buffer buffer = copyBuffer(*sample);
+    uint8_t *data = malloc(buffer.size + 2 * TS_MAX_STREAMS * TS_PACKET_SIZE);
+    uint8_t packet[TS_PACKET_SIZE];
+    int i;
+
+    /* more PIDs than have statistics come before the tables: the listed
+       streams go untracked, but still pass the filter */
+    memcpy(data + 2 * TS_MAX_STREAMS * TS_PACKET_SIZE, buffer.data, buffer.size);
+    free(buffer.data);
+    buffer.data = data;
+    for (i = 0; i < 2 * TS_MAX_STREAMS; i++) {
+        makePacket(packet, 0x200 + i, NULL, 0, -1);
+        memcpy(buffer.data + i * TS_PACKET_SIZE, packet, TS_PACKET_SIZE);
+    }
+    buffer.size += 2 * TS_MAX_STREAMS * TS_PACKET_SIZE;
+    const Result r = demux(&buffer, TS_FILTER_PROGRAMS);
+    check(r.streams == TS_MAX_STREAMS, test, "the statistics are full");
+    check(r.video.pid == 0 && r.pmt.pid == 0, test, "the program is not tracked");
+    check(r.stats.sectionErrors == 0, test, "the tables are parsed");
+    check(r.passedVideo == FRAMES * VIDEO_PACKETS, test, "the video passes");
+    check(r.stats.passed == SAMPLE_PACKETS - 2 * (FRAMES - FRAMES / TABLE_INTERVAL), test,
+            "the program passes, the other PIDs don't");
+    printf("%s: %d tracked, %llu passed\n", test, r.streams,
+            (unsigned long long) r.stats.passed);
+    free(buffer.data);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 && strcmp(argv[1], "--make-sample") == 0) {
+        return makeSample(argv[2]);
+    }
+    const Buffer sample = readFile(argc > 1 ? argv[1] : "sample.ts");
+    if (sample.size != SAMPLE_PACKETS * TS_PACKET_SIZE) {
+        fprintf(stderr, "not the sample of --make-sample\n");
+        return 2;
+    }
+
+    testClean(&sample);
+    testGarbage(&sample);
+    testContinuity(&sample);
+    testCrc(&sample);
+    testPcr(&sample);
+    testManyPids(&sample);
+
+    free(sample.data);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}